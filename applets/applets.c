@@ -16,6 +16,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/wait.h>
 
 #if ENABLE_STATIC && defined(__GLIBC__) && !defined(__UCLIBC__)
 #error Static linking against glibc is not supported. Link dynamically or get uClibc 
@@ -401,9 +402,12 @@ static void check_suid (struct BB_applet *applet)
 
 static const char *unpack_usage_messages(void)
 {
-	int input[2], output[2], pid;
-	char *buf;
+	/* kept: the shell can show usage for in-process applets many times */
+	static char *buf;
+	int input[2], output[2], pid, pid2;
 
+	if (buf)
+		return buf;
 	if(pipe(input) < 0 || pipe(output) < 0)
 		exit(1);
 
@@ -421,8 +425,8 @@ static const char *unpack_usage_messages(void)
 
 	close(input[0]);
 	close(output[1]);
-	pid = fork();
-	switch (pid) {
+	pid2 = fork();
+	switch (pid2) {
 	case -1: /* error */
 		exit(1);
 	case 0: /* child */
@@ -434,6 +438,9 @@ static const char *unpack_usage_messages(void)
 
 	buf = xmalloc(SIZEOF_usage_messages);
 	bb_full_read(output[0], buf, SIZEOF_usage_messages);
+	close(output[0]);
+	waitpid(pid, NULL, 0);
+	waitpid(pid2, NULL, 0);
 	return buf;
 }
 
@@ -458,7 +465,7 @@ void bb_show_usage (void)
 			applet_using->name, usage_string);
 	}
 
-  exit (bb_default_error_retval);
+  bb_xfunc_exit (bb_default_error_retval);
 }
 
 static int applet_name_compare (const void *x, const void *y)
@@ -491,3 +498,33 @@ void run_applet_by_name (const char *name, int argc, char **argv)
 		exit ((*(applet_using->main)) (argc, argv));
 	}
 }
+
+/* Runs applet in this process, which goes on afterwards, and returns its
+ * exit status, whether it returned, exited through bb_xfunc_exit() or died */
+int run_nofork_applet(struct BB_applet *applet, int argc, char **argv)
+{
+	struct BB_applet *old_using = applet_using;
+	const char *old_name = bb_applet_name;
+	int old_retval = bb_default_error_retval;
+	jmp_buf *old_jmp = bb_die_jmp;
+	jmp_buf die_jmp;
+	int rc;
+
+	rc = setjmp(die_jmp);
+	if (!rc) {
+		bb_die_jmp = &die_jmp;
+		applet_using = applet;
+		bb_applet_name = applet->name;
+		bb_default_error_retval = EXIT_FAILURE;
+		bb_opt_complementally = NULL;
+		optind = 0;
+		if (argc == 2 && !strcmp(argv[1], "--help"))
+			bb_show_usage();
+		rc = applet->main(argc, argv);
+	}
+	bb_die_jmp = old_jmp;
+	bb_default_error_retval = old_retval;
+	bb_applet_name = old_name;
+	applet_using = old_using;
+	return rc & 0xff;
+}
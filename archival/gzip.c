@@ -34,6 +34,10 @@
 #include <time.h>
 #include "busybox.h"
 
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+#include <pthread.h>
+#endif
+
 typedef unsigned char uch;
 typedef unsigned short ush;
 typedef unsigned long ulg;
@@ -83,19 +87,16 @@ typedef unsigned long ulg;
 #  endif
 #endif
 
-#  define DECLARE(type, array, size)  static type * array
 #  define ALLOC(type, array, size) { \
       array = (type*)xzalloc((size_t)(((size)+1L)/2) * 2*sizeof(type)); \
    }
 #  define FREE(array) {free(array), array=NULL;}
 
-#define tab_suffix window
-#define tab_prefix prev	/* hash link (see deflate.c) */
-#define head (prev+WSIZE)	/* hash head (see deflate.c) */
-
-static long bytes_in;	/* number of input bytes */
+#define tab_suffix G1.window
+#define tab_prefix G1.prev	/* hash link (see deflate.c) */
+#define head (G1.prev+WSIZE)	/* hash head (see deflate.c) */
 
-#define isize bytes_in
+#define isize G1.bytes_in
 /* for compatibility with old zip sources (to be cleaned) */
 
 typedef int file_t;		/* Do not use stdio */
@@ -141,7 +142,7 @@ typedef int file_t;		/* Do not use stdio */
  */
 
 /* put_byte is used for the compressed output */
-#define put_byte(c) {outbuf[outcnt++]=(uch)(c); if (outcnt==OUTBUFSIZ)\
+#define put_byte(c) {G1.outbuf[G1.outcnt++]=(uch)(c); if (G1.outcnt==OUTBUFSIZ)\
    flush_outbuf();}
 
 
@@ -184,10 +185,14 @@ typedef int file_t;		/* Do not use stdio */
 	/* from zip.c: */
 static int zip(int in, int out);
 static int file_read(char *buf, unsigned size);
+static void gzip_state_new(void);
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+static int zip_parallel(int in, int out);
+#endif
 
 		/* from deflate.c */
-static void lm_init(ush * flags);
-static ulg deflate(void);
+static void lm_init(ush * flagsp);
+static ulg deflate(int eof);
 
 		/* from trees.c */
 static void ct_init(ush * attr, int *methodp);
@@ -200,7 +205,6 @@ static void send_bits(int value, int length);
 static unsigned bi_reverse(unsigned value, int length);
 static void bi_windup(void);
 static void copy_block(char *buf, unsigned len, int header);
-static int (*read_buf) (char *buf, unsigned size);
 
 	/* from util.c: */
 static void flush_outbuf(void);
@@ -261,13 +265,80 @@ static void flush_outbuf(void);
 #  define MAX_SUFFIX  30
 #endif
 
-		/* global buffers */
+		/* compressor state */
+
+/* Everything a single deflate stream works on lives here rather than in
+ * file-scope statics, so that gzip -p can run one stream per thread. The
+ * code reaches it through G1, and the Huffman tree half (see trees.c
+ * below) through G2.
+ */
+struct gzip_trees;
+
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+/* One piece of input for gzip -p, see zip_parallel() */
+struct gzip_job {
+	uch *buf;			/* dictionary followed by the data */
+	unsigned dictlen;	/* length of the dictionary */
+	unsigned len;		/* length of the data */
+	int last;			/* this piece ends the deflate stream */
+	uch *out;			/* the compressed piece */
+	unsigned outlen;	/* valid bytes in out */
+	unsigned outsize;	/* allocated size of out */
+	uint32_t crc;		/* crc of the data */
+	int done;			/* out is complete */
+};
+
+#endif
+
+struct gzip_state {
+	/* global buffers */
+	uch *inbuf;
+	uch *outbuf;
+	ush *d_buf;
+	uch *window;
+	ush *prev;			/* tab_prefix */
+
+	long bytes_in;		/* number of input bytes */
+	int ifd;			/* input file descriptor */
+	int ofd;			/* output file descriptor */
+	unsigned insize;	/* valid bytes in inbuf */
+	unsigned outcnt;	/* bytes in output buffer */
+	uint32_t crc;		/* crc register on uncompressed file data */
+	long header_bytes;	/* number of bytes in gzip header */
+
+	/* bits.c */
+	file_t zfile;		/* output gzip file */
+	unsigned short bi_buf;	/* output bits, inserted at the bottom */
+	int bi_valid;		/* number of bits used within bi_buf */
+#ifdef DEBUG
+	ulg bits_sent;		/* bit length of the compressed data */
+#endif
+	int (*read_buf) (char *buf, unsigned size);	/* current input function */
+
+	/* deflate.c */
+	long block_start;	/* window position of the current output block */
+	unsigned ins_h;		/* hash index of string to be inserted */
+	unsigned int prev_length;	/* best match length at previous step */
+	unsigned strstart;	/* start of string to insert */
+	unsigned match_start;	/* start of matching string */
+	int eofile;			/* flag set at end of input file */
+	unsigned lookahead;	/* number of valid bytes ahead in window */
+
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+	struct gzip_job *job;	/* when set, input and output are in memory */
+	unsigned job_pos;	/* bytes of job input already read */
+#endif
+
+	struct gzip_trees *trees;
+};
 
-DECLARE(uch, inbuf, INBUFSIZ + INBUF_EXTRA);
-DECLARE(uch, outbuf, OUTBUFSIZ + OUTBUF_EXTRA);
-DECLARE(ush, d_buf, DIST_BUFSIZE);
-DECLARE(uch, window, 2L * WSIZE);
-DECLARE(ush, tab_prefix, 1L << BITS);
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+static __thread struct gzip_state *gzip_ctx;
+#else
+static struct gzip_state *gzip_ctx;
+#endif
+#define G1 (*gzip_ctx)
+#define G2 (*gzip_ctx->trees)
 
 static int foreground;	/* set if program run in foreground */
 static int method = DEFLATED;	/* compression method */
@@ -277,20 +348,17 @@ static long time_stamp;	/* original time stamp (modification time) */
 static long ifile_size;	/* input file size, -1 for devices (debug only) */
 static char z_suffix[MAX_SUFFIX + 1];	/* default suffix (can be set with --suffix) */
 static int z_len;		/* strlen(z_suffix) */
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+static int par_threads;	/* -p: number of compressing threads */
+#endif
 
-static int ifd;			/* input file descriptor */
-static int ofd;			/* output file descriptor */
-static unsigned insize;	/* valid bytes in inbuf */
-static unsigned outcnt;	/* bytes in output buffer */
-
-static uint32_t *crc_32_tab;
 
 /* Output a 16 bit value, lsb first */
 static void put_short(ush w)
 {
-	if (outcnt < OUTBUFSIZ - 2) {
-		outbuf[outcnt++] = (uch) ((w) & 0xff);
-		outbuf[outcnt++] = (uch) ((ush) (w) >> 8);
+	if (G1.outcnt < OUTBUFSIZ - 2) {
+		G1.outbuf[G1.outcnt++] = (uch) ((w) & 0xff);
+		G1.outbuf[G1.outcnt++] = (uch) ((ush) (w) >> 8);
 	} else {
 		put_byte((uch) ((w) & 0xff));
 		put_byte((uch) ((ush) (w) >> 8));
@@ -310,9 +378,9 @@ static void abort_gzip(int ATTRIBUTE_UNUSED ignored)
  */
 static void clear_bufs(void)
 {
-	outcnt = 0;
-	insize = 0;
-	bytes_in = 0L;
+	G1.outcnt = 0;
+	G1.insize = 0;
+	G1.bytes_in = 0L;
 }
 
 /* ===========================================================================
@@ -330,29 +398,6 @@ static void write_buf(int fd, void *buf, unsigned cnt)
 	}
 }
 
-/* ===========================================================================
- * Run a set of bytes through the crc shift register.  If s is a NULL
- * pointer, then initialize the crc shift register contents instead.
- * Return the current crc in either case.
- */
-static uint32_t updcrc(uch * s, unsigned n)
-{
-	static uint32_t crc = ~0;	/* shift register contents */
-	uint32_t c;		/* temporary variable */
-
-	if (s == NULL) {
-		c = ~0;
-	} else {
-		c = crc;
-		if (n)
-			do {
-				c = crc_32_tab[((int) c ^ (*s++)) & 0xff] ^ (c >> 8);
-			} while (--n);
-	}
-	crc = c;
-	return ~c;
-}
-
 /* bits.c -- output variable-length bit strings
  * Copyright (C) 1992-1993 Jean-loup Gailly
  * This is free software; you can redistribute it and/or modify it under the
@@ -407,15 +452,8 @@ static uint32_t updcrc(uch * s, unsigned n)
  */
 
 /* ===========================================================================
- * Local data used by the "bit string" routines.
- */
-
-static file_t zfile;	/* output gzip file */
-
-static unsigned short bi_buf;
-
-/* Output buffer. bits are inserted starting at the bottom (least significant
- * bits).
+ * Local data used by the "bit string" routines (zfile, bi_buf, bi_valid and
+ * read_buf) is in struct gzip_state.
  */
 
 #define Buf_size (8 * 2*sizeof(char))
@@ -423,31 +461,23 @@ static unsigned short bi_buf;
  * more than 16 bits on some systems.)
  */
 
-static int bi_valid;
-
-/* Current input function. Set to mem_read for in-memory compression */
-
-#ifdef DEBUG
-ulg bits_sent;			/* bit length of the compressed data */
-#endif
-
 /* ===========================================================================
  * Initialize the bit string routines.
  */
 static void bi_init(file_t zipfile)
 {
-	zfile = zipfile;
-	bi_buf = 0;
-	bi_valid = 0;
+	G1.zfile = zipfile;
+	G1.bi_buf = 0;
+	G1.bi_valid = 0;
 #ifdef DEBUG
-	bits_sent = 0L;
+	G1.bits_sent = 0L;
 #endif
 
 	/* Set the defaults for file compression. They are set by memcompress
 	 * for in-memory compression.
 	 */
-	if (zfile != NO_FILE) {
-		read_buf = file_read;
+	if (G1.zfile != NO_FILE) {
+		G1.read_buf = file_read;
 	}
 }
 
@@ -460,20 +490,20 @@ static void send_bits(int value, int length)
 #ifdef DEBUG
 	Tracev((stderr, " l %2d v %4x ", length, value));
 	Assert(length > 0 && length <= 15, "invalid length");
-	bits_sent += (ulg) length;
+	G1.bits_sent += (ulg) length;
 #endif
 	/* If not enough room in bi_buf, use (valid) bits from bi_buf and
 	 * (16 - bi_valid) bits from value, leaving (width - (16-bi_valid))
 	 * unused bits in value.
 	 */
-	if (bi_valid > (int) Buf_size - length) {
-		bi_buf |= (value << bi_valid);
-		put_short(bi_buf);
-		bi_buf = (ush) value >> (Buf_size - bi_valid);
-		bi_valid += length - Buf_size;
+	if (G1.bi_valid > (int) Buf_size - length) {
+		G1.bi_buf |= (value << G1.bi_valid);
+		put_short(G1.bi_buf);
+		G1.bi_buf = (ush) value >> (Buf_size - G1.bi_valid);
+		G1.bi_valid += length - Buf_size;
 	} else {
-		bi_buf |= value << bi_valid;
-		bi_valid += length;
+		G1.bi_buf |= value << G1.bi_valid;
+		G1.bi_valid += length;
 	}
 }
 
@@ -498,15 +528,15 @@ static unsigned bi_reverse(unsigned code, int len)
  */
 static void bi_windup(void)
 {
-	if (bi_valid > 8) {
-		put_short(bi_buf);
-	} else if (bi_valid > 0) {
-		put_byte(bi_buf);
+	if (G1.bi_valid > 8) {
+		put_short(G1.bi_buf);
+	} else if (G1.bi_valid > 0) {
+		put_byte(G1.bi_buf);
 	}
-	bi_buf = 0;
-	bi_valid = 0;
+	G1.bi_buf = 0;
+	G1.bi_valid = 0;
 #ifdef DEBUG
-	bits_sent = (bits_sent + 7) & ~7;
+	G1.bits_sent = (G1.bits_sent + 7) & ~7;
 #endif
 }
 
@@ -522,11 +552,11 @@ static void copy_block(char *buf, unsigned len, int header)
 		put_short((ush) len);
 		put_short((ush) ~ len);
 #ifdef DEBUG
-		bits_sent += 2 * 16;
+		G1.bits_sent += 2 * 16;
 #endif
 	}
 #ifdef DEBUG
-	bits_sent += (ulg) len << 3;
+	G1.bits_sent += (ulg) len << 3;
 #endif
 	while (len--) {
 		put_byte(*buf++);
@@ -678,13 +708,13 @@ static const ulg window_size = (ulg) 2 * WSIZE;
  * input file length plus MIN_LOOKAHEAD.
  */
 
-static long block_start;
+/* long block_start;  (struct gzip_state) */
 
 /* window position at the beginning of the current output block. Gets
  * negative when the window is moved backwards.
  */
 
-static unsigned ins_h;	/* hash index of string to be inserted */
+/* unsigned ins_h;  hash index of string to be inserted */
 
 #define H_SHIFT  ((HASH_BITS+MIN_MATCH-1)/MIN_MATCH)
 /* Number of bits by which ins_h and del_h must be shifted at each
@@ -693,16 +723,13 @@ static unsigned ins_h;	/* hash index of string to be inserted */
  *   H_SHIFT * MIN_MATCH >= HASH_BITS
  */
 
-static unsigned int prev_length;
+/* unsigned int prev_length; */
 
 /* Length of the best match at previous step. Matches not greater than this
  * are discarded. This is used in the lazy match evaluation.
  */
 
-static unsigned strstart;	/* start of string to insert */
-static unsigned match_start;	/* start of matching string */
-static int eofile;		/* flag set at end of input file */
-static unsigned lookahead;	/* number of valid bytes ahead in window */
+/* strstart, match_start, eofile and lookahead are in struct gzip_state too */
 
 enum {
 	max_chain_length = 4096,
@@ -773,14 +800,14 @@ static void check_match(IPos start, IPos match, int length);
  *    (except for the last MIN_MATCH-1 bytes of the input file).
  */
 #define INSERT_STRING(s, match_head) \
-   (UPDATE_HASH(ins_h, window[(s) + MIN_MATCH-1]), \
-    prev[(s) & WMASK] = match_head = head[ins_h], \
-    head[ins_h] = (s))
+   (UPDATE_HASH(G1.ins_h, G1.window[(s) + MIN_MATCH-1]), \
+    G1.prev[(s) & WMASK] = match_head = head[G1.ins_h], \
+    head[G1.ins_h] = (s))
 
 /* ===========================================================================
  * Initialize the "longest match" routines for a new file
  */
-static void lm_init(ush * flags)
+static void lm_init(ush * flagsp)
 {
 	register unsigned j;
 
@@ -788,34 +815,58 @@ static void lm_init(ush * flags)
 	memset(head, 0, HASH_SIZE * sizeof(*head));
 	/* prev will be initialized on the fly */
 
-	*flags |= SLOW;
+	*flagsp |= SLOW;
 	/* ??? reduce max_chain_length for binary files */
 
-	strstart = 0;
-	block_start = 0L;
+	G1.strstart = 0;
+	G1.block_start = 0L;
 
-	lookahead = read_buf((char *) window,
+	G1.lookahead = G1.read_buf((char *) G1.window,
 						 sizeof(int) <= 2 ? (unsigned) WSIZE : 2 * WSIZE);
 
-	if (lookahead == 0 || lookahead == (unsigned) EOF) {
-		eofile = 1, lookahead = 0;
+	if (G1.lookahead == 0 || G1.lookahead == (unsigned) EOF) {
+		G1.eofile = 1, G1.lookahead = 0;
 		return;
 	}
-	eofile = 0;
+	G1.eofile = 0;
 	/* Make sure that we always have enough lookahead. This is important
 	 * if input comes from a device such as a tty.
 	 */
-	while (lookahead < MIN_LOOKAHEAD && !eofile)
+	while (G1.lookahead < MIN_LOOKAHEAD && !G1.eofile)
 		fill_window();
 
-	ins_h = 0;
+	G1.ins_h = 0;
 	for (j = 0; j < MIN_MATCH - 1; j++)
-		UPDATE_HASH(ins_h, window[j]);
+		UPDATE_HASH(G1.ins_h, G1.window[j]);
 	/* If lookahead < MIN_MATCH, ins_h is garbage, but this is
 	 * not important since only literal bytes will be emitted.
 	 */
 }
 
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+/* ===========================================================================
+ * Step over the first len bytes of input without compressing them, only
+ * entering them in the hash chains. With gzip -p that is the dictionary: the
+ * data before this piece, which another thread compresses.
+ * IN assertion: lm_init() has been called and len <= WSIZE.
+ */
+static void lm_skip(unsigned len)
+{
+	IPos hash_head;
+
+	if (len > G1.lookahead)
+		len = G1.lookahead;
+	while (len--) {
+		INSERT_STRING(G1.strstart, hash_head);
+		G1.strstart++;
+		G1.lookahead--;
+	}
+	G1.block_start = G1.strstart;
+	while (G1.lookahead < MIN_LOOKAHEAD && !G1.eofile)
+		fill_window();
+}
+#endif
+
 /* ===========================================================================
  * Set match_start to the longest match starting at the given string and
  * return its length. Matches shorter or equal to prev_length are discarded,
@@ -832,12 +883,12 @@ static void lm_init(ush * flags)
 static int longest_match(IPos cur_match)
 {
 	unsigned chain_length = max_chain_length;	/* max hash chain length */
-	register uch *scan = window + strstart;	/* current string */
+	register uch *scan = G1.window + G1.strstart;	/* current string */
 	register uch *match;	/* matched string */
 	register int len;	/* length of current match */
-	int best_len = prev_length;	/* best match length so far */
+	int best_len = G1.prev_length;	/* best match length so far */
 	IPos limit =
-		strstart > (IPos) MAX_DIST ? strstart - (IPos) MAX_DIST : NIL;
+		G1.strstart > (IPos) MAX_DIST ? G1.strstart - (IPos) MAX_DIST : NIL;
 	/* Stop when cur_match becomes <= limit. To simplify the code,
 	 * we prevent matches with the string of window index 0.
 	 */
@@ -848,19 +899,19 @@ static int longest_match(IPos cur_match)
 #if HASH_BITS < 8 || MAX_MATCH != 258
 #  error Code too clever
 #endif
-	register uch *strend = window + strstart + MAX_MATCH;
+	register uch *strend = G1.window + G1.strstart + MAX_MATCH;
 	register uch scan_end1 = scan[best_len - 1];
 	register uch scan_end = scan[best_len];
 
 	/* Do not waste too much time if we already have a good match: */
-	if (prev_length >= good_match) {
+	if (G1.prev_length >= good_match) {
 		chain_length >>= 2;
 	}
-	Assert(strstart <= window_size - MIN_LOOKAHEAD, "insufficient lookahead");
+	Assert(G1.strstart <= window_size - MIN_LOOKAHEAD, "insufficient lookahead");
 
 	do {
-		Assert(cur_match < strstart, "no future");
-		match = window + cur_match;
+		Assert(cur_match < G1.strstart, "no future");
+		match = G1.window + cur_match;
 
 		/* Skip to next match if the match length cannot increase
 		 * or if the match length is less than 2:
@@ -891,14 +942,14 @@ static int longest_match(IPos cur_match)
 		scan = strend - MAX_MATCH;
 
 		if (len > best_len) {
-			match_start = cur_match;
+			G1.match_start = cur_match;
 			best_len = len;
 			if (len >= nice_match)
 				break;
 			scan_end1 = scan[best_len - 1];
 			scan_end = scan[best_len];
 		}
-	} while ((cur_match = prev[cur_match & WMASK]) > limit
+	} while ((cur_match = G1.prev[cur_match & WMASK]) > limit
 			 && --chain_length != 0);
 
 	return best_len;
@@ -911,15 +962,15 @@ static int longest_match(IPos cur_match)
 static void check_match(IPos start, IPos match, int length)
 {
 	/* check that the match is indeed a match */
-	if (memcmp((char *) window + match,
-			   (char *) window + start, length) != EQUAL) {
+	if (memcmp((char *) G1.window + match,
+			   (char *) G1.window + start, length) != EQUAL) {
 		bb_error_msg(" start %d, match %d, length %d", start, match, length);
 		bb_error_msg("invalid match");
 	}
 	if (verbose > 1) {
 		bb_error_msg("\\[%d,%d]", start - match, length);
 		do {
-			putc(window[start++], stderr);
+			putc(G1.window[start++], stderr);
 		} while (--length != 0);
 	}
 }
@@ -939,7 +990,7 @@ static void fill_window(void)
 {
 	register unsigned n, m;
 	unsigned more =
-		(unsigned) (window_size - (ulg) lookahead - (ulg) strstart);
+		(unsigned) (window_size - (ulg) G1.lookahead - (ulg) G1.strstart);
 	/* Amount of free space at the end of the window. */
 
 	/* If the window is almost full and there is insufficient lookahead,
@@ -950,25 +1001,25 @@ static void fill_window(void)
 		 * and lookahead == 1 (input done one byte at time)
 		 */
 		more--;
-	} else if (strstart >= WSIZE + MAX_DIST) {
+	} else if (G1.strstart >= WSIZE + MAX_DIST) {
 		/* By the IN assertion, the window is not empty so we can't confuse
 		 * more == 0 with more == 64K on a 16 bit machine.
 		 */
 		Assert(window_size == (ulg) 2 * WSIZE, "no sliding with BIG_MEM");
 
-		memcpy((char *) window, (char *) window + WSIZE, (unsigned) WSIZE);
-		match_start -= WSIZE;
-		strstart -= WSIZE;	/* we now have strstart >= MAX_DIST: */
+		memcpy((char *) G1.window, (char *) G1.window + WSIZE, (unsigned) WSIZE);
+		G1.match_start -= WSIZE;
+		G1.strstart -= WSIZE;	/* we now have strstart >= MAX_DIST: */
 
-		block_start -= (long) WSIZE;
+		G1.block_start -= (long) WSIZE;
 
 		for (n = 0; n < HASH_SIZE; n++) {
 			m = head[n];
 			head[n] = (Pos) (m >= WSIZE ? m - WSIZE : NIL);
 		}
 		for (n = 0; n < WSIZE; n++) {
-			m = prev[n];
-			prev[n] = (Pos) (m >= WSIZE ? m - WSIZE : NIL);
+			m = G1.prev[n];
+			G1.prev[n] = (Pos) (m >= WSIZE ? m - WSIZE : NIL);
 			/* If n is not on any hash chain, prev[n] is garbage but
 			 * its value will never be used.
 			 */
@@ -976,12 +1027,12 @@ static void fill_window(void)
 		more += WSIZE;
 	}
 	/* At this point, more >= 2 */
-	if (!eofile) {
-		n = read_buf((char *) window + strstart + lookahead, more);
+	if (!G1.eofile) {
+		n = G1.read_buf((char *) G1.window + G1.strstart + G1.lookahead, more);
 		if (n == 0 || n == (unsigned) EOF) {
-			eofile = 1;
+			G1.eofile = 1;
 		} else {
-			lookahead += n;
+			G1.lookahead += n;
 		}
 	}
 }
@@ -991,15 +1042,16 @@ static void fill_window(void)
  * IN assertion: strstart is set to the end of the current match.
  */
 #define FLUSH_BLOCK(eof) \
-   flush_block(block_start >= 0L ? (char*)&window[(unsigned)block_start] : \
-		(char*)NULL, (long)strstart - block_start, (eof))
+   flush_block(G1.block_start >= 0L ? (char*)&G1.window[(unsigned)G1.block_start] : \
+		(char*)NULL, (long)G1.strstart - G1.block_start, (eof))
 
 /* ===========================================================================
  * Same as above, but achieves better compression. We use a lazy
  * evaluation for matches: a match is finally adopted only if there is
- * no better match at the next window position.
+ * no better match at the next window position. Unless eof is set the
+ * last block is left open for more data to follow (see zip_job()).
  */
-static ulg deflate(void)
+static ulg deflate(int eof)
 {
 	IPos hash_head;		/* head of hash chain */
 	IPos prev_match;	/* previous match */
@@ -1008,30 +1060,30 @@ static ulg deflate(void)
 	register unsigned match_length = MIN_MATCH - 1;	/* length of best match */
 
 	/* Process the input block. */
-	while (lookahead != 0) {
+	while (G1.lookahead != 0) {
 		/* Insert the string window[strstart .. strstart+2] in the
 		 * dictionary, and set hash_head to the head of the hash chain:
 		 */
-		INSERT_STRING(strstart, hash_head);
+		INSERT_STRING(G1.strstart, hash_head);
 
 		/* Find the longest match, discarding those <= prev_length.
 		 */
-		prev_length = match_length, prev_match = match_start;
+		G1.prev_length = match_length, prev_match = G1.match_start;
 		match_length = MIN_MATCH - 1;
 
-		if (hash_head != NIL && prev_length < max_lazy_match &&
-			strstart - hash_head <= MAX_DIST) {
+		if (hash_head != NIL && G1.prev_length < max_lazy_match &&
+			G1.strstart - hash_head <= MAX_DIST) {
 			/* To simplify the code, we prevent matches with the string
 			 * of window index 0 (in particular we have to avoid a match
 			 * of the string with itself at the start of the input file).
 			 */
 			match_length = longest_match(hash_head);
 			/* longest_match() sets match_start */
-			if (match_length > lookahead)
-				match_length = lookahead;
+			if (match_length > G1.lookahead)
+				match_length = G1.lookahead;
 
 			/* Ignore a length 3 match if it is too distant: */
-			if (match_length == MIN_MATCH && strstart - match_start > TOO_FAR) {
+			if (match_length == MIN_MATCH && G1.strstart - G1.match_start > TOO_FAR) {
 				/* If prev_match is also MIN_MATCH, match_start is garbage
 				 * but we will ignore the current match anyway.
 				 */
@@ -1041,66 +1093,66 @@ static ulg deflate(void)
 		/* If there was a match at the previous step and the current
 		 * match is not better, output the previous match:
 		 */
-		if (prev_length >= MIN_MATCH && match_length <= prev_length) {
+		if (G1.prev_length >= MIN_MATCH && match_length <= G1.prev_length) {
 
-			check_match(strstart - 1, prev_match, prev_length);
+			check_match(G1.strstart - 1, prev_match, G1.prev_length);
 
 			flush =
-				ct_tally(strstart - 1 - prev_match, prev_length - MIN_MATCH);
+				ct_tally(G1.strstart - 1 - prev_match, G1.prev_length - MIN_MATCH);
 
 			/* Insert in hash table all strings up to the end of the match.
 			 * strstart-1 and strstart are already inserted.
 			 */
-			lookahead -= prev_length - 1;
-			prev_length -= 2;
+			G1.lookahead -= G1.prev_length - 1;
+			G1.prev_length -= 2;
 			do {
-				strstart++;
-				INSERT_STRING(strstart, hash_head);
+				G1.strstart++;
+				INSERT_STRING(G1.strstart, hash_head);
 				/* strstart never exceeds WSIZE-MAX_MATCH, so there are
 				 * always MIN_MATCH bytes ahead. If lookahead < MIN_MATCH
 				 * these bytes are garbage, but it does not matter since the
 				 * next lookahead bytes will always be emitted as literals.
 				 */
-			} while (--prev_length != 0);
+			} while (--G1.prev_length != 0);
 			match_available = 0;
 			match_length = MIN_MATCH - 1;
-			strstart++;
+			G1.strstart++;
 			if (flush)
-				FLUSH_BLOCK(0), block_start = strstart;
+				FLUSH_BLOCK(0), G1.block_start = G1.strstart;
 
 		} else if (match_available) {
 			/* If there was no match at the previous position, output a
 			 * single literal. If there was a match but the current match
 			 * is longer, truncate the previous match to a single literal.
 			 */
-			Tracevv((stderr, "%c", window[strstart - 1]));
-			if (ct_tally(0, window[strstart - 1])) {
-				FLUSH_BLOCK(0), block_start = strstart;
+			Tracevv((stderr, "%c", G1.window[G1.strstart - 1]));
+			if (ct_tally(0, G1.window[G1.strstart - 1])) {
+				FLUSH_BLOCK(0), G1.block_start = G1.strstart;
 			}
-			strstart++;
-			lookahead--;
+			G1.strstart++;
+			G1.lookahead--;
 		} else {
 			/* There is no previous match to compare with, wait for
 			 * the next step to decide.
 			 */
 			match_available = 1;
-			strstart++;
-			lookahead--;
+			G1.strstart++;
+			G1.lookahead--;
 		}
-		Assert(strstart <= isize && lookahead <= isize, "a bit too far");
+		Assert(G1.strstart <= isize && G1.lookahead <= isize, "a bit too far");
 
 		/* Make sure that we always have enough lookahead, except
 		 * at the end of the input file. We need MAX_MATCH bytes
 		 * for the next match, plus MIN_MATCH bytes to insert the
 		 * string following the next match.
 		 */
-		while (lookahead < MIN_LOOKAHEAD && !eofile)
+		while (G1.lookahead < MIN_LOOKAHEAD && !G1.eofile)
 			fill_window();
 	}
 	if (match_available)
-		ct_tally(0, window[strstart - 1]);
+		ct_tally(0, G1.window[G1.strstart - 1]);
 
-	return FLUSH_BLOCK(1);	/* eof */
+	return FLUSH_BLOCK(eof);
 }
 
 /* gzip (GNU zip) -- compress files with zip algorithm and 'compress' interface
@@ -1127,6 +1179,12 @@ static ulg deflate(void)
 
 typedef struct dirent dir_type;
 
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+#define GZIP_OPTS "cf123456789dqp:"
+#else
+#define GZIP_OPTS "cf123456789dq"
+#endif
+
 /* ======================================================================== */
 int gzip_main(int argc, char **argv)
 {
@@ -1139,7 +1197,7 @@ int gzip_main(int argc, char **argv)
 	int force = 0;
 	int opt;
 
-	while ((opt = getopt(argc, argv, "cf123456789dq")) != -1) {
+	while ((opt = getopt(argc, argv, GZIP_OPTS)) != -1) {
 		switch (opt) {
 		case 'c':
 			tostdout = 1;
@@ -1160,6 +1218,11 @@ int gzip_main(int argc, char **argv)
 			break;
 		case 'q':
 			break;
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+		case 'p':
+			par_threads = bb_xgetlarg(optarg, 10, 1, 256);
+			break;
+#endif
 #ifdef CONFIG_GUNZIP
 		case 'd':
 			optind = 1;
@@ -1188,16 +1251,9 @@ int gzip_main(int argc, char **argv)
 	strncpy(z_suffix, Z_SUFFIX, sizeof(z_suffix) - 1);
 	z_len = strlen(z_suffix);
 
-	/* Allocate all global buffers (for DYN_ALLOC option) */
-	ALLOC(uch, inbuf, INBUFSIZ + INBUF_EXTRA);
-	ALLOC(uch, outbuf, OUTBUFSIZ + OUTBUF_EXTRA);
-	ALLOC(ush, d_buf, DIST_BUFSIZE);
-	ALLOC(uch, window, 2L * WSIZE);
-	ALLOC(ush, tab_prefix, 1L << BITS);
+	/* Allocate the compressor for the main thread */
+	gzip_state_new();
 
-	/* Initialise the CRC32 table */
-	crc_32_tab = bb_crc32_filltable(0);
-	
 	clear_bufs();
 	part_nb = 0;
 
@@ -1452,9 +1508,6 @@ typedef struct ct_data {
 #define HEAP_SIZE (2*L_CODES+1)
 /* maximum heap size */
 
-static ct_data dyn_ltree[HEAP_SIZE];	/* literal and length tree */
-static ct_data dyn_dtree[2 * D_CODES + 1];	/* distance tree */
-
 static ct_data static_ltree[L_CODES + 2];
 
 /* The static literal tree. Since the bit lengths are imposed, there is no
@@ -1469,10 +1522,6 @@ static ct_data static_dtree[D_CODES];
  * 5 bits.)
  */
 
-static ct_data bl_tree[2 * BL_CODES + 1];
-
-/* Huffman tree for the bit lengths */
-
 typedef struct tree_desc {
 	ct_data *dyn_tree;	/* the dynamic tree */
 	ct_data *static_tree;	/* corresponding static tree or NULL */
@@ -1483,23 +1532,65 @@ typedef struct tree_desc {
 	int max_code;		/* largest code with non zero frequency */
 } tree_desc;
 
-static tree_desc l_desc =
-	{ dyn_ltree, static_ltree, extra_lbits, LITERALS + 1, L_CODES,
-	MAX_BITS, 0
-};
+/* The per stream half of the tree data, reached through G2. The static
+ * trees and the code tables below it never change once ct_init() has
+ * built them, so all streams share those.
+ */
+struct gzip_trees {
+	ct_data dyn_ltree[HEAP_SIZE];	/* literal and length tree */
+	ct_data dyn_dtree[2 * D_CODES + 1];	/* distance tree */
+	ct_data bl_tree[2 * BL_CODES + 1];	/* Huffman tree for the bit lengths */
+
+	tree_desc l_desc;
+	tree_desc d_desc;
+	tree_desc bl_desc;
+
+	ush bl_count[MAX_BITS + 1];
+	/* number of codes at each bit length for an optimal tree */
+
+	int heap[2 * L_CODES + 1];	/* heap used to build the Huffman trees */
+	int heap_len;	/* number of elements in the heap */
+	int heap_max;	/* element of largest frequency */
+	/* The sons of heap[n] are heap[2*n] and heap[2*n+1]. heap[0] is not used.
+	 * The same heap array is used to build all trees.
+	 */
+
+	uch depth[2 * L_CODES + 1];
+	/* Depth of each subtree used as tie breaker for trees of equal frequency */
+
+	uch flag_buf[(LIT_BUFSIZE / 8)];
+	/* flag_buf is a bit array distinguishing literals from lengths in
+	 * l_buf, thus indicating the presence or absence of a distance.
+	 */
+
+	unsigned last_lit;	/* running index in l_buf */
+	unsigned last_dist;	/* running index in d_buf */
+	unsigned last_flags;	/* running index in flag_buf */
+	uch flags;		/* current flags not yet saved in flag_buf */
+	uch flag_bit;	/* current bit used in flags */
+	/* bits are filled in flags starting at bit 0 (least significant).
+	 * Note: these flags are overkill in the current code since we don't
+	 * take advantage of DIST_BUFSIZE == LIT_BUFSIZE.
+	 */
+
+	ulg opt_len;		/* bit length of current block with optimal trees */
+	ulg static_len;	/* bit length of current block with static trees */
 
-static tree_desc d_desc =
-	{ dyn_dtree, static_dtree, extra_dbits, 0, D_CODES, MAX_BITS, 0 };
+	ulg compressed_len;	/* total bit length of compressed file */
 
-static tree_desc bl_desc =
-	{ bl_tree, (ct_data *) 0, extra_blbits, 0, BL_CODES, MAX_BL_BITS,
-	0
+	ush *file_type;	/* pointer to UNKNOWN, BINARY or ASCII */
+	int *file_method;	/* pointer to DEFLATE or STORE */
 };
 
+/* Tree descriptors as gzip_state_new() sets them up, less the dyn_tree */
+static const tree_desc l_desc_init =
+	{ NULL, static_ltree, extra_lbits, LITERALS + 1, L_CODES, MAX_BITS, 0 };
 
-static ush bl_count[MAX_BITS + 1];
+static const tree_desc d_desc_init =
+	{ NULL, static_dtree, extra_dbits, 0, D_CODES, MAX_BITS, 0 };
 
-/* number of codes at each bit length for an optimal tree */
+static const tree_desc bl_desc_init =
+	{ NULL, (ct_data *) 0, extra_blbits, 0, BL_CODES, MAX_BL_BITS, 0 };
 
 static const uch bl_order[BL_CODES]
 = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
@@ -1508,18 +1599,6 @@ static const uch bl_order[BL_CODES]
  * probability, to avoid transmitting the lengths for unused bit length codes.
  */
 
-static int heap[2 * L_CODES + 1];	/* heap used to build the Huffman trees */
-static int heap_len;	/* number of elements in the heap */
-static int heap_max;	/* element of largest frequency */
-
-/* The sons of heap[n] are heap[2*n] and heap[2*n+1]. heap[0] is not used.
- * The same heap array is used to build all trees.
- */
-
-static uch depth[2 * L_CODES + 1];
-
-/* Depth of each subtree used as tie breaker for trees of equal frequency */
-
 static uch length_code[MAX_MATCH - MIN_MATCH + 1];
 
 /* length code for each normalized match length (0 == MIN_MATCH) */
@@ -1539,37 +1618,11 @@ static int base_dist[D_CODES];
 
 /* First normalized distance for each code (0 = distance of 1) */
 
-#define l_buf inbuf
+#define l_buf G1.inbuf
 /* DECLARE(uch, l_buf, LIT_BUFSIZE);  buffer for literals or lengths */
 
 /* DECLARE(ush, d_buf, DIST_BUFSIZE); buffer for distances */
 
-static uch flag_buf[(LIT_BUFSIZE / 8)];
-
-/* flag_buf is a bit array distinguishing literals from lengths in
- * l_buf, thus indicating the presence or absence of a distance.
- */
-
-static unsigned last_lit;	/* running index in l_buf */
-static unsigned last_dist;	/* running index in d_buf */
-static unsigned last_flags;	/* running index in flag_buf */
-static uch flags;		/* current flags not yet saved in flag_buf */
-static uch flag_bit;	/* current bit used in flags */
-
-/* bits are filled in flags starting at bit 0 (least significant).
- * Note: these flags are overkill in the current code since we don't
- * take advantage of DIST_BUFSIZE == LIT_BUFSIZE.
- */
-
-static ulg opt_len;		/* bit length of current block with optimal trees */
-static ulg static_len;	/* bit length of current block with static trees */
-
-static ulg compressed_len;	/* total bit length of compressed file */
-
-
-static ush *file_type;	/* pointer to UNKNOWN, BINARY or ASCII */
-static int *file_method;	/* pointer to DEFLATE or STORE */
-
 /* ===========================================================================
  * Local (static) routines in this file.
  */
@@ -1619,9 +1672,9 @@ static void ct_init(ush * attr, int *methodp)
 	int code;			/* code value */
 	int dist;			/* distance index */
 
-	file_type = attr;
-	file_method = methodp;
-	compressed_len = 0L;
+	G2.file_type = attr;
+	G2.file_method = methodp;
+	G2.compressed_len = 0L;
 
 	if (static_dtree[0].Len != 0)
 		return;			/* ct_init already called */
@@ -1661,16 +1714,16 @@ static void ct_init(ush * attr, int *methodp)
 
 	/* Construct the codes of the static literal tree */
 	for (bits = 0; bits <= MAX_BITS; bits++)
-		bl_count[bits] = 0;
+		G2.bl_count[bits] = 0;
 	n = 0;
 	while (n <= 143)
-		static_ltree[n++].Len = 8, bl_count[8]++;
+		static_ltree[n++].Len = 8, G2.bl_count[8]++;
 	while (n <= 255)
-		static_ltree[n++].Len = 9, bl_count[9]++;
+		static_ltree[n++].Len = 9, G2.bl_count[9]++;
 	while (n <= 279)
-		static_ltree[n++].Len = 7, bl_count[7]++;
+		static_ltree[n++].Len = 7, G2.bl_count[7]++;
 	while (n <= 287)
-		static_ltree[n++].Len = 8, bl_count[8]++;
+		static_ltree[n++].Len = 8, G2.bl_count[8]++;
 	/* Codes 286 and 287 do not exist, but we must include them in the
 	 * tree construction to get a canonical Huffman tree (longest code
 	 * all ones)
@@ -1696,17 +1749,17 @@ static void init_block(void)
 
 	/* Initialize the trees. */
 	for (n = 0; n < L_CODES; n++)
-		dyn_ltree[n].Freq = 0;
+		G2.dyn_ltree[n].Freq = 0;
 	for (n = 0; n < D_CODES; n++)
-		dyn_dtree[n].Freq = 0;
+		G2.dyn_dtree[n].Freq = 0;
 	for (n = 0; n < BL_CODES; n++)
-		bl_tree[n].Freq = 0;
+		G2.bl_tree[n].Freq = 0;
 
-	dyn_ltree[END_BLOCK].Freq = 1;
-	opt_len = static_len = 0L;
-	last_lit = last_dist = last_flags = 0;
-	flags = 0;
-	flag_bit = 1;
+	G2.dyn_ltree[END_BLOCK].Freq = 1;
+	G2.opt_len = G2.static_len = 0L;
+	G2.last_lit = G2.last_dist = G2.last_flags = 0;
+	G2.flags = 0;
+	G2.flag_bit = 1;
 }
 
 #define SMALLEST 1
@@ -1719,8 +1772,8 @@ static void init_block(void)
  */
 #define pqremove(tree, top) \
 {\
-    top = heap[SMALLEST]; \
-    heap[SMALLEST] = heap[heap_len--]; \
+    top = G2.heap[SMALLEST]; \
+    G2.heap[SMALLEST] = G2.heap[G2.heap_len--]; \
     pqdownheap(tree, SMALLEST); \
 }
 
@@ -1730,7 +1783,7 @@ static void init_block(void)
  */
 #define smaller(tree, n, m) \
    (tree[n].Freq < tree[m].Freq || \
-   (tree[n].Freq == tree[m].Freq && depth[n] <= depth[m]))
+   (tree[n].Freq == tree[m].Freq && G2.depth[n] <= G2.depth[m]))
 
 /* ===========================================================================
  * Restore the heap property by moving down the tree starting at node k,
@@ -1740,26 +1793,26 @@ static void init_block(void)
  */
 static void pqdownheap(ct_data * tree, int k)
 {
-	int v = heap[k];
+	int v = G2.heap[k];
 	int j = k << 1;		/* left son of k */
 
-	while (j <= heap_len) {
+	while (j <= G2.heap_len) {
 		/* Set j to the smallest of the two sons: */
-		if (j < heap_len && smaller(tree, heap[j + 1], heap[j]))
+		if (j < G2.heap_len && smaller(tree, G2.heap[j + 1], G2.heap[j]))
 			j++;
 
 		/* Exit if v is smaller than both sons */
-		if (smaller(tree, v, heap[j]))
+		if (smaller(tree, v, G2.heap[j]))
 			break;
 
 		/* Exchange v with the smallest son */
-		heap[k] = heap[j];
+		G2.heap[k] = G2.heap[j];
 		k = j;
 
 		/* And continue down the tree, setting j to the left son of k */
 		j <<= 1;
 	}
-	heap[k] = v;
+	G2.heap[k] = v;
 }
 
 /* ===========================================================================
@@ -1788,15 +1841,15 @@ static void gen_bitlen(tree_desc * desc)
 	int overflow = 0;	/* number of elements with bit length too large */
 
 	for (bits = 0; bits <= MAX_BITS; bits++)
-		bl_count[bits] = 0;
+		G2.bl_count[bits] = 0;
 
 	/* In a first pass, compute the optimal bit lengths (which may
 	 * overflow in the case of the bit length tree).
 	 */
-	tree[heap[heap_max]].Len = 0;	/* root of the heap */
+	tree[G2.heap[G2.heap_max]].Len = 0;	/* root of the heap */
 
-	for (h = heap_max + 1; h < HEAP_SIZE; h++) {
-		n = heap[h];
+	for (h = G2.heap_max + 1; h < HEAP_SIZE; h++) {
+		n = G2.heap[h];
 		bits = tree[tree[n].Dad].Len + 1;
 		if (bits > max_length)
 			bits = max_length, overflow++;
@@ -1806,15 +1859,15 @@ static void gen_bitlen(tree_desc * desc)
 		if (n > max_code)
 			continue;	/* not a leaf node */
 
-		bl_count[bits]++;
+		G2.bl_count[bits]++;
 		xbits = 0;
 		if (n >= base)
 			xbits = extra[n - base];
 		f = tree[n].Freq;
-		opt_len += (ulg) f *(bits + xbits);
+		G2.opt_len += (ulg) f *(bits + xbits);
 
 		if (stree)
-			static_len += (ulg) f *(stree[n].Len + xbits);
+			G2.static_len += (ulg) f *(stree[n].Len + xbits);
 	}
 	if (overflow == 0)
 		return;
@@ -1825,11 +1878,11 @@ static void gen_bitlen(tree_desc * desc)
 	/* Find the first bit length which could increase: */
 	do {
 		bits = max_length - 1;
-		while (bl_count[bits] == 0)
+		while (G2.bl_count[bits] == 0)
 			bits--;
-		bl_count[bits]--;	/* move one leaf down the tree */
-		bl_count[bits + 1] += 2;	/* move one overflow item as its brother */
-		bl_count[max_length]--;
+		G2.bl_count[bits]--;	/* move one leaf down the tree */
+		G2.bl_count[bits + 1] += 2;	/* move one overflow item as its brother */
+		G2.bl_count[max_length]--;
 		/* The brother of the overflow item also moves one step up,
 		 * but this does not affect bl_count[max_length]
 		 */
@@ -1842,15 +1895,15 @@ static void gen_bitlen(tree_desc * desc)
 	 * from 'ar' written by Haruhiko Okumura.)
 	 */
 	for (bits = max_length; bits != 0; bits--) {
-		n = bl_count[bits];
+		n = G2.bl_count[bits];
 		while (n != 0) {
-			m = heap[--h];
+			m = G2.heap[--h];
 			if (m > max_code)
 				continue;
 			if (tree[m].Len != (unsigned) bits) {
 				Trace((stderr, "code %d bits %d->%d\n", m, tree[m].Len,
 					   bits));
-				opt_len +=
+				G2.opt_len +=
 					((long) bits - (long) tree[m].Len) * (long) tree[m].Freq;
 				tree[m].Len = (ush) bits;
 			}
@@ -1878,12 +1931,12 @@ static void gen_codes(ct_data * tree, int max_code)
 	 * without bit reversal.
 	 */
 	for (bits = 1; bits <= MAX_BITS; bits++) {
-		next_code[bits] = code = (code + bl_count[bits - 1]) << 1;
+		next_code[bits] = code = (code + G2.bl_count[bits - 1]) << 1;
 	}
 	/* Check that the bit counts in bl_count are consistent. The last code
 	 * must be all ones.
 	 */
-	Assert(code + bl_count[MAX_BITS] - 1 == (1 << MAX_BITS) - 1,
+	Assert(code + G2.bl_count[MAX_BITS] - 1 == (1 << MAX_BITS) - 1,
 		   "inconsistent bit counts");
 	Tracev((stderr, "\ngen_codes: max_code %d ", max_code));
 
@@ -1923,12 +1976,12 @@ static void build_tree(tree_desc * desc)
 	 * heap[SMALLEST]. The sons of heap[n] are heap[2*n] and heap[2*n+1].
 	 * heap[0] is not used.
 	 */
-	heap_len = 0, heap_max = HEAP_SIZE;
+	G2.heap_len = 0, G2.heap_max = HEAP_SIZE;
 
 	for (n = 0; n < elems; n++) {
 		if (tree[n].Freq != 0) {
-			heap[++heap_len] = max_code = n;
-			depth[n] = 0;
+			G2.heap[++G2.heap_len] = max_code = n;
+			G2.depth[n] = 0;
 		} else {
 			tree[n].Len = 0;
 		}
@@ -1939,14 +1992,14 @@ static void build_tree(tree_desc * desc)
 	 * possible code. So to avoid special checks later on we force at least
 	 * two codes of non zero frequency.
 	 */
-	while (heap_len < 2) {
-		int new = heap[++heap_len] = (max_code < 2 ? ++max_code : 0);
+	while (G2.heap_len < 2) {
+		int new = G2.heap[++G2.heap_len] = (max_code < 2 ? ++max_code : 0);
 
 		tree[new].Freq = 1;
-		depth[new] = 0;
-		opt_len--;
+		G2.depth[new] = 0;
+		G2.opt_len--;
 		if (stree)
-			static_len -= stree[new].Len;
+			G2.static_len -= stree[new].Len;
 		/* new is 0 or 1 so it does not have extra bits */
 	}
 	desc->max_code = max_code;
@@ -1954,7 +2007,7 @@ static void build_tree(tree_desc * desc)
 	/* The elements heap[heap_len/2+1 .. heap_len] are leaves of the tree,
 	 * establish sub-heaps of increasing lengths:
 	 */
-	for (n = heap_len / 2; n >= 1; n--)
+	for (n = G2.heap_len / 2; n >= 1; n--)
 		pqdownheap(tree, n);
 
 	/* Construct the Huffman tree by repeatedly combining the least two
@@ -1962,28 +2015,28 @@ static void build_tree(tree_desc * desc)
 	 */
 	do {
 		pqremove(tree, n);	/* n = node of least frequency */
-		m = heap[SMALLEST];	/* m = node of next least frequency */
+		m = G2.heap[SMALLEST];	/* m = node of next least frequency */
 
-		heap[--heap_max] = n;	/* keep the nodes sorted by frequency */
-		heap[--heap_max] = m;
+		G2.heap[--G2.heap_max] = n;	/* keep the nodes sorted by frequency */
+		G2.heap[--G2.heap_max] = m;
 
 		/* Create a new node father of n and m */
 		tree[node].Freq = tree[n].Freq + tree[m].Freq;
-		depth[node] = (uch) (MAX(depth[n], depth[m]) + 1);
+		G2.depth[node] = (uch) (MAX(G2.depth[n], G2.depth[m]) + 1);
 		tree[n].Dad = tree[m].Dad = (ush) node;
 #ifdef DUMP_BL_TREE
-		if (tree == bl_tree) {
+		if (tree == G2.bl_tree) {
 			bb_error_msg("\nnode %d(%d), sons %d(%d) %d(%d)",
 					node, tree[node].Freq, n, tree[n].Freq, m, tree[m].Freq);
 		}
 #endif
 		/* and insert the new node in the heap */
-		heap[SMALLEST] = node++;
+		G2.heap[SMALLEST] = node++;
 		pqdownheap(tree, SMALLEST);
 
-	} while (heap_len >= 2);
+	} while (G2.heap_len >= 2);
 
-	heap[--heap_max] = heap[SMALLEST];
+	G2.heap[--G2.heap_max] = G2.heap[SMALLEST];
 
 	/* At this point, the fields freq and dad are set. We can now
 	 * generate the bit lengths.
@@ -2020,15 +2073,15 @@ static void scan_tree(ct_data * tree, int max_code)
 		if (++count < max_count && curlen == nextlen) {
 			continue;
 		} else if (count < min_count) {
-			bl_tree[curlen].Freq += count;
+			G2.bl_tree[curlen].Freq += count;
 		} else if (curlen != 0) {
 			if (curlen != prevlen)
-				bl_tree[curlen].Freq++;
-			bl_tree[REP_3_6].Freq++;
+				G2.bl_tree[curlen].Freq++;
+			G2.bl_tree[REP_3_6].Freq++;
 		} else if (count <= 10) {
-			bl_tree[REPZ_3_10].Freq++;
+			G2.bl_tree[REPZ_3_10].Freq++;
 		} else {
-			bl_tree[REPZ_11_138].Freq++;
+			G2.bl_tree[REPZ_11_138].Freq++;
 		}
 		count = 0;
 		prevlen = curlen;
@@ -2067,24 +2120,24 @@ static void send_tree(ct_data * tree, int max_code)
 			continue;
 		} else if (count < min_count) {
 			do {
-				send_code(curlen, bl_tree);
+				send_code(curlen, G2.bl_tree);
 			} while (--count != 0);
 
 		} else if (curlen != 0) {
 			if (curlen != prevlen) {
-				send_code(curlen, bl_tree);
+				send_code(curlen, G2.bl_tree);
 				count--;
 			}
 			Assert(count >= 3 && count <= 6, " 3_6?");
-			send_code(REP_3_6, bl_tree);
+			send_code(REP_3_6, G2.bl_tree);
 			send_bits(count - 3, 2);
 
 		} else if (count <= 10) {
-			send_code(REPZ_3_10, bl_tree);
+			send_code(REPZ_3_10, G2.bl_tree);
 			send_bits(count - 3, 3);
 
 		} else {
-			send_code(REPZ_11_138, bl_tree);
+			send_code(REPZ_11_138, G2.bl_tree);
 			send_bits(count - 11, 7);
 		}
 		count = 0;
@@ -2108,11 +2161,11 @@ static int build_bl_tree(void)
 	int max_blindex;	/* index of last bit length code of non zero freq */
 
 	/* Determine the bit length frequencies for literal and distance trees */
-	scan_tree((ct_data *) dyn_ltree, l_desc.max_code);
-	scan_tree((ct_data *) dyn_dtree, d_desc.max_code);
+	scan_tree((ct_data *) G2.dyn_ltree, G2.l_desc.max_code);
+	scan_tree((ct_data *) G2.dyn_dtree, G2.d_desc.max_code);
 
 	/* Build the bit length tree: */
-	build_tree((tree_desc *) (&bl_desc));
+	build_tree((tree_desc *) (&G2.bl_desc));
 	/* opt_len now includes the length of the tree representations, except
 	 * the lengths of the bit lengths codes and the 5+5+4 bits for the counts.
 	 */
@@ -2122,12 +2175,12 @@ static int build_bl_tree(void)
 	 * 3 but the actual value used is 4.)
 	 */
 	for (max_blindex = BL_CODES - 1; max_blindex >= 3; max_blindex--) {
-		if (bl_tree[bl_order[max_blindex]].Len != 0)
+		if (G2.bl_tree[bl_order[max_blindex]].Len != 0)
 			break;
 	}
 	/* Update opt_len to include the bit length tree and counts */
-	opt_len += 3 * (max_blindex + 1) + 5 + 5 + 4;
-	Tracev((stderr, "\ndyn trees: dyn %ld, stat %ld", opt_len, static_len));
+	G2.opt_len += 3 * (max_blindex + 1) + 5 + 5 + 4;
+	Tracev((stderr, "\ndyn trees: dyn %ld, stat %ld", G2.opt_len, G2.static_len));
 
 	return max_blindex;
 }
@@ -2150,15 +2203,15 @@ static void send_all_trees(int lcodes, int dcodes, int blcodes)
 	send_bits(blcodes - 4, 4);	/* not -3 as stated in appnote.txt */
 	for (rank = 0; rank < blcodes; rank++) {
 		Tracev((stderr, "\nbl code %2d ", bl_order[rank]));
-		send_bits(bl_tree[bl_order[rank]].Len, 3);
+		send_bits(G2.bl_tree[bl_order[rank]].Len, 3);
 	}
-	Tracev((stderr, "\nbl tree: sent %ld", bits_sent));
+	Tracev((stderr, "\nbl tree: sent %ld", G1.bits_sent));
 
-	send_tree((ct_data *) dyn_ltree, lcodes - 1);	/* send the literal tree */
-	Tracev((stderr, "\nlit tree: sent %ld", bits_sent));
+	send_tree((ct_data *) G2.dyn_ltree, lcodes - 1);	/* send the literal tree */
+	Tracev((stderr, "\nlit tree: sent %ld", G1.bits_sent));
 
-	send_tree((ct_data *) dyn_dtree, dcodes - 1);	/* send the distance tree */
-	Tracev((stderr, "\ndist tree: sent %ld", bits_sent));
+	send_tree((ct_data *) G2.dyn_dtree, dcodes - 1);	/* send the distance tree */
+	Tracev((stderr, "\ndist tree: sent %ld", G1.bits_sent));
 }
 
 /* ===========================================================================
@@ -2171,18 +2224,18 @@ static ulg flush_block(char *buf, ulg stored_len, int eof)
 	ulg opt_lenb, static_lenb;	/* opt_len and static_len in bytes */
 	int max_blindex;	/* index of last bit length code of non zero freq */
 
-	flag_buf[last_flags] = flags;	/* Save the flags for the last 8 items */
+	G2.flag_buf[G2.last_flags] = G2.flags;	/* Save the flags for the last 8 items */
 
 	/* Check if the file is ascii or binary */
-	if (*file_type == (ush) UNKNOWN)
+	if (*G2.file_type == (ush) UNKNOWN)
 		set_file_type();
 
 	/* Construct the literal and distance trees */
-	build_tree((tree_desc *) (&l_desc));
-	Tracev((stderr, "\nlit data: dyn %ld, stat %ld", opt_len, static_len));
+	build_tree((tree_desc *) (&G2.l_desc));
+	Tracev((stderr, "\nlit data: dyn %ld, stat %ld", G2.opt_len, G2.static_len));
 
-	build_tree((tree_desc *) (&d_desc));
-	Tracev((stderr, "\ndist data: dyn %ld, stat %ld", opt_len, static_len));
+	build_tree((tree_desc *) (&G2.d_desc));
+	Tracev((stderr, "\ndist data: dyn %ld, stat %ld", G2.opt_len, G2.static_len));
 	/* At this point, opt_len and static_len are the total bit lengths of
 	 * the compressed block data, excluding the tree representations.
 	 */
@@ -2193,13 +2246,13 @@ static ulg flush_block(char *buf, ulg stored_len, int eof)
 	max_blindex = build_bl_tree();
 
 	/* Determine the best encoding. Compute first the block length in bytes */
-	opt_lenb = (opt_len + 3 + 7) >> 3;
-	static_lenb = (static_len + 3 + 7) >> 3;
+	opt_lenb = (G2.opt_len + 3 + 7) >> 3;
+	static_lenb = (G2.static_len + 3 + 7) >> 3;
 
 	Trace((stderr,
 		   "\nopt %lu(%lu) stat %lu(%lu) stored %lu lit %u dist %u ",
-		   opt_lenb, opt_len, static_lenb, static_len, stored_len,
-		   last_lit, last_dist));
+		   opt_lenb, G2.opt_len, static_lenb, G2.static_len, stored_len,
+		   G2.last_lit, G2.last_dist));
 
 	if (static_lenb <= opt_lenb)
 		opt_lenb = static_lenb;
@@ -2208,14 +2261,14 @@ static ulg flush_block(char *buf, ulg stored_len, int eof)
 	 * and if the zip file can be seeked (to rewrite the local header),
 	 * the whole file is transformed into a stored file:
 	 */
-	if (stored_len <= opt_lenb && eof && compressed_len == 0L && seekable()) {
+	if (stored_len <= opt_lenb && eof && G2.compressed_len == 0L && seekable()) {
 		/* Since LIT_BUFSIZE <= 2*WSIZE, the input data must be there: */
 		if (buf == (char *) 0)
 			bb_error_msg("block vanished");
 
 		copy_block(buf, (unsigned) stored_len, 0);	/* without header */
-		compressed_len = stored_len << 3;
-		*file_method = STORED;
+		G2.compressed_len = stored_len << 3;
+		*G2.file_method = STORED;
 
 	} else if (stored_len + 4 <= opt_lenb && buf != (char *) 0) {
 		/* 4: two words for the lengths */
@@ -2226,33 +2279,33 @@ static ulg flush_block(char *buf, ulg stored_len, int eof)
 		 * transform a block into a stored block.
 		 */
 		send_bits((STORED_BLOCK << 1) + eof, 3);	/* send block type */
-		compressed_len = (compressed_len + 3 + 7) & ~7L;
-		compressed_len += (stored_len + 4) << 3;
+		G2.compressed_len = (G2.compressed_len + 3 + 7) & ~7L;
+		G2.compressed_len += (stored_len + 4) << 3;
 
 		copy_block(buf, (unsigned) stored_len, 1);	/* with header */
 
 	} else if (static_lenb == opt_lenb) {
 		send_bits((STATIC_TREES << 1) + eof, 3);
 		compress_block((ct_data *) static_ltree, (ct_data *) static_dtree);
-		compressed_len += 3 + static_len;
+		G2.compressed_len += 3 + G2.static_len;
 	} else {
 		send_bits((DYN_TREES << 1) + eof, 3);
-		send_all_trees(l_desc.max_code + 1, d_desc.max_code + 1,
+		send_all_trees(G2.l_desc.max_code + 1, G2.d_desc.max_code + 1,
 					   max_blindex + 1);
-		compress_block((ct_data *) dyn_ltree, (ct_data *) dyn_dtree);
-		compressed_len += 3 + opt_len;
+		compress_block((ct_data *) G2.dyn_ltree, (ct_data *) G2.dyn_dtree);
+		G2.compressed_len += 3 + G2.opt_len;
 	}
-	Assert(compressed_len == bits_sent, "bad compressed size");
+	Assert(G2.compressed_len == G1.bits_sent, "bad compressed size");
 	init_block();
 
 	if (eof) {
 		bi_windup();
-		compressed_len += 7;	/* align on byte boundary */
+		G2.compressed_len += 7;	/* align on byte boundary */
 	}
-	Tracev((stderr, "\ncomprlen %lu(%lu) ", compressed_len >> 3,
-			compressed_len - 7 * eof));
+	Tracev((stderr, "\ncomprlen %lu(%lu) ", G2.compressed_len >> 3,
+			G2.compressed_len - 7 * eof));
 
-	return compressed_len >> 3;
+	return G2.compressed_len >> 3;
 }
 
 /* ===========================================================================
@@ -2261,10 +2314,10 @@ static ulg flush_block(char *buf, ulg stored_len, int eof)
  */
 static int ct_tally(int dist, int lc)
 {
-	l_buf[last_lit++] = (uch) lc;
+	l_buf[G2.last_lit++] = (uch) lc;
 	if (dist == 0) {
 		/* lc is the unmatched char */
-		dyn_ltree[lc].Freq++;
+		G2.dyn_ltree[lc].Freq++;
 	} else {
 		/* Here, lc is the match length - MIN_MATCH */
 		dist--;			/* dist = match distance - 1 */
@@ -2272,39 +2325,39 @@ static int ct_tally(int dist, int lc)
 			   (ush) lc <= (ush) (MAX_MATCH - MIN_MATCH) &&
 			   (ush) d_code(dist) < (ush) D_CODES, "ct_tally: bad match");
 
-		dyn_ltree[length_code[lc] + LITERALS + 1].Freq++;
-		dyn_dtree[d_code(dist)].Freq++;
+		G2.dyn_ltree[length_code[lc] + LITERALS + 1].Freq++;
+		G2.dyn_dtree[d_code(dist)].Freq++;
 
-		d_buf[last_dist++] = (ush) dist;
-		flags |= flag_bit;
+		G1.d_buf[G2.last_dist++] = (ush) dist;
+		G2.flags |= G2.flag_bit;
 	}
-	flag_bit <<= 1;
+	G2.flag_bit <<= 1;
 
 	/* Output the flags if they fill a byte: */
-	if ((last_lit & 7) == 0) {
-		flag_buf[last_flags++] = flags;
-		flags = 0, flag_bit = 1;
+	if ((G2.last_lit & 7) == 0) {
+		G2.flag_buf[G2.last_flags++] = G2.flags;
+		G2.flags = 0, G2.flag_bit = 1;
 	}
 	/* Try to guess if it is profitable to stop the current block here */
-	if ((last_lit & 0xfff) == 0) {
+	if ((G2.last_lit & 0xfff) == 0) {
 		/* Compute an upper bound for the compressed length */
-		ulg out_length = (ulg) last_lit * 8L;
-		ulg in_length = (ulg) strstart - block_start;
+		ulg out_length = (ulg) G2.last_lit * 8L;
+		ulg in_length = (ulg) G1.strstart - G1.block_start;
 		int dcode;
 
 		for (dcode = 0; dcode < D_CODES; dcode++) {
 			out_length +=
-				(ulg) dyn_dtree[dcode].Freq * (5L + extra_dbits[dcode]);
+				(ulg) G2.dyn_dtree[dcode].Freq * (5L + extra_dbits[dcode]);
 		}
 		out_length >>= 3;
 		Trace((stderr,
 			   "\nlast_lit %u, last_dist %u, in %ld, out ~%ld(%ld%%) ",
-			   last_lit, last_dist, in_length, out_length,
+			   G2.last_lit, G2.last_dist, in_length, out_length,
 			   100L - out_length * 100L / in_length));
-		if (last_dist < last_lit / 2 && out_length < in_length / 2)
+		if (G2.last_dist < G2.last_lit / 2 && out_length < in_length / 2)
 			return 1;
 	}
-	return (last_lit == LIT_BUFSIZE - 1 || last_dist == DIST_BUFSIZE);
+	return (G2.last_lit == LIT_BUFSIZE - 1 || G2.last_dist == DIST_BUFSIZE);
 	/* We avoid equality with LIT_BUFSIZE because of wraparound at 64K
 	 * on 16 bit machines and because stored blocks are restricted to
 	 * 64K-1 bytes.
@@ -2325,10 +2378,10 @@ static void compress_block(ct_data * ltree, ct_data * dtree)
 	unsigned code;		/* the code to send */
 	int extra;			/* number of extra bits to send */
 
-	if (last_lit != 0)
+	if (G2.last_lit != 0)
 		do {
 			if ((lx & 7) == 0)
-				flag = flag_buf[fx++];
+				flag = G2.flag_buf[fx++];
 			lc = l_buf[lx++];
 			if ((flag & 1) == 0) {
 				send_code(lc, ltree);	/* send a literal byte */
@@ -2342,7 +2395,7 @@ static void compress_block(ct_data * ltree, ct_data * dtree)
 					lc -= base_length[code];
 					send_bits(lc, extra);	/* send the extra length bits */
 				}
-				dist = d_buf[dx++];
+				dist = G1.d_buf[dx++];
 				/* Here, dist is the match distance - 1 */
 				code = d_code(dist);
 				Assert(code < D_CODES, "bad d_code");
@@ -2355,7 +2408,7 @@ static void compress_block(ct_data * ltree, ct_data * dtree)
 				}
 			}			/* literal or match pair ? */
 			flag >>= 1;
-		} while (lx < last_lit);
+		} while (lx < G2.last_lit);
 
 	send_code(END_BLOCK, ltree);
 }
@@ -2373,13 +2426,13 @@ static void set_file_type(void)
 	unsigned bin_freq = 0;
 
 	while (n < 7)
-		bin_freq += dyn_ltree[n++].Freq;
+		bin_freq += G2.dyn_ltree[n++].Freq;
 	while (n < 128)
-		ascii_freq += dyn_ltree[n++].Freq;
+		ascii_freq += G2.dyn_ltree[n++].Freq;
 	while (n < LITERALS)
-		bin_freq += dyn_ltree[n++].Freq;
-	*file_type = bin_freq > (ascii_freq >> 2) ? BINARY : ASCII;
-	if (*file_type == BINARY && translate_eol) {
+		bin_freq += G2.dyn_ltree[n++].Freq;
+	*G2.file_type = bin_freq > (ascii_freq >> 2) ? BINARY : ASCII;
+	if (*G2.file_type == BINARY && translate_eol) {
 		bb_error_msg("-l used on binary file");
 	}
 }
@@ -2391,9 +2444,6 @@ static void set_file_type(void)
  */
 
 
-static uint32_t crc;			/* crc on uncompressed file data */
-static long header_bytes;	/* number of bytes in gzip header */
-
 static void put_long(ulg n)
 {
 	put_short((n) & 0xffff);
@@ -2403,7 +2453,7 @@ static void put_long(ulg n)
 /* put_header_byte is used for the compressed output
  * - for the initial 4 bytes that can't overflow the buffer.
  */
-#define put_header_byte(c) {outbuf[outcnt++]=(uch)(c);}
+#define put_header_byte(c) {G1.outbuf[G1.outcnt++]=(uch)(c);}
 
 /* ===========================================================================
  * Deflate in to out.
@@ -2416,9 +2466,14 @@ static int zip(int in, int out)
 	ush attr = 0;		/* ascii/binary flag */
 	ush deflate_flags = 0;	/* pkzip -es, -en or -ex equivalent */
 
-	ifd = in;
-	ofd = out;
-	outcnt = 0;
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+	if (par_threads > 1)
+		return zip_parallel(in, out);
+#endif
+
+	G1.ifd = in;
+	G1.ofd = out;
+	G1.outcnt = 0;
 
 	/* Write the header to the gzip file. See algorithm.doc for the format */
 
@@ -2432,7 +2487,7 @@ static int zip(int in, int out)
 	put_long(time_stamp);
 
 	/* Write deflated file to zip file */
-	crc = updcrc(0, 0);
+	G1.crc = ~0;
 
 	bi_init(out);
 	ct_init(&attr, &method);
@@ -2441,14 +2496,14 @@ static int zip(int in, int out)
 	put_byte((uch) deflate_flags);	/* extra flags */
 	put_byte(OS_CODE);	/* OS identifier */
 
-	header_bytes = (long) outcnt;
+	G1.header_bytes = (long) G1.outcnt;
 
-	(void) deflate();
+	(void) deflate(1);
 
 	/* Write the crc and uncompressed size */
-	put_long(crc);
+	put_long(~G1.crc);
 	put_long(isize);
-	header_bytes += 2 * sizeof(long);
+	G1.header_bytes += 2 * sizeof(long);
 
 	flush_outbuf();
 	return OK;
@@ -2464,13 +2519,13 @@ static int file_read(char *buf, unsigned size)
 {
 	unsigned len;
 
-	Assert(insize == 0, "inbuf not empty");
+	Assert(G1.insize == 0, "inbuf not empty");
 
-	len = read(ifd, buf, size);
+	len = read(G1.ifd, buf, size);
 	if (len == (unsigned) (-1) || len == 0)
 		return (int) len;
 
-	crc = updcrc((uch *) buf, len);
+	G1.crc = bb_crc32_block(G1.crc, buf, len, 0);
 	isize += (ulg) len;
 	return (int) len;
 }
@@ -2481,9 +2536,293 @@ static int file_read(char *buf, unsigned size)
  */
 static void flush_outbuf(void)
 {
-	if (outcnt == 0)
+	if (G1.outcnt == 0)
 		return;
 
-	write_buf(ofd, (char *) outbuf, outcnt);
-	outcnt = 0;
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+	if (G1.job) {
+		struct gzip_job *job = G1.job;
+
+		if (job->outlen + G1.outcnt > job->outsize) {
+			job->outsize = 2 * (job->outlen + G1.outcnt);
+			job->out = xrealloc(job->out, job->outsize);
+		}
+		memcpy(job->out + job->outlen, G1.outbuf, G1.outcnt);
+		job->outlen += G1.outcnt;
+		G1.outcnt = 0;
+		return;
+	}
+#endif
+	write_buf(G1.ofd, (char *) G1.outbuf, G1.outcnt);
+	G1.outcnt = 0;
+}
+
+/* ===========================================================================
+ * Allocate a compressor and make it the current one for this thread.
+ */
+static void gzip_state_new(void)
+{
+	gzip_ctx = xzalloc(sizeof(struct gzip_state));
+	gzip_ctx->trees = xzalloc(sizeof(struct gzip_trees));
+
+	ALLOC(uch, G1.inbuf, INBUFSIZ + INBUF_EXTRA);
+	ALLOC(uch, G1.outbuf, OUTBUFSIZ + OUTBUF_EXTRA);
+	ALLOC(ush, G1.d_buf, DIST_BUFSIZE);
+	ALLOC(uch, G1.window, 2L * WSIZE);
+	ALLOC(ush, tab_prefix, 1L << BITS);
+
+	G2.l_desc = l_desc_init;
+	G2.l_desc.dyn_tree = G2.dyn_ltree;
+	G2.d_desc = d_desc_init;
+	G2.d_desc.dyn_tree = G2.dyn_dtree;
+	G2.bl_desc = bl_desc_init;
+	G2.bl_desc.dyn_tree = G2.bl_tree;
+	init_block();
+}
+
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+
+/* ===========================================================================
+ * Parallel compression, the way pigz does it. The input is cut into
+ * PAR_BLOCK sized pieces, which par_threads threads deflate independently.
+ * Each piece is compressed with the WSIZE bytes before it as a dictionary,
+ * so matches still reach back across the cuts, and every piece but the
+ * last ends in an empty stored block to bring it to a byte boundary. The
+ * pieces then simply run together into one deflate stream, which the main
+ * thread writes out in order, combining the crcs of the pieces as it goes.
+ */
+
+#define PAR_BLOCK (128 * 1024L)
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t todo;	/* signalled when a job is queued */
+	pthread_cond_t finished;	/* signalled when a job is done */
+	struct gzip_job *jobs;	/* job number n lives in jobs[n % njobs] */
+	unsigned njobs;
+	unsigned queued;	/* number of jobs queued so far */
+	unsigned taken;		/* number of jobs picked up by a thread */
+	int quit;
+} par;
+
+/* ===========================================================================
+ * Input function for the compressors: the job's buffer.
+ */
+static int job_read(char *buf, unsigned size)
+{
+	struct gzip_job *job = G1.job;
+	unsigned left = job->dictlen + job->len - G1.job_pos;
+
+	if (size > left)
+		size = left;
+	memcpy(buf, job->buf + G1.job_pos, size);
+	G1.job_pos += size;
+	return (int) size;
 }
+
+/* ===========================================================================
+ * Deflate one piece into job->out.
+ */
+static void zip_job(struct gzip_job *job)
+{
+	ush attr = 0;		/* ascii/binary flag */
+	ush deflate_flags = 0;
+	int job_method = DEFLATED;
+
+	G1.job = job;
+	G1.job_pos = 0;
+	G1.outcnt = 0;
+	job->outlen = 0;
+
+	bi_init(NO_FILE);
+	G1.read_buf = job_read;
+	ct_init(&attr, &job_method);
+	lm_init(&deflate_flags);
+	lm_skip(job->dictlen);
+
+	(void) deflate(job->last);
+	if (!job->last) {
+		send_bits(STORED_BLOCK << 1, 3);
+		copy_block(NULL, 0, 1);
+	}
+	flush_outbuf();
+	G1.job = NULL;
+
+	job->crc = ~bb_crc32_block(~0, job->buf + job->dictlen, job->len, 0);
+}
+
+static void *zip_thread(void *arg)
+{
+	struct gzip_job *job;
+
+	gzip_state_new();
+
+	pthread_mutex_lock(&par.lock);
+	for (;;) {
+		while (par.taken == par.queued && !par.quit)
+			pthread_cond_wait(&par.todo, &par.lock);
+		if (par.taken == par.queued)
+			break;
+		job = &par.jobs[par.taken++ % par.njobs];
+		pthread_mutex_unlock(&par.lock);
+
+		zip_job(job);
+
+		pthread_mutex_lock(&par.lock);
+		job->done = 1;
+		pthread_cond_signal(&par.finished);
+	}
+	pthread_mutex_unlock(&par.lock);
+
+	free(G1.inbuf);
+	free(G1.outbuf);
+	free(G1.d_buf);
+	free(G1.window);
+	free(G1.prev);
+	free(gzip_ctx->trees);
+	free(gzip_ctx);
+	return NULL;
+}
+
+/* ===========================================================================
+ * Read the next piece of input into job, after the end of prev as its
+ * dictionary.
+ */
+static void par_fill(struct gzip_job *job, struct gzip_job *prev)
+{
+	ssize_t n;
+
+	job->dictlen = 0;
+	if (prev) {
+		job->dictlen = prev->dictlen + prev->len;
+		if (job->dictlen > WSIZE)
+			job->dictlen = WSIZE;
+		memcpy(job->buf,
+			prev->buf + prev->dictlen + prev->len - job->dictlen,
+			job->dictlen);
+	}
+	n = bb_full_read(G1.ifd, job->buf + job->dictlen, PAR_BLOCK);
+	if (n < 0)
+		bb_perror_msg_and_die(bb_msg_read_error);
+	job->len = n;
+	job->done = 0;
+}
+
+/* ===========================================================================
+ * Wait for job number n and write it out.
+ */
+static void par_write(unsigned n, uint32_t *crcp)
+{
+	struct gzip_job *job = &par.jobs[n % par.njobs];
+
+	pthread_mutex_lock(&par.lock);
+	while (!job->done)
+		pthread_cond_wait(&par.finished, &par.lock);
+	pthread_mutex_unlock(&par.lock);
+
+	write_buf(G1.ofd, job->out, job->outlen);
+	*crcp = bb_crc32_combine(*crcp, job->crc, job->len);
+	isize += job->len;
+}
+
+/* ===========================================================================
+ * Deflate in to out using par_threads threads.
+ */
+static int zip_parallel(int in, int out)
+{
+	pthread_t *threads;
+	struct gzip_job *job, *next;
+	unsigned n, written;
+	uint32_t crc = 0;
+	ush attr = 0;
+	int i;
+
+	G1.ifd = in;
+	G1.ofd = out;
+	G1.outcnt = 0;
+	isize = 0;
+
+	method = DEFLATED;
+	put_header_byte(GZIP_MAGIC[0]);	/* magic header */
+	put_header_byte(GZIP_MAGIC[1]);
+	put_header_byte(DEFLATED);	/* compression method */
+	put_header_byte(0);	/* general flags */
+	put_long(time_stamp);
+	put_byte(SLOW);		/* extra flags, as lm_init() sets them */
+	put_byte(OS_CODE);	/* OS identifier */
+	flush_outbuf();
+
+	/* The shared tables are built on first use; do that before there is
+	 * anyone to race with. */
+	ct_init(&attr, &method);
+	(void) bb_crc32_block(0, G1.window, 2 * WSIZE, 0);
+
+	pthread_mutex_init(&par.lock, NULL);
+	pthread_cond_init(&par.todo, NULL);
+	pthread_cond_init(&par.finished, NULL);
+	par.njobs = 2 * par_threads;
+	par.jobs = xzalloc(par.njobs * sizeof(struct gzip_job));
+	for (n = 0; n < par.njobs; n++)
+		par.jobs[n].buf = xmalloc(WSIZE + PAR_BLOCK);
+	par.queued = par.taken = 0;
+	par.quit = 0;
+
+	threads = xmalloc(par_threads * sizeof(pthread_t));
+	for (i = 0; i < par_threads; i++)
+		if (pthread_create(&threads[i], NULL, zip_thread, NULL) != 0)
+			bb_error_msg_and_die("can't create thread");
+
+	/* A full piece is only known to be the last one once the next read
+	 * comes back empty, so read one piece ahead. */
+	written = 0;
+	job = &par.jobs[0];
+	par_fill(job, NULL);
+	for (n = 0;; n++) {
+		next = NULL;
+		if (job->len == PAR_BLOCK) {
+			while (n + 1 - written >= par.njobs)
+				par_write(written++, &crc);
+			next = &par.jobs[(n + 1) % par.njobs];
+			par_fill(next, job);
+			if (next->len == 0)
+				next = NULL;
+		}
+		job->last = (next == NULL);
+
+		pthread_mutex_lock(&par.lock);
+		par.queued++;
+		pthread_cond_signal(&par.todo);
+		pthread_mutex_unlock(&par.lock);
+
+		if (next == NULL)
+			break;
+		job = next;
+	}
+	while (written <= n)
+		par_write(written++, &crc);
+
+	pthread_mutex_lock(&par.lock);
+	par.quit = 1;
+	pthread_cond_broadcast(&par.todo);
+	pthread_mutex_unlock(&par.lock);
+	for (i = 0; i < par_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	for (n = 0; n < par.njobs; n++) {
+		free(par.jobs[n].buf);
+		free(par.jobs[n].out);
+	}
+	free(par.jobs);
+	pthread_cond_destroy(&par.finished);
+	pthread_cond_destroy(&par.todo);
+	pthread_mutex_destroy(&par.lock);
+
+	/* Write the crc and uncompressed size */
+	put_long(crc);
+	put_long(isize);
+	flush_outbuf();
+	return OK;
+}
+
+#endif /* CONFIG_FEATURE_GZIP_PARALLEL */
@@ -0,0 +1,43 @@
+/* vi:set ts=4:*/
+/*
+ * Licensed under GPLv2, see file LICENSE in this tarball for details.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "unarchive.h"
+#include "libbb.h"
+
+/* One gunzip window's worth */
+#define COPY_BUFSIZE 0x8000
+
+/* bb_copyfd_size() for archive data: copy size bytes to dst_fd, or just
+ * discard them if dst_fd is -1.  Returns the number of bytes copied. */
+off_t archive_copy_data(const archive_handle_t *archive_handle, int dst_fd, off_t size)
+{
+	off_t total = 0;
+	char *buffer;
+
+	if (!archive_handle->src_stream) {
+		return bb_copyfd_size(archive_handle->src_fd, dst_fd, size);
+	}
+
+	buffer = xmalloc(COPY_BUFSIZE);
+	while (total < size) {
+		ssize_t n = archive_read(archive_handle, buffer,
+				(size - total > COPY_BUFSIZE) ? COPY_BUFSIZE : size - total);
+
+		if (n <= 0) {
+			break;
+		}
+		if (dst_fd >= 0 && bb_full_write(dst_fd, buffer, n) != n) {
+			bb_perror_msg(bb_msg_write_error);
+			break;
+		}
+		total += n;
+	}
+	free(buffer);
+
+	return total;
+}
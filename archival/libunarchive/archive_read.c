@@ -0,0 +1,31 @@
+/* vi:set ts=4:*/
+/*
+ * Licensed under GPLv2, see file LICENSE in this tarball for details.
+ */
+
+#include <stdlib.h>
+
+#include "unarchive.h"
+#include "libbb.h"
+
+/* Read count bytes of archive data, stopping short only at end of file.
+ * Goes through the decompressor if the archive is compressed. */
+ssize_t archive_read(const archive_handle_t *archive_handle, void *buf, size_t count)
+{
+	unpack_stream_t *stream = archive_handle->src_stream;
+	size_t total = 0;
+
+	if (!stream) {
+		return bb_full_read(archive_handle->src_fd, buf, count);
+	}
+
+	while (total < count) {
+		ssize_t n = stream->read(stream, (char *)buf + total, count - total);
+
+		if (n <= 0) {
+			break;
+		}
+		total += n;
+	}
+	return total;
+}
@@ -24,7 +24,7 @@ void archive_xread_all(const archive_handle_t *archive_handle, void *buf, const
 {
 	ssize_t size;
 
-	size = bb_full_read(archive_handle->src_fd, buf, count);
+	size = archive_read(archive_handle, buf, count);
 	if (size != count) {
 		bb_error_msg_and_die("Short read");
 	}
@@ -80,7 +80,7 @@ void data_extract_all(archive_handle_t *archive_handle)
 			case S_IFREG: {
 				/* Regular file */
 				dst_fd = bb_xopen(file_header->name, O_WRONLY | O_CREAT | O_EXCL);
-				bb_copyfd_size(archive_handle->src_fd, dst_fd, file_header->size);
+				archive_copy_data(archive_handle, dst_fd, file_header->size);
 				close(dst_fd);
 				break;
 				}
@@ -19,5 +19,5 @@
 
 void data_extract_to_stdout(archive_handle_t *archive_handle)
 {
-	bb_copyfd_size(archive_handle->src_fd, STDOUT_FILENO, archive_handle->file_header->size);
+	archive_copy_data(archive_handle, STDOUT_FILENO, archive_handle->file_header->size);
 }
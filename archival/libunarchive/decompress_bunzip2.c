@@ -84,7 +84,6 @@ typedef struct {
 	/* The CRC values stored in the block header and calculated from the data */
 
 	uint32_t headerCRC, totalCRC, writeCRC;
-	uint32_t *crc32Table;
 	/* Intermediate buffer and its size (in bytes) */
 
 	unsigned int *dbuf, dbufSize;
@@ -521,12 +520,12 @@ end_of_huffman_loop:
 static int read_bunzip(bunzip_data *bd, char *outbuf, int len)
 {
 	const unsigned int *dbuf;
-	int pos,current,previous,gotcount;
+	int pos,current,previous,gotcount,crcstart;
 
 	/* If last read was short due to end of file, return last block now */
 	if(bd->writeCount<0) return bd->writeCount;
 
-	gotcount = 0;
+	gotcount = crcstart = 0;
 	dbuf=bd->dbuf;
 	pos=bd->writePos;
 	current=bd->writeCurrent;
@@ -551,14 +550,15 @@ static int read_bunzip(bunzip_data *bd, char *outbuf, int len)
 				bd->writePos=pos;
 				bd->writeCurrent=current;
 				bd->writeCopies++;
+				bd->writeCRC=bb_crc32_block(bd->writeCRC, outbuf+crcstart,
+											len-crcstart, 1);
 				return len;
 			}
 
-			/* Write next byte into output buffer, updating CRC */
+			/* Write next byte into output buffer (the CRC is run over
+			   everything written so far whenever we stop) */
 
 			outbuf[gotcount++] = current;
-			bd->writeCRC=(((bd->writeCRC)<<8)
-						  ^bd->crc32Table[((bd->writeCRC)>>24)^current]);
 
 			/* Loop now if we're outputting multiple copies of this byte */
 
@@ -600,6 +600,8 @@ decode_next_byte:
 
 		/* Decompression of this block completed successfully */
 
+		bd->writeCRC=bb_crc32_block(bd->writeCRC, outbuf+crcstart,
+									gotcount-crcstart, 1);
 		bd->writeCRC=~bd->writeCRC;
 		bd->totalCRC=((bd->totalCRC<<1) | (bd->totalCRC>>31)) ^ bd->writeCRC;
 
@@ -620,6 +622,7 @@ decode_next_byte:
 		return (previous!=RETVAL_LAST_BLOCK) ? previous : gotcount;
 	}
 	bd->writeCRC=~0;
+	crcstart=gotcount;
 	pos=bd->writePos;
 	current=bd->writeCurrent;
 	goto decode_next_byte;
@@ -653,10 +656,6 @@ static int start_bunzip(bunzip_data **bdp, int in_fd, unsigned char *inbuf,
 		bd->inbufCount=len;
 	} else bd->inbuf=(unsigned char *)(bd+1);
 
-	/* Init the CRC32 table (big endian) */
-
-	bd->crc32Table = bb_crc32_filltable(1);
-
 	/* Setup for I/O error handling via longjmp */
 
 	i=setjmp(bd->jmpbuf);
@@ -716,6 +715,52 @@ int uncompressStream(int src_fd, int dst_fd)
 	return i;
 }
 
+/* Pull interface for archive_handle_t, see unpack_stream_t */
+
+static ssize_t bunzip2_stream_read(unpack_stream_t *stream, void *buf, size_t count)
+{
+	bunzip_data *bd = stream->state;
+	int i;
+
+	if (count > INT_MAX) count = INT_MAX;
+	/* A short last block comes back as 0, the end of data after that */
+	while ((i = read_bunzip(bd, buf, count)) == 0);
+	if (i > 0) return i;
+
+	if (i == RETVAL_LAST_BLOCK) {
+		if (bd->headerCRC == bd->totalCRC) return 0;
+		bb_error_msg_and_die("Data integrity error when decompressing.");
+	}
+	if (i == RETVAL_UNEXPECTED_INPUT_EOF)
+		bb_error_msg_and_die("Compressed file ends unexpectedly");
+	bb_error_msg_and_die("Decompression failed");
+}
+
+static void bunzip2_stream_close(unpack_stream_t *stream)
+{
+	bunzip_data *bd = stream->state;
+
+	free(bd->dbuf);
+	free(bd);
+	free(stream);
+}
+
+unpack_stream_t *open_bunzip2_stream(int src_fd)
+{
+	unpack_stream_t *stream = xzalloc(sizeof(unpack_stream_t));
+	bunzip_data *bd;
+
+	if (start_bunzip(&bd, src_fd, 0, 0))
+		bb_error_msg_and_die("Decompression failed");
+
+	stream->read = bunzip2_stream_read;
+	stream->close = bunzip2_stream_close;
+	stream->src_fd = src_fd;
+	stream->state = bd;
+
+	return stream;
+}
+
 #ifdef TESTING
 
 static char * const bunzip_errors[]={NULL,"Bad file checksum","Not bzip data",
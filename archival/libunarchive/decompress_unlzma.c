@@ -66,13 +66,6 @@ static void rc_init(rc_t * rc, int fd, int buffer_size)
 	}
 }
 
-/* Called once. TODO: bb_maybe_free() */
-static ATTRIBUTE_ALWAYS_INLINE void rc_free(rc_t * rc)
-{
-	if (ENABLE_FEATURE_CLEAN_UP)
-		free(rc->buffer);
-}
-
 /* Called twice, but one callsite is in speed_inline'd rc_is_bit_0_helper() */
 static void rc_do_normalize(rc_t * rc)
 {
@@ -212,63 +205,132 @@ typedef struct {
 #define LZMA_LITERAL (LZMA_REP_LEN_CODER + LZMA_NUM_LEN_PROBS)
 
 
-int unlzma(int src_fd, int dst_fd)
-{
+/* Everything needed to pick decoding up again where it stopped */
+typedef struct {
 	lzma_header_t header;
-	int lc, pb, lp;
+	int lc;
 	uint32_t pos_state_mask;
 	uint32_t literal_pos_mask;
-	uint32_t pos;
 	uint16_t *p;
-	uint16_t *prob;
-	uint16_t *prob_lit;
-	int num_bits;
-	int num_probs;
 	rc_t rc;
-	int i, mi;
 	uint8_t *buffer;
-	uint8_t previous_byte = 0;
-	size_t buffer_pos = 0, global_pos = 0;
-	int len = 0;
-	int state = 0;
-	uint32_t rep0 = 1, rep1 = 1, rep2 = 1, rep3 = 1;
+	uint8_t previous_byte;
+	size_t buffer_pos, global_pos;
+	/* Start of the data in buffer not yet passed on to the caller */
+	size_t out_pos;
+	/* Bytes of the current match still to copy */
+	int len;
+	int state;
+	uint32_t rep0, rep1, rep2, rep3;
+	/* Nonzero while unlzma_decode() may produce more data */
+	int more;
+} unlzma_t;
+
+static unlzma_t *unlzma_start(int src_fd)
+{
+	unlzma_t *s = xzalloc(sizeof(unlzma_t));
+	int lp, pb, mi, i;
+	int num_probs;
 
-	if (read(src_fd, &header, sizeof(header)) != sizeof(header))
+	if (read(src_fd, &s->header, sizeof(s->header)) != sizeof(s->header))
 		bb_error_msg_and_die("can't read header");
 
-	if (header.pos >= (9 * 5 * 5))
+	if (s->header.pos >= (9 * 5 * 5))
 		bb_error_msg_and_die("bad header");
-	mi = header.pos / 9;
-	lc = header.pos % 9;
+	mi = s->header.pos / 9;
+	s->lc = s->header.pos % 9;
 	pb = mi / 5;
 	lp = mi % 5;
-	pos_state_mask = (1 << pb) - 1;
-	literal_pos_mask = (1 << lp) - 1;
+	s->pos_state_mask = (1 << pb) - 1;
+	s->literal_pos_mask = (1 << lp) - 1;
 
-	header.dict_size = SWAP_LE32(header.dict_size);
-	header.dst_size = SWAP_LE64(header.dst_size);
+	s->header.dict_size = SWAP_LE32(s->header.dict_size);
+	s->header.dst_size = SWAP_LE64(s->header.dst_size);
 
-	if (header.dict_size == 0)
-		header.dict_size = 1;
+	if (s->header.dict_size == 0)
+		s->header.dict_size = 1;
 
-	buffer = xmalloc(MIN(header.dst_size, header.dict_size));
+	s->buffer = xmalloc(MIN(s->header.dst_size, s->header.dict_size));
 
-	num_probs = LZMA_BASE_SIZE + (LZMA_LIT_SIZE << (lc + lp));
-	p = xmalloc(num_probs * sizeof(*p));
-	num_probs = LZMA_LITERAL + (LZMA_LIT_SIZE << (lc + lp));
+	num_probs = LZMA_BASE_SIZE + (LZMA_LIT_SIZE << (s->lc + lp));
+	s->p = xmalloc(num_probs * sizeof(*s->p));
+	num_probs = LZMA_LITERAL + (LZMA_LIT_SIZE << (s->lc + lp));
 	for (i = 0; i < num_probs; i++)
-		p[i] = (1 << RC_MODEL_TOTAL_BITS) >> 1;
+		s->p[i] = (1 << RC_MODEL_TOTAL_BITS) >> 1;
 
-	rc_init(&rc, src_fd, 0x10000);
+	rc_init(&s->rc, src_fd, 0x10000);
 
-	while (global_pos + buffer_pos < header.dst_size) {
-		int pos_state = (buffer_pos + global_pos) & pos_state_mask;
+	s->rep0 = s->rep1 = s->rep2 = s->rep3 = 1;
+	s->more = 1;
+	return s;
+}
+
+static void unlzma_free(unlzma_t *s)
+{
+	free(s->rc.buffer);
+	free(s->p);
+	free(s->buffer);
+	free(s);
+}
+
+/* Decode until the dictionary buffer is full or the data ends.  The new
+ * data is buffer[out_pos..buffer_pos), and must all be consumed before the
+ * next call, which recycles the buffer.  Clears s->more at the end. */
+static void unlzma_decode(unlzma_t *s)
+{
+	const uint32_t dict_size = s->header.dict_size;
+	const uint64_t dst_size = s->header.dst_size;
+	const int lc = s->lc;
+	const uint32_t pos_state_mask = s->pos_state_mask;
+	const uint32_t literal_pos_mask = s->literal_pos_mask;
+	uint16_t *const p = s->p;
+	uint8_t *const buffer = s->buffer;
+	rc_t *const rc = &s->rc;
+	uint32_t pos;
+	uint16_t *prob;
+	uint16_t *prob_lit;
+	int num_bits;
+	int i, mi;
+	uint8_t previous_byte = s->previous_byte;
+	size_t buffer_pos = s->buffer_pos, global_pos = s->global_pos;
+	int len = s->len;
+	int state = s->state;
+	uint32_t rep0 = s->rep0, rep1 = s->rep1, rep2 = s->rep2, rep3 = s->rep3;
+
+	if (buffer_pos == dict_size) {
+		buffer_pos = 0;
+		global_pos += dict_size;
+	}
+	s->out_pos = buffer_pos;
+
+	for (;;) {
+		int pos_state;
+
+		/* Copy out the current match, or what fits of it */
+		while (len != 0 && buffer_pos != dict_size
+				&& global_pos + buffer_pos < dst_size) {
+			pos = buffer_pos - rep0;
+			while (pos >= dict_size)
+				pos += dict_size;
+			previous_byte = buffer[pos];
+			buffer[buffer_pos++] = previous_byte;
+			len--;
+		}
+
+		if (global_pos + buffer_pos >= dst_size) {
+			s->more = 0;
+			break;
+		}
+		if (buffer_pos == dict_size)
+			break;
+
+		pos_state = (buffer_pos + global_pos) & pos_state_mask;
 
 		prob =
 			p + LZMA_IS_MATCH + (state << LZMA_NUM_POS_BITS_MAX) + pos_state;
-		if (rc_is_bit_0(&rc, prob)) {
+		if (rc_is_bit_0(rc, prob)) {
 			mi = 1;
-			rc_update_bit_0(&rc, prob);
+			rc_update_bit_0(rc, prob);
 			prob = (p + LZMA_LITERAL + (LZMA_LIT_SIZE
 					* ((((buffer_pos + global_pos) & literal_pos_mask) << lc)
 					+ (previous_byte >> (8 - lc)))));
@@ -277,8 +339,8 @@ int unlzma(int src_fd, int dst_fd)
 				int match_byte;
 
 				pos = buffer_pos - rep0;
-				while (pos >= header.dict_size)
-					pos += header.dict_size;
+				while (pos >= dict_size)
+					pos += dict_size;
 				match_byte = buffer[pos];
 				do {
 					int bit;
@@ -286,7 +348,7 @@ int unlzma(int src_fd, int dst_fd)
 					match_byte <<= 1;
 					bit = match_byte & 0x100;
 					prob_lit = prob + 0x100 + bit + mi;
-					if (rc_get_bit(&rc, prob_lit, &mi)) {
+					if (rc_get_bit(rc, prob_lit, &mi)) {
 						if (!bit)
 							break;
 					} else {
@@ -297,16 +359,11 @@ int unlzma(int src_fd, int dst_fd)
 			}
 			while (mi < 0x100) {
 				prob_lit = prob + mi;
-				rc_get_bit(&rc, prob_lit, &mi);
+				rc_get_bit(rc, prob_lit, &mi);
 			}
 			previous_byte = (uint8_t) mi;
 
 			buffer[buffer_pos++] = previous_byte;
-			if (buffer_pos == header.dict_size) {
-				buffer_pos = 0;
-				global_pos += header.dict_size;
-				write(dst_fd, buffer, header.dict_size);
-			}
 			if (state < 4)
 				state = 0;
 			else if (state < 10)
@@ -317,56 +374,51 @@ int unlzma(int src_fd, int dst_fd)
 			int offset;
 			uint16_t *prob_len;
 
-			rc_update_bit_1(&rc, prob);
+			rc_update_bit_1(rc, prob);
 			prob = p + LZMA_IS_REP + state;
-			if (rc_is_bit_0(&rc, prob)) {
-				rc_update_bit_0(&rc, prob);
+			if (rc_is_bit_0(rc, prob)) {
+				rc_update_bit_0(rc, prob);
 				rep3 = rep2;
 				rep2 = rep1;
 				rep1 = rep0;
 				state = state < LZMA_NUM_LIT_STATES ? 0 : 3;
 				prob = p + LZMA_LEN_CODER;
 			} else {
-				rc_update_bit_1(&rc, prob);
+				rc_update_bit_1(rc, prob);
 				prob = p + LZMA_IS_REP_G0 + state;
-				if (rc_is_bit_0(&rc, prob)) {
-					rc_update_bit_0(&rc, prob);
+				if (rc_is_bit_0(rc, prob)) {
+					rc_update_bit_0(rc, prob);
 					prob = (p + LZMA_IS_REP_0_LONG
 							+ (state << LZMA_NUM_POS_BITS_MAX) + pos_state);
-					if (rc_is_bit_0(&rc, prob)) {
-						rc_update_bit_0(&rc, prob);
+					if (rc_is_bit_0(rc, prob)) {
+						rc_update_bit_0(rc, prob);
 
 						state = state < LZMA_NUM_LIT_STATES ? 9 : 11;
 						pos = buffer_pos - rep0;
-						while (pos >= header.dict_size)
-							pos += header.dict_size;
+						while (pos >= dict_size)
+							pos += dict_size;
 						previous_byte = buffer[pos];
 						buffer[buffer_pos++] = previous_byte;
-						if (buffer_pos == header.dict_size) {
-							buffer_pos = 0;
-							global_pos += header.dict_size;
-							write(dst_fd, buffer, header.dict_size);
-						}
 						continue;
 					} else {
-						rc_update_bit_1(&rc, prob);
+						rc_update_bit_1(rc, prob);
 					}
 				} else {
 					uint32_t distance;
 
-					rc_update_bit_1(&rc, prob);
+					rc_update_bit_1(rc, prob);
 					prob = p + LZMA_IS_REP_G1 + state;
-					if (rc_is_bit_0(&rc, prob)) {
-						rc_update_bit_0(&rc, prob);
+					if (rc_is_bit_0(rc, prob)) {
+						rc_update_bit_0(rc, prob);
 						distance = rep1;
 					} else {
-						rc_update_bit_1(&rc, prob);
+						rc_update_bit_1(rc, prob);
 						prob = p + LZMA_IS_REP_G2 + state;
-						if (rc_is_bit_0(&rc, prob)) {
-							rc_update_bit_0(&rc, prob);
+						if (rc_is_bit_0(rc, prob)) {
+							rc_update_bit_0(rc, prob);
 							distance = rep2;
 						} else {
-							rc_update_bit_1(&rc, prob);
+							rc_update_bit_1(rc, prob);
 							distance = rep3;
 							rep3 = rep2;
 						}
@@ -380,30 +432,30 @@ int unlzma(int src_fd, int dst_fd)
 			}
 
 			prob_len = prob + LZMA_LEN_CHOICE;
-			if (rc_is_bit_0(&rc, prob_len)) {
-				rc_update_bit_0(&rc, prob_len);
+			if (rc_is_bit_0(rc, prob_len)) {
+				rc_update_bit_0(rc, prob_len);
 				prob_len = (prob + LZMA_LEN_LOW
 							+ (pos_state << LZMA_LEN_NUM_LOW_BITS));
 				offset = 0;
 				num_bits = LZMA_LEN_NUM_LOW_BITS;
 			} else {
-				rc_update_bit_1(&rc, prob_len);
+				rc_update_bit_1(rc, prob_len);
 				prob_len = prob + LZMA_LEN_CHOICE_2;
-				if (rc_is_bit_0(&rc, prob_len)) {
-					rc_update_bit_0(&rc, prob_len);
+				if (rc_is_bit_0(rc, prob_len)) {
+					rc_update_bit_0(rc, prob_len);
 					prob_len = (prob + LZMA_LEN_MID
 								+ (pos_state << LZMA_LEN_NUM_MID_BITS));
 					offset = 1 << LZMA_LEN_NUM_LOW_BITS;
 					num_bits = LZMA_LEN_NUM_MID_BITS;
 				} else {
-					rc_update_bit_1(&rc, prob_len);
+					rc_update_bit_1(rc, prob_len);
 					prob_len = prob + LZMA_LEN_HIGH;
 					offset = ((1 << LZMA_LEN_NUM_LOW_BITS)
 							  + (1 << LZMA_LEN_NUM_MID_BITS));
 					num_bits = LZMA_LEN_NUM_HIGH_BITS;
 				}
 			}
-			rc_bit_tree_decode(&rc, prob_len, num_bits, &len);
+			rc_bit_tree_decode(rc, prob_len, num_bits, &len);
 			len += offset;
 
 			if (state < 4) {
@@ -416,7 +468,7 @@ int unlzma(int src_fd, int dst_fd)
 					  LZMA_NUM_LEN_TO_POS_STATES ? len :
 					  LZMA_NUM_LEN_TO_POS_STATES - 1)
 					 << LZMA_NUM_POS_SLOT_BITS);
-				rc_bit_tree_decode(&rc, prob, LZMA_NUM_POS_SLOT_BITS,
+				rc_bit_tree_decode(rc, prob, LZMA_NUM_POS_SLOT_BITS,
 								   &pos_slot);
 				if (pos_slot >= LZMA_START_POS_MODEL_INDEX) {
 					num_bits = (pos_slot >> 1) - 1;
@@ -427,7 +479,7 @@ int unlzma(int src_fd, int dst_fd)
 					} else {
 						num_bits -= LZMA_NUM_ALIGN_BITS;
 						while (num_bits--)
-							rep0 = (rep0 << 1) | rc_direct_bit(&rc);
+							rep0 = (rep0 << 1) | rc_direct_bit(rc);
 						prob = p + LZMA_ALIGN;
 						rep0 <<= LZMA_NUM_ALIGN_BITS;
 						num_bits = LZMA_NUM_ALIGN_BITS;
@@ -435,37 +487,82 @@ int unlzma(int src_fd, int dst_fd)
 					i = 1;
 					mi = 1;
 					while (num_bits--) {
-						if (rc_get_bit(&rc, prob + mi, &mi))
+						if (rc_get_bit(rc, prob + mi, &mi))
 							rep0 |= i;
 						i <<= 1;
 					}
 				} else
 					rep0 = pos_slot;
-				if (++rep0 == 0)
+				if (++rep0 == 0) {
+					/* End of stream marker */
+					len = 0;
+					s->more = 0;
 					break;
+				}
 			}
 
+			/* Copied at the top of the loop */
 			len += LZMA_MATCH_MIN_LEN;
-
-			do {
-				pos = buffer_pos - rep0;
-				while (pos >= header.dict_size)
-					pos += header.dict_size;
-				previous_byte = buffer[pos];
-				buffer[buffer_pos++] = previous_byte;
-				if (buffer_pos == header.dict_size) {
-					buffer_pos = 0;
-					global_pos += header.dict_size;
-					write(dst_fd, buffer, header.dict_size);
-				}
-				len--;
-			} while (len != 0 && buffer_pos < header.dst_size);
 		}
 	}
 
-	write(dst_fd, buffer, buffer_pos);
-	rc_free(&rc);
+	s->previous_byte = previous_byte;
+	s->buffer_pos = buffer_pos;
+	s->global_pos = global_pos;
+	s->len = len;
+	s->state = state;
+	s->rep0 = rep0;
+	s->rep1 = rep1;
+	s->rep2 = rep2;
+	s->rep3 = rep3;
+}
+
+int unlzma(int src_fd, int dst_fd)
+{
+	unlzma_t *s = unlzma_start(src_fd);
+
+	while (s->more) {
+		unlzma_decode(s);
+		write(dst_fd, s->buffer + s->out_pos, s->buffer_pos - s->out_pos);
+	}
+	unlzma_free(s);
 	return 0;
 }
 
+/* Pull interface for archive_handle_t, see unpack_stream_t */
+
+static ssize_t unlzma_stream_read(unpack_stream_t *stream, void *buf, size_t count)
+{
+	unlzma_t *s = stream->state;
+
+	while (s->out_pos == s->buffer_pos) {
+		if (!s->more)
+			return 0;
+		unlzma_decode(s);
+	}
+	if (count > s->buffer_pos - s->out_pos)
+		count = s->buffer_pos - s->out_pos;
+	memcpy(buf, s->buffer + s->out_pos, count);
+	s->out_pos += count;
+	return count;
+}
+
+static void unlzma_stream_close(unpack_stream_t *stream)
+{
+	unlzma_free(stream->state);
+	free(stream);
+}
+
+unpack_stream_t *open_unlzma_stream(int src_fd)
+{
+	unpack_stream_t *stream = xzalloc(sizeof(unpack_stream_t));
+
+	stream->read = unlzma_stream_read;
+	stream->close = unlzma_stream_close;
+	stream->src_fd = src_fd;
+	stream->state = unlzma_start(src_fd);
+
+	return stream;
+}
+
 /* vi:set ts=4: */
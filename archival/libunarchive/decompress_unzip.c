@@ -34,62 +34,92 @@
  */
 
 #include "libbb.h"
-#include <sys/wait.h>
-#include <signal.h>
 #include "unarchive.h"
 
-typedef struct huft_s {
-	unsigned char e;	/* number of extra bits or operation */
-	unsigned char b;	/* number of bits in this code or subcode */
-	union {
-		unsigned short n;	/* literal, length base, or distance base */
-		struct huft_s *t;	/* pointer to next level of table */
-	} v;
-} huft_t;
-
-static int gunzip_src_fd;
-unsigned int gunzip_bytes_out;	/* number of output bytes */
-static unsigned int gunzip_outbuf_count;	/* bytes in output buffer */
-
-/* gunzip_window size--must be a power of two, and
- *  at least 32K for zip's deflate method */
-enum { gunzip_wsize = 0x8000 };
-static unsigned char *gunzip_window;
-
-static uint32_t *gunzip_crc_table;
-uint32_t gunzip_crc;
-
-/* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
-#define BMAX 16	/* maximum bit length of any code (16 for explode) */
-#define N_MAX 288	/* maximum number of codes in any set */
-
-/* bitbuffer */
-static unsigned int gunzip_bb;	/* bit buffer */
-static unsigned char gunzip_bk;	/* bits in bit buffer */
-
-/* These control the size of the bytebuffer */
-static unsigned int bytebuffer_max = 0x8000;
-static unsigned char *bytebuffer = NULL;
-static unsigned int bytebuffer_offset = 0;
-static unsigned int bytebuffer_size = 0;
-
-static const unsigned short mask_bits[] = {
-	0x0000, 0x0001, 0x0003, 0x0007, 0x000f, 0x001f, 0x003f, 0x007f, 0x00ff,
-	0x01ff, 0x03ff, 0x07ff, 0x0fff, 0x1fff, 0x3fff, 0x7fff, 0xffff
+/* Decoding tables.  Each table is a main table indexed by the next
+ * TABLEBITS bits of input, followed in the same array by subtables for
+ * the few codes that are longer than that.  Every entry says how many bits
+ * its code takes, so no walking of linked tables is needed.
+ *
+ * op is one of:
+ *   0x00-0x0f  length or distance base in val, with op extra bits
+ *   0x10|n     subtable of 2^n entries starting at val
+ *   0x20       end of block
+ *   0x30       invalid code
+ *   0x40       literal byte in val
+ *   0x80|n     two literals (val & 0xff, then val >> 8), the first one
+ *              n bits long; bits covers both codes
+ */
+typedef struct inflate_code_s {
+	unsigned char op;
+	unsigned char bits;
+	unsigned short val;
+} inflate_code_t;
+
+#define OP_SUB		0x10
+#define OP_EOB		0x20
+#define OP_BAD		0x30
+#define OP_LITERAL	0x40
+#define OP_PAIR		0x80
+
+#define LITLEN_TABLEBITS	11
+#define DIST_TABLEBITS		8
+#define CODELEN_TABLEBITS	7
+/* Largest possible main table plus subtables, from zlib's "enough" */
+#define LITLEN_ENOUGH		2342
+#define DIST_ENOUGH			402
+
+/* Kinds of code, to tell inflate_build() what a symbol stands for */
+enum { CODE_CODELEN, CODE_LITLEN, CODE_DIST };
+
+/* The window holds the last 32K of output, which matches may refer to,
+ * and after it room for new output.  When that room is used up and has
+ * been handed out, the last 32K is slid back down to the start.  Slack
+ * past the end lets a symbol be decoded whenever out is below the limit,
+ * and lets matches be copied a word at a time. */
+#define WSIZE		0x8000
+#define OUTSIZE		(3 * WSIZE)
+#define WINDOW_SLACK	(258 + 16)
+#define INBUF_SIZE	0x10000
+
+/* MODE_CHECKED: done, and the gzip trailer has been checked too */
+enum { MODE_HEADER, MODE_STORED, MODE_CODES, MODE_DONE, MODE_CHECKED };
+
+struct inflate_state_s {
+	int src_fd;
+	off_t src_left;		/* bytes we may still read, < 0 if no limit */
+
+	unsigned char *in_buf;
+	const unsigned char *in_next, *in_end;
+	uint64_t bitbuf;	/* bits are taken from the bottom */
+	unsigned bitcnt;	/* valid bits in bitbuf, the rest may be junk */
+
+	unsigned char *window;
+	unsigned char *out;		/* decode output goes here */
+	unsigned char *flushed;	/* output before this has been handed out */
+
+	int mode;
+	int last;			/* this is the final block */
+	unsigned stored_left;
+
+	uint32_t crc;
+	off_t bytes_out;
+
+	inflate_code_t litlen[LITLEN_ENOUGH];
+	inflate_code_t dist[DIST_ENOUGH];
 };
 
 /* Copy lengths for literal codes 257..285 */
 static const unsigned short cplens[] = {
 	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
-	67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0
+	67, 83, 99, 115, 131, 163, 195, 227, 258
 };
 
-/* note: see note #13 above about the 258 in this list. */
 /* Extra bits for literal codes 257..285 */
 static const unsigned char cplext[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5,
-	5, 5, 5, 0, 99, 99
-};						/* 99==invalid */
+	5, 5, 5, 0
+};
 
 /* Copy offsets for distance codes 0..29 */
 static const unsigned short cpdist[] = {
@@ -109,814 +139,717 @@ static const unsigned char border[] = {
 	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
 };
 
-static unsigned int fill_bitbuffer(unsigned int bitbuffer, unsigned int *current, const unsigned int required)
+static inflate_code_t inflate_sym(int kind, unsigned sym)
 {
-	while (*current < required) {
-		if (bytebuffer_offset >= bytebuffer_size) {
-			/* Leave the first 4 bytes empty so we can always unwind the bitbuffer
-			 * to the front of the bytebuffer, leave 4 bytes free at end of tail
-			 * so we can easily top up buffer in check_trailer_gzip() */
-			if (!(bytebuffer_size = bb_xread(gunzip_src_fd, &bytebuffer[4], bytebuffer_max - 8))) {
-				bb_error_msg_and_die("unexpected end of file");
-			}
-			bytebuffer_size += 4;
-			bytebuffer_offset = 4;
+	inflate_code_t c;
+
+	c.bits = 0;
+	c.val = 0;
+	if (kind == CODE_CODELEN) {
+		c.op = OP_LITERAL;
+		c.val = sym;
+	} else if (kind == CODE_LITLEN) {
+		if (sym < 256) {
+			c.op = OP_LITERAL;
+			c.val = sym;
+		} else if (sym == 256) {
+			c.op = OP_EOB;
+		} else if (sym < 286) {
+			c.op = cplext[sym - 257];
+			c.val = cplens[sym - 257];
+		} else {
+			c.op = OP_BAD;
+		}
+	} else {
+		if (sym < 30) {
+			c.op = cpdext[sym];
+			c.val = cpdist[sym];
+		} else {
+			c.op = OP_BAD;
 		}
-		bitbuffer |= ((unsigned int) bytebuffer[bytebuffer_offset]) << *current;
-		bytebuffer_offset++;
-		*current += 8;
-	}
-	return(bitbuffer);
-}
-
-/*
- * Free the malloc'ed tables built by huft_build(), which makes a linked
- * list of the tables it made, with the links in a dummy first entry of
- * each table.
- * t: table to free
- */
-static int huft_free(huft_t * t)
-{
-	huft_t *p;
-	huft_t *q;
-
-	/* Go through linked list, freeing from the malloced (t[-1]) address. */
-	p = t;
-	while (p != (huft_t *) NULL) {
-		q = (--p)->v.t;
-		free((char *) p);
-		p = q;
 	}
-	return 0;
+	return c;
 }
 
-/* Given a list of code lengths and a maximum table size, make a set of
- * tables to decode that set of codes.  Return zero on success, one if
- * the given code set is incomplete (the tables are still built in this
- * case), two if the input is invalid (all zero length codes or an
- * oversubscribed set of lengths), and three if not enough memory.
- *
- * b:	code lengths in bits (all assumed <= BMAX)
- * n:	number of codes (assumed <= N_MAX)
- * s:	number of simple-valued codes (0..s-1)
- * d:	list of base values for non-simple codes
- * e:	list of extra bits for non-simple codes
- * t:	result: starting table
- * m:	maximum lookup bits, returns actual
- */
-static
-int huft_build(unsigned int *b, const unsigned int n,
-			   const unsigned int s, const unsigned short *d,
-			   const unsigned char *e, huft_t ** t, unsigned int *m)
+/* Build a decoding table for the code lengths lens[0..num-1] (all <= 15).
+ * Returns nonzero if the lengths don't describe a usable code.  An
+ * incomplete code is only accepted if it has a single one bit code. */
+static int inflate_build(inflate_code_t *table, unsigned root,
+		const unsigned char *lens, unsigned num, int kind, unsigned enough)
 {
-	unsigned a;				/* counter for codes of length k */
-	unsigned c[BMAX + 1];	/* bit length count table */
-	unsigned eob_len;		/* length of end-of-block code (value 256) */
-	unsigned f;				/* i repeats in table every f entries */
-	int g;					/* maximum code length */
-	int htl;				/* table level */
-	unsigned i;				/* counter, current code */
-	unsigned j;				/* counter */
-	int k;					/* number of bits in current code */
-	unsigned *p;			/* pointer into c[], b[], or v[] */
-	huft_t *q;				/* points to current table */
-	huft_t r;				/* table entry for structure assignment */
-	huft_t *u[BMAX];		/* table stack */
-	unsigned v[N_MAX];		/* values in order of bit length */
-	int ws[BMAX+1];			/* bits decoded stack */
-	int w;					/* bits decoded */
-	unsigned x[BMAX + 1];	/* bit offsets, then code stack */
-	unsigned *xp;			/* pointer into x */
-	int y;					/* number of dummy codes added */
-	unsigned z;				/* number of entries in current table */
-
-	/* Length of EOB code, if any */
-	eob_len = n > 256 ? b[256] : BMAX;
-
-	/* Generate counts for each bit length */
-	memset((void *)c, 0, sizeof(c));
-	p = b;
-	i = n;
-	do {
-		c[*p]++; /* assume all entries <= BMAX */
-		p++; /* Can't combine with above line (Solaris bug) */
-	} while (--i);
-	if (c[0] == n) { /* null input--all zero length codes */
-		*t = (huft_t *) NULL;
-		*m = 0;
-		return 2;
-	}
-
-	/* Find minimum and maximum length, bound *m by those */
-	for (j = 1; (c[j] == 0) && (j <= BMAX); j++);
-	k = j; /* minimum code length */
-	for (i = BMAX; (c[i] == 0) && i; i--);
-	g = i; /* maximum code length */
-	*m = (*m < j) ? j : ((*m > i) ? i : *m);
-
-	/* Adjust last length count to fill out codes, if needed */
-	for (y = 1 << j; j < i; j++, y <<= 1) {
-		if ((y -= c[j]) < 0) {
-			return 2; /* bad input: more codes than bits */
-		}
-	}
-	if ((y -= c[i]) < 0) {
-		return 2;
-	}
-	c[i] += y;
-
-	/* Generate starting offsets into the value table for each length */
-	x[1] = j = 0;
-	p = c + 1;
-	xp = x + 2;
-	while (--i) { /* note that i == g from above */
-		*xp++ = (j += *p++);
+	unsigned short count[16], offs[16], sorted[288];
+	unsigned len, sym, max, min, huff, incr, fill, low, mask, curr, drop, used;
+	int left;
+	inflate_code_t here, *next;
+
+	memset(count, 0, sizeof(count));
+	for (sym = 0; sym < num; sym++)
+		count[lens[sym]]++;
+	for (max = 15; max && !count[max]; max--);
+
+	/* Prefill with invalid codes, which also covers an empty code and
+	 * the gaps of an incomplete one */
+	here.op = OP_BAD;
+	here.bits = root;
+	here.val = 0;
+	for (fill = 0; fill < (1U << root); fill++)
+		table[fill] = here;
+	if (max == 0)
+		return 0;
+	for (min = 1; min < max && !count[min]; min++);
+
+	left = 1;
+	for (len = 1; len <= 15; len++) {
+		left <<= 1;
+		left -= count[len];
+		if (left < 0)
+			return 1;	/* over-subscribed */
 	}
-
-	/* Make a table of values in order of bit lengths */
-	p = b;
-	i = 0;
-	do {
-		if ((j = *p++) != 0) {
-			v[x[j]++] = i;
+	if (left > 0 && (kind == CODE_CODELEN || max != 1))
+		return 1;	/* incomplete */
+
+	offs[1] = 0;
+	for (len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + count[len];
+	for (sym = 0; sym < num; sym++)
+		if (lens[sym])
+			sorted[offs[lens[sym]]++] = sym;
+
+	/* Walk the codes in canonical order, bit reversed as they appear in
+	 * the input, replicating each over all the entries it prefixes.  Codes
+	 * longer than root go in subtables sized to fit all codes sharing
+	 * their first root bits.  Subtable entries hold the full code length. */
+	huff = 0;
+	sym = 0;
+	len = min;
+	next = table;
+	curr = root;
+	drop = 0;
+	low = (unsigned)-1;
+	used = 1U << root;
+	mask = used - 1;
+	for (;;) {
+		here = inflate_sym(kind, sorted[sym]);
+		here.bits = len;
+		incr = 1U << (len - drop);
+		fill = 1U << curr;
+		do {
+			fill -= incr;
+			next[(huff >> drop) + fill] = here;
+		} while (fill);
+
+		incr = 1U << (len - 1);
+		while (huff & incr)
+			incr >>= 1;
+		if (incr) {
+			huff &= incr - 1;
+			huff += incr;
+		} else
+			huff = 0;
+
+		sym++;
+		if (--count[len] == 0) {
+			if (len == max)
+				break;
+			len = lens[sorted[sym]];
 		}
-	} while (++i < n);
-
-	/* Generate the Huffman codes and for each, make the table entries */
-	x[0] = i = 0;			/* first Huffman code is zero */
-	p = v;					/* grab values in bit order */
-	htl = -1;				/* no tables yet--level -1 */
-	w = ws[0] = 0;			/* bits decoded */
-	u[0] = (huft_t *) NULL;	/* just to keep compilers happy */
-	q = (huft_t *) NULL;	/* ditto */
-	z = 0;					/* ditto */
-
-	/* go through the bit lengths (k already is bits in shortest code) */
-	for (; k <= g; k++) {
-		a = c[k];
-		while (a--) {
-			/* here i is the Huffman code of length k bits for value *p */
-			/* make tables up to required level */
-			while (k > ws[htl + 1]) {
-				w = ws[++htl];
-
-				/* compute minimum size table less than or equal to *m bits */
-				z = (z = g - w) > *m ? *m : z; /* upper limit on table size */
-				if ((f = 1 << (j = k - w)) > a + 1) { /* try a k-w bit table */
-					/* too few codes for k-w bit table */
-					f -= a + 1; /* deduct codes from patterns left */
-					xp = c + k;
-					while (++j < z) { /* try smaller tables up to z bits */
-						if ((f <<= 1) <= *++xp) {
-							break; /* enough codes to use up j bits */
-						}
-						f -= *xp; /* else deduct codes from patterns */
-					}
-				}
-				j = (w + j > eob_len && w < eob_len) ? eob_len - w : j;	/* make EOB code end at table */
-				z = 1 << j;	/* table entries for j-bit table */
-				ws[htl+1] = w + j;	/* set bits decoded in stack */
-
-				/* allocate and link in new table */
-				q = (huft_t *) xzalloc((z + 1) * sizeof(huft_t));
-				*t = q + 1;	/* link to list for huft_free() */
-				t = &(q->v.t);
-				u[htl] = ++q;	/* table starts after link */
-
-				/* connect to last table, if there is one */
-				if (htl) {
-					x[htl] = i; /* save pattern for backing up */
-					r.b = (unsigned char) (w - ws[htl - 1]); /* bits to dump before this table */
-					r.e = (unsigned char) (16 + j); /* bits in this table */
-					r.v.t = q; /* pointer to this table */
-					j = (i & ((1 << w) - 1)) >> ws[htl - 1];
-					u[htl - 1][j] = r; /* connect to last table */
-				}
-			}
-
-			/* set up table entry in r */
-			r.b = (unsigned char) (k - w);
-			if (p >= v + n) {
-				r.e = 99; /* out of values--invalid code */
-			} else if (*p < s) {
-				r.e = (unsigned char) (*p < 256 ? 16 : 15);	/* 256 is EOB code */
-				r.v.n = (unsigned short) (*p++); /* simple code is just the value */
-			} else {
-				r.e = (unsigned char) e[*p - s]; /* non-simple--look up in lists */
-				r.v.n = d[*p++ - s];
-			}
-
-			/* fill code-like entries with r */
-			f = 1 << (k - w);
-			for (j = i >> w; j < z; j += f) {
-				q[j] = r;
-			}
-
-			/* backwards increment the k-bit code i */
-			for (j = 1 << (k - 1); i & j; j >>= 1) {
-				i ^= j;
-			}
-			i ^= j;
 
-			/* backup over finished tables */
-			while ((i & ((1 << w) - 1)) != x[htl]) {
-				w = ws[--htl];
+		if (len > root && (huff & mask) != low) {
+			if (drop == 0)
+				drop = root;
+			next += 1U << curr;
+			curr = len - drop;
+			left = 1 << curr;
+			while (curr + drop < max) {
+				left -= count[curr + drop];
+				if (left <= 0)
+					break;
+				curr++;
+				left <<= 1;
 			}
+			used += 1U << curr;
+			if (used > enough)
+				return 1;
+			low = huff & mask;
+			table[low].op = OP_SUB | curr;
+			table[low].bits = root;
+			table[low].val = next - table;
 		}
 	}
 
-	/* return actual size of base table */
-	*m = ws[1];
-
-	/* Return true (1) if we were given an incomplete table */
-	return y != 0 && g != 1;
-}
-
-/*
- * inflate (decompress) the codes in a deflated (compressed) block.
- * Return an error code or zero if it all goes ok.
- *
- * tl, td: literal/length and distance decoder tables
- * bl, bd: number of bits decoded by tl[] and td[]
- */
-static int inflate_codes(huft_t * my_tl, huft_t * my_td, const unsigned int my_bl, const unsigned int my_bd, int setup)
-{
-	static unsigned int e;	/* table entry flag/number of extra bits */
-	static unsigned int n, d;	/* length and index for copy */
-	static unsigned int w;	/* current gunzip_window position */
-	static huft_t *t;			/* pointer to table entry */
-	static unsigned int ml, md;	/* masks for bl and bd bits */
-	static unsigned int b;	/* bit buffer */
-	static unsigned int k;			/* number of bits in bit buffer */
-	static huft_t *tl, *td;
-	static unsigned int bl, bd;
-	static int resumeCopy = 0;
-
-	if (setup) { // 1st time we are called, copy in variables
-		tl = my_tl;
-		td = my_td;
-		bl = my_bl;
-		bd = my_bd;
-		/* make local copies of globals */
-		b = gunzip_bb;				/* initialize bit buffer */
-		k = gunzip_bk;
-		w = gunzip_outbuf_count;			/* initialize gunzip_window position */
-
-		/* inflate the coded data */
-		ml = mask_bits[bl];	/* precompute masks for speed */
-		md = mask_bits[bd];
-		return 0; // Don't actually do anything the first time
-	}
-
-	if (resumeCopy) goto do_copy;
-
-	while (1) {			/* do until end of block */
-		b = fill_bitbuffer(b, &k, bl);
-		if ((e = (t = tl + ((unsigned) b & ml))->e) > 16)
-			do {
-				if (e == 99) {
-					bb_error_msg_and_die("inflate_codes error 1");
-				}
-				b >>= t->b;
-				k -= t->b;
-				e -= 16;
-				b = fill_bitbuffer(b, &k, e);
-			} while ((e =
-					  (t = t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
-		b >>= t->b;
-		k -= t->b;
-		if (e == 16) {	/* then it's a literal */
-			gunzip_window[w++] = (unsigned char) t->v.n;
-			if (w == gunzip_wsize) {
-				gunzip_outbuf_count = (w);
-				//flush_gunzip_window();
-				w = 0;
-				return 1; // We have a block to read
-			}
-		} else {		/* it's an EOB or a length */
-
-			/* exit if end of block */
-			if (e == 15) {
-				break;
-			}
-
-			/* get length of block to copy */
-			b = fill_bitbuffer(b, &k, e);
-			n = t->v.n + ((unsigned) b & mask_bits[e]);
-			b >>= e;
-			k -= e;
-
-			/* decode distance of block to copy */
-			b = fill_bitbuffer(b, &k, bd);
-			if ((e = (t = td + ((unsigned) b & md))->e) > 16)
-				do {
-					if (e == 99)
-						bb_error_msg_and_die("inflate_codes error 2");
-					b >>= t->b;
-					k -= t->b;
-					e -= 16;
-					b = fill_bitbuffer(b, &k, e);
-				} while ((e =
-						  (t =
-						   t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
-			b >>= t->b;
-			k -= t->b;
-			b = fill_bitbuffer(b, &k, e);
-			d = w - t->v.n - ((unsigned) b & mask_bits[e]);
-			b >>= e;
-			k -= e;
-
-			/* do the copy */
-do_copy:		do {
-				n -= (e =
-					  (e =
-					   gunzip_wsize - ((d &= gunzip_wsize - 1) > w ? d : w)) > n ? n : e);
-			   /* copy to new buffer to prevent possible overwrite */
-				if (w - d >= e) {	/* (this test assumes unsigned comparison) */
-					memcpy(gunzip_window + w, gunzip_window + d, e);
-					w += e;
-					d += e;
-				} else {
-				   /* do it slow to avoid memcpy() overlap */
-				   /* !NOMEMCPY */
-					do {
-						gunzip_window[w++] = gunzip_window[d++];
-					} while (--e);
-				}
-				if (w == gunzip_wsize) {
-					gunzip_outbuf_count = (w);
-					if (n) resumeCopy = 1;
-					else resumeCopy = 0;
-					//flush_gunzip_window();
-					w = 0;
-					return 1;
-				}
-			} while (n);
-			resumeCopy = 0;
+	/* Merge a literal whose code leaves room for a second literal's code
+	 * in the same lookup into one entry.  Going downwards, the entry for
+	 * the remaining bits (i >> bits) hasn't been merged itself yet. */
+	if (kind == CODE_LITLEN) {
+		for (fill = 1U << root; fill--;) {
+			inflate_code_t first = table[fill], second;
+
+			if (first.op != OP_LITERAL || first.bits >= root)
+				continue;
+			second = table[fill >> first.bits];
+			if (second.op != OP_LITERAL || first.bits + second.bits > root)
+				continue;
+			table[fill].op = OP_PAIR | first.bits;
+			table[fill].bits = first.bits + second.bits;
+			table[fill].val = first.val | (second.val << 8);
 		}
 	}
-
-	/* restore the globals from the locals */
-	gunzip_outbuf_count = w;			/* restore global gunzip_window pointer */
-	gunzip_bb = b;				/* restore global bit buffer */
-	gunzip_bk = k;
-
-	/* normally just after call to inflate_codes, but save code by putting it here */
-	/* free the decoding tables, return */
-	huft_free(tl);
-	huft_free(td);
-
-	/* done */
 	return 0;
 }
 
-static int inflate_stored(int my_n, int my_b_stored, int my_k_stored, int setup)
+/* Read more input behind what's left in the buffer.  The 8 bytes before
+ * in_next are kept, so bytes already taken into bitbuf can be given back
+ * at the end of the stream.  Returns 0 at end of input. */
+static size_t inflate_fill_input(inflate_state_t *s)
 {
-	static unsigned int n, b_stored, k_stored, w;
-	if (setup) {
-		n = my_n;
-		b_stored = my_b_stored;
-		k_stored = my_k_stored;
-		w = gunzip_outbuf_count;		/* initialize gunzip_window position */
-		return 0; // Don't do anything first time
-	}
-
-	/* read and output the compressed data */
-	while (n--) {
-		b_stored = fill_bitbuffer(b_stored, &k_stored, 8);
-		gunzip_window[w++] = (unsigned char) b_stored;
-		if (w == gunzip_wsize) {
-			gunzip_outbuf_count = (w);
-			//flush_gunzip_window();
-			w = 0;
-			b_stored >>= 8;
-			k_stored -= 8;
-			return 1; // We have a block
-		}
-		b_stored >>= 8;
-		k_stored -= 8;
-	}
-
-	/* restore the globals from the locals */
-	gunzip_outbuf_count = w;		/* restore global gunzip_window pointer */
-	gunzip_bb = b_stored;	/* restore global bit buffer */
-	gunzip_bk = k_stored;
-	return 0; // Finished
+	size_t keep = s->in_next - s->in_buf;
+	size_t left = s->in_end - s->in_next;
+	ssize_t n;
+
+	if (keep > 8)
+		keep = 8;
+	memmove(s->in_buf, s->in_next - keep, keep + left);
+	s->in_next = s->in_buf + keep;
+	s->in_end = s->in_next + left;
+
+	n = INBUF_SIZE - (keep + left);
+	if (s->src_left >= 0 && n > s->src_left)
+		n = s->src_left;
+	if (n == 0)
+		return 0;
+	n = bb_xread(s->src_fd, s->in_buf + keep + left, n);
+	s->in_end += n;
+	if (s->src_left >= 0)
+		s->src_left -= n;
+	return n;
 }
 
-/*
- * decompress an inflated block
- * e: last block flag
- *
- * GLOBAL VARIABLES: bb, kk,
- */
- // Return values: -1 = inflate_stored, -2 = inflate_codes
-static int inflate_block(int *e)
+static unsigned inflate_get_byte(inflate_state_t *s)
 {
-	unsigned t;			/* block type */
-	register unsigned int b;	/* bit buffer */
-	unsigned int k;	/* number of bits in bit buffer */
-
-	/* make local bit buffer */
-
-	b = gunzip_bb;
-	k = gunzip_bk;
-
-	/* read in last block bit */
-	b = fill_bitbuffer(b, &k, 1);
-	*e = (int) b & 1;
-	b >>= 1;
-	k -= 1;
-
-	/* read in block type */
-	b = fill_bitbuffer(b, &k, 2);
-	t = (unsigned) b & 3;
-	b >>= 2;
-	k -= 2;
-
-	/* restore the global bit buffer */
-	gunzip_bb = b;
-	gunzip_bk = k;
+	if (s->in_next == s->in_end && !inflate_fill_input(s))
+		bb_error_msg_and_die("unexpected end of file");
+	return *s->in_next++;
+}
 
-	/* inflate that block type */
-	switch (t) {
-	case 0:			/* Inflate stored */
-	{
-		unsigned int n;	/* number of bytes in block */
-		unsigned int b_stored;	/* bit buffer */
-		unsigned int k_stored;	/* number of bits in bit buffer */
-
-		/* make local copies of globals */
-		b_stored = gunzip_bb;	/* initialize bit buffer */
-		k_stored = gunzip_bk;
-
-		/* go to byte boundary */
-		n = k_stored & 7;
-		b_stored >>= n;
-		k_stored -= n;
-
-		/* get the length and its complement */
-		b_stored = fill_bitbuffer(b_stored, &k_stored, 16);
-		n = ((unsigned) b_stored & 0xffff);
-		b_stored >>= 16;
-		k_stored -= 16;
-
-		b_stored = fill_bitbuffer(b_stored, &k_stored, 16);
-		if (n != (unsigned) ((~b_stored) & 0xffff)) {
-			return 1;	/* error in compressed data */
-		}
-		b_stored >>= 16;
-		k_stored -= 16;
+/* Get n (<= 32) more bits, reading just as many bytes as that needs */
+static unsigned inflate_bits(inflate_state_t *s, unsigned n)
+{
+	unsigned v;
 
-		inflate_stored(n, b_stored, k_stored, 1); // Setup inflate_stored
-		return -1;
+	while (s->bitcnt < n) {
+		s->bitbuf &= ((uint64_t)1 << s->bitcnt) - 1;
+		s->bitbuf |= (uint64_t)inflate_get_byte(s) << s->bitcnt;
+		s->bitcnt += 8;
 	}
-	case 1:			/* Inflate fixed
-						   * decompress an inflated type 1 (fixed Huffman codes) block.  We should
-						   * either replace this with a custom decoder, or at least precompute the
-						   * Huffman tables.
-						 */
-	{
-		int i;			/* temporary variable */
-		huft_t *tl;		/* literal/length code table */
-		huft_t *td;		/* distance code table */
-		unsigned int bl;			/* lookup bits for tl */
-		unsigned int bd;			/* lookup bits for td */
-		unsigned int l[288];	/* length list for huft_build */
-
-		/* set up literal table */
-		for (i = 0; i < 144; i++) {
-			l[i] = 8;
-		}
-		for (; i < 256; i++) {
-			l[i] = 9;
-		}
-		for (; i < 280; i++) {
-			l[i] = 7;
-		}
-		for (; i < 288; i++) {	/* make a complete, but wrong code set */
-			l[i] = 8;
-		}
-		bl = 7;
-		if ((i = huft_build(l, 288, 257, cplens, cplext, &tl, &bl)) != 0) {
-			return i;
-		}
+	v = s->bitbuf & ((1U << n) - 1);
+	s->bitbuf >>= n;
+	s->bitcnt -= n;
+	return v;
+}
 
-		/* set up distance table */
-		for (i = 0; i < 30; i++) {	/* make an incomplete code set */
-			l[i] = 5;
+/* Drop bits up to the next byte boundary and give whole bytes still in
+ * bitbuf back to the input buffer. */
+static void inflate_align(inflate_state_t *s)
+{
+	s->in_next -= s->bitcnt >> 3;
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+}
+
+/* Look up the next code one byte at a time, never reading past it, for
+ * when the input buffer is nearly empty. */
+static inflate_code_t inflate_decode_slow(inflate_state_t *s,
+		const inflate_code_t *table, unsigned root)
+{
+	inflate_code_t e;
+	unsigned base = 0, sub = 0;
+
+	for (;;) {
+		s->bitbuf &= ((uint64_t)1 << s->bitcnt) - 1;
+		e = table[base + ((s->bitbuf >> sub) & ((1U << root) - 1))];
+		if ((e.op & OP_PAIR) && e.bits > s->bitcnt) {
+			/* The second literal may not be there yet; don't wait
+			 * for bytes that might be past the end of the stream. */
+			e.bits = e.op & 0x0f;
+			e.op = OP_LITERAL;
+			e.val &= 0xff;
 		}
-		bd = 5;
-		if ((i = huft_build(l, 30, 0, cpdist, cpdext, &td, &bd)) > 1) {
-			huft_free(tl);
-			return i;
+		if (e.bits > s->bitcnt) {
+			s->bitbuf |= (uint64_t)inflate_get_byte(s) << s->bitcnt;
+			s->bitcnt += 8;
+			continue;
 		}
+		if ((e.op & 0xf0) != OP_SUB)
+			return e;
+		base = e.val;
+		sub = root;
+		root = e.op & 0x0f;
+	}
+}
 
-		/* decompress until an end-of-block code */
-		inflate_codes(tl, td, bl, bd, 1); // Setup inflate_codes
-
-		/* huft_free code moved into inflate_codes */
+static void inflate_bad_distance(void)
+{
+	bb_error_msg_and_die("invalid distance");
+}
 
-		return -2;
+static void inflate_copy_match(unsigned char *out, unsigned len, unsigned dist)
+{
+	const unsigned char *src = out - dist;
+	unsigned char *end = out + len;
+
+	if (dist >= 8) {
+		/* May write up to 7 bytes past end, into the slack */
+		do {
+			memcpy(out, src, 8);
+			out += 8;
+			src += 8;
+		} while (out < end);
+	} else if (dist == 1) {
+		memset(out, out[-1], len);
+	} else {
+		do
+			*out++ = *src++;
+		while (out < end);
 	}
-	case 2:			/* Inflate dynamic */
-	{
-		const int dbits = 6;	/* bits in base distance lookup table */
-		const int lbits = 9;	/* bits in base literal/length lookup table */
-
-		huft_t *tl;		/* literal/length code table */
-		huft_t *td;		/* distance code table */
-		unsigned int i;			/* temporary variables */
-		unsigned int j;
-		unsigned int l;		/* last length */
-		unsigned int m;		/* mask for bit lengths table */
-		unsigned int n;		/* number of lengths to get */
-		unsigned int bl;			/* lookup bits for tl */
-		unsigned int bd;			/* lookup bits for td */
-		unsigned int nb;	/* number of bit length codes */
-		unsigned int nl;	/* number of literal/length codes */
-		unsigned int nd;	/* number of distance codes */
-
-		unsigned int ll[286 + 30];	/* literal/length and distance code lengths */
-		unsigned int b_dynamic;	/* bit buffer */
-		unsigned int k_dynamic;	/* number of bits in bit buffer */
-
-		/* make local bit buffer */
-		b_dynamic = gunzip_bb;
-		k_dynamic = gunzip_bk;
-
-		/* read in table lengths */
-		b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 5);
-		nl = 257 + ((unsigned int) b_dynamic & 0x1f);	/* number of literal/length codes */
-
-		b_dynamic >>= 5;
-		k_dynamic -= 5;
-		b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 5);
-		nd = 1 + ((unsigned int) b_dynamic & 0x1f);	/* number of distance codes */
-
-		b_dynamic >>= 5;
-		k_dynamic -= 5;
-		b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 4);
-		nb = 4 + ((unsigned int) b_dynamic & 0xf);	/* number of bit length codes */
-
-		b_dynamic >>= 4;
-		k_dynamic -= 4;
-		if (nl > 286 || nd > 30) {
-			return 1;	/* bad lengths */
-		}
+}
 
-		/* read in bit-length-code lengths */
-		for (j = 0; j < nb; j++) {
-			b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 3);
-			ll[border[j]] = (unsigned int) b_dynamic & 7;
-			b_dynamic >>= 3;
-			k_dynamic -= 3;
+/* The fast path: refill the bit buffer from the input a word at a time
+ * while at least 8 bytes are buffered.  After a refill there are at least
+ * 56 bits, enough for a length and a distance with their extra bits.
+ * Returns 1 at end of block. */
+static int inflate_codes_fast(inflate_state_t *s)
+{
+	const unsigned litmask = (1U << LITLEN_TABLEBITS) - 1;
+	const unsigned distmask = (1U << DIST_TABLEBITS) - 1;
+	const unsigned char *in_next = s->in_next;
+	const unsigned char *in_fast_end = s->in_end - 8;
+	unsigned char *out = s->out;
+	unsigned char *out_limit = s->window + WSIZE + OUTSIZE;
+	uint64_t bitbuf = s->bitbuf;
+	unsigned bitcnt = s->bitcnt;
+	int ret = 0;
+
+	while (in_next <= in_fast_end && out < out_limit) {
+		inflate_code_t e;
+		unsigned len, dist, n;
+		uint64_t word;
+
+		memcpy(&word, in_next, 8);
+		bitbuf |= SWAP_LE64(word) << bitcnt;
+		in_next += (63 - bitcnt) >> 3;
+		bitcnt |= 56;
+
+		e = s->litlen[bitbuf & litmask];
+		if (e.op & OP_PAIR) {
+			bitbuf >>= e.bits;
+			bitcnt -= e.bits;
+			out[0] = e.val;
+			out[1] = e.val >> 8;
+			out += 2;
+			continue;
 		}
-		for (; j < 19; j++) {
-			ll[border[j]] = 0;
+		if ((e.op & 0xf0) == OP_SUB)
+			e = s->litlen[e.val + ((bitbuf >> LITLEN_TABLEBITS)
+					& ((1U << (e.op & 0x0f)) - 1))];
+		bitbuf >>= e.bits;
+		bitcnt -= e.bits;
+		if (e.op == OP_LITERAL) {
+			*out++ = e.val;
+			continue;
 		}
-
-		/* build decoding table for trees--single level, 7 bit lookup */
-		bl = 7;
-		i = huft_build(ll, 19, 19, NULL, NULL, &tl, &bl);
-		if (i != 0) {
-			if (i == 1) {
-				huft_free(tl);
+		if (e.op >= 0x10) {
+			if (e.op == OP_EOB) {
+				ret = 1;
+				break;
 			}
-			return i;	/* incomplete code set */
+			bb_error_msg_and_die("invalid literal/length code");
 		}
 
-		/* read in literal and distance code lengths */
-		n = nl + nd;
-		m = mask_bits[bl];
-		i = l = 0;
-		while ((unsigned int) i < n) {
-			b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, (unsigned int)bl);
-			j = (td = tl + ((unsigned int) b_dynamic & m))->b;
-			b_dynamic >>= j;
-			k_dynamic -= j;
-			j = td->v.n;
-			if (j < 16) {	/* length of code in bits (0..15) */
-				ll[i++] = l = j;	/* save last length in l */
-			} else if (j == 16) {	/* repeat last length 3 to 6 times */
-				b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 2);
-				j = 3 + ((unsigned int) b_dynamic & 3);
-				b_dynamic >>= 2;
-				k_dynamic -= 2;
-				if ((unsigned int) i + j > n) {
-					return 1;
-				}
-				while (j--) {
-					ll[i++] = l;
-				}
-			} else if (j == 17) {	/* 3 to 10 zero length codes */
-				b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 3);
-				j = 3 + ((unsigned int) b_dynamic & 7);
-				b_dynamic >>= 3;
-				k_dynamic -= 3;
-				if ((unsigned int) i + j > n) {
-					return 1;
-				}
-				while (j--) {
-					ll[i++] = 0;
-				}
-				l = 0;
-			} else {	/* j == 18: 11 to 138 zero length codes */
-				b_dynamic = fill_bitbuffer(b_dynamic, &k_dynamic, 7);
-				j = 11 + ((unsigned int) b_dynamic & 0x7f);
-				b_dynamic >>= 7;
-				k_dynamic -= 7;
-				if ((unsigned int) i + j > n) {
-					return 1;
-				}
-				while (j--) {
-					ll[i++] = 0;
-				}
-				l = 0;
-			}
-		}
+		n = e.op;
+		len = e.val + (bitbuf & ((1U << n) - 1));
+		bitbuf >>= n;
+		bitcnt -= n;
+
+		e = s->dist[bitbuf & distmask];
+		if ((e.op & 0xf0) == OP_SUB)
+			e = s->dist[e.val + ((bitbuf >> DIST_TABLEBITS)
+					& ((1U << (e.op & 0x0f)) - 1))];
+		if (e.op >= 0x10)
+			bb_error_msg_and_die("invalid distance code");
+		bitbuf >>= e.bits;
+		bitcnt -= e.bits;
+		n = e.op;
+		dist = e.val + (bitbuf & ((1U << n) - 1));
+		bitbuf >>= n;
+		bitcnt -= n;
+
+		if (dist > (unsigned)(out - s->window))
+			inflate_bad_distance();
+		inflate_copy_match(out, len, dist);
+		out += len;
+	}
 
-		/* free decoding table for trees */
-		huft_free(tl);
+	s->in_next = in_next;
+	s->bitbuf = bitbuf;
+	s->bitcnt = bitcnt;
+	s->out = out;
+	return ret;
+}
 
-		/* restore the global bit buffer */
-		gunzip_bb = b_dynamic;
-		gunzip_bk = k_dynamic;
+/* Decode one symbol the careful way.  Returns 1 at end of block. */
+static int inflate_codes_slow(inflate_state_t *s)
+{
+	inflate_code_t e;
+	unsigned len, dist;
+
+	e = inflate_decode_slow(s, s->litlen, LITLEN_TABLEBITS);
+	s->bitbuf >>= e.bits;
+	s->bitcnt -= e.bits;
+	if (e.op & OP_PAIR) {
+		s->out[0] = e.val;
+		s->out[1] = e.val >> 8;
+		s->out += 2;
+		return 0;
+	}
+	if (e.op == OP_LITERAL) {
+		*s->out++ = e.val;
+		return 0;
+	}
+	if (e.op == OP_EOB)
+		return 1;
+	if (e.op >= 0x10)
+		bb_error_msg_and_die("invalid literal/length code");
+	len = e.val + inflate_bits(s, e.op);
+
+	e = inflate_decode_slow(s, s->dist, DIST_TABLEBITS);
+	if (e.op >= 0x10)
+		bb_error_msg_and_die("invalid distance code");
+	s->bitbuf >>= e.bits;
+	s->bitcnt -= e.bits;
+	dist = e.val + inflate_bits(s, e.op);
+
+	if (dist > (unsigned)(s->out - s->window))
+		inflate_bad_distance();
+	inflate_copy_match(s->out, len, dist);
+	s->out += len;
+	return 0;
+}
 
-		/* build the decoding tables for literal/length and distance codes */
-		bl = lbits;
+/* Returns 1 at end of block, 0 when the output area is full */
+static int inflate_codes(inflate_state_t *s)
+{
+	unsigned char *out_limit = s->window + WSIZE + OUTSIZE;
+
+	while (s->out < out_limit) {
+		if (s->in_end - s->in_next >= 8) {
+			if (inflate_codes_fast(s))
+				return 1;
+		} else if (inflate_codes_slow(s))
+			return 1;
+	}
+	return 0;
+}
 
-		if ((i = huft_build(ll, nl, 257, cplens, cplext, &tl, &bl)) != 0) {
-			if (i == 1) {
-				bb_error_msg_and_die("Incomplete literal tree");
-				huft_free(tl);
-			}
-			return i;	/* incomplete code set */
-		}
+static void inflate_fixed_tables(inflate_state_t *s)
+{
+	unsigned char l[288];
+
+	memset(l, 8, 144);
+	memset(l + 144, 9, 256 - 144);
+	memset(l + 256, 7, 280 - 256);
+	memset(l + 280, 8, 288 - 280);
+	inflate_build(s->litlen, LITLEN_TABLEBITS, l, 288, CODE_LITLEN, LITLEN_ENOUGH);
+	/* 30 and 31 take part in the code, but are invalid */
+	memset(l, 5, 32);
+	inflate_build(s->dist, DIST_TABLEBITS, l, 32, CODE_DIST, DIST_ENOUGH);
+}
 
-		bd = dbits;
-		if ((i = huft_build(ll + nl, nd, 0, cpdist, cpdext, &td, &bd)) != 0) {
-			if (i == 1) {
-				bb_error_msg_and_die("incomplete distance tree");
-				huft_free(td);
-			}
-			huft_free(tl);
-			return i;	/* incomplete code set */
+static void inflate_dynamic_tables(inflate_state_t *s)
+{
+	inflate_code_t codelen[1 << CODELEN_TABLEBITS];
+	unsigned char ll[286 + 30];
+	unsigned nl, nd, nb, i, n;
+
+	nl = 257 + inflate_bits(s, 5);
+	nd = 1 + inflate_bits(s, 5);
+	nb = 4 + inflate_bits(s, 4);
+	if (nl > 286 || nd > 30)
+		bb_error_msg_and_die("too many length or distance codes");
+
+	memset(ll, 0, 19);
+	for (i = 0; i < nb; i++)
+		ll[border[i]] = inflate_bits(s, 3);
+	if (inflate_build(codelen, CODELEN_TABLEBITS, ll, 19, CODE_CODELEN,
+				1 << CODELEN_TABLEBITS))
+		bb_error_msg_and_die("invalid code lengths set");
+
+	n = nl + nd;
+	i = 0;
+	while (i < n) {
+		inflate_code_t e = inflate_decode_slow(s, codelen, CODELEN_TABLEBITS);
+		unsigned sym = e.val, rep, len = 0;
+
+		if (e.op == OP_BAD)
+			bb_error_msg_and_die("invalid code lengths set");
+		s->bitbuf >>= e.bits;
+		s->bitcnt -= e.bits;
+		if (sym < 16) {
+			ll[i++] = sym;
+			continue;
 		}
+		if (sym == 16) {
+			if (i == 0)
+				bb_error_msg_and_die("invalid bit length repeat");
+			len = ll[i - 1];
+			rep = 3 + inflate_bits(s, 2);
+		} else if (sym == 17)
+			rep = 3 + inflate_bits(s, 3);
+		else
+			rep = 11 + inflate_bits(s, 7);
+		if (i + rep > n)
+			bb_error_msg_and_die("invalid bit length repeat");
+		memset(ll + i, len, rep);
+		i += rep;
+	}
 
-		/* decompress until an end-of-block code */
-		inflate_codes(tl, td, bl, bd, 1); // Setup inflate_codes
+	if (ll[256] == 0)
+		bb_error_msg_and_die("missing end-of-block code");
+	if (inflate_build(s->litlen, LITLEN_TABLEBITS, ll, nl, CODE_LITLEN, LITLEN_ENOUGH))
+		bb_error_msg_and_die("invalid literal/lengths set");
+	if (inflate_build(s->dist, DIST_TABLEBITS, ll + nl, nd, CODE_DIST, DIST_ENOUGH))
+		bb_error_msg_and_die("invalid distances set");
+}
 
-		/* huft_free code moved into inflate_codes */
+/* Start the next block, or finish off the stream after the last one */
+static void inflate_block_header(inflate_state_t *s)
+{
+	unsigned t;
 
-		return -2;
+	if (s->last) {
+		inflate_align(s);
+		s->mode = MODE_DONE;
+		return;
 	}
+	s->last = inflate_bits(s, 1);
+	t = inflate_bits(s, 2);
+	switch (t) {
+	case 0:
+		inflate_align(s);
+		t = inflate_get_byte(s);
+		t |= inflate_get_byte(s) << 8;
+		s->stored_left = t;
+		t = inflate_get_byte(s);
+		t |= inflate_get_byte(s) << 8;
+		if (s->stored_left != (~t & 0xffff))
+			bb_error_msg_and_die("invalid stored block lengths");
+		s->mode = MODE_STORED;
+		break;
+	case 1:
+		inflate_fixed_tables(s);
+		s->mode = MODE_CODES;
+		break;
+	case 2:
+		inflate_dynamic_tables(s);
+		s->mode = MODE_CODES;
+		break;
 	default:
-		/* bad block type */
 		bb_error_msg_and_die("bad block type %d\n", t);
 	}
 }
 
-static void calculate_gunzip_crc(void)
+static void inflate_stored(inflate_state_t *s)
 {
-	int n;
-	for (n = 0; n < gunzip_outbuf_count; n++) {
-		gunzip_crc = gunzip_crc_table[((int) gunzip_crc ^ (gunzip_window[n])) & 0xff] ^ (gunzip_crc >> 8);
+	unsigned char *out_limit = s->window + WSIZE + OUTSIZE;
+
+	while (s->stored_left && s->out < out_limit) {
+		size_t n = s->in_end - s->in_next;
+
+		if (n == 0) {
+			if (!inflate_fill_input(s))
+				bb_error_msg_and_die("unexpected end of file");
+			continue;
+		}
+		if (n > s->stored_left)
+			n = s->stored_left;
+		if (n > (size_t)(out_limit - s->out))
+			n = out_limit - s->out;
+		memcpy(s->out, s->in_next, n);
+		s->in_next += n;
+		s->out += n;
+		s->stored_left -= n;
 	}
-	gunzip_bytes_out += gunzip_outbuf_count;
+	if (!s->stored_left)
+		s->mode = MODE_HEADER;
 }
 
-static int inflate_get_next_window(void)
+/* Make more output available, sliding the window down first if all of it
+ * has been handed out.  Returns the number of bytes waiting at
+ * s->flushed, 0 at the end of the stream. */
+static size_t inflate_more(inflate_state_t *s)
 {
-	static int method = -1; // Method == -1 for stored, -2 for codes
-	static int e = 0;
-	static int needAnotherBlock = 1;
-
-	gunzip_outbuf_count = 0;
-
-	while(1) {
-		int ret;
-
-		if (needAnotherBlock) {
-			if(e) {
-				calculate_gunzip_crc();
-				e = 0;
-				needAnotherBlock = 1;
-				return 0;
-			} // Last block
-			method = inflate_block(&e);
-			needAnotherBlock = 0;
-		}
+	unsigned char *out_limit = s->window + WSIZE + OUTSIZE;
+	unsigned char *start;
 
-		switch (method) {
-			case -1:	ret = inflate_stored(0,0,0,0);
-					break;
-			case -2:	ret = inflate_codes(0,0,0,0,0);
-					break;
-			default:	bb_error_msg_and_die("inflate error %d", method);
-		}
+	if (s->flushed != s->out)
+		return s->out - s->flushed;
+
+	if (s->out >= out_limit) {
+		memmove(s->window, s->out - WSIZE, WSIZE);
+		s->out = s->flushed = s->window + WSIZE;
+	}
 
-		if (ret == 1) {
-			calculate_gunzip_crc();
-			return 1; // More data left
-		} else needAnotherBlock = 1; // End of that block
+	start = s->out;
+	while (s->mode < MODE_DONE && s->out < out_limit) {
+		switch (s->mode) {
+		case MODE_HEADER:
+			inflate_block_header(s);
+			break;
+		case MODE_STORED:
+			inflate_stored(s);
+			break;
+		case MODE_CODES:
+			if (inflate_codes(s))
+				s->mode = MODE_HEADER;
+			break;
+		}
 	}
-	/* Doesnt get here */
+
+	s->crc = bb_crc32_block(s->crc, start, s->out - start, 0);
+	s->bytes_out += s->out - start;
+	return s->out - s->flushed;
 }
 
-/* Initialise bytebuffer, be careful not to overfill the buffer */
-void inflate_init(unsigned int bufsize)
+/* src_size is how much compressed data there is, or -1 if unknown.  Only
+ * with a known size is src_fd left exactly at the end of the data. */
+inflate_state_t *inflate_start(int src_fd, off_t src_size)
 {
-	/* Set the bytebuffer size, default is same as gunzip_wsize */
-	bytebuffer_max = bufsize + 8;
-	bytebuffer_offset = 4;
-	bytebuffer_size = 0;
+	inflate_state_t *s = xzalloc(sizeof(inflate_state_t));
+
+	s->src_fd = src_fd;
+	s->src_left = src_size;
+	s->in_buf = xmalloc(INBUF_SIZE);
+	s->in_next = s->in_end = s->in_buf;
+	s->window = xmalloc(WSIZE + OUTSIZE + WINDOW_SLACK);
+	s->out = s->flushed = s->window;
+	s->mode = MODE_HEADER;
+	s->crc = ~0;
+	return s;
 }
 
-void inflate_cleanup(void)
+/* Returns up to count bytes of output, 0 at the end of the stream.
+ * Dies on corrupt data. */
+ssize_t inflate_read(inflate_state_t *s, void *buf, size_t count)
 {
-	free(bytebuffer);
+	size_t n = inflate_more(s);
+
+	if (count > n)
+		count = n;
+	memcpy(buf, s->flushed, count);
+	s->flushed += count;
+	return count;
 }
 
-int inflate_unzip(int in, int out)
+/* Inflate the whole stream to dst_fd */
+int inflate_unzip(inflate_state_t *s, int dst_fd)
 {
-	ssize_t nwrote;
-	typedef void (*sig_type) (int);
-
-	/* Allocate all global buffers (for DYN_ALLOC option) */
-	gunzip_window = xmalloc(gunzip_wsize);
-	gunzip_outbuf_count = 0;
-	gunzip_bytes_out = 0;
-	gunzip_src_fd = in;
-
-	/* initialize gunzip_window, bit buffer */
-	gunzip_bk = 0;
-	gunzip_bb = 0;
-
-	/* Create the crc table */
-	gunzip_crc_table = bb_crc32_filltable(0);
-	gunzip_crc = ~0;
-	
-	/* Allocate space for buffer */
-	bytebuffer = xmalloc(bytebuffer_max);
-
-	while(1) {
-		int ret = inflate_get_next_window();
-		nwrote = bb_full_write(out, gunzip_window, gunzip_outbuf_count);
-		if (nwrote == -1) {
+	size_t n;
+
+	while ((n = inflate_more(s)) != 0) {
+		if (bb_full_write(dst_fd, s->flushed, n) != n) {
 			bb_perror_msg("write");
 			return -1;
 		}
-		if (ret == 0) break;
-	}
-
-	/* Cleanup */
-	free(gunzip_window);
-	free(gunzip_crc_table);
-
-	/* Store unused bytes in a global buffer so calling applets can access it */
-	if (gunzip_bk >= 8) {
-		/* Undo too much lookahead. The next read will be byte aligned
-		 * so we can discard unused bits in the last meaningful byte. */
-		bytebuffer_offset--;
-		bytebuffer[bytebuffer_offset] = gunzip_bb & 0xff;
-		gunzip_bb >>= 8;
-		gunzip_bk -= 8;
+		s->flushed += n;
 	}
 	return 0;
 }
 
-int inflate_gunzip(int in, int out)
+/* CRC32 and size of everything inflated so far */
+uint32_t inflate_crc(const inflate_state_t *s)
 {
-	uint32_t stored_crc = 0;
-	unsigned int count;
+	return ~s->crc;
+}
 
-	inflate_unzip(in, out);
+off_t inflate_count(const inflate_state_t *s)
+{
+	return s->bytes_out;
+}
 
-	/* top up the input buffer with the rest of the trailer */
-	count = bytebuffer_size - bytebuffer_offset;
-	if (count < 8) {
-		bb_xread_all(in, &bytebuffer[bytebuffer_size], 8 - count);
-		bytebuffer_size += 8 - count;
-	}
-	for (count = 0; count != 4; count++) {
-		stored_crc |= (bytebuffer[bytebuffer_offset] << (count * 8));
-		bytebuffer_offset++;
+void inflate_end(inflate_state_t *s)
+{
+	if (s) {
+		free(s->in_buf);
+		free(s->window);
+		free(s);
 	}
+}
+
+static int check_trailer_gzip(inflate_state_t *s)
+{
+	uint32_t stored_crc = 0, stored_size = 0;
+	int count;
+
+	for (count = 0; count != 4; count++)
+		stored_crc |= inflate_get_byte(s) << (count * 8);
+	for (count = 0; count != 4; count++)
+		stored_size |= inflate_get_byte(s) << (count * 8);
 
 	/* Validate decompression - crc */
-	if (stored_crc != (~gunzip_crc)) {
+	if (stored_crc != inflate_crc(s)) {
 		bb_error_msg("crc error");
 		return -1;
 	}
 
 	/* Validate decompression - size */
-	if (gunzip_bytes_out !=
-		(bytebuffer[bytebuffer_offset] | (bytebuffer[bytebuffer_offset+1] << 8) |
-		(bytebuffer[bytebuffer_offset+2] << 16) | (bytebuffer[bytebuffer_offset+3] << 24))) {
+	if (stored_size != (uint32_t)inflate_count(s)) {
 		bb_error_msg("Incorrect length");
 		return -1;
 	}
 
 	return 0;
 }
+
+int inflate_gunzip(int in, int out)
+{
+	inflate_state_t *s = inflate_start(in, -1);
+	int ret;
+
+	ret = inflate_unzip(s, out);
+	if (ret == 0)
+		ret = check_trailer_gzip(s);
+	inflate_end(s);
+	return ret;
+}
+
+/* Pull interface for archive_handle_t, see unpack_stream_t */
+static ssize_t gunzip_stream_read(unpack_stream_t *stream, void *buf, size_t count)
+{
+	inflate_state_t *s = stream->state;
+	ssize_t n = inflate_read(s, buf, count);
+
+	if (n == 0 && count && s->mode == MODE_DONE) {
+		/* Check the trailer once, on the first read past the end */
+		if (check_trailer_gzip(s))
+			exit(bb_default_error_retval);
+		s->mode = MODE_CHECKED;
+	}
+	return n;
+}
+
+static void gunzip_stream_close(unpack_stream_t *stream)
+{
+	inflate_end(stream->state);
+	free(stream);
+}
+
+unpack_stream_t *open_gunzip_stream(int src_fd)
+{
+	unpack_stream_t *stream = xzalloc(sizeof(unpack_stream_t));
+
+	stream->read = gunzip_stream_read;
+	stream->close = gunzip_stream_close;
+	stream->src_fd = src_fd;
+	stream->state = inflate_start(src_fd, -1);
+
+	return stream;
+}
@@ -55,7 +55,7 @@ char get_header_tar(archive_handle_t *archive_handle)
 	/* Align header */
 	data_align(archive_handle, 512);
 
-	if (bb_full_read(archive_handle->src_fd, tar.raw, 512) != 512) {
+	if (archive_read(archive_handle, tar.raw, 512) != 512) {
 		/* Assume end of file */
 		bb_error_msg_and_die("Short header");
 		//return(EXIT_FAILURE);
@@ -68,7 +68,7 @@ char get_header_tar(archive_handle_t *archive_handle)
 			/* This is the second consecutive empty header! End of archive!
 			 * Read until the end to empty the pipe from gz or bz2
 			 */
-			while (bb_full_read(archive_handle->src_fd, tar.raw, 512) == 512);
+			while (archive_read(archive_handle, tar.raw, 512) == 512);
 			return(EXIT_FAILURE);
 		}
 		end = 1;
@@ -33,9 +33,10 @@ char get_header_tar_gz(archive_handle_t *archive_handle)
 
 	check_header_gzip(archive_handle->src_fd);
 
-	archive_handle->src_fd = open_transformer(archive_handle->src_fd, inflate_gunzip);
+	archive_handle->src_stream = open_gunzip_stream(archive_handle->src_fd);
 	archive_handle->offset = 0;
 	while (get_header_tar(archive_handle) == EXIT_SUCCESS);
+	close_unpack_stream(archive_handle);
 
 	/* Can only do one file at a time */
 	return(EXIT_FAILURE);
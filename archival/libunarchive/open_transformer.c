@@ -39,3 +39,14 @@ int open_transformer(int src_fd, int (*transformer)(int src_fd, int dst_fd))
 
 	return(fd_pipe[0]);
 }
+
+/* Done reading through an in-process decompressor, go back to raw src_fd */
+void close_unpack_stream(archive_handle_t *archive_handle)
+{
+	unpack_stream_t *stream = archive_handle->src_stream;
+
+	if (stream) {
+		stream->close(stream);
+		archive_handle->src_stream = NULL;
+	}
+}
@@ -18,6 +18,6 @@
 void seek_by_char(const archive_handle_t *archive_handle, const unsigned int jump_size)
 {
 	if (jump_size) {
-		bb_copyfd_size(archive_handle->src_fd, -1, jump_size);
+		archive_copy_data(archive_handle, -1, jump_size);
 	}
 }
@@ -200,9 +200,10 @@ void extract_cpio_gz(int fd) {
 	check_header_gzip(archive_handle->src_fd);
 	bb_xchdir("/"); // Install RPM's to root
 
-	archive_handle->src_fd = open_transformer(archive_handle->src_fd, inflate_gunzip);
+	archive_handle->src_stream = open_gunzip_stream(archive_handle->src_fd);
 	archive_handle->offset = 0;
 	while (get_header_cpio(archive_handle) == EXIT_SUCCESS);
+	close_unpack_stream(archive_handle);
 }
 
 
@@ -68,20 +68,6 @@ struct TarHeader {		/* byte offset */
 };
 typedef struct TarHeader TarHeader;
 
-/*
-** writeTarFile(),  writeFileToTarball(), and writeTarHeader() are
-** the only functions that deal with the HardLinkInfo structure.
-** Even these functions use the xxxHardLinkInfo() functions.
-*/
-typedef struct HardLinkInfo HardLinkInfo;
-struct HardLinkInfo {
-	HardLinkInfo *next;	/* Next entry in list */
-	dev_t dev;			/* Device number */
-	ino_t ino;			/* Inode number */
-	short linkCount;	/* (Hard) Link Count */
-	char name[1];		/* Start of filename (must be last) */
-};
-
 /* Some info to be carried along when creating a new tarball */
 struct TarBallInfo {
 	char *fileName;			/* File name of the tarball */
@@ -93,8 +79,8 @@ struct TarBallInfo {
 							   to include the tarball into itself */
 	int verboseFlag;		/* Whether to print extra stuff or not */
 	const llist_t *excludeList;	/* List of files to not include */
-	HardLinkInfo *hlInfoHead;	/* Hard Link Tracking Information */
-	HardLinkInfo *hlInfo;	/* Hard Link Info for the current file */
+	char *hlName;			/* Earlier name of the current file, if it
+							   is a hard link to one we already have */
 };
 typedef struct TarBallInfo TarBallInfo;
 
@@ -114,51 +100,6 @@ enum TarFileType {
 };
 typedef enum TarFileType TarFileType;
 
-/* Might be faster (and bigger) if the dev/ino were stored in numeric order;) */
-static inline void addHardLinkInfo(HardLinkInfo ** hlInfoHeadPtr,
-					struct stat *statbuf,
-					const char *name)
-{
-	/* Note: hlInfoHeadPtr can never be NULL! */
-	HardLinkInfo *hlInfo;
-
-	hlInfo = (HardLinkInfo *) xmalloc(sizeof(HardLinkInfo) + strlen(name));
-	hlInfo->next = *hlInfoHeadPtr;
-	*hlInfoHeadPtr = hlInfo;
-	hlInfo->dev = statbuf->st_dev;
-	hlInfo->ino = statbuf->st_ino;
-	hlInfo->linkCount = statbuf->st_nlink;
-	strcpy(hlInfo->name, name);
-}
-
-static void freeHardLinkInfo(HardLinkInfo ** hlInfoHeadPtr)
-{
-	HardLinkInfo *hlInfo = NULL;
-	HardLinkInfo *hlInfoNext = NULL;
-
-	if (hlInfoHeadPtr) {
-		hlInfo = *hlInfoHeadPtr;
-		while (hlInfo) {
-			hlInfoNext = hlInfo->next;
-			free(hlInfo);
-			hlInfo = hlInfoNext;
-		}
-		*hlInfoHeadPtr = NULL;
-	}
-	return;
-}
-
-/* Might be faster (and bigger) if the dev/ino were stored in numeric order;) */
-static inline HardLinkInfo *findHardLinkInfo(HardLinkInfo * hlInfo, struct stat *statbuf)
-{
-	while (hlInfo) {
-		if ((statbuf->st_ino == hlInfo->ino) && (statbuf->st_dev == hlInfo->dev))
-			break;
-		hlInfo = hlInfo->next;
-	}
-	return (hlInfo);
-}
-
 /* Put an octal string into the specified buffer.
  * The number is zero and space padded and possibly null padded.
  * Returns TRUE if successful.  */
@@ -219,10 +160,10 @@ static inline int writeTarHeader(struct TarBallInfo *tbInfo,
 	if (bb_getgrgid(header.gname, statbuf->st_gid, sizeof(header.gname)) == NULL)
 		strcpy(header.gname, "root");
 
-	if (tbInfo->hlInfo) {
+	if (tbInfo->hlName) {
 		/* This is a hard link */
 		header.typeflag = LNKTYPE;
-		strncpy(header.linkname, tbInfo->hlInfo->name,
+		strncpy(header.linkname, tbInfo->hlName,
 				sizeof(header.linkname));
 	} else if (S_ISLNK(statbuf->st_mode)) {
 		char *lpath = xreadlink(real_name);
@@ -332,13 +273,12 @@ static int writeFileToTarball(const char *fileName, struct stat *statbuf,
 	   ** If so -
 	   ** Treat the first occurance of a given dev/inode as a file while
 	   ** treating any additional occurances as hard links.  This is done
-	   ** by adding the file information to the HardLinkInfo linked list.
+	   ** by adding the file information to the dev/inode hash table.
 	 */
-	tbInfo->hlInfo = NULL;
+	tbInfo->hlName = NULL;
 	if (statbuf->st_nlink > 1) {
-		tbInfo->hlInfo = findHardLinkInfo(tbInfo->hlInfoHead, statbuf);
-		if (tbInfo->hlInfo == NULL)
-			addHardLinkInfo(&tbInfo->hlInfoHead, statbuf, fileName);
+		if (!is_in_ino_dev_hashtable(statbuf, &tbInfo->hlName))
+			add_to_ino_dev_hashtable(statbuf, fileName);
 	}
 
 	/* It is against the rules to archive a socket */
@@ -381,7 +321,7 @@ static int writeFileToTarball(const char *fileName, struct stat *statbuf,
 	}
 
 	/* Is this a regular file? */
-	if ((tbInfo->hlInfo == NULL) && (S_ISREG(statbuf->st_mode))) {
+	if ((tbInfo->hlName == NULL) && (S_ISREG(statbuf->st_mode))) {
 
 		/* open the file we want to archive, and make sure all is well */
 		if ((inputFileFd = open(fileName, O_RDONLY)) < 0) {
@@ -421,7 +361,7 @@ static inline int writeTarFile(const int tar_fd, const int verboseFlag,
 	ssize_t size;
 	struct TarBallInfo tbInfo;
 
-	tbInfo.hlInfoHead = NULL;
+	tbInfo.hlName = NULL;
 
 	fchmod(tar_fd, 0644);
 	tbInfo.tarFd = tar_fd;
@@ -514,8 +454,9 @@ static inline int writeTarFile(const int tar_fd, const int verboseFlag,
 	close(tbInfo.tarFd);
 
 	/* Hang up the tools, close up shop, head home */
-	if (ENABLE_FEATURE_CLEAN_UP)
-		freeHardLinkInfo(&tbInfo.hlInfoHead);
+#ifdef CONFIG_FEATURE_CLEAN_UP
+	reset_ino_dev_hashtable();
+#endif
 
 	if (errorFlag)
 		bb_error_msg("Error exit delayed from previous errors");
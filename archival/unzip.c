@@ -55,9 +55,6 @@ __swap32(uint32_t x) {
 #define ZIP_CDS_END_MAGIC		__swap32(0x06054b50)
 #define ZIP_DD_MAGIC			__swap32(0x08074b50)
 
-extern unsigned int gunzip_crc;
-extern unsigned int gunzip_bytes_out;
-
 typedef union {
 	unsigned char raw[26];
 	struct {
@@ -111,16 +108,22 @@ static int unzip_extract(zip_header_t *zip_header, int src_fd, int dst_fd)
 
 	} else {
 		/* Method 8 - inflate */
-		inflate_init(zip_header->formated.cmpsize);
-		inflate_unzip(src_fd, dst_fd);
-		inflate_cleanup();
+		inflate_state_t *inflate;
+		uint32_t crc;
+		off_t count;
+
+		inflate = inflate_start(src_fd, zip_header->formated.cmpsize);
+		inflate_unzip(inflate, dst_fd);
+		crc = inflate_crc(inflate);
+		count = inflate_count(inflate);
+		inflate_end(inflate);
 		/* Validate decompression - crc */
-		if (zip_header->formated.crc32 != (gunzip_crc ^ 0xffffffffL)) {
+		if (zip_header->formated.crc32 != crc) {
 			bb_error_msg("Invalid compressed data--crc error");
 			return 1;
 		}
 		/* Validate decompression - size */
-		if (zip_header->formated.ucmpsize != gunzip_bytes_out) {
+		if (zip_header->formated.ucmpsize != count) {
 			bb_error_msg("Invalid compressed data--length error");
 			return 1;
 		}
@@ -13,14 +13,12 @@
 
 int cksum_main(int argc, char **argv) {
 	
-	uint32_t *crc32_table = bb_crc32_filltable(1);
-
 	FILE *fp;
 	uint32_t crc;
 	long length, filesize;
 	int bytes_read;
-	char *cp;
-	RESERVE_CONFIG_BUFFER(buf, BUFSIZ);
+	unsigned char c;
+	RESERVE_CONFIG_BUFFER(buf, BB_BULK_BUFSIZE);
 	int inp_stdin = (argc == optind) ? 1 : 0;
 	
 	do {
@@ -29,17 +27,17 @@ int cksum_main(int argc, char **argv) {
 		crc = 0;
 		length = 0;
 		
-		while ((bytes_read = fread(buf, 1, BUFSIZ, fp)) > 0) {
-			cp = buf;
+		while ((bytes_read = fread(buf, 1, BB_BULK_BUFSIZE, fp)) > 0) {
 			length += bytes_read;
-			while (bytes_read--)
-				crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ (*cp++)) & 0xffL];
+			crc = bb_crc32_block(crc, buf, bytes_read, 1);
 		}
 		
 		filesize = length;
 		
-		for (; length; length >>= 8)
-			crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ length) & 0xffL];
+		for (; length; length >>= 8) {
+			c = length;
+			crc = bb_crc32_block(crc, &c, 1, 1);
+		}
 		crc ^= 0xffffffffL;
 
 		if (inp_stdin) {
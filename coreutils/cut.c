@@ -267,11 +267,13 @@ static void cut_file_by_lines(const char *line, unsigned int linenum)
  */
 static void cut_file(FILE *file)
 {
-	char *line = NULL;
+	line_reader_t *lr = bb_line_reader_open(fileno(file));
+	char *line;
+	size_t len;
 	unsigned int linenum = 0; /* keep these zero-based to be consistent */
 
 	/* go through every line in the file */
-	while ((line = bb_get_chomped_line_from_file(file)) != NULL) {
+	while ((line = bb_line_reader_chomped(lr, '\n', &len)) != NULL) {
 
 		/* cut based on chars/bytes XXX: only works when sizeof(char) == byte */
 		if ((part & (OPT_CHAR_FLGS | OPT_BYTE_FLGS)))
@@ -286,8 +288,8 @@ static void cut_file(FILE *file)
 		}
 
 		linenum++;
-		free(line);
 	}
+	bb_line_reader_free(lr);
 }
 
 
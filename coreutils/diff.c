@@ -1101,7 +1101,8 @@ static char **get_dir(char *path)
 
 	/* Now fill dl with a listing. */
 	if (cmd_flags & FLAG_r)
-		recursive_action(path, TRUE, TRUE, FALSE, add_to_dirlist, NULL,
+		recursive_action(path, ACTION_RECURSE | ACTION_MODE_ONLY,
+						 TRUE, FALSE, add_to_dirlist, NULL,
 						 userdata);
 	else {
 		DIR *dp;
@@ -92,6 +92,7 @@ static void tostring (VALUE *v);
 int expr_main (int argc, char **argv)
 {
 	VALUE *v;
+	int rc;
 
 	if (argc == 1) {
 		bb_error_msg_and_die("too few arguments");
@@ -108,7 +109,9 @@ int expr_main (int argc, char **argv)
 	else
 		puts (v->u.s);
 
-	exit (null (v));
+	rc = null (v);
+	freev (v);
+	return rc;
 }
 
 /* Return a VALUE for I.  */
@@ -297,6 +300,7 @@ of a basic regular expression is not portable; it is being ignored",
 		else
 			v = int_value (0);
 	}
+	regfree (&re_buffer);
 	return v;
 }
 
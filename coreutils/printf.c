@@ -215,7 +215,7 @@ static int print_formatted(char *format, int argc, char **argv)
 
 		case '\\':
 			if (*++f == 'c')
-				exit(0);
+				bb_fflush_stdout_and_exit(EXIT_SUCCESS);
 			putchar(bb_process_escape_sequence((const char **)&f));
 			f--;
 			break;
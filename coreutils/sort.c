@@ -5,7 +5,7 @@
  * Copyright (C) 2004 by Rob Landley <rob@landley.net>
  *
  * MAINTAINER: Rob Landley <rob@landley.net>
- * 
+ *
  * Licensed under GPLv2, see file LICENSE in this tarball for details.
  *
  * See SuS3 sort standard at:
@@ -13,14 +13,20 @@
  */
 
 #include <ctype.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <langinfo.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <unistd.h>
 #include "busybox.h"
 
+#ifdef CONFIG_FEATURE_SORT_PARALLEL
+#include <pthread.h>
+#endif
+
 static int global_flags;
 
 /*
@@ -43,84 +49,265 @@ static int global_flags;
 #define FLAG_d			512		/* Ignore !(isalnum()|isspace()) */
 #define FLAG_f			1024	/* Force uppercase */
 #define FLAG_i			2048	/* Ignore !isprint() */
+#define FLAG_m			4096	/* Inputs are sorted already, just merge */
 #define FLAG_bb			32768	/* Ignore trailing blanks  */
 
+/* Lines are copied once into big blocks, next to a record with their
+ * length and every key already parsed into what is compared: plain keys
+ * stay where they are in the text, -d, -i and -f ones get a normalized
+ * copy behind it, numbers and months are turned into their values.
+ * Comparing then never has to look for keys, parse or allocate. */
+struct sort_keyval {
+	unsigned start,end;		/* offsets of the key, or its copy, in text */
+	int type;				/* KEY_* for -n and -g, month or -1 for -M */
+	union {
+		long long n;
+		double d;
+	} v;
+};
+
+#define KEY_INT			0	/* -n: exact integer in v.n */
+#define KEY_DOUBLE		1	/* -n: anything else atof() took, in v.d */
+#define KEY_NAN			1	/* -g: the order of the types is the sort order */
+#define KEY_NOT_NUMBER	0
+#define KEY_NUMBER		2
+
+struct sort_line {
+	char *text;			/* NUL terminated */
+	unsigned len;
+#ifdef CONFIG_FEATURE_SORT_BIG
+	struct sort_keyval key[];
+#endif
+};
+
+static size_t line_size = sizeof(struct sort_line);
+static char line_delim = '\n';
+
+/* Plain byte order */
+static int compare_text(const char *x, unsigned xlen, const char *y, unsigned ylen)
+{
+	int retval=memcmp(x,y,xlen<ylen ? xlen : ylen);
+
+	if(retval) return retval;
+	return xlen<ylen ? -1 : xlen>ylen;
+}
 
 #ifdef CONFIG_FEATURE_SORT_BIG
 static char key_separator;
+static int copied_keys;		/* how many keys get a normalized copy */
+
+typedef int (*key_compare_t)(const struct sort_line *, const struct sort_keyval *,
+		const struct sort_line *, const struct sort_keyval *);
 
 static struct sort_key
 {
 	struct sort_key *next_key;	/* linked list */
 	unsigned short range[4];	/* start word, start char, end word, end char */
 	int flags;
+	key_compare_t compare;
 } *key_list;
 
-static char *get_key(char *str, struct sort_key *key, int flags)
-{
-	int start=0,end,len,i,j;
+/* Keys usually come left to right, so finding a field carries on from
+ * the one found last if it can */
+struct field_cursor {
+	int field;
+	unsigned pos;
+};
 
-	/* Special case whole string, so we don't have to make a copy */
-	if(key->range[0]==1 && !key->range[1] && !key->range[2] && !key->range[3]
-		&& !(flags&(FLAG_b&FLAG_d&FLAG_f&FLAG_i&FLAG_bb))) return str;
-	/* Find start of key on first pass, end on second pass*/
-	len=strlen(str);
+/* Where field n (counting from 1) starts; without -t that's at the blanks
+ * in front of it */
+static unsigned field_start(const char *str, unsigned len, int n,
+		struct field_cursor *cur)
+{
+	unsigned pos=0;
+	int field=1;
 
-	for(j=0;j<2;j++) {
-		if(!key->range[2*j]) end=len;
-		/* Loop through fields */
-		else {
-			end=0;
-			for(i=1;i<key->range[2*j]+j;i++) {
-				/* Skip leading blanks or first separator */
-				if(str[end]) {
-					if(!key_separator && isspace(str[end]))
-						while(isspace(str[end])) end++;
-				}
-				/* Skip body of key */
-				for(;str[end];end++) {
-					if(key_separator) {
-						if(str[end]==key_separator) break;
-					} else if(isspace(str[end])) break;
-				}
-			}
+	if(cur->field<=n) {
+		field=cur->field;
+		pos=cur->pos;
+	}
+	for(;field<n && pos<len;field++) {
+		if(key_separator) {
+			while(pos<len && str[pos]!=key_separator) pos++;
+			if(pos<len) pos++;
+		} else {
+			while(pos<len && isspace(str[pos])) pos++;
+			while(pos<len && !isspace(str[pos])) pos++;
 		}
-		if(!j) start=end;
 	}
-	/* Key with explicit separator starts after separator */
-	if(key_separator && str[start]==key_separator) start++;
-	/* Strip leading whitespace if necessary */
-	if(flags&FLAG_b) while(isspace(str[start])) start++;
-	/* Strip trailing whitespace if necessary */
-	if(flags&FLAG_bb) while(end>start && isspace(str[end-1])) end--;
-	/* Handle offsets on start and end */
-	if(key->range[3]) {
-		end+=key->range[3]-1;
-		if(end>len) end=len;
+	cur->field=field;
+	cur->pos=pos;
+	return pos;
+}
+
+static unsigned field_end(const char *str, unsigned len, int n,
+		struct field_cursor *cur)
+{
+	unsigned pos=field_start(str,len,n,cur);
+
+	if(key_separator) {
+		while(pos<len && str[pos]!=key_separator) pos++;
+	} else {
+		while(pos<len && isspace(str[pos])) pos++;
+		while(pos<len && !isspace(str[pos])) pos++;
 	}
-	if(key->range[1]) {
-		start+=key->range[1]-1;
-		if(start>len) start=len;
+	return pos;
+}
+
+/* Numbers and months are parsed from a NUL terminated copy of the key,
+ * which is usually short enough for the stack */
+#define KEY_COPY_SIZE 64
+
+static char *key_copy(char *buf, const char *str, unsigned len)
+{
+	if(len>=KEY_COPY_SIZE) return bb_xstrndup(str,len);
+	memcpy(buf,str,len);
+	buf[len]=0;
+	return buf;
+}
+
+/* -n: integers are kept exact, whatever else atof() makes of the key
+ * as a double */
+static void parse_numeric(struct sort_keyval *kv, const char *str, unsigned len)
+{
+	const unsigned char *p=(const unsigned char *)str,*end=p+len;
+	unsigned long long n=0;
+	int neg=0,digits=0;
+	char buf[KEY_COPY_SIZE],*x;
+
+	while(p<end && isspace(*p)) p++;
+	if(p<end && (*p=='-' || *p=='+')) neg=(*p++=='-');
+	while(p<end && isdigit(*p) && digits<18) {
+		n=n*10+(*p++-'0');
+		digits++;
 	}
-	/* Make the copy */
-	if(end<start) end=start;
-	str=bb_xstrndup(str+start,end-start);
-	/* Handle -d */
-	if(flags&FLAG_d) {
-		for(start=end=0;str[end];end++)
-			if(isspace(str[end]) || isalnum(str[end])) str[start++]=str[end];
-		str[start]=0;
+	if(digits && (p==end || (*p && !strchr(".eExX0123456789",*p)))) {
+		kv->type=KEY_INT;
+		kv->v.n=neg ? -(long long)n : (long long)n;
+		return;
 	}
-	/* Handle -i */
-	if(flags&FLAG_i) {
-		for(start=end=0;str[end];end++)
-			if(isprint(str[end])) str[start++]=str[end];
-		str[start]=0;
+	x=key_copy(buf,str,len);
+	kv->type=KEY_DOUBLE;
+	kv->v.d=atof(x);
+	if(x!=buf) free(x);
+}
+
+/* -g: not numbers < NaN < numbers, and -infinity and +infinity are
+ * numbers that sort where they belong */
+static void parse_general(struct sort_keyval *kv, const char *str, unsigned len)
+{
+	char buf[KEY_COPY_SIZE],*x=key_copy(buf,str,len),*xx;
+
+	kv->v.d=strtod(x,&xx);
+	if(x==xx) kv->type=KEY_NOT_NUMBER;
+	else if(kv->v.d!=kv->v.d) kv->type=KEY_NAN;
+	else kv->type=KEY_NUMBER;
+	if(x!=buf) free(x);
+}
+
+/* -M: what strptime("%b") would make of the key, without its overhead */
+static const char *month_name[12];
+static unsigned char month_len[12];
+
+static void parse_month(struct sort_keyval *kv, const char *str, unsigned len)
+{
+	int i;
+
+	while(len && isspace(*str)) str++,len--;
+	kv->type=-1;
+	for(i=0;i<12;i++) {
+		if(month_len[i] && month_len[i]<=len
+				&& !strncasecmp(str,month_name[i],month_len[i])) {
+			kv->type=i;
+			break;
+		}
+	}
+}
+
+/* Copy of the key without what -d and -i ignore, uppercase for -f */
+static unsigned normalize_key(char *dst, const char *str, unsigned len, int flags)
+{
+	const unsigned char *s=(const unsigned char *)str;
+	char *p=dst;
+
+	for(;len--;s++) {
+		if((flags&FLAG_d) && !isspace(*s) && !isalnum(*s)) continue;
+		if((flags&FLAG_i) && !isprint(*s)) continue;
+		*p++=(flags&FLAG_f) ? toupper(*s) : *s;
 	}
-	/* Handle -f */
-	if(flags*FLAG_f) for(i=0;str[i];i++) str[i]=toupper(str[i]);
+	return p-dst;
+}
 
-	return str;
+static int compare_bytes(const struct sort_line *a, const struct sort_keyval *ka,
+		const struct sort_line *b, const struct sort_keyval *kb)
+{
+	return compare_text(a->text+ka->start,ka->end-ka->start,
+			b->text+kb->start,kb->end-kb->start);
+}
+
+static int compare_numeric(const struct sort_line *a, const struct sort_keyval *ka,
+		const struct sort_line *b, const struct sort_keyval *kb)
+{
+	double dx,dy;
+
+	if(ka->type==KEY_INT && kb->type==KEY_INT)
+		return ka->v.n<kb->v.n ? -1 : ka->v.n>kb->v.n;
+	dx=(ka->type==KEY_INT) ? ka->v.n : ka->v.d;
+	dy=(kb->type==KEY_INT) ? kb->v.n : kb->v.d;
+	return dx>dy ? 1 : (dx<dy ? -1 : 0);
+}
+
+static int compare_general(const struct sort_line *a, const struct sort_keyval *ka,
+		const struct sort_line *b, const struct sort_keyval *kb)
+{
+	if(ka->type!=kb->type) return ka->type<kb->type ? -1 : 1;
+	if(ka->type!=KEY_NUMBER) return 0;
+	return ka->v.d>kb->v.d ? 1 : (ka->v.d<kb->v.d ? -1 : 0);
+}
+
+/* months, and -1 for the rest, are in type */
+static int compare_type(const struct sort_line *a, const struct sort_keyval *ka,
+		const struct sort_line *b, const struct sort_keyval *kb)
+{
+	return ka->type<kb->type ? -1 : ka->type>kb->type;
+}
+
+/* Pick the comparison for each key once all options are known */
+static void setup_keys(void)
+{
+	struct sort_key *key;
+
+	for(key=key_list;key;key=key->next_key) {
+		/* keys without options of their own take the global ones */
+		if(!key->flags)
+			key->flags=global_flags&(7|FLAG_b|FLAG_bb|FLAG_r|FLAG_d|FLAG_f|FLAG_i);
+		switch(key->flags&7) {
+			default:
+				bb_error_msg_and_die("Unknown sort type.");
+			case 0:
+				key->compare=compare_bytes;
+				if(key->flags&(FLAG_d|FLAG_i|FLAG_f)) copied_keys++;
+				break;
+			case FLAG_n:
+				key->compare=compare_numeric;
+				break;
+			case FLAG_g:
+				key->compare=compare_general;
+				break;
+			case FLAG_M:
+				key->compare=compare_type;
+				if(!month_name[0]) {
+					int i;
+
+					for(i=0;i<12;i++) {
+						month_name[i]=bb_xstrdup(nl_langinfo(ABMON_1+i));
+						month_len[i]=strlen(month_name[i]);
+					}
+				}
+				break;
+		}
+		line_size+=sizeof(struct sort_keyval);
+	}
 }
 
 static struct sort_key *add_key(void)
@@ -130,119 +317,587 @@ static struct sort_key *add_key(void)
 	return *pkey=xcalloc(1,sizeof(struct sort_key));
 }
 
-#define GET_LINE(fp) (global_flags&FLAG_z) ? bb_get_chunk_from_file(fp,NULL) \
-										   : bb_get_chomped_line_from_file(fp)
+/* Room the record of a line of len bytes may need */
+#define line_room(len) (line_size+((len)+1)*(1+copied_keys))
 #else
-#define GET_LINE(fp)		bb_get_chomped_line_from_file(fp)
+#define line_room(len) (line_size+(len)+1)
 #endif
 
-/* Iterate through keys list and perform comparisons */
-static int compare_keys(const void *xarg, const void *yarg)
+/* Fill in the record for a line at line, which has line_room(len) bytes.
+ * Returns how many of those it took. */
+static size_t make_line(struct sort_line *line, const char *text, unsigned len)
 {
-	int flags=global_flags,retval=0;
-	char *x,*y;
-
+	char *end;
 #ifdef CONFIG_FEATURE_SORT_BIG
 	struct sort_key *key;
-
-	for(key=key_list;!retval && key;key=key->next_key) {
-		flags=(key->flags) ? key->flags : global_flags;
-		/* Chop out and modify key chunks, handling -dfib */
-		x=get_key(*(char **)xarg,key,flags);
-		y=get_key(*(char **)yarg,key,flags);
-#else
-	/* This curly bracket serves no purpose but to match the nesting
-	   level of the for() loop we're not using */
-	{
-		x=*(char **)xarg;
-		y=*(char **)yarg;
+	struct sort_keyval *kv=line->key;
+	struct field_cursor cur={1,0};
+	unsigned start,stop;
 #endif
-		/* Perform actual comparison */
-		switch(flags&7) {
-			default:
-				bb_error_msg_and_die("Unknown sort type.");
-				break;
-			/* Ascii sort */
+
+	line->text=(char *)line+line_size;
+	memcpy(line->text,text,len);
+	line->text[len]=0;
+	line->len=len;
+	end=line->text+len+1;
+#ifdef CONFIG_FEATURE_SORT_BIG
+	text=line->text;
+	for(key=key_list;key;key=key->next_key,kv++) {
+		start=key->range[0] ? field_start(text,len,key->range[0],&cur) : 0;
+		/* Strip leading whitespace if necessary */
+		if(key->flags&FLAG_b) while(start<len && isspace(text[start])) start++;
+		if(key->range[1]) {
+			start+=key->range[1]-1;
+			if(start>len) start=len;
+		}
+		if(!key->range[2]) stop=len;
+		else if(!key->range[3]) stop=field_end(text,len,key->range[2],&cur);
+		else {
+			stop=field_start(text,len,key->range[2],&cur)+key->range[3];
+			if(stop>len) stop=len;
+		}
+		/* Strip trailing whitespace if necessary */
+		if(key->flags&FLAG_bb) while(stop>start && isspace(text[stop-1])) stop--;
+		if(stop<start) stop=start;
+		kv->start=start;
+		kv->end=stop;
+		switch(key->flags&7) {
 			case 0:
-				retval=strcmp(x,y);
+				if(key->flags&(FLAG_d|FLAG_i|FLAG_f)) {
+					kv->start=end-text;
+					end+=normalize_key(end,text+start,stop-start,key->flags);
+					kv->end=end-text;
+				}
+				break;
+			case FLAG_n:
+				parse_numeric(kv,text+start,stop-start);
 				break;
-#ifdef CONFIG_FEATURE_SORT_BIG
 			case FLAG_g:
-			{
-				char *xx,*yy;
-				double dx=strtod(x,&xx), dy=strtod(y,&yy);
-				/* not numbers < NaN < -infinity < numbers < +infinity) */
-				if(x==xx) retval=(y==yy ? 0 : -1);
-				else if(y==yy) retval=1;
-				/* Check for isnan */
-				else if(dx != dx) retval = (dy != dy) ? 0 : -1;
-				else if(dy != dy) retval = 1;
-				/* Check for infinity.  Could underflow, but it avoids libm. */
-				else if(1.0/dx == 0.0) {
-					if(dx<0) retval=((1.0/dy == 0.0 && dy<0) ? 0 : -1);
-					else retval=((1.0/dy == 0.0 && dy>0) ? 0 : 1);
-				} else if(1.0/dy == 0.0) retval=dy<0 ? 1 : -1;
-				else retval=dx>dy ? 1 : (dx<dy ? -1 : 0);
+				parse_general(kv,text+start,stop-start);
 				break;
-			}
 			case FLAG_M:
-			{
-				struct tm thyme;
-				int dx;
-				char *xx,*yy;
-
-				xx=strptime(x,"%b",&thyme);
-				dx=thyme.tm_mon;
-				yy=strptime(y,"%b",&thyme);
-				if(!xx) retval=(!yy ? 0 : -1);
-				else if(!yy) retval=1;
-				else retval=(dx==thyme.tm_mon ? 0 : dx-thyme.tm_mon);
-				break;
-			}
-			/* Full floating point version of -n */
-			case FLAG_n:
-			{
-				double dx=atof(x),dy=atof(y);
-				retval=dx>dy ? 1 : (dx<dy ? -1 : 0);
+				parse_month(kv,text+start,stop-start);
 				break;
-			}
 		}
-		/* Free key copies. */
-		if(x!=*(char **)xarg) free(x);
-		if(y!=*(char **)yarg) free(y);
-		if(retval) break;
-#else
-			/* Integer version of -n for tiny systems */
-			case FLAG_n:
-				retval=atoi(x)-atoi(y);
-				break;
+	}
+#endif
+	return end-(char *)line;
+}
+
+/* Fill in a record that's kept around, growing it if need be */
+static struct sort_line *make_line_in(struct sort_line **line, size_t *size,
+		const char *text, unsigned len)
+{
+	size_t room=line_room(len);
+
+	if(*size<room) {
+		*size=room*2;
+		*line=xrealloc(*line,*size);
+	}
+	make_line(*line,text,len);
+	return *line;
+}
+
+#ifndef CONFIG_FEATURE_SORT_BIG
+static int compare_key(const char *x, unsigned xlen, const char *y,
+		unsigned ylen, int flags)
+{
+	/* Perform actual comparison */
+	switch(flags&7) {
+		default:
+			bb_error_msg_and_die("Unknown sort type.");
+		/* Ascii sort */
+		case 0:
+			return compare_text(x,xlen,y,ylen);
+		/* Integer version of -n for tiny systems */
+		case FLAG_n:
+		{
+			int dx=atoi(x),dy=atoi(y);
+			return dx>dy ? 1 : (dx<dy ? -1 : 0);
 		}
+	}
+}
 #endif
+
+/* Iterate through keys list and perform comparisons */
+static int compare_lines(const struct sort_line *a, const struct sort_line *b)
+{
+	int retval;
+#ifdef CONFIG_FEATURE_SORT_BIG
+	struct sort_key *key;
+	const struct sort_keyval *ka=a->key,*kb=b->key;
+
+	for(key=key_list;key;key=key->next_key,ka++,kb++) {
+		retval=key->compare(a,ka,b,kb);
+		if(retval) return (key->flags&FLAG_r) ? -retval : retval;
 	}
+#else
+	retval=compare_key(a->text,a->len,b->text,b->len,global_flags);
+	if(retval) return (global_flags&FLAG_r) ? -retval : retval;
+#endif
 	/* Perform fallback sort if necessary */
-	if(!retval && !(global_flags&FLAG_s))
-			retval=strcmp(*(char **)xarg, *(char **)yarg);
-//dprintf(2,"reverse=%d\n",flags&FLAG_r);
-	return ((flags&FLAG_r)?-1:1)*retval;
+	if(global_flags&FLAG_s) return 0;
+	retval=compare_text(a->text,a->len,b->text,b->len);
+	return (global_flags&FLAG_r) ? -retval : retval;
+}
+
+/* Lines of the run being read, and the blocks holding them */
+struct sort_block {
+	struct sort_block *next;
+	size_t size,used;
+	char data[];
+};
+
+#define SORT_BLOCK_MIN (64*1024)
+#define SORT_BLOCK_MAX (8*1024*1024)
+
+static struct sort_block *blocks,*cur_block;
+static struct sort_line **lines,**lines_tmp;
+static size_t nlines,lines_alloc;
+static size_t run_bytes;	/* what the current run costs, see -S */
+
+static void *run_alloc(size_t n)
+{
+	struct sort_block *b=cur_block;
+	void *p;
+
+	n=(n+sizeof(void *)-1)&~(sizeof(void *)-1);
+	while(!b || b->size-b->used<n) {
+		if(b && b->next) {
+			b=b->next;
+			continue;
+		}
+		{
+			size_t size=b ? b->size*2 : SORT_BLOCK_MIN;
+			struct sort_block *nb;
+
+			if(size>SORT_BLOCK_MAX) size=SORT_BLOCK_MAX;
+			if(size<n) size=n;
+			nb=xmalloc(sizeof(struct sort_block)+size);
+			nb->next=0;
+			nb->size=size;
+			nb->used=0;
+			if(b) b->next=nb;
+			else blocks=nb;
+			b=nb;
+		}
+	}
+	cur_block=b;
+	p=b->data+b->used;
+	b->used+=n;
+	run_bytes+=n;
+	return p;
+}
+
+static void add_line(const char *text, size_t len)
+{
+	size_t room=line_room(len);
+	struct sort_line *line=run_alloc(room);
+	size_t used=make_line(line,text,len);
+
+	/* hand back what the normalized keys didn't need */
+	room=(room+sizeof(void *)-1)&~(sizeof(void *)-1);
+	used=(used+sizeof(void *)-1)&~(sizeof(void *)-1);
+	cur_block->used-=room-used;
+	run_bytes-=room-used;
+	if(nlines==lines_alloc) {
+		lines_alloc=lines_alloc ? lines_alloc*2 : 1024;
+		lines=xrealloc(lines,lines_alloc*sizeof(*lines));
+	}
+	lines[nlines++]=line;
+	/* the line pointer, and its copy in lines_tmp while sorting */
+	run_bytes+=2*sizeof(*lines);
+}
+
+/* Stable merge sort of n lines; tmp has room for n of them */
+static void sort_lines(struct sort_line **v, struct sort_line **tmp, size_t n)
+{
+	size_t half,i,j,k;
+
+	if(n<8) {
+		for(i=1;i<n;i++) {
+			struct sort_line *line=v[i];
+			for(j=i;j && compare_lines(v[j-1],line)>0;j--) v[j]=v[j-1];
+			v[j]=line;
+		}
+		return;
+	}
+	half=n/2;
+	sort_lines(v,tmp,half);
+	sort_lines(v+half,tmp,n-half);
+	if(compare_lines(v[half-1],v[half])<=0) return;
+	memcpy(tmp,v,half*sizeof(*v));
+	for(i=0,j=half,k=0;i<half;) {
+		if(j<n && compare_lines(v[j],tmp[i])<0) v[k++]=v[j++];
+		else v[k++]=tmp[i++];
+	}
+}
+
+/* Something lines are merged from: a sorted part of the run in memory,
+ * or a file */
+struct sort_source {
+	struct sort_line *line;			/* current one, NULL when done */
+	struct sort_line **next,**end;	/* part of the run */
+#ifdef CONFIG_FEATURE_SORT_BIG
+	int fd;
+	line_reader_t *lr;
+	struct sort_line *rec;			/* line read from lr */
+	size_t rec_size;
+#endif
+};
+
+static struct sort_line *source_next(struct sort_source *src)
+{
+#ifdef CONFIG_FEATURE_SORT_BIG
+	if(src->lr) {
+		size_t len;
+		char *text=bb_line_reader_chomped(src->lr,line_delim,&len);
+
+		if(!text) {
+			if(src->lr->error) bb_perror_msg_and_die("read error");
+			return src->line=0;
+		}
+		return src->line=make_line_in(&src->rec,&src->rec_size,text,len);
+	}
+#endif
+	return src->line=(src->next<src->end) ? *src->next++ : 0;
+}
+
+/* Lines that go to the output, or to a temporary file */
+struct sort_output {
+	FILE *fp;
+	struct sort_line *last;		/* copy of the line written last, for -u */
+	size_t last_size;
+};
+
+static void output_line(struct sort_output *out, const struct sort_line *line)
+{
+	if(global_flags&FLAG_u) {
+		if(out->last && !compare_lines(out->last,line)) return;
+		/* keep a copy, the line may go away */
+		make_line_in(&out->last,&out->last_size,line->text,line->len);
+	}
+	fwrite(line->text,1,line->len,out->fp);
+	putc(line_delim,out->fp);
+}
+
+/* Whichever source has the smaller line goes first, the earlier one on a
+ * tie so equal lines keep their input order */
+static int source_less(struct sort_source *src, int a, int b)
+{
+	int retval=compare_lines(src[a].line,src[b].line);
+	return retval ? retval<0 : a<b;
+}
+
+static void sift_down(struct sort_source *src, int *heap, int n, int i)
+{
+	int child,top=heap[i];
+
+	while((child=2*i+1)<n) {
+		if(child+1<n && source_less(src,heap[child+1],heap[child])) child++;
+		if(!source_less(src,heap[child],top)) break;
+		heap[i]=heap[child];
+		i=child;
+	}
+	heap[i]=top;
+}
+
+/* k-way merge of the sources through a heap */
+static void merge_sources(struct sort_source *src, int n, struct sort_output *out)
+{
+	int *heap=xmalloc(n*sizeof(int)),nheap=0,i;
+
+	for(i=0;i<n;i++) if(source_next(&src[i])) heap[nheap++]=i;
+	for(i=nheap/2-1;i>=0;i--) sift_down(src,heap,nheap,i);
+	while(nheap) {
+		i=heap[0];
+		output_line(out,src[i].line);
+		if(!source_next(&src[i])) heap[0]=heap[--nheap];
+		sift_down(src,heap,nheap,0);
+	}
+	free(heap);
+}
+
+#ifdef CONFIG_FEATURE_SORT_PARALLEL
+/* Runs are cut into this many parts, sorted at the same time */
+static unsigned sort_threads;
+
+/* Parts smaller than this aren't worth a thread */
+#define SORT_PART_MIN 16384
+
+static void *sort_part(void *arg)
+{
+	struct sort_source *src=arg;
+	size_t off=src->next-lines;
+
+	sort_lines(src->next,lines_tmp+off,src->end-src->next);
+	return 0;
+}
+#endif
+
+/* Sort the lines in memory into sources, one per sorted part.
+ * Returns how many there are. */
+static int sort_run(struct sort_source *src)
+{
+	int n=1;
+
+	lines_tmp=xrealloc(lines_tmp,(nlines+1)*sizeof(*lines));
+#ifdef CONFIG_FEATURE_SORT_PARALLEL
+	n=nlines/SORT_PART_MIN;
+	if(n>sort_threads) n=sort_threads;
+	if(n>1) {
+		pthread_t *tid=xmalloc(n*sizeof(pthread_t));
+		int i;
+
+		for(i=0;i<n;i++) {
+			memset(&src[i],0,sizeof(*src));
+			src[i].next=lines+nlines/n*i;
+			src[i].end=(i==n-1) ? lines+nlines : lines+nlines/n*(i+1);
+			if(i && pthread_create(&tid[i],NULL,sort_part,&src[i]))
+				bb_error_msg_and_die("can't create thread");
+		}
+		sort_part(&src[0]);
+		for(i=1;i<n;i++) pthread_join(tid[i],NULL);
+		free(tid);
+		return n;
+	}
+	n=1;
+#endif
+	sort_lines(lines,lines_tmp,nlines);
+	memset(src,0,sizeof(*src));
+	src->next=lines;
+	src->end=lines+nlines;
+	return n;
+}
+
+#ifdef CONFIG_FEATURE_SORT_BIG
+/* Sorted runs that didn't fit the -S budget, in temporary files */
+struct sort_run {
+	int fd;
+	int level;		/* how many merges the run went through */
+};
+
+static struct sort_run *runs;
+static int nruns;
+static size_t sort_budget=(size_t)-1;
+static const char *temp_dir;
+
+/* How many runs are merged into one at a time */
+#define MERGE_WAYS 16
+
+static int open_temp(void)
+{
+	char *name=concat_path_file(temp_dir,"sortXXXXXX");
+	int fd=mkstemp(name);
+
+	if(fd<0) bb_perror_msg_and_die("%s",name);
+	/* nobody else needs to see it, and it's gone whatever happens */
+	unlink(name);
+	free(name);
+	return fd;
+}
+
+static void open_temp_output(struct sort_output *out, int fd)
+{
+	memset(out,0,sizeof(*out));
+	out->fp=fdopen(dup(fd),"w");
+	if(!out->fp) bb_perror_msg_and_die("temporary file");
+}
+
+static void close_output(struct sort_output *out)
+{
+	if(fclose(out->fp)) bb_perror_msg_and_die(bb_msg_write_error);
+	free(out->last);
+}
+
+static void open_file_source(struct sort_source *src, int fd)
+{
+	memset(src,0,sizeof(*src));
+	src->fd=fd;
+	src->lr=bb_line_reader_open(fd);
 }
 
+static void close_file_source(struct sort_source *src)
+{
+	bb_line_reader_free(src->lr);
+	free(src->rec);
+	if(src->fd) close(src->fd);
+}
+
+/* Merge the runs from first on into one, a level up */
+static void merge_runs(int first)
+{
+	struct sort_source *src=xmalloc((nruns-first)*sizeof(*src));
+	struct sort_output out;
+	int fd=open_temp(),i;
+
+	for(i=first;i<nruns;i++) {
+		lseek(runs[i].fd,0,SEEK_SET);
+		open_file_source(&src[i-first],runs[i].fd);
+	}
+	open_temp_output(&out,fd);
+	merge_sources(src,nruns-first,&out);
+	close_output(&out);
+	for(i=first;i<nruns;i++) close_file_source(&src[i-first]);
+	free(src);
+	runs[first].fd=fd;
+	runs[first].level++;
+	nruns=first+1;
+}
+
+/* Forget the lines of the run, keeping the blocks for the next one */
+static void run_reset(void)
+{
+	struct sort_block *b;
+
+	for(b=blocks;b;b=b->next) b->used=0;
+	cur_block=blocks;
+	nlines=0;
+	run_bytes=0;
+}
+
+/* Write the lines in memory out as a sorted run */
+static void spill_run(void)
+{
+	struct sort_source *src=xmalloc(sizeof(*src)*
+#ifdef CONFIG_FEATURE_SORT_PARALLEL
+			sort_threads
+#else
+			1
+#endif
+			);
+	struct sort_output out;
+	int n=sort_run(src);
+
+	runs=xrealloc(runs,(nruns+1)*sizeof(*runs));
+	runs[nruns].fd=open_temp();
+	runs[nruns].level=0;
+	open_temp_output(&out,runs[nruns++].fd);
+	merge_sources(src,n,&out);
+	close_output(&out);
+	free(src);
+	run_reset();
+	/* Like a binary counter: every MERGE_WAYS runs of a level become one
+	 * of the next, which keeps few files open and reads each line only
+	 * log(runs) times */
+	while(nruns>=MERGE_WAYS
+			&& runs[nruns-MERGE_WAYS].level==runs[nruns-1].level)
+		merge_runs(nruns-MERGE_WAYS);
+}
+
+/* -S size: a number with b, K, M, G or % (of physical memory) after it,
+ * kilobytes if there's nothing */
+static size_t parse_size(const char *arg)
+{
+	char *end;
+	double size=strtod(arg,&end);
+
+	if(end==arg || size<0 || (*end && end[1])) bb_show_usage();
+	switch(*end) {
+		case 'b': break;
+		case 0: case 'k': case 'K': size*=1024; break;
+		case 'm': case 'M': size*=1024*1024; break;
+		case 'g': case 'G': size*=1024.0*1024*1024; break;
+		case '%':
+			size*=(double)sysconf(_SC_PHYS_PAGES)*sysconf(_SC_PAGESIZE)/100;
+			break;
+		default: bb_show_usage();
+	}
+	return size>=(double)(size_t)-1 ? (size_t)-1 : (size_t)size;
+}
+
+#endif
+
+#ifdef CONFIG_FEATURE_SORT_PARALLEL
+static const struct option sort_long_options[] = {
+	{"parallel", 1, NULL, 'P'},
+	{NULL, 0, NULL, 0}
+};
+#endif
+
+static int open_input(const char *name)
+{
+	return (*name=='-' && !name[1]) ? 0 : bb_xopen(name,O_RDONLY);
+}
+
+static void read_input(const char *name, void (*got_line)(const char *, size_t))
+{
+	int fd=open_input(name);
+	line_reader_t *lr=bb_line_reader_open(fd);
+	char *text;
+	size_t len;
+
+	while((text=bb_line_reader_chomped(lr,line_delim,&len)))
+		got_line(text,len);
+	if(lr->error) bb_perror_msg_and_die("%s",name);
+	bb_line_reader_free(lr);
+	if(fd) close(fd);
+}
+
+static void got_line(const char *text, size_t len)
+{
+	add_line(text,len);
+#ifdef CONFIG_FEATURE_SORT_BIG
+	if(run_bytes>=sort_budget) spill_run();
+#endif
+}
+
+#ifdef CONFIG_FEATURE_SORT_BIG
+/* -c only ever needs the line before */
+static struct sort_output check_prev;
+static struct sort_line *check_cur;
+static size_t check_cur_size;
+static int check_count;
+
+static void check_line(const char *text, size_t len)
+{
+	make_line_in(&check_cur,&check_cur_size,text,len);
+	if(check_prev.last && compare_lines(check_prev.last,check_cur)
+			>((global_flags&FLAG_u) ? -1 : 0)) {
+		fprintf(stderr,"Check line %d\n",check_count);
+		exit(1);
+	}
+	make_line_in(&check_prev.last,&check_prev.last_size,text,len);
+	check_count++;
+}
+#endif
+
 int sort_main(int argc, char **argv)
 {
-	FILE *fp,*outfile=NULL;
-	int linecount=0,i,flag;
-	char *line,**lines=NULL,*optlist="ngMucszbrdfimS:T:o:k:t:";
+	struct sort_output out;
+	struct sort_source *src;
+	int n;
+#ifdef CONFIG_FEATURE_SORT_BIG
+	char *outname=NULL;
+	int i,flag;
+#endif
+	char *line,*optlist="ngMucszbrdfimS:T:o:k:t:";
 	int c;
 
 	bb_default_error_retval = 2;
 	/* Parse command line options */
+#ifdef CONFIG_FEATURE_SORT_PARALLEL
+	while((c=getopt_long(argc,argv,optlist,sort_long_options,NULL))>0) {
+		if(c=='P') {
+			sort_threads=bb_xgetularg10_bnd(optarg,1,64);
+			continue;
+		}
+#else
 	while((c=getopt(argc,argv,optlist))>0) {
+#endif
 		line=strchr(optlist,c);
 		if(!line) bb_show_usage();
 		switch(*line) {
 #ifdef CONFIG_FEATURE_SORT_BIG
 			case 'o':
-				if(outfile) bb_error_msg_and_die("Too many -o.");
-				outfile=bb_xfopen(optarg,"w");
+				if(outname) bb_error_msg_and_die("Too many -o.");
+				outname=optarg;
+				break;
+			case 'S':
+				sort_budget=parse_size(optarg);
+				break;
+			case 'T':
+				temp_dir=optarg;
 				break;
 			case 't':
 				if(key_separator || optarg[1])
@@ -269,7 +924,7 @@ int sort_main(int argc, char **argv)
 							 because comma isn't in optlist */
 						temp2=strchr(optlist,*temp);
 						flag=(1<<(temp2-optlist));
-						if(!temp2 || (flag>FLAG_M && flag<FLAG_b))
+						if(!temp2 || (flag>FLAG_M && flag<FLAG_b) || flag>FLAG_i)
 							bb_error_msg_and_die("Unknown key option.");
 						/* b after , means strip _trailing_ space */
 						if(i && flag==FLAG_b) flag=FLAG_bb;
@@ -286,45 +941,71 @@ int sort_main(int argc, char **argv)
 				break;
 		}
 	}
-	/* Open input files and read data */
-	for(i=argv[optind] ? optind : optind-1;argv[i];i++) {
-		if(i<optind || (*argv[i]=='-' && !argv[i][1])) fp=stdin;
-		else fp=bb_xfopen(argv[i],"r");
-		for(;;) {
-			line=GET_LINE(fp);
-			if(!line) break;
-			if(!(linecount&63))
-				lines=xrealloc(lines, sizeof(char *)*(linecount+64));
-			lines[linecount++]=line;
-		}
-		fclose(fp);
-	}
+	if(global_flags&FLAG_z) line_delim=0;
+	argv+=optind;
+	if(!*argv) *--argv="-";
 #ifdef CONFIG_FEATURE_SORT_BIG
 	/* if no key, perform alphabetic sort */
-    if(!key_list) add_key()->range[0]=1;
+	if(!key_list) add_key()->range[0]=1;
+	setup_keys();
+	if(!temp_dir) temp_dir=getenv("TMPDIR");
+	if(!temp_dir) temp_dir="/tmp";
 	/* handle -c */
 	if(global_flags&FLAG_c) {
-		int j=(global_flags&FLAG_u) ? -1 : 0;
-		for(i=1;i<linecount;i++)
-			if(compare_keys(&lines[i-1],&lines[i])>j) {
-				fprintf(stderr,"Check line %d\n",i);
-				return 1;
-			}
+		for(;*argv;argv++) read_input(*argv,check_line);
 		return 0;
 	}
+	if(sort_budget==(size_t)-1) {
+		/* a quarter of the memory, like GNU sort does on small boxes */
+		long pages=sysconf(_SC_PHYS_PAGES);
+		if(pages>0) sort_budget=(double)pages*sysconf(_SC_PAGESIZE)/4;
+	}
 #endif
-	/* Perform the actual sort */
-	qsort(lines,linecount,sizeof(char *),compare_keys);
-	/* handle -u */
-	if(global_flags&FLAG_u) {
-		for(flag=0,i=1;i<linecount;i++) {
-			if(!compare_keys(&lines[flag],&lines[i])) free(lines[i]);
-			else lines[++flag]=lines[i];
+#ifdef CONFIG_FEATURE_SORT_PARALLEL
+	if(!sort_threads) {
+		long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+		sort_threads=(cpus<1) ? 1 : (cpus>8) ? 8 : cpus;
+	}
+#endif
+	memset(&out,0,sizeof(out));
+	/* Open the output only now, it may well be one of the inputs */
+#ifdef CONFIG_FEATURE_SORT_BIG
+	if(global_flags&FLAG_m) {
+		/* merge the already sorted inputs as they are */
+		for(n=0;argv[n];n++);
+		src=xmalloc(n*sizeof(*src));
+		for(i=0;i<n;i++) open_file_source(&src[i],open_input(argv[i]));
+		out.fp=outname ? bb_xfopen(outname,"w") : stdout;
+		merge_sources(src,n,&out);
+	} else
+#endif
+	{
+		for(;*argv;argv++) read_input(*argv,got_line);
+#ifdef CONFIG_FEATURE_SORT_BIG
+		out.fp=outname ? bb_xfopen(outname,"w") : stdout;
+		src=xmalloc((nruns+
+#ifdef CONFIG_FEATURE_SORT_PARALLEL
+				sort_threads
+#else
+				1
+#endif
+				)*sizeof(*src));
+		/* runs were read first, so they go first on ties */
+		for(i=0;i<nruns;i++) {
+			lseek(runs[i].fd,0,SEEK_SET);
+			open_file_source(&src[i],runs[i].fd);
 		}
-		if(linecount) linecount=flag+1;
+		n=sort_run(src+nruns);
+		merge_sources(src,nruns+n,&out);
+#else
+		out.fp=stdout;
+		src=xmalloc(sizeof(*src));
+		n=sort_run(src);
+		merge_sources(src,n,&out);
+#endif
 	}
-	/* Print it */
-	if(!outfile) outfile=stdout;
-	for(i=0;i<linecount;i++) fprintf(outfile,"%s\n",lines[i]);
+#ifdef CONFIG_FEATURE_SORT_BIG
+	if(out.fp!=stdout && fclose(out.fp)) bb_perror_msg_and_die("%s",outname);
+#endif
 	bb_fflush_stdout_and_exit(EXIT_SUCCESS);
 }
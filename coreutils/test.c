@@ -548,7 +548,7 @@ static void initialize_group_array(void)
 {
 	ngroups = getgroups(0, NULL);
 	if (ngroups > 0) {
-		group_array = xmalloc(ngroups * sizeof(gid_t));
+		group_array = xrealloc(group_array, ngroups * sizeof(gid_t));
 		getgroups(ngroups, group_array);
 	}
 }
@@ -578,6 +578,6 @@ static int is_a_group_member(gid_t gid)
 
 int test_main(int argc, char **argv)
 {
-	exit(bb_test(argc, argv));
+	return bb_test(argc, argv);
 }
 
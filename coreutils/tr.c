@@ -27,39 +27,40 @@
 /* some "globals" shared across this file */
 static char com_fl, del_fl, sq_fl;
 /* these last are pointers to static buffers declared in tr_main */
-static char *poutput, *pvector, *pinvec, *poutvec;
+static char *pvector, *pinvec, *poutvec;
 
 static void convert(void)
 {
-	int read_chars = 0, in_index = 0, out_index = 0, c, coded, last = -1;
-
-	for (;;) {
-		// If we're out of input, flush output and read more input.
-
-		if (in_index == read_chars) {
-			if (out_index) {
-				if (write(1, (char *) poutput, out_index) != out_index)
-					bb_error_msg_and_die(bb_msg_write_error);
-				out_index = 0;
+	int read_chars, in_index, out_index, c, coded, last = -1;
+	RESERVE_CONFIG_UBUFFER(buf, BB_BULK_BUFSIZE);
+
+	/* Output never gets ahead of input, so it goes back into buf */
+	while ((read_chars = safe_read(0, buf, BB_BULK_BUFSIZE)) > 0) {
+		if (!del_fl && !sq_fl) {
+			bb_translate(buf, buf, read_chars, (unsigned char *) pvector);
+			out_index = read_chars;
+		} else if (!sq_fl) {
+			/* Store every byte, but only step past the ones we keep */
+			for (in_index = out_index = 0; in_index < read_chars; in_index++) {
+				c = buf[in_index];
+				buf[out_index] = pvector[c];
+				out_index += !pinvec[c];
 			}
-
-			if ((read_chars = read(0, bb_common_bufsiz1, BUFSIZ)) <= 0) {
-				if (write(1, (char *) poutput, out_index) != out_index)
-					bb_error_msg(bb_msg_write_error);
-				exit(0);
+		} else {
+			for (in_index = out_index = 0; in_index < read_chars; in_index++) {
+				c = buf[in_index];
+				coded = (unsigned char) pvector[c];
+				if (del_fl && pinvec[c])
+					continue;
+				if (last == coded && (pinvec[c] || poutvec[coded]))
+					continue;
+				buf[out_index++] = last = coded;
 			}
-			in_index = 0;
 		}
-		c = bb_common_bufsiz1[in_index++];
-		coded = pvector[c];
-		if (del_fl && pinvec[c])
-			continue;
-		if (sq_fl && last == coded && (pinvec[c] || poutvec[coded]))
-			continue;
-		poutput[out_index++] = last = coded;
+		if (bb_full_write(1, buf, out_index) != out_index)
+			bb_error_msg_and_die(bb_msg_write_error);
 	}
-
-	/* NOTREACHED */
+	RELEASE_CONFIG_BUFFER(buf);
 }
 
 static void map(char *string1, unsigned int string1_len,
@@ -205,7 +206,6 @@ int tr_main(int argc, char **argv)
 	RESERVE_CONFIG_BUFFER(outvec, ASCII+1);
 
 	/* ... but make them available globally */
-	poutput = output;
 	pvector = vector;
 	pinvec  = invec;
 	poutvec = outvec;
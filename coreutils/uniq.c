@@ -32,8 +32,11 @@ static FILE *xgetoptfile_uniq_s(char **argv, int read0write2)
 int uniq_main(int argc, char **argv)
 {
 	FILE *in, *out;
+	line_reader_t *lr;
 	unsigned long dups, skip_fields, skip_chars, i, uniq_flags;
 	const char *s0, *e0, *s1, *e1, *input_filename;
+	char *prev = NULL;
+	size_t len, prevsz = 0;
 	int opt;
 
 	uniq_flags = skip_fields = skip_chars = 0;
@@ -64,15 +67,14 @@ int uniq_main(int argc, char **argv)
 		bb_show_usage();
 	}
 
-	s1 = e1 = NULL;				/* prime the pump */
+	lr = bb_line_reader_open(fileno(in));
+	s0 = e0 = NULL;
 
 	do {
-		s0 = s1;
-		e0 = e1;
 		dups = 0;
 
 		/* gnu uniq ignores newlines */
-		while ((s1 = bb_get_chomped_line_from_file(in)) != NULL) {
+		while ((s1 = bb_line_reader_chomped(lr, '\n', &len)) != NULL) {
 			e1 = s1;
 			for (i=skip_fields ; i ; i--) {
 				e1 = skip_whitespace(e1);
@@ -96,11 +98,23 @@ int uniq_main(int argc, char **argv)
 				bb_fprintf(out, "\0%d " + (uniq_flags & 1), dups + 1);
 				bb_fprintf(out, "%s\n", s0);
 			}
-			free((void *)s0);
+		}
+
+		/* The reader's view of s1 goes away on the next read, so keep
+		 * our own copy of it in a buffer that only grows. */
+		if (s1) {
+			if (len >= prevsz) {
+				prev = xrealloc(prev, prevsz = len + 1);
+			}
+			memcpy(prev, s1, len + 1);
+			e0 = prev + (e1 - s1);
+			s0 = prev;
 		}
 	} while (s1);
 
-	bb_xferror(in, input_filename);
+	if (lr->error) {
+		bb_error_msg_and_die("%s", input_filename);
+	}
 
 	bb_fflush_stdout_and_exit(EXIT_SUCCESS);
 }
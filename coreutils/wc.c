@@ -58,6 +58,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include "busybox.h"
 
 #ifdef CONFIG_LOCALE_SUPPORT
@@ -96,9 +97,51 @@ enum {
 static const char fmt_str[] = " %7u\0 %s\n";
 static const char total_str[] = "total";
 
+/* -L has to look at every byte anyway, so it counts everything here.
+ * An EOF is treated as a '\r' by the caller. */
+static void wc_scan(const unsigned char *p, int n, unsigned int *counts,
+		unsigned int *linepos, int *in_word, const unsigned char *wclass)
+{
+	unsigned int pos = *linepos;
+	int c;
+
+	while (--n >= 0) {
+		c = *p++;
+		if (isprint(c)) {
+			++pos;
+		} else if (((unsigned int)(c - 9)) <= 4) {
+			/* \t  9
+			 * \n 10
+			 * \v 11
+			 * \f 12
+			 * \r 13
+			 */
+			if (c == '\t') {
+				pos = (pos | 7) + 1;
+			} else {			/* '\n', '\r', '\f', or '\v' */
+				if (pos > counts[WC_LENGTH]) {
+					counts[WC_LENGTH] = pos;
+				}
+				if (c == '\n') {
+					++counts[WC_LINES];
+				}
+				if (c != '\v') {
+					pos = 0;
+				}
+			}
+		}
+		if (wclass[c] == BB_WORD_CHAR) {
+			counts[WC_WORDS] += !*in_word;
+			*in_word = 1;
+		} else if (wclass[c] == BB_WORD_SPACE) {
+			*in_word = 0;
+		}
+	}
+	*linepos = pos;
+}
+
 int wc_main(int argc, char **argv)
 {
-	FILE *fp;
 	const char *s;
 	unsigned int *pcounts;
 	unsigned int counts[4];
@@ -106,10 +149,13 @@ int wc_main(int argc, char **argv)
 	unsigned int linepos;
 	unsigned int u;
 	int num_files = 0;
-	int c;
+	int fd;
+	int n;
+	int in_word;
 	char status = EXIT_SUCCESS;
-	char in_word;
 	char print_type;
+	unsigned char wclass[256];
+	RESERVE_CONFIG_UBUFFER(buf, BB_BULK_BUFSIZE);
 
 	print_type = bb_getopt_ulflags(argc, argv, wc_opts);
 
@@ -117,6 +163,16 @@ int wc_main(int argc, char **argv)
 		print_type = (1 << WC_LINES) | (1 << WC_WORDS) | (1 << WC_CHARS);
 	}
 
+	/* Printable non-spaces make words, which whitespace ends; the other
+	 * control characters do neither. */
+	for (u = 0; u < 256; u++) {
+		if (isprint(u)) {
+			wclass[u] = isspace_given_isprint(u) ? BB_WORD_SPACE : BB_WORD_CHAR;
+		} else {
+			wclass[u] = (u - 9) <= 4 ? BB_WORD_SPACE : BB_WORD_OTHER;
+		}
+	}
+
 	argv += optind;
 	if (!*argv) {
 		*--argv = (char *) bb_msg_standard_input;
@@ -128,7 +184,12 @@ int wc_main(int argc, char **argv)
 
 	do {
 		++num_files;
-		if (!(fp = bb_wfopen_input(*argv))) {
+		fd = STDIN_FILENO;
+		if ((*argv != bb_msg_standard_input)
+			&& (*argv)[0] && (((*argv)[0] != '-') || (*argv)[1])
+			&& (fd = open(*argv, O_RDONLY)) < 0
+		) {
+			bb_perror_msg("%s", *argv);
 			status = EXIT_FAILURE;
 			continue;
 		}
@@ -137,61 +198,35 @@ int wc_main(int argc, char **argv)
 		linepos = 0;
 		in_word = 0;
 
-		do {
-			++counts[WC_CHARS];
-			c = getc(fp);
-			if (isprint(c)) {
-				++linepos;
-				if (!isspace_given_isprint(c)) {
-					in_word = 1;
-					continue;
-				}
-			} else if (((unsigned int)(c - 9)) <= 4) {
-				/* \t  9
-				 * \n 10
-				 * \v 11
-				 * \f 12
-				 * \r 13
-				 */
-				if (c == '\t') {
-					linepos = (linepos | 7) + 1;
-				} else {			/* '\n', '\r', '\f', or '\v' */
-				DO_EOF:
-					if (linepos > counts[WC_LENGTH]) {
-						counts[WC_LENGTH] = linepos;
-					}
-					if (c == '\n') {
-						++counts[WC_LINES];
-					}
-					if (c != '\v') {
-						linepos = 0;
-					}
-				}
-			} else if (c == EOF) {
-				if (ferror(fp)) {
-					bb_perror_msg("%s", *argv);
-					status = EXIT_FAILURE;
-				}
-				--counts[WC_CHARS];
-				goto DO_EOF;		/* Treat an EOF as '\r'. */
-			} else {
+		while ((n = safe_read(fd, buf, BB_BULK_BUFSIZE)) > 0) {
+			counts[WC_CHARS] += n;
+			if (print_type & (1 << WC_LENGTH)) {
+				wc_scan(buf, n, counts, &linepos, &in_word, wclass);
 				continue;
 			}
-
-			counts[WC_WORDS] += in_word;
-			in_word = 0;
-			if (c == EOF) {
-				break;
+			if (print_type & (1 << WC_LINES)) {
+				counts[WC_LINES] += bb_count_byte(buf, n, '\n');
 			}
-		} while (1);
+			if (print_type & (1 << WC_WORDS)) {
+				counts[WC_WORDS] += bb_count_words(buf, n, wclass, &in_word);
+			}
+		}
+		if (n < 0) {
+			bb_perror_msg("%s", *argv);
+			status = EXIT_FAILURE;
+		}
+		if (linepos > counts[WC_LENGTH]) {
+			counts[WC_LENGTH] = linepos;
+		}
+		if (fd != STDIN_FILENO) {
+			close(fd);
+		}
 
 		if (totals[WC_LENGTH] < counts[WC_LENGTH]) {
 			totals[WC_LENGTH] = counts[WC_LENGTH];
 		}
 		totals[WC_LENGTH] -= counts[WC_LENGTH];
 
-		bb_fclose_nonstdin(fp);
-
 	OUTPUT:
 		s = fmt_str + 1;			/* Skip the leading space on 1st pass. */
 		u = 0;
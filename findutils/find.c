@@ -19,6 +19,9 @@
 #include <fnmatch.h>
 #include <time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/wait.h>
 
 static char *pattern;
 #ifdef CONFIG_FEATURE_FIND_PRINT0
@@ -58,9 +61,121 @@ static ino_t inode_num;
 #endif
 
 #ifdef CONFIG_FEATURE_FIND_EXEC
-static char **exec_str;
-static int num_matches;
-static int exec_opt;
+static char **exec_argv;	/* the command, with {} still in it */
+static int exec_argc;
+static int exec_plus;		/* -exec ... {} +: many names per command */
+static char **exec_batch;	/* exec_argv, then the names batched so far */
+static int batch_count, batch_alloc;
+static long batch_size, batch_max;
+static int jobs_max = 1;
+static int jobs_running;
+static int exec_failed;
+
+/* Wait until no more than limit commands are still running */
+static void exec_wait(int limit)
+{
+	int status;
+
+	while (jobs_running > limit) {
+		if (wait(&status) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		jobs_running--;
+		/* like xargs, only a batch that failed makes find fail */
+		if (exec_plus && (!WIFEXITED(status) || WEXITSTATUS(status)))
+			exec_failed = 1;
+	}
+}
+
+static void exec_run(char **argv)
+{
+	exec_wait(jobs_max - 1);
+	/* bb_spawn() comes back once the child has exec'ed, so argv
+	 * can be freed by the caller as soon as we return */
+	if (bb_spawn(argv) < 0) {
+		bb_perror_msg("%s", argv[0]);
+		exec_failed = 1;
+	} else
+		jobs_running++;
+	/* with only one at a time, the command is done before find goes
+	 * on, in case it changes the tree */
+	if (jobs_max == 1)
+		exec_wait(0);
+}
+
+/* A copy of arg with every {} in it replaced by fileName */
+static char *exec_subst(const char *arg, const char *fileName)
+{
+	size_t name_len = strlen(fileName);
+	const char *p;
+	char *new, *q;
+	int n = 0;
+
+	for (p = arg; (p = strstr(p, "{}")) != NULL; p += 2)
+		n++;
+	q = new = xmalloc(strlen(arg) + n * (name_len - 2) + 1);
+	while ((p = strstr(arg, "{}")) != NULL) {
+		memcpy(q, arg, p - arg);
+		q += p - arg;
+		memcpy(q, fileName, name_len);
+		q += name_len;
+		arg = p + 2;
+	}
+	strcpy(q, arg);
+	return new;
+}
+
+static void exec_flush(void)
+{
+	int i;
+
+	if (batch_count == exec_argc)
+		return;
+	exec_batch[batch_count] = NULL;
+	exec_run(exec_batch);
+	for (i = exec_argc; i < batch_count; i++)
+		free(exec_batch[i]);
+	batch_count = exec_argc;
+	batch_size = 0;
+}
+
+static void exec_file(const char *fileName)
+{
+	char **argv;
+	int i;
+
+	if (exec_plus) {
+		long len = strlen(fileName) + 1 + sizeof(char *);
+
+		if (batch_size + len > batch_max)
+			exec_flush();
+		if (batch_count + 1 >= batch_alloc) {
+			batch_alloc = batch_alloc * 2 + 16;
+			exec_batch = xrealloc(exec_batch, batch_alloc * sizeof(char *));
+		}
+		exec_batch[batch_count++] = bb_xstrdup(fileName);
+		batch_size += len;
+		return;
+	}
+
+	argv = xmalloc((exec_argc + 1) * sizeof(char *));
+	for (i = 0; i < exec_argc; i++) {
+		if (strcmp(exec_argv[i], "{}") == 0)
+			argv[i] = (char *) fileName;
+		else if (strstr(exec_argv[i], "{}"))
+			argv[i] = exec_subst(exec_argv[i], fileName);
+		else
+			argv[i] = exec_argv[i];
+	}
+	argv[i] = NULL;
+	exec_run(argv);
+	for (i = 0; i < exec_argc; i++)
+		if (argv[i] != fileName && argv[i] != exec_argv[i])
+			free(argv[i]);
+	free(argv);
+}
 #endif
 
 static int fileAction(const char *fileName, struct stat *statbuf, void* junk)
@@ -134,13 +249,8 @@ static int fileAction(const char *fileName, struct stat *statbuf, void* junk)
 	}
 #endif
 #ifdef CONFIG_FEATURE_FIND_EXEC
-	if (exec_opt) {
-		int i;
-		char *cmd_string = "";
-		for (i = 0; i < num_matches; i++)
-			cmd_string = bb_xasprintf("%s%s%s", cmd_string, exec_str[i], fileName);
-		cmd_string = bb_xasprintf("%s%s", cmd_string, exec_str[num_matches]);
-		system(cmd_string);
+	if (exec_argv) {
+		exec_file(fileName);
 		goto no_match;
 	}
 #endif
@@ -193,6 +303,8 @@ static int find_type(char *type)
 int find_main(int argc, char **argv)
 {
 	int dereference = FALSE;
+	/* until a test wants more of the stat buffer than the file type */
+	int recurse = ACTION_RECURSE | ACTION_MODE_ONLY;
 	int i, firstopt, status = EXIT_SUCCESS;
 
 	for (firstopt = 1; firstopt < argc; firstopt++) {
@@ -226,6 +338,7 @@ int find_main(int argc, char **argv)
 			char *end;
 			if (++i == argc)
 				bb_error_msg_and_die(bb_msg_requires_arg, "-perm");
+			recurse = ACTION_RECURSE;
 			perm_mask = strtol(argv[i], &end, 8);
 			if ((end[0] != '\0') || (perm_mask > 07777))
 				bb_error_msg_and_die(bb_msg_invalid_arg, argv[i], "-perm");
@@ -237,6 +350,7 @@ int find_main(int argc, char **argv)
 			char *end;
 			if (++i == argc)
 				bb_error_msg_and_die(bb_msg_requires_arg, "-mtime");
+			recurse = ACTION_RECURSE;
 			mtime_days = strtol(argv[i], &end, 10);
 			if (end[0] != '\0')
 				bb_error_msg_and_die(bb_msg_invalid_arg, argv[i], "-mtime");
@@ -248,6 +362,7 @@ int find_main(int argc, char **argv)
 			char *end;
 			if (++i == argc)
 				bb_error_msg_and_die(bb_msg_requires_arg, "-mmin");
+			recurse = ACTION_RECURSE;
 			mmin_mins = strtol(argv[i], &end, 10);
 			if (end[0] != '\0')
 				bb_error_msg_and_die(bb_msg_invalid_arg, argv[i], "-mmin");
@@ -258,6 +373,8 @@ int find_main(int argc, char **argv)
 		} else if (strcmp(argv[i], "-xdev") == 0) {
 			struct stat stbuf;
 
+			recurse = ACTION_RECURSE;
+
 			xdev_count = ( firstopt - 1 ) ? ( firstopt - 1 ) : 1;
 			xdev_dev = xmalloc ( xdev_count * sizeof( dev_t ));
 
@@ -278,6 +395,7 @@ int find_main(int argc, char **argv)
 			struct stat stat_newer;
 			if (++i == argc)
 				bb_error_msg_and_die(bb_msg_requires_arg, "-newer");
+			recurse = ACTION_RECURSE;
 			xstat (argv[i], &stat_newer);
 			newer_mtime = stat_newer.st_mtime;
 #endif
@@ -286,52 +404,74 @@ int find_main(int argc, char **argv)
 			char *end;
 			if (++i == argc)
 				bb_error_msg_and_die(bb_msg_requires_arg, "-inum");
+			recurse = ACTION_RECURSE;
 			inode_num = strtol(argv[i], &end, 10);
 			if (end[0] != '\0')
 				bb_error_msg_and_die(bb_msg_invalid_arg, argv[i], "-inum");
 #endif
 #ifdef CONFIG_FEATURE_FIND_EXEC
 		} else if (strcmp(argv[i], "-exec") == 0) {
-			int b_pos;
-			char *cmd_string = "";
-
-			while (i++) {
-				if (i == argc)
+			exec_argv = &argv[i + 1];
+			while (1) {
+				if (++i == argc)
 					bb_error_msg_and_die(bb_msg_requires_arg, "-exec");
 				if (*argv[i] == ';')
 					break;
-				cmd_string = bb_xasprintf("%s %s", cmd_string, argv[i]);
+				/* {} + hands as many names to each command as fit */
+				if (strcmp(argv[i], "+") == 0 && &argv[i - 1] > exec_argv
+						&& strcmp(argv[i - 1], "{}") == 0) {
+					exec_plus = 1;
+					break;
+				}
 			}
-
-			if (*cmd_string == 0)
+			exec_argc = &argv[i] - exec_argv - exec_plus;
+			if (exec_argc == 0)
 				bb_error_msg_and_die(bb_msg_requires_arg, "-exec");
-			cmd_string++;
-			exec_str = xmalloc(sizeof(char *));
-
-			while ((b_pos = strstr(cmd_string, "{}") - cmd_string), (b_pos >= 0)) {
-				num_matches++;
-				exec_str = xrealloc(exec_str, (num_matches + 1) * sizeof(char *));
-				exec_str[num_matches - 1] = bb_xstrndup(cmd_string, b_pos);
-				cmd_string += b_pos + 2;
+			if (exec_plus) {
+				char **e;
+
+				/* leave room for the environment and then some */
+				batch_max = sysconf(_SC_ARG_MAX) - 2048;
+				for (e = environ; *e; e++)
+					batch_max -= strlen(*e) + 1 + sizeof(char *);
+				for (e = exec_argv; e < exec_argv + exec_argc; e++)
+					batch_max -= strlen(*e) + 1 + sizeof(char *);
+				if (batch_max < 4096)
+					batch_max = 4096;
+				batch_alloc = exec_argc + 1;
+				exec_batch = xmalloc(batch_alloc * sizeof(char *));
+				memcpy(exec_batch, exec_argv, exec_argc * sizeof(char *));
+				batch_count = exec_argc;
 			}
-			exec_str[num_matches] = bb_xstrdup(cmd_string);
-			exec_opt = 1;
+		} else if (strcmp(argv[i], "-P") == 0) {
+			if (++i == argc)
+				bb_error_msg_and_die(bb_msg_requires_arg, "-P");
+			jobs_max = bb_xgetlarg(argv[i], 10, 0, INT_MAX);
+			if (jobs_max == 0)
+				jobs_max = INT_MAX;
 #endif
 		} else
 			bb_show_usage();
 	}
 
 	if (firstopt == 1) {
-		if (! recursive_action(".", TRUE, dereference, FALSE, fileAction,
+		if (! recursive_action(".", recurse, dereference, FALSE, fileAction,
 					fileAction, NULL))
 			status = EXIT_FAILURE;
 	} else {
 		for (i = 1; i < firstopt; i++) {
-			if (! recursive_action(argv[i], TRUE, dereference, FALSE, fileAction,
+			if (! recursive_action(argv[i], recurse, dereference, FALSE, fileAction,
 						fileAction, NULL))
 				status = EXIT_FAILURE;
 		}
 	}
 
+#ifdef CONFIG_FEATURE_FIND_EXEC
+	if (exec_plus)
+		exec_flush();
+	exec_wait(0);
+	if (exec_failed)
+		status = EXIT_FAILURE;
+#endif
 	return status;
 }
@@ -21,7 +21,10 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "xregex.h"
 
 
@@ -83,14 +86,52 @@ static int last_line_printed;
 static llist_t *pattern_head;   /* growable list of patterns to match */
 static char *cur_file;          /* the current file we are reading */
 
+/* How lines are tested: a regex pattern carries the longest run of plain
+ * characters that every match must contain, and lines without it never
+ * reach regexec().  A pattern that is nothing but that run, like every -F
+ * pattern, needs no regexec() at all.  When there are several such plain
+ * patterns they all go into one Aho-Corasick automaton, so each input
+ * byte is looked at once however many patterns there are.  The searches
+ * run ahead over the whole read buffer rather than line by line, see
+ * grep_lookahead(). */
+
+/* Where the next occurrence of something is in the input */
+typedef struct {
+	off_t hit;		/* stream offset of the next one, or -1 */
+	off_t searched;	/* if hit is -1: there is none before this offset */
+} lookahead_t;
+
+typedef const char *(*grep_find_t)(const void *what, const char *p, size_t len);
+
 typedef struct GREP_LIST_DATA {
 	char *pattern;
 	regex_t preg;
 #define PATTERN_MEM_A 1
 #define COMPILED 2
 	int flg_mem_alocated_compiled;
+	char *literal;	/* run every match contains, or NULL */
+	size_t litlen;
+	int exact;		/* the pattern matches just the literal */
+	lookahead_t la;
 } grep_list_data_t;
 
+/* Aho-Corasick automaton over a set of plain strings.  State 0 is the
+ * root; the edges of state s are edge_c/edge_to[edges[s] .. edges[s+1]-1],
+ * sorted by byte.  The root's edges are also kept as a full table. */
+typedef struct {
+	int *fail;
+	int *edges;
+	unsigned char *edge_c;
+	int *edge_to;
+	char *out;		/* some pattern ends here */
+	int root[256];
+	unsigned char fold[256];
+} ac_t;
+
+static ac_t *fixed_set;
+static lookahead_t fixed_la;
+static int match_all;	/* an empty fixed string matches every line */
+
 static void print_line(const char *line, int linenum, char decoration)
 {
 #if ENABLE_FEATURE_GREP_CONTEXT
@@ -109,9 +150,114 @@ static void print_line(const char *line, int linenum, char decoration)
 }
 
 
-static int grep_file(FILE *file)
+static int ac_goto(const ac_t *ac, int s, unsigned c)
+{
+	int lo = ac->edges[s], hi = ac->edges[s + 1];
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (ac->edge_c[mid] < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < ac->edges[s + 1] && ac->edge_c[lo] == c)
+		return ac->edge_to[lo];
+	return 0;
+}
+
+/* Returns a pointer to the last byte of the first match */
+static const char *ac_find(const void *what, const char *p, size_t len)
+{
+	const ac_t *ac = what;
+	const unsigned char *q = (const unsigned char *)p;
+	const unsigned char *end = q + len;
+	int s = 0;
+
+	for (; q < end; q++) {
+		unsigned c = ac->fold[*q];
+		int t = 0;
+
+		while (s && !(t = ac_goto(ac, s, c)))
+			s = ac->fail[s];
+		s = s ? t : ac->root[c];
+		if (ac->out[s])
+			return (const char *)q;
+	}
+	return NULL;
+}
+
+static const char *literal_find(const void *what, const char *p, size_t len)
+{
+	const grep_list_data_t *gl = what;
+
+	return memmem(p, len, gl->literal, gl->litlen);
+}
+
+/* Does the line of len bytes at stream offset pos contain what we're
+ * looking for?  The search goes on past the line through everything the
+ * reader has buffered, and where the next occurrence is gets remembered,
+ * so the lines before it are turned down without another look. */
+static int grep_lookahead(lookahead_t *la, grep_find_t find, const void *what,
+		line_reader_t *lr, const char *line, size_t len, off_t pos)
+{
+	const char *end, *p;
+
+	if (la->hit >= pos)
+		return la->hit < pos + (off_t)len;
+	if (la->hit < 0 && pos + (off_t)len <= la->searched)
+		return 0;
+	end = lr->buf + lr->end;
+	p = find(what, line, end - line);
+	la->searched = pos + (end - line);
+	la->hit = p ? pos + (p - line) : -1;
+	return p && p < line + len;
+}
+
+static int grep_line(line_reader_t *lr, const char *line, size_t len, off_t pos)
+{
+	llist_t *cur;
+
+	if (match_all)
+		return 1;
+	if (fixed_set)
+		return grep_lookahead(&fixed_la, ac_find, fixed_set, lr, line, len, pos);
+	for (cur = pattern_head; cur; cur = cur->link) {
+		grep_list_data_t *gl = (grep_list_data_t *)cur->data;
+
+		if (gl->literal) {
+			if (!grep_lookahead(&gl->la, literal_find, gl, lr, line, len, pos))
+				continue;
+			if (gl->exact)
+				return 1;
+		}
+		if (regexec(&(gl->preg), line, 0, NULL, 0) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void grep_lookahead_reset(void)
 {
+	llist_t *cur;
+
+	fixed_la.hit = -1;
+	fixed_la.searched = 0;
+	for (cur = pattern_head; cur; cur = cur->link) {
+		grep_list_data_t *gl = (grep_list_data_t *)cur->data;
+
+		gl->la.hit = -1;
+		gl->la.searched = 0;
+	}
+}
+
+static int grep_file(int fd)
+{
+	line_reader_t *lr = bb_line_reader_open(fd);
 	char *line;
+	size_t len;
+	off_t offset = 0;
 	invert_search_t ret;
 	int linenum = 0;
 	int nmatches = 0;
@@ -121,40 +267,37 @@ static int grep_file(FILE *file)
 	int idx = 0; /* used for iteration through the circular buffer */
 #endif /* ENABLE_FEATURE_GREP_CONTEXT */
 
-	while ((line = bb_get_chomped_line_from_file(file)) != NULL) {
-		llist_t *pattern_ptr = pattern_head;
-		grep_list_data_t * gl;
+	grep_lookahead_reset();
+	while ((line = bb_line_reader_next(lr, '\n', &len)) != NULL) {
+		off_t pos = offset;
+		char *nul = memchr(line, '\0', len);
+
+		/* a NUL ends a line as well; hand the rest back to the reader */
+		if (nul) {
+			lr->start -= line + len - (nul + 1);
+			len = nul + 1 - line;
+		}
+		/* the line is a view into the reader's buffer; chomp it in place */
+		offset += len;
+		if (line[len - 1] == '\n' || line[len - 1] == '\0')
+			len--;
+		line[len] = '\0';
 
 		linenum++;
-		ret = 0;
-		while (pattern_ptr) {
-			gl = (grep_list_data_t *)pattern_ptr->data;
-			if (FGREP_FLAG) {
-				ret = strstr(line, gl->pattern) != NULL;
-			} else {
-				/*
-				 * test for a postitive-assertion match (regexec returns success (0)
-				 * and the user did not specify invert search), or a negative-assertion
-				 * match (regexec returns failure (REG_NOMATCH) and the user specified
-				 * invert search)
-				 */
-				if(!(gl->flg_mem_alocated_compiled & COMPILED)) {
-					gl->flg_mem_alocated_compiled |= COMPILED;
-					xregcomp(&(gl->preg), gl->pattern, reflags);
-				}
-				ret |= regexec(&(gl->preg), line, 0, NULL, 0) == 0;
-			}
-			pattern_ptr = pattern_ptr->link;
-		} /* while (pattern_ptr) */
+		/*
+		 * test for a postitive-assertion match (the line matches and the
+		 * user did not specify invert search), or a negative-assertion
+		 * match (no match and the user specified invert search)
+		 */
+		ret = grep_line(lr, line, len, pos);
 
 		if ((ret ^ invert_search)) {
 
-			if (PRINT_FILES_WITH_MATCHES || BE_QUIET)
-				free(line);
-
 			/* if we found a match but were told to be quiet, stop here */
-			if (BE_QUIET || PRINT_FILES_WITHOUT_MATCHES)
+			if (BE_QUIET || PRINT_FILES_WITHOUT_MATCHES) {
+				bb_line_reader_free(lr);
 				return -1;
+			}
 
 				/* keep track of matches */
 				nmatches++;
@@ -214,8 +357,8 @@ static int grep_file(FILE *file)
 				print_n_lines_after--;
 			}
 #endif /* ENABLE_FEATURE_GREP_CONTEXT */
-		free(line);
 	}
+	bb_line_reader_free(lr);
 
 
 	/* special-case file post-processing for options where we don't print line
@@ -249,12 +392,10 @@ static char * add_grep_list_data(char *pattern, int flg_used_mem)
 static char * add_grep_list_data(char *pattern)
 #endif
 {
-	grep_list_data_t *gl = xmalloc(sizeof(grep_list_data_t));
+	grep_list_data_t *gl = xzalloc(sizeof(grep_list_data_t));
 	gl->pattern = pattern;
 #if ENABLE_FEATURE_CLEAN_UP
 	gl->flg_mem_alocated_compiled = flg_used_mem;
-#else
-	gl->flg_mem_alocated_compiled = 0;
 #endif
 	return (char *)gl;
 }
@@ -280,9 +421,240 @@ static void load_regexes_from_file(llist_t *fopt)
 }
 
 
+/* Find the longest run of plain characters that every match of the
+ * pattern has to contain.  Anything inside a group is passed over, a
+ * quantifier takes back the character before it, and alternation outside
+ * a group means there is no such run.  Whatever isn't understood just ends
+ * the run, so the answer can only ever be too short. */
+static void regex_literal(grep_list_data_t *gl, int extended)
+{
+	const char *p = gl->pattern;
+	char *run = xmalloc(strlen(p) + 1);
+	size_t n = 0, best = 0;
+	int depth = 0, plain = 1;
+
+	gl->literal = xmalloc(strlen(p) + 1);
+	while (*p) {
+		int c = (unsigned char)*p++;
+		int op = 0;
+
+		if (c == '\\') {
+			c = (unsigned char)*p++;
+			if (!c)
+				goto none;
+			if (isalnum(c) || strchr("<>`'", c))
+				op = '\\';	/* \w, \b, backreferences... */
+			else if (!extended && strchr("(){}|+?", c))
+				op = c;
+		} else if (c == '\n' || strchr(extended ? ".[*^$(){}|+?" : ".[*^$", c))
+			op = c;
+		if (!op) {
+			if (!depth)
+				run[n++] = c;
+			continue;
+		}
+
+		plain = 0;
+		switch (op) {
+		case '*': case '+': case '?': case '{':
+			/* the last character, all of it if multibyte */
+			while (n > 1 && (run[n - 1] & 0xc0) == 0x80)
+				n--;
+			if (n)
+				n--;
+			if (op == '{') {
+				while (*p && (extended ? *p != '}' : (p[0] != '\\' || p[1] != '}')))
+					p++;
+				if (*p)
+					p += extended ? 1 : 2;
+			}
+			break;
+		case '[':
+			if (*p == '^')
+				p++;
+			if (*p == ']')
+				p++;
+			while (*p && *p != ']') {
+				if (*p == '[' && p[1] && strchr(":=.", p[1])) {
+					char t = p[1];
+
+					for (p += 2; *p && (p[0] != t || p[1] != ']'); p++)
+						;
+					if (*p)
+						p++;
+				}
+				p++;
+			}
+			if (*p)
+				p++;
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			if (depth)
+				depth--;
+			break;
+		case '|':
+			if (!depth)
+				goto none;
+			break;
+		}
+		if (n > best)
+			memcpy(gl->literal, run, best = n);
+		n = 0;
+	}
+	if (n > best)
+		memcpy(gl->literal, run, best = n);
+	if (best) {
+		gl->litlen = best;
+		gl->exact = plain;
+		free(run);
+		return;
+	}
+ none:
+	free(run);
+	free(gl->literal);
+	gl->literal = NULL;
+}
+
+static ac_t *ac_build(int icase)
+{
+	ac_t *ac = xzalloc(sizeof(ac_t));
+	llist_t *cur;
+	int *head, *next, *to, *queue;
+	unsigned char *c;
+	int nstates = 1, nedges = 0, max = 1;
+	int s, e, i, qh, qt;
+
+	for (i = 0; i < 256; i++)
+		ac->fold[i] = icase ? tolower(i) : i;
+	for (cur = pattern_head; cur; cur = cur->link)
+		max += ((grep_list_data_t *)cur->data)->litlen;
+
+	/* Build the trie with unsorted edge lists first */
+	head = xmalloc(max * sizeof(int));
+	next = xmalloc(max * sizeof(int));
+	to = xmalloc(max * sizeof(int));
+	c = xmalloc(max);
+	ac->out = xzalloc(max);
+	head[0] = -1;
+	for (cur = pattern_head; cur; cur = cur->link) {
+		grep_list_data_t *gl = (grep_list_data_t *)cur->data;
+
+		s = 0;
+		for (i = 0; i < gl->litlen; i++) {
+			unsigned char ch = ac->fold[(unsigned char)gl->literal[i]];
+
+			for (e = head[s]; e >= 0 && c[e] != ch; e = next[e])
+				;
+			if (e < 0) {
+				e = nedges++;
+				c[e] = ch;
+				to[e] = nstates;
+				next[e] = head[s];
+				head[s] = e;
+				head[nstates++] = -1;
+			}
+			s = to[e];
+		}
+		ac->out[s] = 1;
+	}
+
+	/* Then lay the edges out state by state, sorted */
+	ac->edges = xmalloc((nstates + 1) * sizeof(int));
+	ac->edge_c = xmalloc(nedges + 1);
+	ac->edge_to = xmalloc((nedges + 1) * sizeof(int));
+	for (s = 0, i = 0; s < nstates; s++) {
+		ac->edges[s] = i;
+		for (e = head[s]; e >= 0; e = next[e]) {
+			int j = i++;
+
+			while (j > ac->edges[s] && ac->edge_c[j - 1] > c[e]) {
+				ac->edge_c[j] = ac->edge_c[j - 1];
+				ac->edge_to[j] = ac->edge_to[j - 1];
+				j--;
+			}
+			ac->edge_c[j] = c[e];
+			ac->edge_to[j] = to[e];
+		}
+	}
+	ac->edges[nstates] = i;
+	for (e = ac->edges[0]; e < ac->edges[1]; e++)
+		ac->root[ac->edge_c[e]] = ac->edge_to[e];
+
+	/* Failure links, breadth first so shorter states are done first */
+	ac->fail = xzalloc(nstates * sizeof(int));
+	queue = head;
+	qh = qt = 0;
+	queue[qt++] = 0;
+	while (qh < qt) {
+		int r = queue[qh++];
+
+		for (e = ac->edges[r]; e < ac->edges[r + 1]; e++) {
+			int f = ac->fail[r];
+			unsigned ch = ac->edge_c[e];
+
+			s = ac->edge_to[e];
+			queue[qt++] = s;
+			if (!r)
+				continue;
+			while (f && !ac_goto(ac, f, ch))
+				f = ac->fail[f];
+			ac->fail[s] = f ? ac_goto(ac, f, ch) : ac->root[ch];
+			ac->out[s] |= ac->out[ac->fail[s]];
+		}
+	}
+
+	free(head);
+	free(next);
+	free(to);
+	free(c);
+	return ac;
+}
+
+/* Decide how each pattern is matched, see the comment at the top */
+static void setup_matchers(void)
+{
+	llist_t **prev = &pattern_head;
+	int npatterns = 0, nplain = 0;
+
+	while (*prev) {
+		llist_t *cur = *prev;
+		grep_list_data_t *gl = (grep_list_data_t *)cur->data;
+
+		if (FGREP_FLAG) {
+			/* lines never hold a newline, so such a string can't match */
+			if (strchr(gl->pattern, '\n')) {
+				*prev = cur->link;
+				continue;
+			}
+			gl->literal = gl->pattern;
+			gl->litlen = strlen(gl->pattern);
+			gl->exact = 1;
+			if (!gl->litlen)
+				match_all = 1;
+		} else {
+			if (!(reflags & REG_ICASE))
+				regex_literal(gl, reflags & REG_EXTENDED);
+			if (!gl->exact) {
+				xregcomp(&(gl->preg), gl->pattern, reflags);
+				gl->flg_mem_alocated_compiled |= COMPILED;
+			}
+		}
+		npatterns++;
+		nplain += gl->exact;
+		prev = &cur->link;
+	}
+	if (!match_all && npatterns && nplain == npatterns
+			&& (npatterns > 1 || (opt & GREP_OPT_i)))
+		fixed_set = ac_build(opt & GREP_OPT_i);
+}
+
+
 int grep_main(int argc, char **argv)
 {
-	FILE *file;
+	int fd;
 	int matched;
 	llist_t *fopt = NULL;
 	int error_open_count = 0;
@@ -377,6 +749,7 @@ int grep_main(int argc, char **argv)
 			argc--;
 		}
 	}
+	setup_matchers();
 
 	/* argv[(optind)..(argc-1)] should be names of file to grep through. If
 	 * there is more than one file to grep, we will print the filenames */
@@ -393,22 +766,23 @@ int grep_main(int argc, char **argv)
 		cur_file = *argv++;
 		if(!cur_file || (*cur_file == '-' && !cur_file[1])) {
 			cur_file = "(standard input)";
-			file = stdin;
+			fd = STDIN_FILENO;
 		} else {
-			file = fopen(cur_file, "r");
+			fd = open(cur_file, O_RDONLY);
 		}
-		if (file == NULL) {
+		if (fd < 0) {
 			if (!SUPPRESS_ERR_MSGS)
 				bb_perror_msg("%s", cur_file);
 			error_open_count++;
 		} else {
-			matched += grep_file(file);
+			matched += grep_file(fd);
 			if(matched < 0) {
 				/* we found a match but were told to be quiet, stop here and
 				* return success */
 				break;
 			}
-			fclose(file);
+			if (fd != STDIN_FILENO)
+				close(fd);
 		}
 	}
 
@@ -424,8 +798,19 @@ int grep_main(int argc, char **argv)
 				free(gl->pattern);
 			if((gl->flg_mem_alocated_compiled & COMPILED))
 				regfree(&(gl->preg));
+			if (gl->literal != gl->pattern)
+				free(gl->literal);
+			free(gl);
 			free(pattern_head_ptr);
 		}
+		if (fixed_set) {
+			free(fixed_set->fail);
+			free(fixed_set->edges);
+			free(fixed_set->edge_c);
+			free(fixed_set->edge_to);
+			free(fixed_set->out);
+			free(fixed_set);
+		}
 	}
 	/* 0 = success, 1 = failed, 2 = error */
 	/* If the -q option is specified, the exit status shall be zero
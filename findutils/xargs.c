@@ -1,7 +1,8 @@
 /* vi: set sw=4 ts=4: */
 /*
  * Mini xargs implementation for busybox
- * Options are supported: "-prtx -n max_arg -s max_chars -e[ouf_str]"
+ * Options are supported: "-prtx -n max_arg -s max_chars -e[ouf_str]
+ *   -L max_lines -P max_procs"
  *
  * (C) 2002,2003 by Vladimir Oleynik <dzo@simtreas.ru>
  *
@@ -53,61 +54,77 @@
 # endif
 #endif
 
+static int xargs_running;        /* children not waited for yet */
+static int xargs_status;         /* worst exit code so far */
+
+static void xargs_set_status(int code)
+{
+	if (code > xargs_status)
+		xargs_status = code;
+}
+
+/* Wait until no more than limit commands are still running */
+static void xargs_wait(const char *name, int limit)
+{
+	int status;
+
+	while (xargs_running > limit) {
+		if (wait(&status) == (pid_t) - 1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		xargs_running--;
+		if (WIFSIGNALED(status)) {
+			bb_error_msg("%s: terminated by signal %d",
+				name, WTERMSIG(status));
+			xargs_set_status(125);
+		} else if (WEXITSTATUS(status) == 255) {
+			bb_error_msg("%s: exited with status 255; aborting", name);
+			xargs_set_status(124);
+		} else if (WEXITSTATUS(status) != 0)
+			xargs_set_status(123);
+	}
+}
+
 /*
    This function have special algorithm.
    Don`t use fork and include to main!
 */
-static int xargs_exec(char *const *args)
+static void xargs_exec(char *const *args, int jobs)
 {
 	pid_t p;
 	volatile int exec_errno = 0;    /* shared vfork stack */
 
-	if ((p = vfork()) >= 0) {
-		if (p == 0) {
-			/* vfork -- child */
-			execvp(args[0], args);
-			exec_errno = errno;     /* set error to shared stack */
-			_exit(1);
-		} else {
-			/* vfork -- parent */
-			int status;
-
-			while (wait(&status) == (pid_t) - 1)
-				if (errno != EINTR)
-					break;
-			if (exec_errno) {
-				errno = exec_errno;
-				bb_perror_msg("%s", args[0]);
-				return exec_errno == ENOENT ? 127 : 126;
-			} else {
-				if (WEXITSTATUS(status) == 255) {
-					bb_error_msg("%s: exited with status 255; aborting", args[0]);
-					return 124;
-				}
-				if (WIFSTOPPED(status)) {
-					bb_error_msg("%s: stopped by signal %d",
-						args[0], WSTOPSIG(status));
-					return 125;
-				}
-				if (WIFSIGNALED(status)) {
-					bb_error_msg("%s: terminated by signal %d",
-						args[0], WTERMSIG(status));
-					return 125;
-				}
-				if (WEXITSTATUS(status) != 0)
-					return 123;
-				return 0;
-			}
-		}
-	} else {
+	/* wait for a free job slot */
+	xargs_wait(args[0], jobs - 1);
+	if ((p = vfork()) < 0)
 		bb_perror_msg_and_die("vfork");
+	if (p == 0) {
+		/* vfork -- child */
+		execvp(args[0], args);
+		exec_errno = errno;     /* set error to shared stack */
+		_exit(1);
 	}
+	/* vfork -- parent, the child has exec'ed or exited by now */
+	if (exec_errno) {
+		waitpid(p, NULL, 0);
+		errno = exec_errno;
+		bb_perror_msg("%s", args[0]);
+		xargs_set_status(exec_errno == ENOENT ? 127 : 126);
+		return;
+	}
+	xargs_running++;
+	/* one at a time: the status is known before reading on */
+	if (jobs == 1)
+		xargs_wait(args[0], 0);
 }
 
 
 typedef struct xlist_s {
 	char *data;
 	size_t lenght;
+	char eol;               /* the word ended an input line */
 	struct xlist_s *link;
 } xlist_t;
 
@@ -131,6 +148,7 @@ static xlist_t *process_stdin(xlist_t * list_arg,
 	char q = 0;             /* quote char */
 	char state = NORM;
 	char eof_str_detected = 0;
+	char eol = 0;
 	size_t line_l = 0;      /* size loaded args line */
 	int c;                  /* current char */
 	xlist_t *cur;
@@ -146,8 +164,10 @@ static xlist_t *process_stdin(xlist_t * list_arg,
 		c = getchar();
 		if (c == EOF) {
 			eof_stdin_detected++;
-			if (s)
+			if (s) {
+				eol = 1;
 				goto unexpected_eof;
+			}
 			break;
 		}
 		if (eof_str_detected)
@@ -166,6 +186,7 @@ static xlist_t *process_stdin(xlist_t * list_arg,
 
 			if (ISSPACE(c)) {
 				if (s) {
+					eol = c == '\n';
 unexpected_eof:
 					state = SPACE;
 					c = 0;
@@ -202,6 +223,7 @@ set:
 				cur = xmalloc(sizeof(xlist_t) + lenght);
 				cur->data = memcpy(cur + 1, s, lenght);
 				cur->lenght = lenght;
+				cur->eol = eol;
 				cur->link = NULL;
 				if (prev == NULL) {
 					list_arg = cur;
@@ -229,6 +251,7 @@ static xlist_t *process_stdin(xlist_t * list_arg,
 
 	int c;                  /* current char */
 	int eof_str_detected = 0;
+	char eol = 0;
 	char *s = NULL;         /* start word */
 	char *p = NULL;         /* pointer to end word */
 	size_t line_l = 0;      /* size loaded args line */
@@ -251,6 +274,7 @@ static xlist_t *process_stdin(xlist_t * list_arg,
 		if (c == EOF || ISSPACE(c)) {
 			if (s == NULL)
 				continue;
+			eol = c == EOF || c == '\n';
 			c = EOF;
 		}
 		if (s == NULL)
@@ -269,6 +293,7 @@ static xlist_t *process_stdin(xlist_t * list_arg,
 				cur = xmalloc(sizeof(xlist_t) + lenght);
 				cur->data = memcpy(cur + 1, s, lenght);
 				cur->lenght = lenght;
+				cur->eol = eol;
 				cur->link = NULL;
 				if (prev == NULL) {
 					list_arg = cur;
@@ -363,6 +388,7 @@ static xlist_t *process0_stdin(xlist_t * list_arg, const char *eof_str ATTRIBUTE
 			cur = xmalloc(sizeof(xlist_t) + lenght);
 			cur->data = memcpy(cur + 1, s, lenght);
 			cur->lenght = lenght;
+			cur->eol = 1;           /* for -L, each name is a line */
 			cur->link = NULL;
 			if (prev == NULL) {
 				list_arg = cur;
@@ -394,15 +420,17 @@ static xlist_t *process0_stdin(xlist_t * list_arg, const char *eof_str ATTRIBUTE
 #define OPT_UPTO_NUMBER (1<<2)
 #define OPT_UPTO_SIZE   (1<<3)
 #define OPT_EOF_STRING  (1<<4)
+#define OPT_UPTO_LINES  (1<<5)
+#define OPT_PARALLEL    (1<<6)
 #ifdef CONFIG_FEATURE_XARGS_SUPPORT_CONFIRMATION
-#define OPT_INTERACTIVE (1<<5)
+#define OPT_INTERACTIVE (1<<7)
 #else
 #define OPT_INTERACTIVE (0)     /* require for algorithm &| */
 #endif
-#define OPT_TERMINATE   (1<<(5+OPT_INC_P))
-#define OPT_ZEROTERM    (1<<(5+OPT_INC_P+OPT_INC_X))
+#define OPT_TERMINATE   (1<<(7+OPT_INC_P))
+#define OPT_ZEROTERM    (1<<(7+OPT_INC_P+OPT_INC_X))
 /* next future
-#define OPT_NEXT_OTHER  (1<<(5+OPT_INC_P+OPT_INC_X+OPT_INC_0))
+#define OPT_NEXT_OTHER  (1<<(7+OPT_INC_P+OPT_INC_X+OPT_INC_0))
 */
 
 int xargs_main(int argc, char **argv)
@@ -411,9 +439,9 @@ int xargs_main(int argc, char **argv)
 	int i, a, n;
 	xlist_t *list = NULL;
 	xlist_t *cur;
-	int child_error = 0;
-	char *max_args, *max_chars;
-	int n_max_arg;
+	char *max_args, *max_chars, *max_lines, *max_jobs;
+	int n_max_arg, n_max_lines, lines;
+	int jobs = 1;
 	size_t n_chars = 0;
 	long orig_arg_max;
 	const char *eof_str = "_";
@@ -428,7 +456,7 @@ int xargs_main(int argc, char **argv)
 	bb_opt_complementally = "pt";
 #endif
 
-	opt = bb_getopt_ulflags(argc, argv, "+trn:s:e::"
+	opt = bb_getopt_ulflags(argc, argv, "+trn:s:e::L:P:"
 #ifdef CONFIG_FEATURE_XARGS_SUPPORT_CONFIRMATION
 	"p"
 #endif
@@ -438,7 +466,7 @@ int xargs_main(int argc, char **argv)
 #ifdef CONFIG_FEATURE_XARGS_SUPPORT_ZERO_TERM
 	"0"
 #endif
-	,&max_args, &max_chars, &eof_str);
+	,&max_args, &max_chars, &eof_str, &max_lines, &max_jobs);
 
 	a = argc - optind;
 	argv += optind;
@@ -455,7 +483,7 @@ int xargs_main(int argc, char **argv)
 	if ((opt & OPT_UPTO_SIZE)) {
 		n_max_chars = bb_xgetularg10_bnd(max_chars, 1, orig_arg_max);
 		for (i = 0; i < a; i++) {
-			n_chars += strlen(*argv) + 1;
+			n_chars += strlen(argv[i]) + 1;
 		}
 		if (n_max_chars < n_chars) {
 			bb_error_msg_and_die("can not fit single argument within argument list size limit");
@@ -477,6 +505,15 @@ int xargs_main(int argc, char **argv)
 	} else {
 		n_max_arg = n_max_chars;
 	}
+	n_max_lines = INT_MAX;
+	if (opt & OPT_UPTO_LINES)
+		n_max_lines = bb_xgetularg10_bnd(max_lines, 1, INT_MAX);
+	if (opt & OPT_PARALLEL) {
+		/* -P 0: as many at a time as it takes */
+		jobs = bb_xgetularg10_bnd(max_jobs, 0, INT_MAX);
+		if (jobs == 0)
+			jobs = INT_MAX;
+	}
 
 #ifdef CONFIG_FEATURE_XARGS_SUPPORT_ZERO_TERM
 	if (opt & OPT_ZEROTERM)
@@ -489,26 +526,22 @@ int xargs_main(int argc, char **argv)
 		opt |= OPT_NO_EMPTY;
 		n = 0;
 		n_chars = 0;
-#ifdef CONFIG_FEATURE_XARGS_SUPPORT_TERMOPT
+		lines = 0;
 		for (cur = list; cur;) {
 			n_chars += cur->lenght;
 			n++;
+			lines += cur->eol;
 			cur = cur->link;
-			if (n_chars > n_max_chars || (n == n_max_arg && cur)) {
+			if (n_chars > n_max_chars) {
+#ifdef CONFIG_FEATURE_XARGS_SUPPORT_TERMOPT
 				if (opt & OPT_TERMINATE)
 					bb_error_msg_and_die("argument list too long");
+#endif
 				break;
 			}
-		}
-#else
-		for (cur = list; cur; cur = cur->link) {
-			n_chars += cur->lenght;
-			n++;
-			if (n_chars > n_max_chars || n == n_max_arg) {
+			if (n == n_max_arg || lines == n_max_lines)
 				break;
-			}
 		}
-#endif /* CONFIG_FEATURE_XARGS_SUPPORT_TERMOPT */
 
 		/* allocating pointers for execvp:
 		   a*arg, n*arg from stdin, NULL */
@@ -534,7 +567,7 @@ int xargs_main(int argc, char **argv)
 				fputc('\n', stderr);
 		}
 		if ((opt & OPT_INTERACTIVE) == 0 || xargs_ask_confirmation() != 0) {
-			child_error = xargs_exec(args);
+			xargs_exec(args, jobs);
 		}
 
 		/* clean up */
@@ -544,14 +577,15 @@ int xargs_main(int argc, char **argv)
 			free(cur);
 		}
 		free(args);
-		if (child_error > 0 && child_error != 123) {
+		if (xargs_status > 123) {
 			break;
 		}
 	}
+	xargs_wait(argv[0], 0);
 #ifdef CONFIG_FEATURE_CLEAN_UP
 	free(max_chars);
 #endif
-	return child_error;
+	return xargs_status;
 }
 
 
@@ -561,7 +595,8 @@ const char *bb_applet_name = "debug stuff usage";
 
 void bb_show_usage(void)
 {
-	fprintf(stderr, "Usage: %s [-p] [-r] [-t] -[x] [-n max_arg] [-s max_chars]\n",
+	fprintf(stderr, "Usage: %s [-p] [-r] [-t] -[x] [-n max_arg] [-s max_chars]"
+		" [-L max_lines] [-P max_procs]\n",
 		bb_applet_name);
 	exit(1);
 }
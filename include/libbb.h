@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <netdb.h>
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -133,6 +134,9 @@ extern ssize_t safe_read(int fd, void *buf, size_t count);
 extern ssize_t bb_full_read(int fd, void *buf, size_t len);
 extern ssize_t safe_write(int fd, const void *buf, size_t count);
 extern ssize_t bb_full_write(int fd, const void *buf, size_t len);
+/* recursive_action() recurse flags */
+#define ACTION_RECURSE		1
+#define ACTION_MODE_ONLY	2	/* actions only use st_mode and st_ino */
 extern int recursive_action(const char *fileName, int recurse,
 	  int followLinks, int depthFirst,
 	  int (*fileAction) (const char *fileName, struct stat* statbuf, void* userData),
@@ -156,6 +160,33 @@ extern char *find_block_device(char *path);
 extern char *bb_get_line_from_file(FILE *file);
 extern char *bb_get_chomped_line_from_file(FILE *file);
 extern char *bb_get_chunk_from_file(FILE *file, int *end);
+
+typedef struct line_reader_s {
+	int fd;
+	int eof;
+	int error;
+	char *buf;
+	size_t size;	/* allocated size of buf */
+	size_t start;	/* first byte not yet handed out */
+	size_t end;		/* one past the last byte read */
+} line_reader_t;
+
+extern line_reader_t *bb_line_reader_open(int fd);
+extern char *bb_line_reader_next(line_reader_t *lr, int delim, size_t *len);
+extern char *bb_line_reader_chomped(line_reader_t *lr, int delim, size_t *len);
+extern void bb_line_reader_free(line_reader_t *lr);
+
+/* Read buffer size for tools that stream whole files through bulk_scan.c */
+#define BB_BULK_BUFSIZE (64 * 1024)
+#define BB_WORD_OTHER	0
+#define BB_WORD_CHAR	1
+#define BB_WORD_SPACE	2
+extern size_t bb_count_byte(const void *buf, size_t len, int c);
+extern size_t bb_count_words(const void *buf, size_t len,
+		const unsigned char *wclass, int *in_word);
+extern void bb_translate(void *dst, const void *src, size_t len,
+		const unsigned char *table);
+
 extern int bb_copyfd_size(int fd1, int fd2, const off_t size);
 extern int bb_copyfd_eof(int fd1, int fd2);
 extern void  bb_xprint_and_close_file(FILE *file);
@@ -169,6 +200,11 @@ extern FILE *bb_xfopen(const char *path, const char *mode);
 extern int   bb_fclose_nonstdin(FILE *f);
 extern void  bb_fflush_stdout_and_exit(int retval) ATTRIBUTE_NORETURN;
 
+/* exit(), or back to whoever set bb_die_jmp; the die functions end here */
+#define BB_DIE_JMP_FLAG 0x100
+extern jmp_buf *bb_die_jmp;
+extern void bb_xfunc_exit(int retval) ATTRIBUTE_NORETURN;
+
 extern void xstat(const char *filename, struct stat *buf);
 extern int  bb_xsocket(int domain, int type, int protocol);
 extern pid_t bb_spawn(char **argv);
@@ -208,6 +244,7 @@ extern char *skip_whitespace(const char *);
 
 extern struct BB_applet *find_applet_by_name(const char *name);
 void run_applet_by_name(const char *name, int argc, char **argv);
+extern int run_nofork_applet(struct BB_applet *applet, int argc, char **argv);
 
 /* dmalloc will redefine these to it's own implementation. It is safe
  * to have the prototypes here unconditionally.  */
@@ -496,6 +533,18 @@ typedef struct {
 	char short_cmd[COMM_LEN];
 } procps_status_t;
 
+typedef struct procps_scan_s {
+	DIR *dir;			/* /proc, kept open between walks */
+	int flags;
+	struct procps_uid_s **uid_hash;	/* uid -> user name cache */
+	procps_status_t status;
+} procps_scan_t;
+
+#define PSSCAN_CMD	1	/* fill in cmd from /proc/<pid>/cmdline */
+
+extern procps_scan_t *procps_scan_open(int flags);
+extern procps_status_t *procps_scan_next(procps_scan_t *ps);
+extern void procps_scan_close(procps_scan_t *ps);
 extern procps_status_t * procps_scan(int save_user_arg0);
 extern int compare_string_array(const char * const string_array[], const char *key);
 
@@ -538,6 +587,8 @@ void md5_hash(const void *data, size_t length, md5_ctx_t *ctx);
 void *md5_end(void *resbuf, md5_ctx_t *ctx);
 
 extern uint32_t *bb_crc32_filltable (int endian);
+extern uint32_t bb_crc32_block(uint32_t crc, const void *buf, size_t len, int endian);
+extern uint32_t bb_crc32_combine(uint32_t crc1, uint32_t crc2, off_t len2);
 
 #ifndef RB_POWER_OFF
 /* Stop system and switch power off if possible.  */
@@ -25,6 +25,21 @@ typedef struct file_headers_s {
 	dev_t device;
 } file_header_t;
 
+/* An in-process decompressor that archive data can be pulled through,
+ * in place of a forked open_transformer() child feeding a pipe. */
+typedef struct unpack_stream_s {
+	/* Fill buf with up to count bytes of decompressed data, returning
+	 * 0 at the end of the compressed stream.  Corrupt input is fatal. */
+	ssize_t (*read)(struct unpack_stream_s *stream, void *buf, size_t count);
+	void (*close)(struct unpack_stream_s *stream);
+
+	/* The compressed input */
+	int src_fd;
+
+	/* Decompressor specific state */
+	void *state;
+} unpack_stream_t;
+
 typedef struct archive_handle_s {
 	/* define if the header and data component should processed */
 	char (*filter)(struct archive_handle_s *);
@@ -52,6 +67,9 @@ typedef struct archive_handle_s {
 	/* The raw stream as read from disk or stdin */
 	int src_fd;
 
+	/* If set, src_fd is compressed and all reads go through this */
+	unpack_stream_t *src_stream;
+
 	/* Count the number of bytes processed */
 	off_t offset;
 
@@ -96,6 +114,8 @@ extern char get_header_tar_gz(archive_handle_t *archive_handle);
 extern void seek_by_jump(const archive_handle_t *archive_handle, const unsigned int amount);
 extern void seek_by_char(const archive_handle_t *archive_handle, const unsigned int amount);
 
+extern ssize_t archive_read(const archive_handle_t *archive_handle, void *buf, size_t count);
+extern off_t archive_copy_data(const archive_handle_t *archive_handle, int dst_fd, off_t size);
 extern void archive_xread_all(const archive_handle_t *archive_handle, void *buf, const size_t count);
 extern ssize_t archive_xread_all_eof(archive_handle_t *archive_handle, unsigned char *buf, size_t count);
 
@@ -103,12 +123,21 @@ extern void data_align(archive_handle_t *archive_handle, const unsigned short bo
 extern const llist_t *find_list_entry(const llist_t *list, const char *filename);
 
 extern int uncompressStream(int src_fd, int dst_fd);
-extern void inflate_init(unsigned int bufsize);
-extern void inflate_cleanup(void);
-extern int inflate_unzip(int in, int out);
+typedef struct inflate_state_s inflate_state_t;
+extern inflate_state_t *inflate_start(int src_fd, off_t src_size);
+extern ssize_t inflate_read(inflate_state_t *state, void *buf, size_t count);
+extern int inflate_unzip(inflate_state_t *state, int dst_fd);
+extern uint32_t inflate_crc(const inflate_state_t *state);
+extern off_t inflate_count(const inflate_state_t *state);
+extern void inflate_end(inflate_state_t *state);
 extern int inflate_gunzip(int in, int out);
 extern int unlzma(int src_fd, int dst_fd);
 
+extern unpack_stream_t *open_gunzip_stream(int src_fd);
+extern unpack_stream_t *open_bunzip2_stream(int src_fd);
+extern unpack_stream_t *open_unlzma_stream(int src_fd);
+extern void close_unpack_stream(archive_handle_t *archive_handle);
+
 extern int open_transformer(int src_fd, int (*transformer)(int src_fd, int dst_fd));
 
 
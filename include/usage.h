@@ -658,8 +658,10 @@ USE_FEATURE_DATE_ISOFMT( \
 ) USE_FEATURE_FIND_INUM( \
 	"\n\t-inum N\t\tFile has inode number N" \
 ) USE_FEATURE_FIND_EXEC( \
-	"\n\t-exec CMD\tExecute CMD with all instances of {} replaced by the" \
-	"\n\t\t\tfiles matching EXPRESSION")
+	"\n\t-exec CMD ;\tExecute CMD with all instances of {} replaced by the" \
+	"\n\t\t\tfiles matching EXPRESSION" \
+	"\n\t-exec CMD {} +\tExecute CMD with as many matching files as fit" \
+	"\n\t-P N\t\tRun up to N commands at a time (0: no limit)")
 #define find_example_usage \
 	"$ find / -name passwd\n" \
 	"/etc/passwd\n"
@@ -842,6 +844,12 @@ USE_FEATURE_DATE_ISOFMT( \
 	"$ ls -la /tmp/stablebox*\n" \
 	"-rw-rw-r--    1 andersen andersen  1761280 Apr 14 17:47 /tmp/stablebox-0.43.tar\n"
 
+#ifdef CONFIG_FEATURE_GZIP_PARALLEL
+#  define USAGE_GZIP_PARALLEL(a) a
+#else
+#  define USAGE_GZIP_PARALLEL(a)
+#endif
+
 #define gzip_trivial_usage \
 	"[OPTION]... [FILE]..."
 #define gzip_full_usage \
@@ -850,7 +858,9 @@ USE_FEATURE_DATE_ISOFMT( \
 	"Options:\n" \
 	"\t-c\tWrite output to standard output instead of FILE.gz\n" \
 	"\t-d\tDecompress\n" \
-	"\t-f\tForce write when destination is a terminal"
+	"\t-f\tForce write when destination is a terminal" \
+	USAGE_GZIP_PARALLEL( \
+	"\n\t-p N\tCompress on N threads")
 #define gzip_example_usage \
 	"$ ls -la /tmp/stablebox*\n" \
 	"-rw-rw-r--    1 andersen andersen  1761280 Apr 14 17:47 /tmp/stablebox.tar\n" \
@@ -2315,8 +2325,14 @@ USE_FEATURE_MDEV_CONFIG( \
 #  define USAGE_SORT_BIG(a)
 #endif
 
+#if ENABLE_FEATURE_SORT_PARALLEL
+#  define USAGE_SORT_PARALLEL(a) a
+#else
+#  define USAGE_SORT_PARALLEL(a)
+#endif
+
 #define sort_trivial_usage \
-	"[-nru" USAGE_SORT_BIG("gMcszbdfimSTokt] [-o outfile] [-k start[.offset][opts][,end[.offset][opts]] [-t char") "] [FILE]..."
+	"[-nru" USAGE_SORT_BIG("gMcszbdfimokt] [-o outfile] [-k start[.offset][opts][,end[.offset][opts]] [-t char] [-S size] [-T dir") "] [FILE]..."
 #define sort_full_usage \
 	"Sorts lines of text in the specified files\n\n" \
 	"Options:\n" \
@@ -2328,19 +2344,22 @@ USE_FEATURE_MDEV_CONFIG( \
 		"\t-g\tgeneral numerical sort\n" \
 		"\t-i\tignore unprintable characters\n" \
 		"\t-k\tspecify sort key\n" \
+		"\t-m\tmerge already sorted files\n" \
 		"\t-M\tsort month\n" \
 	) \
 	"\t-n\tsort numbers\n" \
 	USAGE_SORT_BIG( \
 		"\t-o\toutput to file\n" \
 		"\t-k\tsort by key\n" \
+		"\t-S\tmemory to use before spilling to temporary files\n" \
 		"\t-t\tuse key separator other than whitespace\n" \
+		"\t-T\tdirectory for temporary files\n" \
 	) \
 	"\t-r\treverse sort order\n" \
 	USAGE_SORT_BIG("\t-s\tstable (don't sort ties alphabetically)\n") \
 	"\t-u\tsuppress duplicate lines" \
-	USAGE_SORT_BIG("\n\t-z\tinput terminated by nulls, not newlines\n") \
-	USAGE_SORT_BIG("\t-mST\tignored for GNU compatibility") \
+	USAGE_SORT_BIG("\n\t-z\tlines terminated by nulls, not newlines") \
+	USAGE_SORT_PARALLEL("\n\t--parallel=N\tsort on N threads") \
 	""
 #define sort_example_usage \
 	"$ echo -e \"e\\nf\\nb\\nd\\nc\\na\" | sort\n" \
@@ -3111,6 +3130,9 @@ USE_FEATURE_START_STOP_DAEMON_FANCY( \
 	"Options:\n" \
 	USAGE_XARGS_CONFIRMATION("\t-p\tPrompt the user about whether to run each command\n") \
 	"\t-r\tDo not run command for empty read lines\n" \
+	"\t-n N\tPass at most N arguments to each command\n" \
+	"\t-L N\tPass at most N input lines to each command\n" \
+	"\t-P N\tRun up to N commands at a time (0: no limit)\n" \
 	USAGE_XARGS_TERMOPT("\t-x\tExit if the size is exceeded\n") \
 	USAGE_XARGS_ZERO_TERM("\t-0\tInput filenames are terminated by a null character\n") \
 	"\t-t\tPrint the command line on stderr before executing it"
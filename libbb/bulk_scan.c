@@ -0,0 +1,214 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Utility routines.
+ *
+ * Whole-buffer kernels for the text filters (wc, tr) that go over big
+ * read buffers: counting a byte, counting words and translating bytes
+ * through a 256 entry table.  With SSE2 they take 16 bytes per step,
+ * elsewhere a machine word or an unrolled loop the compiler can
+ * vectorize itself.
+ *
+ * Licensed under GPLv2, see file LICENSE in this tarball for details.
+ */
+
+#include <string.h>
+#include "libbb.h"
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define BULK_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define ONES	((unsigned long)-1 / 0xff)		/* 0x0101...01 */
+#define HIGHS	(ONES * 0x80)					/* 0x8080...80 */
+
+/* How many bytes of buf are c */
+size_t bb_count_byte(const void *buf, size_t len, int c)
+{
+	const unsigned char *p = buf;
+	size_t count = 0;
+
+#ifdef BULK_SSE2
+	const __m128i needle = _mm_set1_epi8(c);
+
+	while (len >= 16) {
+		/* Byte counters go up by one per match, and are added up
+		 * before they can wrap */
+		__m128i acc = _mm_setzero_si128();
+		size_t n = len / 16 > 255 ? 255 : len / 16;
+
+		len -= n * 16;
+		while (n--) {
+			__m128i v = _mm_loadu_si128((const __m128i *)p);
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+			p += 16;
+		}
+		acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+		count += _mm_cvtsi128_si32(acc)
+			+ _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+	}
+#else
+	const unsigned long pattern = ONES * (unsigned char)c;
+
+	for (; len >= sizeof(long); len -= sizeof(long), p += sizeof(long)) {
+		unsigned long w;
+
+		memcpy(&w, p, sizeof(w));
+		w ^= pattern;
+		/* high bit set in each byte that is now zero, exactly */
+		w = ~(((w & ~HIGHS) + ~HIGHS) | w) & HIGHS;
+		count += __builtin_popcountl(w);
+	}
+#endif
+	while (len--)
+		count += (*p++ == (unsigned char)c);
+	return count;
+}
+
+static size_t count_words_table(const unsigned char *p, size_t len,
+		const unsigned char *wclass, int *in_word)
+{
+	size_t count = 0;
+	int in = *in_word;
+
+	while (len--) {
+		switch (wclass[*p++]) {
+		case BB_WORD_CHAR:
+			count += !in;
+			in = 1;
+			break;
+		case BB_WORD_SPACE:
+			in = 0;
+			break;
+		}
+	}
+	*in_word = in;
+	return count;
+}
+
+/* Counts the words in buf, wclass saying which bytes are BB_WORD_CHAR,
+ * which BB_WORD_SPACE and which BB_WORD_OTHER; the last neither start
+ * nor end a word.  *in_word carries over from one buffer to the next:
+ * a word that started in the last buffer isn't counted again. */
+size_t bb_count_words(const void *buf, size_t len,
+		const unsigned char *wclass, int *in_word)
+{
+	const unsigned char *p = buf;
+	size_t count = 0;
+
+#ifdef BULK_SSE2
+	/* Plain ASCII text, which is nearly all of it, goes 64 bytes at a
+	 * time; blocks with anything else in them go through the table */
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t' - 1);
+	const __m128i cr = _mm_set1_epi8('\r' + 1);
+	const __m128i del = _mm_set1_epi8(0x7f);
+
+	for (; len >= 64; p += 64, len -= 64) {
+		unsigned long long words = 0, known = 0;
+		int i;
+
+		for (i = 0; i < 4; i++) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+			/* signed compares: bytes from 0x80 up are negative */
+			__m128i w = _mm_and_si128(_mm_cmpgt_epi8(v, space),
+					_mm_cmplt_epi8(v, del));
+			__m128i s = _mm_or_si128(_mm_cmpeq_epi8(v, space),
+					_mm_and_si128(_mm_cmpgt_epi8(v, tab),
+						_mm_cmplt_epi8(v, cr)));
+
+			words |= (unsigned long long)_mm_movemask_epi8(w) << (16 * i);
+			known |= (unsigned long long)
+				_mm_movemask_epi8(_mm_or_si128(w, s)) << (16 * i);
+		}
+		if (~known) {
+			count += count_words_table(p, 64, wclass, in_word);
+			continue;
+		}
+		/* a word starts where a word byte follows a space */
+		count += __builtin_popcountll(words & ~((words << 1) | *in_word));
+		*in_word = words >> 63;
+	}
+#endif
+	return count + count_words_table(p, len, wclass, in_word);
+}
+
+/* A table that only moves a few ranges of bytes by a fixed amount each,
+ * like tr a-z A-Z does, can be applied with compares and adds */
+#define MAX_SHIFTS 4
+
+struct byte_shift {
+	unsigned char lo, len, delta;
+};
+
+static int table_shifts(const unsigned char *table, struct byte_shift *shift)
+{
+	int c, n = 0;
+
+	for (c = 0; c < 256; c++) {
+		unsigned char delta = table[c] - c;
+
+		if (!delta)
+			continue;
+		if (n && shift[n - 1].lo + shift[n - 1].len + 1 == c
+				&& shift[n - 1].delta == delta) {
+			shift[n - 1].len++;
+			continue;
+		}
+		if (n == MAX_SHIFTS)
+			return -1;
+		shift[n].lo = c;
+		shift[n].len = 0;		/* one less than the length */
+		shift[n].delta = delta;
+		n++;
+	}
+	return n;
+}
+
+/* dst[i] = table[src[i]]; dst may be src */
+void bb_translate(void *dst, const void *src, size_t len,
+		const unsigned char *table)
+{
+	const unsigned char *s = src;
+	unsigned char *d = dst;
+
+#ifdef BULK_SSE2
+	struct byte_shift shift[MAX_SHIFTS];
+	int n = len >= 64 ? table_shifts(table, shift) : -1;
+
+	if (n >= 0) {
+		__m128i lo[MAX_SHIFTS], top[MAX_SHIFTS], delta[MAX_SHIFTS];
+		int i;
+
+		for (i = 0; i < n; i++) {
+			lo[i] = _mm_set1_epi8(shift[i].lo);
+			top[i] = _mm_set1_epi8(shift[i].len);
+			delta[i] = _mm_set1_epi8(shift[i].delta);
+		}
+		for (; len >= 16; len -= 16, s += 16, d += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)s);
+			__m128i out = v;
+
+			for (i = 0; i < n; i++) {
+				/* v - lo <= len - 1, unsigned */
+				__m128i x = _mm_sub_epi8(v, lo[i]);
+				__m128i in = _mm_cmpeq_epi8(_mm_min_epu8(x, top[i]), x);
+
+				out = _mm_add_epi8(out, _mm_and_si128(in, delta[i]));
+			}
+			_mm_storeu_si128((__m128i *)d, out);
+		}
+	}
+#endif
+	for (; len >= 8; len -= 8, s += 8, d += 8) {
+		unsigned char c0 = table[s[0]], c1 = table[s[1]];
+		unsigned char c2 = table[s[2]], c3 = table[s[3]];
+		unsigned char c4 = table[s[4]], c5 = table[s[5]];
+		unsigned char c6 = table[s[6]], c7 = table[s[7]];
+
+		d[0] = c0; d[1] = c1; d[2] = c2; d[3] = c3;
+		d[4] = c4; d[5] = c5; d[6] = c6; d[7] = c7;
+	}
+	while (len--)
+		*d++ = table[*s++];
+}
@@ -14,26 +14,124 @@
 
 #include "libbb.h"
 
+#ifdef CONFIG_FEATURE_COPYFD_OFFLOAD
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+/* Size of the bounce buffer used when the kernel can't do the copy for us.
+ * Big enough that copying a large file isn't bound by syscall overhead,
+ * and allocated at runtime so it never lands on a small stack. */
+#define COPYFD_BUFSIZE (64 * 1024)
+
+#ifdef CONFIG_FEATURE_COPYFD_OFFLOAD
+
+/* Largest chunk handed to the kernel in one call; sendfile() and friends
+ * won't move more than this per call anyway. */
+#define COPYFD_CHUNK 0x7ffff000
 
-#if BUFSIZ < 4096
-#undef BUFSIZ
-#define BUFSIZ 4096
+static ssize_t copyfd_copy_file_range(int src_fd, int dst_fd, size_t len)
+{
+#ifdef __NR_copy_file_range
+	return syscall(__NR_copy_file_range, src_fd, NULL, dst_fd, NULL, len, 0);
+#else
+	errno = ENOSYS;
+	return -1;
 #endif
+}
 
+static ssize_t copyfd_sendfile(int src_fd, int dst_fd, size_t len)
+{
+	return sendfile(dst_fd, src_fd, NULL, len);
+}
+
+static ssize_t copyfd_splice(int src_fd, int dst_fd, size_t len)
+{
+	/* A pipe never holds more than this; asking for more just makes the
+	 * kernel clamp it. */
+	if (len > 64 * 1024)
+		len = 64 * 1024;
+	return splice(src_fd, NULL, dst_fd, NULL, len,
+			SPLICE_F_MOVE | SPLICE_F_MORE);
+}
+
+/* Let the kernel move the data without it ever reaching userspace:
+ * copy_file_range() between regular files, sendfile() from a regular file
+ * to anything else, splice() when either end is a pipe.  Every one of them
+ * advances the file offsets just like read()/write() would, so when the
+ * kernel refuses (old kernel, unsupported filesystem, O_APPEND, ...) the
+ * caller simply carries on with the read/write loop from wherever we
+ * stopped.  Returns nonzero if the copy is complete. */
+static int copyfd_offload(int src_fd, int dst_fd, size_t size, size_t *total)
+{
+	ssize_t (*xfer)(int, int, size_t);
+	struct stat src_st, dst_st;
+
+	if (fstat(src_fd, &src_st) || fstat(dst_fd, &dst_st))
+		return 0;
+
+	if (S_ISREG(src_st.st_mode) && S_ISREG(dst_st.st_mode))
+		xfer = copyfd_copy_file_range;
+	else if (S_ISREG(src_st.st_mode) || S_ISBLK(src_st.st_mode))
+		xfer = copyfd_sendfile;
+	else if (S_ISFIFO(src_st.st_mode) || S_ISFIFO(dst_st.st_mode))
+		xfer = copyfd_splice;
+	else
+		return 0;
+
+	while (!size || *total < size) {
+		size_t len = COPYFD_CHUNK;
+		ssize_t n;
+
+		if (size && size - *total < len)
+			len = size - *total;
+		n = xfer(src_fd, dst_fd, len);
+		if (n > 0) {
+			*total += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		/* Some pseudo filesystems (/proc, /sys) report everything as
+		 * EOF to copy_file_range() and sendfile(); let the read loop
+		 * confirm an immediate EOF. */
+		if (n == 0 && *total)
+			return 1;
+		/* Errors fall back to read/write, which reports them properly
+		 * if they're real. */
+		return 0;
+	}
+	return 1;
+}
+
+#endif /* CONFIG_FEATURE_COPYFD_OFFLOAD */
 
 static ssize_t bb_full_fd_action(int src_fd, int dst_fd, size_t size)
 {
 	int status = -1;
 	size_t total = 0;
-	RESERVE_CONFIG_BUFFER(buffer,BUFSIZ);
+	size_t bufsize = COPYFD_BUFSIZE;
+	char *buffer;
+
+	if (src_fd < 0) return -1;
+
+#ifdef CONFIG_FEATURE_COPYFD_OFFLOAD
+	if (dst_fd >= 0 && copyfd_offload(src_fd, dst_fd, size, &total))
+		return total;
+#endif
+
+	if (size && size - total < bufsize)
+		bufsize = size - total;
+	buffer = xmalloc(bufsize);
 
-	if (src_fd < 0) goto out;
 	while (!size || total < size)
 	{
 		ssize_t wrote, xread;
 
 		xread = safe_read(src_fd, buffer,
-				(!size || size - total > BUFSIZ) ? BUFSIZ : size - total);
+				(!size || size - total > bufsize) ? bufsize : size - total);
 
 		if (xread > 0) {
 			/* A -1 dst_fd means we need to fake it... */
@@ -54,8 +152,7 @@ static ssize_t bb_full_fd_action(int src_fd, int dst_fd, size_t size)
 		}
 	}
 
-out:
-	RELEASE_CONFIG_BUFFER(buffer);
+	free(buffer);
 
 	return status ? status : (ssize_t)total;
 }
@@ -6,25 +6,40 @@
  * very well-known)
  *
  * The following function creates a CRC32 table depending on whether
- * a big-endian (0x04c11db7) or little-endian (0xedb88320) CRC32 is 
+ * a big-endian (0x04c11db7) or little-endian (0xedb88320) CRC32 is
  * required. Admittedly, there are other CRC32 polynomials floating
  * around, but Busybox doesn't use them.
  *
  * endian = 1: big-endian
  * endian = 0: little-endian
+ *
+ * bb_crc32_block() runs a whole buffer through the shift register, eight
+ * bytes per step ("slicing-by-8"), or with carry-less multiplication on
+ * CPUs that have it.  Both directions are the same polynomial, so gzip,
+ * unzip, bzip2 and cksum all share it.  bb_crc32_combine() joins the crcs
+ * of two adjacent pieces, for gzip -p which checksums its pieces apart.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include "libbb.h"
 
-uint32_t *bb_crc32_filltable (int endian) {
-	
-	uint32_t *crc_table = xmalloc(256 * sizeof(uint32_t));
+#if defined(CONFIG_FEATURE_CRC32_PCLMUL) && defined(__GNUC__) \
+	&& (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) \
+	&& (defined(__x86_64__) || defined(__i386__))
+#define CRC32_PCLMUL 1
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+static void crc32_fill(uint32_t *crc_table, int endian)
+{
 	uint32_t polynomial = endian ? 0x04c11db7 : 0xedb88320;
 	uint32_t c;
 	int i, j;
-	
+
 	for (i = 0; i < 256; i++) {
 		c = endian ? (i << 24) : i;
 		for (j = 8; j; j--) {
@@ -35,6 +50,229 @@ uint32_t *bb_crc32_filltable (int endian) {
 		}
 		*crc_table++ = c;
 	}
+}
+
+uint32_t *bb_crc32_filltable (int endian) {
+
+	uint32_t *crc_table = xmalloc(256 * sizeof(uint32_t));
+
+	crc32_fill(crc_table, endian);
+	return crc_table;
+}
+
+/* Eight tables per direction: table k gives the effect of a byte that
+ * still has k more bytes to go through the register after it. */
+static uint32_t *crc32_slice[2];
+
+static uint32_t *crc32_slice_tables(int endian)
+{
+	uint32_t *t = crc32_slice[endian];
+	int i, k;
+
+	if (t)
+		return t;
+	t = crc32_slice[endian] = xmalloc(8 * 256 * sizeof(uint32_t));
+	crc32_fill(t, endian);
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			uint32_t c = t[(k - 1) * 256 + i];
+
+			if (endian)
+				c = (c << 8) ^ t[c >> 24];
+			else
+				c = (c >> 8) ^ t[c & 0xff];
+			t[k * 256 + i] = c;
+		}
+	}
+	return t;
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const unsigned char *p,
+		size_t len, int endian)
+{
+	const uint32_t *t = crc32_slice_tables(endian);
+
+	if (endian) {
+		for (; len >= 8; len -= 8, p += 8) {
+			crc ^= ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+			crc = t[7*256 + (crc >> 24)] ^ t[6*256 + ((crc >> 16) & 0xff)]
+				^ t[5*256 + ((crc >> 8) & 0xff)] ^ t[4*256 + (crc & 0xff)]
+				^ t[3*256 + p[4]] ^ t[2*256 + p[5]]
+				^ t[1*256 + p[6]] ^ t[p[7]];
+		}
+		while (len--)
+			crc = (crc << 8) ^ t[(crc >> 24) ^ *p++];
+	} else {
+		for (; len >= 8; len -= 8, p += 8) {
+			crc ^= p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+			crc = t[7*256 + (crc & 0xff)] ^ t[6*256 + ((crc >> 8) & 0xff)]
+				^ t[5*256 + ((crc >> 16) & 0xff)] ^ t[4*256 + (crc >> 24)]
+				^ t[3*256 + p[4]] ^ t[2*256 + p[5]]
+				^ t[1*256 + p[6]] ^ t[p[7]];
+		}
+		while (len--)
+			crc = t[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#ifdef CRC32_PCLMUL
+
+/* Folding with PCLMULQDQ: the data is treated as one long polynomial and
+ * a 128 bit chunk followed by n more bits is replaced by its two 64 bit
+ * halves times x^n mod P, which is congruent and 32 bits shorter, so four
+ * independent lanes can be folded forward over the whole buffer.  The last
+ * 128 bit remainder goes through the table code, which does the final
+ * reduction for us.
+ *
+ * Register layouts: for the big-endian CRC the 16 bytes are byte swapped
+ * so bit i is the coefficient of x^i.  For the little-endian CRC they are
+ * used as loaded, so bit i is the coefficient of x^(127-i); multiplying
+ * two bit-reversed 64 bit values gives a product reversed over 127 bits,
+ * which is why those constants are x^(n-1) rather than x^n. */
+
+static int crc32_pclmul_ok = -1;
 
-	return crc_table - 256;
+/* Fold constants for 512 and 128 bits, in the order they're used */
+static __m128i crc32_k512[2], crc32_k128[2];
+
+/* x^n mod P, big-endian representation */
+static uint32_t crc32_xpow(unsigned n)
+{
+	uint32_t r = 1;
+
+	while (n--)
+		r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+	return r;
+}
+
+static uint64_t crc32_reflect64(uint32_t k)
+{
+	uint32_t r = 0;
+	int i;
+
+	for (i = 0; i < 32; i++)
+		if (k & (1U << i))
+			r |= 0x80000000U >> i;
+	return (uint64_t)r << 32;
+}
+
+static void crc32_pclmul_init(void)
+{
+	unsigned eax, ebx, ecx, edx;
+
+	crc32_pclmul_ok = 0;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)
+			|| !(ecx & bit_PCLMUL) || !(ecx & bit_SSSE3))
+		return;
+
+	/* Big-endian: high half is multiplied by x^(n+64), low by x^n */
+	crc32_k512[1] = _mm_set_epi64x(crc32_xpow(512 + 64), crc32_xpow(512));
+	crc32_k128[1] = _mm_set_epi64x(crc32_xpow(128 + 64), crc32_xpow(128));
+	/* Little-endian: the high coefficients live in the low half */
+	crc32_k512[0] = _mm_set_epi64x(crc32_reflect64(crc32_xpow(512 - 1)),
+			crc32_reflect64(crc32_xpow(512 + 64 - 1)));
+	crc32_k128[0] = _mm_set_epi64x(crc32_reflect64(crc32_xpow(128 - 1)),
+			crc32_reflect64(crc32_xpow(128 + 64 - 1)));
+	crc32_pclmul_ok = 1;
+}
+
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc32_fold(__m128i x, __m128i k, __m128i next)
+{
+	return _mm_xor_si128(_mm_xor_si128(
+			_mm_clmulepi64_si128(x, k, 0x00),
+			_mm_clmulepi64_si128(x, k, 0x11)), next);
+}
+
+/* len must be at least 64 */
+__attribute__((target("pclmul,ssse3")))
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char *p,
+		size_t len, int endian)
+{
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+			8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i k512 = crc32_k512[endian], k128 = crc32_k128[endian];
+	__m128i x0, x1, x2, x3;
+	unsigned char rest[16];
+
+#define CRC32_LOAD(q) (endian \
+		? _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(q)), bswap) \
+		: _mm_loadu_si128((const __m128i *)(q)))
+
+	x0 = CRC32_LOAD(p);
+	x1 = CRC32_LOAD(p + 16);
+	x2 = CRC32_LOAD(p + 32);
+	x3 = CRC32_LOAD(p + 48);
+	/* The incoming crc is xored into the first 32 bits of the message */
+	x0 = _mm_xor_si128(x0, endian ? _mm_set_epi32(crc, 0, 0, 0)
+			: _mm_cvtsi32_si128(crc));
+	p += 64;
+	len -= 64;
+
+	for (; len >= 64; len -= 64, p += 64) {
+		x0 = crc32_fold(x0, k512, CRC32_LOAD(p));
+		x1 = crc32_fold(x1, k512, CRC32_LOAD(p + 16));
+		x2 = crc32_fold(x2, k512, CRC32_LOAD(p + 32));
+		x3 = crc32_fold(x3, k512, CRC32_LOAD(p + 48));
+	}
+	x0 = crc32_fold(x0, k128, x1);
+	x0 = crc32_fold(x0, k128, x2);
+	x0 = crc32_fold(x0, k128, x3);
+	for (; len >= 16; len -= 16, p += 16)
+		x0 = crc32_fold(x0, k128, CRC32_LOAD(p));
+#undef CRC32_LOAD
+
+	if (endian)
+		x0 = _mm_shuffle_epi8(x0, bswap);
+	_mm_storeu_si128((__m128i *)rest, x0);
+	crc = crc32_slice8(0, rest, 16, endian);
+	return crc32_slice8(crc, p, len, endian);
+}
+
+#endif /* CRC32_PCLMUL */
+
+/* Update a raw crc register (no initial or final inversion) with len bytes.
+ * endian as for bb_crc32_filltable(). */
+uint32_t bb_crc32_block(uint32_t crc, const void *buf, size_t len, int endian)
+{
+	endian = !!endian;
+#ifdef CRC32_PCLMUL
+	if (len >= 256) {
+		if (crc32_pclmul_ok < 0)
+			crc32_pclmul_init();
+		if (crc32_pclmul_ok)
+			return crc32_pclmul(crc, buf, len, endian);
+	}
+#endif
+	return crc32_slice8(crc, buf, len, endian);
+}
+
+/* Multiply two polynomials modulo the little-endian one.  Bit 31 is the
+ * coefficient of x^0 here, as in the crc register itself. */
+static uint32_t crc32_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t p = 0;
+
+	for (; a; a <<= 1) {
+		if (a & 0x80000000)
+			p ^= b;
+		b = (b & 1) ? (b >> 1) ^ 0xedb88320 : b >> 1;
+	}
+	return p;
+}
+
+/* Given the finished little-endian (gzip) crcs of two pieces of data, return
+ * the crc of the two run together.  len2 is the length of the second. */
+uint32_t bb_crc32_combine(uint32_t crc1, uint32_t crc2, off_t len2)
+{
+	uint32_t sq = 0x00800000;	/* x^8, one byte of zeroes */
+	uint32_t xn = 0x80000000;	/* 1 */
+
+	for (; len2; len2 >>= 1) {
+		if (len2 & 1)
+			xn = crc32_multmodp(xn, sq);
+		sq = crc32_multmodp(sq, sq);
+	}
+	return crc32_multmodp(xn, crc1) ^ crc2;
 }
@@ -21,5 +21,5 @@ void bb_error_msg_and_die(const char *s, ...)
 	bb_verror_msg(s, p);
 	va_end(p);
 	putc('\n', stderr);
-	exit(bb_default_error_retval);
+	bb_xfunc_exit(bb_default_error_retval);
 }
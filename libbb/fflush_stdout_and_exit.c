@@ -33,5 +33,5 @@ void bb_fflush_stdout_and_exit(int retval)
 	if (fflush(stdout)) {
 		retval = bb_default_error_retval;
 	}
-	exit(retval);
+	bb_xfunc_exit(retval);
 }
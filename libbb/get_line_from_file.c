@@ -16,7 +16,12 @@
 /* get_line_from_file() - This function reads an entire line from a text file,
  * up to a newline or NUL byte.  It returns a malloc'ed char * which must be
  * stored and free'ed  by the caller.  If end is null '\n' isn't considered
- * and of line.  If end isn't null, length of the chunk read is stored in it. */
+ * and of line.  If end isn't null, length of the chunk read is stored in it.
+ *
+ * Callers may keep using stdio on the stream afterwards, so unlike
+ * bb_line_reader_next() we can't read ahead past the end of the line into
+ * a buffer of our own.  We can at least skip the stdio locking and grow
+ * the line geometrically. */
 
 char *bb_get_chunk_from_file(FILE * file, int *end)
 {
@@ -25,10 +30,10 @@ char *bb_get_chunk_from_file(FILE * file, int *end)
 	char *linebuf = NULL;
 	int linebufsz = 0;
 
-	while ((ch = getc(file)) != EOF) {
+	while ((ch = getc_unlocked(file)) != EOF) {
 		/* grow the line buffer as necessary */
 		if (idx > linebufsz - 2) {
-			linebuf = xrealloc(linebuf, linebufsz += 80);
+			linebuf = xrealloc(linebuf, linebufsz += linebufsz + 80);
 		}
 		linebuf[idx++] = (char) ch;
 		if (!ch || (end && ch == '\n'))
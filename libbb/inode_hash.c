@@ -13,17 +13,73 @@
 #include <string.h>
 #include "libbb.h"
 
-#define HASH_SIZE	311		/* Should be prime */
-#define hash_inode(i)	((i) % HASH_SIZE)
+/* Open addressing with linear probing, doubled when 3/4 full.  The
+ * names are packed into big blocks instead of one malloc each. */
+#define HASH_MIN	256		/* Must be a power of 2 */
+#define NAME_BLOCK	(64 * 1024)
 
-typedef struct ino_dev_hash_bucket_struct {
-  struct ino_dev_hash_bucket_struct *next;
-  ino_t ino;
-  dev_t dev;
-  char name[1];
-} ino_dev_hashtable_bucket_t;
+typedef struct ino_dev_hash_entry_struct {
+	ino_t ino;
+	dev_t dev;
+	char *name;			/* NULL in an empty slot */
+} ino_dev_hash_entry_t;
 
-static ino_dev_hashtable_bucket_t *ino_dev_hashtable[HASH_SIZE];
+static ino_dev_hash_entry_t *ino_dev_hashtable;
+static size_t hash_mask, hash_used;
+static char *name_block;	/* starts with a pointer to the previous one */
+static char *name_next;
+static size_t name_left;
+
+static size_t hash_ino_dev(ino_t ino, dev_t dev)
+{
+	unsigned long long h = ((unsigned long long)ino ^ ((unsigned long long)dev << 32))
+		* 0x9e3779b97f4a7c15ULL;
+
+	return (size_t)(h ^ (h >> 29));
+}
+
+static ino_dev_hash_entry_t *find_slot(ino_t ino, dev_t dev)
+{
+	size_t i = hash_ino_dev(ino, dev) & hash_mask;
+
+	while (ino_dev_hashtable[i].name
+			&& (ino_dev_hashtable[i].ino != ino || ino_dev_hashtable[i].dev != dev))
+		i = (i + 1) & hash_mask;
+	return &ino_dev_hashtable[i];
+}
+
+static void grow_hashtable(void)
+{
+	ino_dev_hash_entry_t *old = ino_dev_hashtable;
+	size_t i, old_size = old ? hash_mask + 1 : 0;
+
+	hash_mask = old ? old_size * 2 - 1 : HASH_MIN - 1;
+	ino_dev_hashtable = xcalloc(hash_mask + 1, sizeof(*ino_dev_hashtable));
+	for (i = 0; i < old_size; i++)
+		if (old[i].name)
+			*find_slot(old[i].ino, old[i].dev) = old[i];
+	free(old);
+}
+
+static char *save_name(const char *name)
+{
+	size_t len = strlen(name) + 1;
+	char *p;
+
+	if (len > name_left) {
+		size_t size = len > NAME_BLOCK ? len : NAME_BLOCK;
+
+		p = xmalloc(sizeof(char *) + size);
+		*(char **)p = name_block;
+		name_block = p;
+		name_next = p + sizeof(char *);
+		name_left = size;
+	}
+	p = memcpy(name_next, name, len);
+	name_next += len;
+	name_left -= len;
+	return p;
+}
 
 /*
  * Return 1 if statbuf->st_ino && statbuf->st_dev are recorded in
@@ -35,54 +91,45 @@ static ino_dev_hashtable_bucket_t *ino_dev_hashtable[HASH_SIZE];
  */
 int is_in_ino_dev_hashtable(const struct stat *statbuf, char **name)
 {
-	ino_dev_hashtable_bucket_t *bucket;
-
-	bucket = ino_dev_hashtable[hash_inode(statbuf->st_ino)];
-	while (bucket != NULL) {
-	  if ((bucket->ino == statbuf->st_ino) &&
-		  (bucket->dev == statbuf->st_dev))
-	  {
-		if (name) *name = bucket->name;
-		return 1;
-	  }
-	  bucket = bucket->next;
-	}
-	return 0;
+	ino_dev_hash_entry_t *entry;
+
+	if (!ino_dev_hashtable)
+		return 0;
+	entry = find_slot(statbuf->st_ino, statbuf->st_dev);
+	if (!entry->name)
+		return 0;
+	if (name) *name = entry->name;
+	return 1;
 }
 
 /* Add statbuf to statbuf hash table */
 void add_to_ino_dev_hashtable(const struct stat *statbuf, const char *name)
 {
-	int i;
-	size_t s;
-	ino_dev_hashtable_bucket_t *bucket;
-
-	i = hash_inode(statbuf->st_ino);
-	s = name ? strlen(name) : 0;
-	bucket = xmalloc(sizeof(ino_dev_hashtable_bucket_t) + s);
-	bucket->ino = statbuf->st_ino;
-	bucket->dev = statbuf->st_dev;
-	if (name)
-		strcpy(bucket->name, name);
-	else
-		bucket->name[0] = '\0';
-	bucket->next = ino_dev_hashtable[i];
-	ino_dev_hashtable[i] = bucket;
+	ino_dev_hash_entry_t *entry;
+
+	if (!ino_dev_hashtable || hash_used >= (hash_mask + 1) / 4 * 3)
+		grow_hashtable();
+	entry = find_slot(statbuf->st_ino, statbuf->st_dev);
+	if (!entry->name)
+		hash_used++;
+	entry->ino = statbuf->st_ino;
+	entry->dev = statbuf->st_dev;
+	entry->name = name ? save_name(name) : (char *) "";
 }
 
 #ifdef CONFIG_FEATURE_CLEAN_UP
 /* Clear statbuf hash table */
 void reset_ino_dev_hashtable(void)
 {
-	int i;
-	ino_dev_hashtable_bucket_t *bucket;
-
-	for (i = 0; i < HASH_SIZE; i++) {
-		while (ino_dev_hashtable[i] != NULL) {
-			bucket = ino_dev_hashtable[i]->next;
-			free(ino_dev_hashtable[i]);
-			ino_dev_hashtable[i] = bucket;
-		}
+	char *block;
+
+	free(ino_dev_hashtable);
+	ino_dev_hashtable = NULL;
+	hash_mask = hash_used = 0;
+	while ((block = name_block) != NULL) {
+		name_block = *(char **)block;
+		free(block);
 	}
+	name_left = 0;
 }
 #endif
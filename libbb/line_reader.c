@@ -0,0 +1,113 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Utility routines.
+ *
+ * Streaming line reader: pulls large blocks from a file descriptor and
+ * hands lines out as pointer+length views into its own buffer, so callers
+ * that only look at each line once never pay a malloc per line.
+ *
+ * Licensed under GPLv2, see file LICENSE in this tarball for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libbb.h"
+
+/* Buffer grows past this only for lines longer than the buffer itself. */
+#define LINE_READER_BUFSIZE (64 * 1024)
+
+line_reader_t *bb_line_reader_open(int fd)
+{
+	line_reader_t *lr = xzalloc(sizeof(line_reader_t));
+
+	lr->fd = fd;
+	lr->size = LINE_READER_BUFSIZE;
+	lr->buf = xmalloc(lr->size);
+	return lr;
+}
+
+/* Read more data in behind whatever is still unconsumed, sliding the
+ * leftover to the front or growing the buffer first if there's no room.
+ * One byte is always kept spare past the data so the last, unterminated
+ * line can be NUL terminated in place.
+ * Returns number of bytes read, 0 on EOF, -1 on error. */
+static ssize_t line_reader_fill(line_reader_t *lr)
+{
+	ssize_t n;
+
+	if (lr->start) {
+		lr->end -= lr->start;
+		memmove(lr->buf, lr->buf + lr->start, lr->end);
+		lr->start = 0;
+	}
+	if (lr->end + 1 >= lr->size) {
+		lr->size <<= 1;
+		lr->buf = xrealloc(lr->buf, lr->size);
+	}
+	n = safe_read(lr->fd, lr->buf + lr->end, lr->size - lr->end - 1);
+	if (n > 0)
+		lr->end += n;
+	return n;
+}
+
+/* Return the next chunk ending with delim (included in *len), or whatever
+ * is left before EOF if the last chunk is unterminated.  The returned view
+ * is only valid until the next call; it is not NUL terminated.  Returns
+ * NULL at EOF, or on a read error (with lr->error set). */
+char *bb_line_reader_next(line_reader_t *lr, int delim, size_t *len)
+{
+	size_t scanned = 0;
+	char *line, *p;
+
+	for (;;) {
+		p = memchr(lr->buf + lr->start + scanned, delim,
+				lr->end - lr->start - scanned);
+		if (p) {
+			p++;
+			break;
+		}
+		scanned = lr->end - lr->start;
+		if (!lr->eof) {
+			ssize_t n = line_reader_fill(lr);
+
+			if (n > 0)
+				continue;
+			if (n < 0)
+				lr->error = 1;
+			lr->eof = 1;
+		}
+		if (lr->start == lr->end)
+			return NULL;
+		p = lr->buf + lr->end;
+		break;
+	}
+
+	line = lr->buf + lr->start;
+	*len = p - line;
+	lr->start += *len;
+	return line;
+}
+
+/* Same, but strip the delimiter and NUL terminate the line in place.
+ * *len is the length without the delimiter. */
+char *bb_line_reader_chomped(line_reader_t *lr, int delim, size_t *len)
+{
+	char *line = bb_line_reader_next(lr, delim, len);
+
+	if (line) {
+		if (*len && line[*len - 1] == delim)
+			--*len;
+		line[*len] = '\0';
+	}
+	return line;
+}
+
+void bb_line_reader_free(line_reader_t *lr)
+{
+	if (lr) {
+		free(lr->buf);
+		free(lr);
+	}
+}
@@ -20,115 +20,188 @@
 
 #define PROCPS_BUFSIZE 1024
 
-static int read_to_buf(const char *filename, void *buf)
+/* Everything on a box usually runs as a handful of users, so their names
+ * are looked up once per scanner instead of once per process. */
+#define UID_HASH_SIZE 64
+
+struct procps_uid_s {
+	struct procps_uid_s *next;
+	uid_t uid;
+	char name[9];
+};
+
+/* Read a file below /proc/<pid>; its owner is the process owner */
+static int read_to_buf(procps_scan_t *ps, const char *filename, void *buf,
+		struct stat *sb)
 {
 	int fd;
 	ssize_t ret;
 
-	fd = open(filename, O_RDONLY);
+	fd = openat(dirfd(ps->dir), filename, O_RDONLY);
 	if(fd < 0)
 		return -1;
+	if (sb && fstat(fd, sb)) {
+		close(fd);
+		return -1;
+	}
 	ret = read(fd, buf, PROCPS_BUFSIZE-1);
 	((char *)buf)[ret > 0 ? ret : 0] = 0;
 	close(fd);
 	return ret;
 }
 
+static const char *procps_user(procps_scan_t *ps, uid_t uid)
+{
+	struct procps_uid_s **head = &ps->uid_hash[uid % UID_HASH_SIZE];
+	struct procps_uid_s *u;
 
-procps_status_t * procps_scan(int save_user_arg0)
+	for (u = *head; u; u = u->next)
+		if (u->uid == uid)
+			return u->name;
+	u = xmalloc(sizeof(*u));
+	u->uid = uid;
+	bb_getpwuid(u->name, uid, sizeof(u->name));
+	u->next = *head;
+	*head = u;
+	return u->name;
+}
+
+/* Skip n space separated fields */
+static char *skip_fields(char *p, int n)
+{
+	while (n--) {
+		while (*p == ' ')
+			p++;
+		while (*p && *p != ' ')
+			p++;
+	}
+	return p;
+}
+
+/* Parse the next, possibly negative, decimal field.  Returns NULL
+ * if there's no number there. */
+static char *read_field(char *p, long *val)
+{
+	unsigned long v = 0;
+	int neg = 0;
+
+	while (*p == ' ')
+		p++;
+	if (*p == '-') {
+		neg = 1;
+		p++;
+	}
+	if (*p < '0' || *p > '9')
+		return NULL;
+	do
+		v = v * 10 + (*p++ - '0');
+	while (*p >= '0' && *p <= '9');
+	*val = neg ? -(long)v : (long)v;
+	return p;
+}
+
+procps_scan_t *procps_scan_open(int flags)
+{
+	procps_scan_t *ps = xzalloc(sizeof(procps_scan_t));
+
+	ps->dir = bb_xopendir("/proc");
+	fcntl(dirfd(ps->dir), F_SETFD, FD_CLOEXEC);
+	ps->flags = flags;
+	ps->uid_hash = xzalloc(UID_HASH_SIZE * sizeof(struct procps_uid_s *));
+	return ps;
+}
+
+/* Returns the next process, or NULL once all were seen; the following
+ * call then starts over with a fresh look at /proc. */
+procps_status_t *procps_scan_next(procps_scan_t *ps)
 {
-	static DIR *dir;
 	struct dirent *entry;
-	static procps_status_t ret_status;
-	char *name;
+	char *name, *p;
 	int n;
 	char status[32];
 	char *status_tail;
 	char buf[PROCPS_BUFSIZE];
-	procps_status_t curstatus;
-	int pid;
-	long tasknice;
+	procps_status_t *cur = &ps->status;
+	long val, tasknice;
 	struct stat sb;
 
-	if (!dir) {
-		dir = bb_xopendir("/proc");
-	}
 	for(;;) {
-		if((entry = readdir(dir)) == NULL) {
-			closedir(dir);
-			dir = 0;
+		if((entry = readdir(ps->dir)) == NULL) {
+			rewinddir(ps->dir);
 			return 0;
 		}
 		name = entry->d_name;
 		if (!(*name >= '0' && *name <= '9'))
 			continue;
 
-		memset(&curstatus, 0, sizeof(procps_status_t));
-		pid = atoi(name);
-		curstatus.pid = pid;
+		memset(cur, 0, sizeof(procps_status_t));
+		cur->pid = atoi(name);
 
-		status_tail = status + sprintf(status, "/proc/%d", pid);
-		if(stat(status, &sb))
-			continue;
-		bb_getpwuid(curstatus.user, sb.st_uid, sizeof(curstatus.user));
+		status_tail = status + sprintf(status, "%d", cur->pid);
 
 		/* see proc(5) for some details on this */
 		strcpy(status_tail, "/stat");
-		n = read_to_buf(status, buf);
-		if(n < 0)
+		if (read_to_buf(ps, status, buf, &sb) < 0)
 			continue;
-		name = strrchr(buf, ')'); /* split into "PID (cmd" and "<rest>" */
-		if(name == 0 || name[1] != ' ')
+		safe_strncpy(cur->user, procps_user(ps, sb.st_uid),
+				sizeof(cur->user));
+		/* split into "PID (cmd" and "<rest>" */
+		name = strrchr(buf, ')');
+		p = strchr(buf, '(');
+		if(name == 0 || p == 0 || name < p || name[1] != ' ' || !name[2])
 			continue;
-		*name = 0;
-		sscanf(buf, "%*s (%15c", curstatus.short_cmd);
-		n = sscanf(name+2,
-		"%c %d "
-		"%*s %*s %*s %*s "     /* pgrp, session, tty, tpgid */
-		"%*s %*s %*s %*s %*s " /* flags, min_flt, cmin_flt, maj_flt, cmaj_flt */
-#ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
-		"%lu %lu "             /* utime, stime */
-#else
-		"%*s %*s "             /* utime, stime */
-#endif
-		"%*s %*s %*s "         /* cutime, cstime, priority */
-		"%ld "                 /* nice */
-		"%*s %*s %*s "         /* timeout, it_real_value, start_time */
-		"%*s "                 /* vsize */
-		"%ld",                 /* rss */
-		curstatus.state, &curstatus.ppid,
-#ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
-		&curstatus.utime, &curstatus.stime,
-#endif
-		&tasknice,
-		&curstatus.rss);
+		n = name - ++p;
+		if (n > COMM_LEN - 1)
+			n = COMM_LEN - 1;
+		memcpy(cur->short_cmd, p, n);
+
+		p = name + 2;
+		cur->state[0] = *p++;
+		if (!(p = read_field(p, &val)))
+			continue;
+		cur->ppid = val;
+		/* pgrp, session, tty, tpgid,
+		 * flags, min_flt, cmin_flt, maj_flt, cmaj_flt */
+		p = skip_fields(p, 9);
 #ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
-		if(n != 6)
+		if (!(p = read_field(p, &val)))
+			continue;
+		cur->utime = val;
+		if (!(p = read_field(p, &val)))
+			continue;
+		cur->stime = val;
 #else
-		if(n != 4)
+		p = skip_fields(p, 2);		/* utime, stime */
 #endif
+		p = skip_fields(p, 3);		/* cutime, cstime, priority */
+		if (!(p = read_field(p, &tasknice)))
 			continue;
+		/* timeout, it_real_value, start_time, vsize */
+		p = skip_fields(p, 4);
+		if (!(p = read_field(p, &val)))
+			continue;
+		cur->rss = val;
 
-		if (curstatus.rss == 0 && curstatus.state[0] != 'Z')
-			curstatus.state[1] = 'W';
+		if (cur->rss == 0 && cur->state[0] != 'Z')
+			cur->state[1] = 'W';
 		else
-			curstatus.state[1] = ' ';
+			cur->state[1] = ' ';
 		if (tasknice < 0)
-			curstatus.state[2] = '<';
+			cur->state[2] = '<';
 		else if (tasknice > 0)
-			curstatus.state[2] = 'N';
+			cur->state[2] = 'N';
 		else
-			curstatus.state[2] = ' ';
+			cur->state[2] = ' ';
 
 #ifdef PAGE_SHIFT
-		curstatus.rss <<= (PAGE_SHIFT - 10);     /* 2**10 = 1kb */
+		cur->rss <<= (PAGE_SHIFT - 10);     /* 2**10 = 1kb */
 #else
-		curstatus.rss *= (getpagesize() >> 10);     /* 2**10 = 1kb */
+		cur->rss *= (getpagesize() >> 10);     /* 2**10 = 1kb */
 #endif
 
-		if(save_user_arg0) {
+		if (ps->flags & PSSCAN_CMD) {
 			strcpy(status_tail, "/cmdline");
-			n = read_to_buf(status, buf);
+			n = read_to_buf(ps, status, buf, NULL);
 			if(n > 0) {
 				if(buf[n-1]=='\n')
 					buf[--n] = 0;
@@ -141,10 +214,38 @@ procps_status_t * procps_scan(int save_user_arg0)
 				}
 				*name = 0;
 				if(buf[0])
-					curstatus.cmd = strdup(buf);
+					cur->cmd = strdup(buf);
 				/* if NULL it work true also */
 			}
 		}
-		return memcpy(&ret_status, &curstatus, sizeof(procps_status_t));
+		return cur;
+	}
+}
+
+void procps_scan_close(procps_scan_t *ps)
+{
+	int i;
+
+	for (i = 0; i < UID_HASH_SIZE; i++) {
+		while (ps->uid_hash[i]) {
+			struct procps_uid_s *u = ps->uid_hash[i];
+
+			ps->uid_hash[i] = u->next;
+			free(u);
+		}
 	}
+	free(ps->uid_hash);
+	closedir(ps->dir);
+	free(ps);
+}
+
+/* One walk over all processes with a scanner kept for the next walk */
+procps_status_t * procps_scan(int save_user_arg0)
+{
+	static procps_scan_t *ps;
+
+	if (!ps)
+		ps = procps_scan_open(0);
+	ps->flags = save_user_arg0 ? PSSCAN_CMD : 0;
+	return procps_scan_next(ps);
 }
@@ -10,22 +10,173 @@
 #include <stdio.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <stdlib.h>	/* free() */
 #include "libbb.h"
 
 #undef DEBUG_RECURS_ACTION
 
+#define DOT_OR_DOTDOT(s) ((s)[0] == '.' && (!(s)[1] || ((s)[1] == '.' && !(s)[2])))
+
+
+/* Directories this deep are read in full and closed before going into
+ * them, so the walk never holds more than this many fds open */
+#define WALK_MAX_FDS	32
+
+struct walk {
+	char *path;			/* name of the current file, for the actions */
+	size_t path_len, path_alloc;
+	int followLinks, depthFirst, modeOnly;
+	int (*fileAction) (const char *fileName, struct stat * statbuf,
+					   void* userData);
+	int (*dirAction) (const char *fileName, struct stat * statbuf,
+					  void* userData);
+	void* userData;
+};
+
+struct walk_entry {
+	ino_t ino;
+	unsigned char type;
+	char name[1];
+};
+
+static int walk_file(struct walk *w, int atfd, const char *atname,
+		unsigned char d_type, ino_t d_ino, int depth);
+
+/* Append "/name" to w->path and visit it; atfd/atname get to it */
+static int walk_child(struct walk *w, int atfd, const char *name,
+		unsigned char d_type, ino_t d_ino, int depth)
+{
+	size_t len = w->path_len, name_len;
+	int status;
+
+	if (DOT_OR_DOTDOT(name))
+		return TRUE;
+	name_len = strlen(name);
+	if (len + name_len + 2 > w->path_alloc) {
+		w->path_alloc = len + name_len + 256;
+		w->path = xrealloc(w->path, w->path_alloc);
+	}
+	if (!len || w->path[len - 1] != '/')
+		w->path[w->path_len++] = '/';
+	memcpy(w->path + w->path_len, name, name_len + 1);
+	w->path_len += name_len;
+	status = walk_file(w, atfd, atfd == AT_FDCWD ? w->path : name,
+			d_type, d_ino, depth);
+	w->path_len = len;
+	w->path[len] = '\0';
+	return status;
+}
+
+static int walk_dir(struct walk *w, int atfd, const char *atname, int depth)
+{
+	struct dirent *next;
+	DIR *dir;
+	int fd, status = TRUE;
+
+	fd = openat(atfd, atname, O_RDONLY | O_DIRECTORY | O_NONBLOCK
+			| (w->followLinks ? 0 : O_NOFOLLOW));
+	if (fd < 0 || (dir = fdopendir(fd)) == NULL) {
+		bb_perror_msg("unable to open `%s'", w->path);
+		if (fd >= 0)
+			close(fd);
+		return FALSE;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	if (depth < WALK_MAX_FDS) {
+		/* the children are looked up relative to this directory */
+		while ((next = readdir(dir)) != NULL) {
+			if (!walk_child(w, fd, next->d_name, next->d_type,
+						next->d_ino, depth + 1))
+				status = FALSE;
+		}
+		closedir(dir);
+		return status;
+	} else {
+		/* too deep to keep it open: read it all, then go by full name */
+		struct walk_entry **list = NULL;
+		int i, n = 0;
+
+		while ((next = readdir(dir)) != NULL) {
+			struct walk_entry *e;
+
+			if (DOT_OR_DOTDOT(next->d_name))
+				continue;
+			e = xmalloc(sizeof(*e) + strlen(next->d_name));
+			e->ino = next->d_ino;
+			e->type = next->d_type;
+			strcpy(e->name, next->d_name);
+			if ((n & 63) == 0)
+				list = xrealloc(list, (n + 64) * sizeof(*list));
+			list[n++] = e;
+		}
+		closedir(dir);
+		for (i = 0; i < n; i++) {
+			if (!walk_child(w, AT_FDCWD, list[i]->name, list[i]->type,
+						list[i]->ino, depth + 1))
+				status = FALSE;
+			free(list[i]);
+		}
+		free(list);
+	}
+	return status;
+}
+
+static int walk_file(struct walk *w, int atfd, const char *atname,
+		unsigned char d_type, ino_t d_ino, int depth)
+{
+	int status;
+	struct stat statbuf;
+
+	/* When the actions only want the file type, readdir() has told us
+	 * already on most filesystems */
+	if (w->modeOnly && d_type != DT_UNKNOWN
+			&& !(w->followLinks && d_type == DT_LNK)) {
+		memset(&statbuf, 0, sizeof(statbuf));
+		statbuf.st_mode = DTTOIF(d_type);
+		statbuf.st_ino = d_ino;
+	} else if (fstatat(atfd, atname, &statbuf,
+				w->followLinks ? 0 : AT_SYMLINK_NOFOLLOW) < 0) {
+		bb_perror_msg("%s", w->path);
+		return FALSE;
+	}
+
+	if (! S_ISDIR(statbuf.st_mode)) {
+		if (w->fileAction == NULL)
+			return TRUE;
+		else
+			return w->fileAction(w->path, &statbuf, w->userData);
+	}
+
+	if (w->dirAction != NULL && ! w->depthFirst) {
+		status = w->dirAction(w->path, &statbuf, w->userData);
+		if (! status) {
+			bb_perror_msg("%s", w->path);
+			return FALSE;
+		} else if (status == SKIP)
+			return TRUE;
+	}
+	status = walk_dir(w, atfd, atname, depth);
+	if (w->dirAction != NULL && w->depthFirst) {
+		if (! w->dirAction(w->path, &statbuf, w->userData)) {
+			bb_perror_msg("%s", w->path);
+			return FALSE;
+		}
+	}
+	return status;
+}
 
 /*
  * Walk down all the directories under the specified
  * location, and do something (something specified
  * by the fileAction and dirAction function pointers).
  *
- * Unfortunately, while nftw(3) could replace this and reduce
- * code size a bit, nftw() wasn't supported before GNU libc 2.1,
- * and so isn't sufficiently portable to take over since glibc2.1
- * is so stinking huge.
+ * Entries are looked up relative to an fd of their directory with
+ * fstatat(), rather than by their whole path.  If recurse has
+ * ACTION_MODE_ONLY in it, the actions promise to look at nothing but
+ * st_mode and st_ino, which can then come from readdir()'s d_type.
  */
 int recursive_action(const char *fileName,
 					int recurse, int followLinks, int depthFirst,
@@ -39,7 +190,7 @@ int recursive_action(const char *fileName,
 {
 	int status;
 	struct stat statbuf;
-	struct dirent *next;
+	struct walk w;
 
 	if (followLinks)
 		status = stat(fileName, &statbuf);
@@ -62,57 +213,47 @@ int recursive_action(const char *fileName,
 			return fileAction(fileName, &statbuf, userData);
 	}
 
-	if (! recurse) {
-		if (S_ISDIR(statbuf.st_mode)) {
-			if (dirAction != NULL)
-				return (dirAction(fileName, &statbuf, userData));
-			else
-				return TRUE;
-		}
+	if (! S_ISDIR(statbuf.st_mode)) {
+		if (fileAction == NULL)
+			return TRUE;
+		else
+			return fileAction(fileName, &statbuf, userData);
 	}
 
-	if (S_ISDIR(statbuf.st_mode)) {
-		DIR *dir;
+	if (! (recurse & ACTION_RECURSE)) {
+		if (dirAction != NULL)
+			return (dirAction(fileName, &statbuf, userData));
+		else
+			return TRUE;
+	}
 
-		if (dirAction != NULL && ! depthFirst) {
-			status = dirAction(fileName, &statbuf, userData);
-			if (! status) {
-				bb_perror_msg("%s", fileName);
-				return FALSE;
-			} else if (status == SKIP)
-				return TRUE;
-		}
-		dir = bb_opendir(fileName);
-		if (!dir) {
+	if (dirAction != NULL && ! depthFirst) {
+		status = dirAction(fileName, &statbuf, userData);
+		if (! status) {
+			bb_perror_msg("%s", fileName);
 			return FALSE;
-		}
-		status = TRUE;
-		while ((next = readdir(dir)) != NULL) {
-			char *nextFile;
+		} else if (status == SKIP)
+			return TRUE;
+	}
 
-			nextFile = concat_subpath_file(fileName, next->d_name);
-			if(nextFile == NULL)
-				continue;
-			if (! recursive_action(nextFile, TRUE, followLinks, depthFirst,
-						fileAction, dirAction, userData)) {
-				status = FALSE;
-			}
-			free(nextFile);
-		}
-		closedir(dir);
-		if (dirAction != NULL && depthFirst) {
-			if (! dirAction(fileName, &statbuf, userData)) {
-				bb_perror_msg("%s", fileName);
-				return FALSE;
-			}
-		}
-		if (! status)
+	w.path_len = strlen(fileName);
+	w.path_alloc = w.path_len + 256;
+	w.path = xmalloc(w.path_alloc);
+	memcpy(w.path, fileName, w.path_len + 1);
+	w.followLinks = followLinks;
+	w.depthFirst = depthFirst;
+	w.modeOnly = recurse & ACTION_MODE_ONLY;
+	w.fileAction = fileAction;
+	w.dirAction = dirAction;
+	w.userData = userData;
+	status = walk_dir(&w, AT_FDCWD, fileName, 0);
+	free(w.path);
+
+	if (dirAction != NULL && depthFirst) {
+		if (! dirAction(fileName, &statbuf, userData)) {
+			bb_perror_msg("%s", fileName);
 			return FALSE;
-	} else {
-		if (fileAction == NULL)
-			return TRUE;
-		else
-			return fileAction(fileName, &statbuf, userData);
+		}
 	}
-	return TRUE;
+	return status;
 }
@@ -0,0 +1,24 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Utility routines.
+ *
+ * Where the die functions go to end an applet.  Normally that's exit(),
+ * but an applet run inside a process that goes on afterwards, the shell
+ * running one without a fork, points bb_die_jmp at a jmp_buf and gets
+ * retval back from setjmp() as retval | BB_DIE_JMP_FLAG.
+ *
+ * Licensed under GPLv2, see file LICENSE in this tarball for details.
+ */
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include "libbb.h"
+
+jmp_buf *bb_die_jmp;
+
+void bb_xfunc_exit(int retval)
+{
+	if (bb_die_jmp)
+		longjmp(*bb_die_jmp, (retval & 0xff) | BB_DIE_JMP_FLAG);
+	exit(retval);
+}
@@ -58,6 +58,10 @@ extern int __parsespent(void *sp, char *line);
 extern int __pgsreader(int (*__parserfunc)(void *d, char *line), void *data,
 					   char *__restrict line_buff, size_t buflen, FILE *f);
 
+extern int __pgsindex(const char *path, const char *name, unsigned long id,
+					  int (*__parserfunc)(void *d, char *line), void *data,
+					  char *__restrict line_buff, size_t buflen);
+
 /**********************************************************************/
 /* For the various fget??ent_r funcs, return
  *
@@ -222,6 +226,7 @@ int sgetspent_r(const char *string, struct spwd *result_buf,
 #define GETXXKEY_R_PARSER		__parsepwent
 #define GETXXKEY_R_ENTTYPE		struct passwd
 #define GETXXKEY_R_TEST(ENT)	(!strcmp((ENT)->pw_name, key))
+#define GETXXKEY_R_INDEX		key, 0
 #define DO_GETXXKEY_R_KEYTYPE	const char *__restrict
 #define DO_GETXXKEY_R_PATHNAME  _PATH_PASSWD
 #include "pwd_grp_internal.c"
@@ -232,6 +237,7 @@ int sgetspent_r(const char *string, struct spwd *result_buf,
 #define GETXXKEY_R_PARSER		__parsegrent
 #define GETXXKEY_R_ENTTYPE		struct group
 #define GETXXKEY_R_TEST(ENT)	(!strcmp((ENT)->gr_name, key))
+#define GETXXKEY_R_INDEX		key, 0
 #define DO_GETXXKEY_R_KEYTYPE	const char *__restrict
 #define DO_GETXXKEY_R_PATHNAME  _PATH_GROUP
 #include "pwd_grp_internal.c"
@@ -252,6 +258,7 @@ int sgetspent_r(const char *string, struct spwd *result_buf,
 #define GETXXKEY_R_PARSER		__parsepwent
 #define GETXXKEY_R_ENTTYPE		struct passwd
 #define GETXXKEY_R_TEST(ENT)	((ENT)->pw_uid == key)
+#define GETXXKEY_R_INDEX		NULL, key
 #define DO_GETXXKEY_R_KEYTYPE	uid_t
 #define DO_GETXXKEY_R_PATHNAME  _PATH_PASSWD
 #include "pwd_grp_internal.c"
@@ -262,6 +269,7 @@ int sgetspent_r(const char *string, struct spwd *result_buf,
 #define GETXXKEY_R_PARSER		__parsegrent
 #define GETXXKEY_R_ENTTYPE		struct group
 #define GETXXKEY_R_TEST(ENT)	((ENT)->gr_gid == key)
+#define GETXXKEY_R_INDEX		NULL, key
 #define DO_GETXXKEY_R_KEYTYPE	gid_t
 #define DO_GETXXKEY_R_PATHNAME  _PATH_GROUP
 #include "pwd_grp_internal.c"
@@ -1029,6 +1037,191 @@ int __parsespent(void *data, char * line)
 	return EINVAL;
 }
 
+#endif
+/**********************************************************************/
+#ifdef L___pgsindex
+
+/* getpw{nam,uid}_r() and getgr{nam,gid}_r() look entries up in an index
+ * of the whole file instead of reading it through each time.  The file
+ * is mmap'ed once and hashed by name and by uid/gid; as long as stat()
+ * says it is the same file, the index is used again.
+ *
+ * The chains keep file order and the matching lines are still parsed
+ * into the caller's buffer by the usual parser, so a lookup returns
+ * just what reading the file from the top would. */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+struct pgs_line {
+	unsigned off, len;
+	unsigned long id;
+	unsigned next_name, next_id;	/* index + 1 of the next in chain */
+};
+
+struct pgs_cache {
+	const char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime, ctime;
+	char *map;
+	struct pgs_line *line;
+	unsigned *by_name, *by_id;		/* index + 1 of the first in chain */
+	unsigned mask;
+};
+
+static struct pgs_cache pgs_cache[2];	/* passwd and group */
+
+static unsigned pgs_hash(const char *s, size_t len)
+{
+	unsigned h = 2166136261U;
+
+	while (len--)
+		h = (h ^ (unsigned char)*s++) * 16777619U;
+	return h;
+}
+
+static void pgs_free(struct pgs_cache *c)
+{
+	if (c->map)
+		munmap(c->map, c->size);
+	free(c->line);
+	free(c->by_name);
+	free(c->by_id);
+	c->map = NULL;
+	c->line = NULL;
+	c->by_name = c->by_id = NULL;
+	c->path = NULL;
+}
+
+static int pgs_build(struct pgs_cache *c, const char *path, struct stat *st)
+{
+	unsigned nlines = 0, alloc = 0, i;
+	char *p, *end, *eol;
+	int fd;
+
+	pgs_free(c);
+	c->dev = st->st_dev;
+	c->ino = st->st_ino;
+	c->size = st->st_size;
+	c->mtime = st->st_mtime;
+	c->ctime = st->st_ctime;
+	if (st->st_size) {
+		if ((fd = open(path, O_RDONLY)) < 0)
+			return errno;
+		c->map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (c->map == MAP_FAILED) {
+			c->map = NULL;
+			return errno;
+		}
+	}
+
+	/* Same lines as __pgsreader() would look at */
+	for (p = c->map, end = p + c->size; p < end; p = eol + 1) {
+		if (!(eol = memchr(p, '\n', end - p)))
+			eol = end;
+		if (eol == p || *p == '#' || isspace((unsigned char)*p))
+			continue;
+		if (nlines == alloc) {
+			alloc = alloc * 2 + 64;
+			c->line = xrealloc(c->line, alloc * sizeof(*c->line));
+		}
+		c->line[nlines].off = p - c->map;
+		c->line[nlines].len = eol - p;
+		nlines++;
+	}
+
+	for (c->mask = 63; c->mask < nlines * 2; c->mask = c->mask * 2 + 1)
+		continue;
+	c->by_name = xcalloc(c->mask + 1, sizeof(unsigned));
+	c->by_id = xcalloc(c->mask + 1, sizeof(unsigned));
+	/* Backwards, so that each chain ends up in file order */
+	for (i = nlines; i--; ) {
+		struct pgs_line *l = &c->line[i];
+		char *line = c->map + l->off, *colon;
+		unsigned h;
+
+		l->next_name = l->next_id = 0;
+		if (!(colon = memchr(line, ':', l->len)))
+			continue;
+		h = pgs_hash(line, colon - line) & c->mask;
+		l->next_name = c->by_name[h];
+		c->by_name[h] = i + 1;
+
+		/* the uid or gid is the third field in both files */
+		if (!(colon = memchr(colon + 1, ':', line + l->len - colon - 1)))
+			continue;
+		/* the same test as the parsers make; the next ':' stops it */
+		p = colon + 1;
+		l->id = strtoul(p, &eol, 10);
+		if (eol == p || eol >= line + l->len || *eol != ':')
+			continue;
+		h = (unsigned)(l->id * 2654435761UL) & c->mask;
+		l->next_id = c->by_id[h];
+		c->by_id[h] = i + 1;
+	}
+	c->path = path;
+	return 0;
+}
+
+/* Like looking for name (or for id, if name is NULL) with __pgsreader().
+ * Returns 0 if found, ENOENT if not, or an errno. */
+int __pgsindex(const char *path, const char *name, unsigned long id,
+			   int (*__parserfunc)(void *d, char *line), void *data,
+			   char *__restrict line_buff, size_t buflen)
+{
+	struct pgs_cache *c = &pgs_cache[strcmp(path, _PATH_PASSWD) != 0];
+	struct stat st;
+	size_t name_len = 0;
+	unsigned i;
+	int rv;
+
+	if (buflen < PWD_BUFFER_SIZE) {
+		errno = ERANGE;
+		return ERANGE;
+	}
+	if (stat(path, &st) < 0)
+		return errno;
+	if (!c->path || strcmp(c->path, path) || c->dev != st.st_dev
+			|| c->ino != st.st_ino || c->size != st.st_size
+			|| c->mtime != st.st_mtime || c->ctime != st.st_ctime) {
+		if ((rv = pgs_build(c, path, &st)) != 0) {
+			pgs_free(c);
+			return rv;
+		}
+	}
+
+	if (name) {
+		name_len = strlen(name);
+		i = c->by_name[pgs_hash(name, name_len) & c->mask];
+	} else
+		i = c->by_id[(unsigned)(id * 2654435761UL) & c->mask];
+
+	for (; i; i = name ? c->line[i - 1].next_name : c->line[i - 1].next_id) {
+		struct pgs_line *l = &c->line[i - 1];
+		const char *line = c->map + l->off;
+
+		if (name) {
+			if (l->len <= name_len || line[name_len] != ':'
+					|| memcmp(line, name, name_len))
+				continue;
+		} else if (l->id != id)
+			continue;
+		/* A line fgets() couldn't have fit in the buffer is skipped */
+		if (l->len + 2 > buflen)
+			continue;
+		memcpy(line_buff, line, l->len);
+		line_buff[l->len] = 0;
+		if (__parserfunc == __parsegrent)	/* Do evil group hack. */
+			((struct group *) data)->gr_name = line_buff + buflen;
+		if (!__parserfunc(data, line_buff))
+			return 0;
+	}
+	return ENOENT;
+}
+
 #endif
 /**********************************************************************/
 #ifdef L___pgsreader
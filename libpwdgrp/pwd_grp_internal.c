@@ -59,6 +59,9 @@ extern int __parsespent(void *sp, char *line);
 
 extern int __pgsreader(int (*__parserfunc)(void *d, char *line), void *data,
 					   char *__restrict line_buff, size_t buflen, FILE *f);
+extern int __pgsindex(const char *path, const char *name, unsigned long id,
+					  int (*__parserfunc)(void *d, char *line), void *data,
+					  char *__restrict line_buff, size_t buflen);
 
 
 #ifndef GETXXKEY_R_FUNC
@@ -72,6 +75,19 @@ int GETXXKEY_R_FUNC(DO_GETXXKEY_R_KEYTYPE key,
 					char *__restrict buffer, size_t buflen,
 					GETXXKEY_R_ENTTYPE **__restrict result)
 {
+#ifdef GETXXKEY_R_INDEX
+	int rv;
+
+	*result = NULL;
+
+	rv = __pgsindex(DO_GETXXKEY_R_PATHNAME, GETXXKEY_R_INDEX,
+					GETXXKEY_R_PARSER, resultbuf, buffer, buflen);
+	if (!rv) {
+		*result = resultbuf;
+	} else if (rv == ENOENT) {	/* not there */
+		rv = 0;
+	}
+#else
 	FILE *stream;
 	int rv;
 
@@ -97,6 +113,7 @@ int GETXXKEY_R_FUNC(DO_GETXXKEY_R_KEYTYPE key,
 		} while (1);
 		fclose(stream);
 	}
+#endif
 
 	return rv;
 }
@@ -107,6 +124,7 @@ int GETXXKEY_R_FUNC(DO_GETXXKEY_R_KEYTYPE key,
 #undef GETXXKEY_R_PARSER
 #undef GETXXKEY_R_ENTTYPE
 #undef GETXXKEY_R_TEST
+#undef GETXXKEY_R_INDEX
 #undef DO_GETXXKEY_R_KEYTYPE
 #undef DO_GETXXKEY_R_PATHNAME
 
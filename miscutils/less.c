@@ -37,6 +37,10 @@
 #include <termios.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef CONFIG_FEATURE_LESS_REGEXP
 #include "xregex.h"
@@ -66,15 +70,11 @@
 /* The escape code to clear the screen */
 #define CLEAR "\033[H\033[J"
 
-/* Maximum number of lines in a file */
-#define MAXLINES 10000
-
 static int height;
 static int width;
 static char **files;
 static char filename[256];
 static char **buffer;
-static char **flines;
 static int current_file = 1;
 static int line_pos;
 static int num_flines;
@@ -99,7 +99,6 @@ static int num_marks;
 #endif
 
 #ifdef CONFIG_FEATURE_LESS_REGEXP
-static int match_found;
 static int *match_lines;
 static int match_pos;
 static int num_matches;
@@ -188,48 +187,217 @@ static void clear_line(void)
 	printf("\033[K");
 }
 
-/* This adds line numbers to every line, as the -N flag necessitates */
-static void add_linenumbers(void)
+/* The input is a regular file mapped whole, or else is read into data
+ * as far as the lines looked at so far need.  Every LINE_STEP-th line
+ * start is kept in line_index; lines in between are found with memchr. */
+#define LINE_STEP 64
+
+static char *data;
+static size_t data_len;
+static size_t data_alloc;		/* 0 if data is mapped */
+static int data_fd = -1;
+static int data_eof;
+static size_t *line_index;
+static size_t scan_pos;			/* start of the line after num_flines */
+static int cached_line = -1;
+static size_t cached_pos;
+
+static void data_close(void)
 {
-	char current_line[256];
-	int i;
+	if (data_alloc)
+		free(data);
+	else if (data_len)
+		munmap(data, data_len);
+	if (data_fd >= 0)
+		close(data_fd);
+	data = NULL;
+	data_len = data_alloc = 0;
+	data_fd = -1;
+	free(line_index);
+	line_index = NULL;
+}
 
-	for (i = 0; i <= num_flines; i++) {
-		safe_strncpy(current_line, flines[i], 256);
-		flines[i] = bb_xasprintf("%5d %s", i + 1, current_line);
+/* Read another chunk of a pipe into data, 0 at EOF */
+static int data_read(void)
+{
+	ssize_t n;
+
+	if (data_eof)
+		return 0;
+	if (data_alloc - data_len < BUFSIZ) {
+		data_alloc = data_alloc * 2 + BB_BULK_BUFSIZE;
+		data = xrealloc(data, data_alloc);
 	}
+	n = safe_read(data_fd, data + data_len, data_alloc - data_len);
+	if (n < 0)
+		bb_perror_msg_and_die("%s", filename);
+	if (n == 0)
+		data_eof = 1;
+	data_len += n;
+	return n;
 }
 
-static void data_readlines(void)
+/* Find lines until line n or the end of the input, whichever comes
+ * first.  After that num_flines is exact if it is less than n. */
+static void index_lines(int n)
 {
+	size_t from = scan_pos;
+	char *p;
+
+	while (num_flines < n) {
+		if (from >= data_len && !data_read())
+			break;
+		p = memchr(data + from, '\n', data_len - from);
+		if (p == NULL) {
+			from = data_len;
+			if (data_read())
+				continue;
+			if (scan_pos == data_len)
+				break;
+		}
+		if ((++num_flines % LINE_STEP) == 0) {
+			if ((num_flines / LINE_STEP) % 64 == 0)
+				line_index = xrealloc(line_index,
+					(num_flines / LINE_STEP + 64) * sizeof(size_t));
+			line_index[num_flines / LINE_STEP] = scan_pos;
+		}
+		scan_pos = from = p ? p - data + 1 : data_len;
+	}
+}
+
+static void index_all(void)
+{
+	index_lines(INT_MAX);
+}
+
+/* Whether there is a line n */
+static int have_line(int n)
+{
+	index_lines(n);
+	return n <= num_flines;
+}
+
+/* Where line n, which must exist, starts; its length without the
+ * newline goes to *len */
+static const char *line_text(int n, size_t *len)
+{
+	size_t pos;
 	int i;
-	char current_line[256];
-	FILE *fp;
+	char *p;
 
-	fp = (inp_stdin) ? stdin : bb_xfopen(filename, "r");
-	flines = NULL;
-	for (i = 0; (feof(fp)==0) && (i <= MAXLINES); i++) {
-		strcpy(current_line, "");
-		fgets(current_line, 256, fp);
-		if (fp != stdin)
-			bb_xferror(fp, filename);
-		flines = xrealloc(flines, (i+1) * sizeof(char *));
-		flines[i] = bb_xstrdup(current_line);
+	/* The screen asks for the lines in order, go on from the last one */
+	if (cached_line >= 0 && cached_line <= n && n - cached_line < LINE_STEP) {
+		i = cached_line;
+		pos = cached_pos;
+	} else {
+		i = n - n % LINE_STEP;
+		pos = line_index[i / LINE_STEP];
+	}
+	for (; i < n; i++)
+		pos = (char *) memchr(data + pos, '\n', data_len - pos) - data + 1;
+	cached_line = n;
+	cached_pos = pos;
+
+	p = memchr(data + pos, '\n', data_len - pos);
+	*len = (p ? p : data + data_len) - (data + pos);
+	return data + pos;
+}
+
+#ifdef CONFIG_FEATURE_LESS_REGEXP
+/* Copies the len bytes at p to dst with what the last search matched
+ * highlighted, and returns how many that took.  With dst NULL it only
+ * counts. */
+static size_t highlight(char *dst, const char *p, size_t len)
+{
+	regmatch_t match;
+	size_t pos = 0, out = 0;
+
+#define PUT(s, n) do { if (dst) memcpy(dst + out, s, n); out += n; } while (0)
+	while (pos < len) {
+		match.rm_so = pos;
+		match.rm_eo = len;
+		if (regexec(&old_pattern, p, 1, &match, REG_STARTEND) != 0)
+			break;
+		PUT(p + pos, match.rm_so - pos);
+		pos = match.rm_eo;
+		if (match.rm_so == match.rm_eo) {
+			/* Nothing to highlight, step over a byte */
+			if (pos == len)
+				break;
+			PUT(p + pos, 1);
+			pos++;
+			continue;
+		}
+		PUT(HIGHLIGHT, sizeof(HIGHLIGHT) - 1);
+		PUT(p + match.rm_so, match.rm_eo - match.rm_so);
+		PUT(NORMAL, sizeof(NORMAL) - 1);
+	}
+	PUT(p + pos, len - pos);
+#undef PUT
+	return out;
+}
+#endif
+
+/* A copy of line n as it goes on the screen, "" just past the last */
+static char *get_line(int n)
+{
+	const char *p;
+	char *line;
+	size_t len, size;
+	int num = 0;
+
+	if (!have_line(n))
+		return bb_xstrdup("");
+	p = line_text(n, &len);
+	size = len;
+#ifdef CONFIG_FEATURE_LESS_REGEXP
+	if (num_matches)
+		size = highlight(NULL, p, len);
+#endif
+	/* room for the -N number, the newline and the NUL */
+	line = xmalloc(size + sizeof(int) * 3 + 4);
+	if (flags & FLAG_N)
+		num = sprintf(line, "%5d ", n + 1);
+#ifdef CONFIG_FEATURE_LESS_REGEXP
+	if (num_matches)
+		highlight(line + num, p, len);
+	else
+#endif
+		memcpy(line + num, p, len);
+	strcpy(line + num + size, "\n");
+	return line;
+}
+
+static void data_readlines(void)
+{
+	struct stat st;
+
+	/* Keep what was read already from stdin, it can't be read again */
+	if (!inp_stdin || data_fd != STDIN_FILENO) {
+		data_close();
+		data_fd = (inp_stdin) ? STDIN_FILENO : bb_xopen(filename, O_RDONLY);
+		data_eof = 0;
+		if (fstat(data_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+				&& (off_t)(size_t) st.st_size == st.st_size) {
+			data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, data_fd, 0);
+			if (data != MAP_FAILED) {
+				data_len = st.st_size;
+				data_eof = 1;
+			} else
+				data = NULL;
+		}
+		num_flines = -1;
+		scan_pos = 0;
+		cached_line = -1;
 	}
-	num_flines = i - 2;
 
 	/* Reset variables for a new file */
 
 	line_pos = 0;
 	past_eof = 0;
 
-	fclose(fp);
-
 	if (inp == NULL)
 		inp = (inp_stdin) ? bb_xfopen(CURRENT_TTY, "r") : stdin;
-
-	if (flags & FLAG_N)
-		add_linenumbers();
 }
 
 #ifdef CONFIG_FEATURE_LESS_FLAGS
@@ -238,6 +406,7 @@ static void data_readlines(void)
  * on my build. */
 static int calc_percent(void)
 {
+	index_all();
 	return ((100 * (line_pos + height - 2) / num_flines) + 1);
 }
 
@@ -246,6 +415,7 @@ static void m_status_print(void)
 {
 	int percentage;
 
+	index_all();
 	if (!past_eof) {
 		if (!line_pos) {
 			if (num_files > 1)
@@ -294,6 +464,8 @@ static void medium_status_print(void)
 /* Print the status line */
 static void status_print(void)
 {
+	index_lines(line_pos + height - 1);
+
 	/* Change the status if flags have been set */
 #ifdef CONFIG_FEATURE_LESS_FLAGS
 	if (flags & FLAG_M)
@@ -327,6 +499,7 @@ static void buffer_print(void)
 	int i;
 
 	printf("%s", CLEAR);
+	index_lines(height - 2);
 	if (num_flines >= height - 2) {
 		for (i = 0; i < height - 1; i++)
 			printf("%s", buffer[i]);
@@ -355,43 +528,40 @@ static void buffer_init(void)
 	}
 
 	/* Fill the buffer until the end of the file or the
-	   end of the buffer is reached */
-	for (i = 0; (i < (height - 1)) && (i <= num_flines); i++) {
-		buffer[i] = bb_xstrdup(flines[i]);
-	}
+	   end of the buffer is reached, and then with blank lines */
+	for (i = 0; i < (height - 1); i++)
+		buffer[i] = get_line(i);
+}
 
-	/* If the buffer still isn't full, fill it with blank lines */
-	for (; i < (height - 1); i++) {
-		buffer[i] = bb_xstrdup("");
+/* Refill the buffer from line_pos on */
+static void buffer_fill(void)
+{
+	int i;
+
+	for (i = 0; i < (height - 1); i++) {
+		free(buffer[i]);
+		buffer[i] = get_line(line_pos + i);
 	}
 }
 
 /* Move the buffer up and down in the file in order to scroll */
 static void buffer_down(int nlines)
 {
-	int i;
-
 	if (!past_eof) {
+		index_lines(line_pos + (height - 2) + nlines);
 		if (line_pos + (height - 3) + nlines < num_flines) {
 			line_pos += nlines;
-			for (i = 0; i < (height - 1); i++) {
-				free(buffer[i]);
-				buffer[i] = bb_xstrdup(flines[line_pos + i]);
-			}
+			buffer_fill();
 		}
-		else {
+		else if (line_pos + (height - 3) + 1 < num_flines) {
 			/* As the number of lines requested was too large, we just move
 			to the end of the file */
-			while (line_pos + (height - 3) + 1 < num_flines) {
-				line_pos += 1;
-				for (i = 0; i < (height - 1); i++) {
-					free(buffer[i]);
-					buffer[i] = bb_xstrdup(flines[line_pos + i]);
-				}
-			}
+			line_pos = num_flines - (height - 2);
+			buffer_fill();
 		}
 
 		/* We exit if the -E flag has been set */
+		index_lines(line_pos + (height - 1));
 		if ((flags & FLAG_E) && (line_pos + (height - 2) == num_flines))
 			tless_exit(0);
 	}
@@ -405,21 +575,13 @@ static void buffer_up(int nlines)
 	if (!past_eof) {
 		if (line_pos - nlines >= 0) {
 			line_pos -= nlines;
-			for (i = 0; i < (height - 1); i++) {
-				free(buffer[i]);
-				buffer[i] = bb_xstrdup(flines[line_pos + i]);
-			}
+			buffer_fill();
 		}
-		else {
+		else if (line_pos != 0) {
 		/* As the requested number of lines to move was too large, we
-		   move one line up at a time until we can't. */
-			while (line_pos != 0) {
-				line_pos -= 1;
-				for (i = 0; i < (height - 1); i++) {
-					free(buffer[i]);
-					buffer[i] = bb_xstrdup(flines[line_pos + i]);
-				}
-			}
+		   move to the top. */
+			line_pos = 0;
+			buffer_fill();
 		}
 	}
 	else {
@@ -439,7 +601,7 @@ static void buffer_up(int nlines)
 			for (i = 0; i < (height - 1); i++) {
 				free(buffer[i]);
 				if (i < tilde_line - nlines + 1)
-					buffer[i] = bb_xstrdup(flines[line_pos + i]);
+					buffer[i] = get_line(line_pos + i);
 				else {
 					if (line_pos >= num_flines - height + 2)
 						buffer[i] = bb_xstrdup("~\n");
@@ -454,23 +616,21 @@ static void buffer_line(int linenum)
 	int i;
 	past_eof = 0;
 
+	index_lines(linenum + height + 3);
 	if (linenum < 0 || linenum > num_flines) {
 		clear_line();
 		printf("%s%s%i%s", HIGHLIGHT, "Cannot seek to line number ", linenum + 1, NORMAL);
 	}
 	else if (linenum < (num_flines - height - 2)) {
-		for (i = 0; i < (height - 1); i++) {
-			free(buffer[i]);
-			buffer[i] = bb_xstrdup(flines[linenum + i]);
-		}
 		line_pos = linenum;
+		buffer_fill();
 		buffer_print();
 	}
 	else {
 		for (i = 0; i < (height - 1); i++) {
 			free(buffer[i]);
 			if (linenum + i < num_flines + 2)
-				buffer[i] = bb_xstrdup(flines[linenum + i]);
+				buffer[i] = get_line(linenum + i);
 			else
 				buffer[i] = bb_xstrdup((flags & FLAG_TILDE) ? "\n" : "~\n");
 		}
@@ -484,12 +644,6 @@ static void buffer_line(int linenum)
 /* Reinitialise everything for a new file - free the memory and start over */
 static void reinitialise(void)
 {
-	int i;
-
-	for (i = 0; i <= num_flines; i++)
-		free(flines[i]);
-	free(flines);
-
 	data_readlines();
 	buffer_init();
 	buffer_print();
@@ -597,48 +751,11 @@ static void colon_process(void)
 #ifdef CONFIG_FEATURE_LESS_REGEXP
 /* The below two regular expression handler functions NEED development. */
 
-/* Get a regular expression from the user, and then go through the current
-   file line by line, running a processing regex function on each one. */
+/* Get a regular expression from the user, and then find the lines of the
+   current file it matches.  The lines are highlighted as they are shown. */
 
-static char *process_regex_on_line(char *line, regex_t *pattern, int action)
-{
-	/* This function takes the regex and applies it to the line.
-	   Each part of the line that matches has the HIGHLIGHT
-	   and NORMAL escape sequences placed around it by
-	   insert_highlights if action = 1, or has the escape sequences
-	   removed if action = 0, and then the line is returned. */
-	int match_status;
-	char *line2 = (char *) xmalloc((sizeof(char) * (strlen(line) + 1)) + 64);
-	char *growline = "";
-	regmatch_t match_structs;
-
-	line2 = bb_xstrdup(line);
-
-	match_found = 0;
-	match_status = regexec(pattern, line2, 1, &match_structs, 0);
-	
-	while (match_status == 0) {
-		if (match_found == 0)
-			match_found = 1;
-		
-		if (action) {
-			growline = bb_xasprintf("%s%.*s%s%.*s%s", growline, match_structs.rm_so, line2, HIGHLIGHT, match_structs.rm_eo - match_structs.rm_so, line2 + match_structs.rm_so, NORMAL); 
-		}
-		else {
-			growline = bb_xasprintf("%s%.*s%.*s", growline, match_structs.rm_so - 4, line2, match_structs.rm_eo - match_structs.rm_so, line2 + match_structs.rm_so);
-		}
-		
-		line2 += match_structs.rm_eo;
-		match_status = regexec(pattern, line2, 1, &match_structs, REG_NOTBOL);
-	}
-	
-	growline = bb_xasprintf("%s%s", growline, line2);
-	
-	return (match_found ? growline : line);
-	
-	free(growline);
-	free(line2);
-}
+/* regexec takes int offsets, so the input is searched a piece at a time */
+#define SEARCH_CHUNK (1024 * 1024)
 
 static void goto_match(int match)
 {
@@ -653,8 +770,10 @@ static void goto_match(int match)
 static void regex_process(void)
 {
 	char uncomp_regex[100];
-	char *current_line;
-	int i;
+	regmatch_t match;
+	size_t pos, end;
+	char *p;
+	int i = 0;
 	int j = 0;
 	regex_t pattern;
 	/* Get the uncompiled regular expression from the user */
@@ -673,34 +792,51 @@ static void regex_process(void)
 	uncomp_regex[strlen(uncomp_regex) - 1] = '\0';
 	
 	/* Compile the regex and check for errors */
-	xregcomp(&pattern, uncomp_regex, 0);
+	xregcomp(&pattern, uncomp_regex, REG_NEWLINE);
 
-	if (num_matches) {
-		/* Get rid of all the highlights we added previously */
-		for (i = 0; i <= num_flines; i++) {
-			current_line = process_regex_on_line(flines[i], &old_pattern, 0);
-			flines[i] = bb_xstrdup(current_line);
-		}
-	}
+	if (match_lines)
+		regfree(&old_pattern);
 	old_pattern = pattern;
-	
+
 	/* Reset variables */
 	match_lines = xrealloc(match_lines, sizeof(int));
 	match_lines[0] = -1;
 	match_pos = 0;
 	num_matches = 0;
-	match_found = 0;
-	/* Run the regex on each line of the current file here */
-	for (i = 0; i <= num_flines; i++) {
-		current_line = process_regex_on_line(flines[i], &pattern, 1);
-		flines[i] = bb_xstrdup(current_line);
-		if (match_found) {
-			match_lines = xrealloc(match_lines, (j + 1) * sizeof(int));
-			match_lines[j] = i;
-			j++;
+	/* Run the regex over the whole file, pieces ending with a line */
+	index_all();
+	for (pos = 0; pos < data_len; pos = end) {
+		end = data_len;
+		if (data_len - pos > SEARCH_CHUNK) {
+			p = memchr(data + pos + SEARCH_CHUNK, '\n',
+					data_len - pos - SEARCH_CHUNK);
+			if (p)
+				end = p - data + 1;
 		}
+		while (pos < end) {
+			match.rm_so = 0;
+			match.rm_eo = end - pos;
+			if (regexec(&pattern, data + pos, 1, &match,
+					REG_STARTEND | (end < data_len ? REG_NOTEOL : 0)) != 0)
+				break;
+			i += bb_count_byte(data + pos, match.rm_so, '\n');
+			if (i > num_flines)
+				break;
+			if ((j % 64) == 0)
+				match_lines = xrealloc(match_lines, (j + 64) * sizeof(int));
+			match_lines[j++] = i;
+			/* Go on with the next line */
+			p = memchr(data + pos + match.rm_so, '\n', end - pos - match.rm_so);
+			if (p == NULL) {
+				pos = end;
+				break;
+			}
+			i++;
+			pos = p - data + 1;
+		}
+		i += bb_count_byte(data + pos, end - pos, '\n');
 	}
-	
+
 	num_matches = j;
 	if ((match_lines[0] != -1) && (num_flines > height - 2)) {
 		if (match_backwards) {
@@ -744,7 +880,7 @@ static void number_process(int first_digit)
 	keypress = num_input[i];
 	num_input[i] = '\0';
 	num = strtol(num_input, &endptr, 10);
-	if (endptr==num_input || *endptr!='\0' || num < 1 || num > MAXLINES) {
+	if (endptr==num_input || *endptr!='\0' || num < 1 || num > INT_MAX / 4) {
 		buffer_print();
 		return;
 	}
@@ -758,10 +894,12 @@ static void number_process(int first_digit)
 			buffer_up(num);
 			break;
 		case 'g': case '<': case 'G': case '>':
+			index_lines(height - 2);
 			if (num_flines >= height - 2)
 				buffer_line(num - 1);
 			break;
 		case 'p': case '%':
+			index_all();
 			buffer_line(((num / 100) * num_flines) - 1);
 			break;
 #ifdef CONFIG_FEATURE_LESS_REGEXP
@@ -856,7 +994,6 @@ static void full_repaint(void)
 static void save_input_to_file(void)
 {
 	char current_line[256];
-	int i;
 	FILE *fp;
 
 	clear_line();
@@ -864,9 +1001,9 @@ static void save_input_to_file(void)
 	fgets(current_line, 256, inp);
 	current_line[strlen(current_line) - 1] = '\0';
 	if (strlen(current_line) > 1) {
+		index_all();
 		fp = bb_xfopen(current_line, "w");
-		for (i = 0; i < num_flines; i++)
-			fprintf(fp, "%s", flines[i]);
+		fwrite(data, 1, data_len, fp);
 		fclose(fp);
 		buffer_print();
 	}
@@ -949,6 +1086,18 @@ static char opp_bracket(char bracket)
 	}
 }
 
+/* Whether line n has c in it */
+static int line_has(int n, char c)
+{
+	const char *p;
+	size_t len;
+
+	if (!have_line(n))
+		return 0;
+	p = line_text(n, &len);
+	return memchr(p, c, len) != NULL;
+}
+
 static void match_right_bracket(char bracket)
 {
 	int bracket_line = -1;
@@ -956,11 +1105,11 @@ static void match_right_bracket(char bracket)
 
 	clear_line();
 
-	if (strchr(flines[line_pos], bracket) == NULL)
+	if (!line_has(line_pos, bracket))
 		printf("%s%s%s", HIGHLIGHT, "No bracket in top line", NORMAL);
 	else {
-		for (i = line_pos + 1; i < num_flines; i++) {
-			if (strchr(flines[i], opp_bracket(bracket)) != NULL) {
+		for (i = line_pos + 1; have_line(i + 1); i++) {
+			if (line_has(i, opp_bracket(bracket))) {
 				bracket_line = i;
 				break;
 			}
@@ -980,14 +1129,11 @@ static void match_left_bracket(char bracket)
 
 	clear_line();
 
-	if (strchr(flines[line_pos + height - 2], bracket) == NULL) {
+	if (!line_has(line_pos + height - 2, bracket))
 		printf("%s%s%s", HIGHLIGHT, "No bracket in bottom line", NORMAL);
-		printf("%s", flines[line_pos + height]);
-		sleep(4);
-	}
 	else {
 		for (i = line_pos + height - 2; i >= 0; i--) {
-			if (strchr(flines[i], opp_bracket(bracket)) != NULL) {
+			if (line_has(i, opp_bracket(bracket))) {
 				bracket_line = i;
 				break;
 			}
@@ -1033,6 +1179,7 @@ static void keypress_process(int keypress)
 			buffer_line(0);
 			break;
 		case 'G': case '>':
+			index_all();
 			buffer_line(num_flines - height + 2);
 			break;
 		case 'q': case 'Q':
@@ -4107,8 +4107,8 @@ int insmod_main( int argc, char **argv)
 				module_dir = tmdn;
 			else
 				module_dir = real_module_dir;
-			recursive_action(module_dir, TRUE, FALSE, FALSE,
-					check_module_name_match, 0, m_fullName);
+			recursive_action(module_dir, ACTION_RECURSE | ACTION_MODE_ONLY,
+					FALSE, FALSE, check_module_name_match, 0, m_fullName);
 			free(tmdn);
 		}
 
@@ -4123,7 +4123,8 @@ int insmod_main( int argc, char **argv)
 				strcpy(module_dir, _PATH_MODULES);
 			/* No module found under /lib/modules/`uname -r`, this
 			 * time cast the net a bit wider.  Search /lib/modules/ */
-			if (! recursive_action(module_dir, TRUE, FALSE, FALSE,
+			if (! recursive_action(module_dir,
+						ACTION_RECURSE | ACTION_MODE_ONLY, FALSE, FALSE,
 						check_module_name_match, 0, m_fullName))
 			{
 				if (m_filename == 0
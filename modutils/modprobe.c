@@ -23,6 +23,8 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <fnmatch.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 struct mod_opt_t {	/* one-way list of options to pass to a module */
 	char *  m_opt_val;
@@ -266,6 +268,33 @@ static char *parse_command_string( char *src, char **dst )
 #define parse_command_string(src, dst)	(0)
 #endif /* ENABLE_FEATURE_MODPROBE_MULTIPLE_OPTIONS */
 
+#if ENABLE_FEATURE_MODPROBE_DEP_CACHE
+/* Every file build_dep() tries to read, and what it looked like then */
+struct dep_source {
+	char *path;
+	struct stat st;
+	int exists;
+};
+
+static struct dep_source *dep_sources;
+static int dep_nsources;
+static char *dep_cache_path;	/* where to save what they gave */
+
+static int dep_open ( const char *path )
+{
+	int fd = open ( path, O_RDONLY );
+	struct dep_source *src;
+
+	dep_sources = xrealloc ( dep_sources, (dep_nsources + 1) * sizeof ( *src ));
+	src = &dep_sources [dep_nsources++];
+	src-> path = bb_xstrdup ( path );
+	src-> exists = fd >= 0 && fstat ( fd, &src-> st ) == 0;
+	return fd;
+}
+#else
+#define dep_open(path)	open ( path, O_RDONLY )
+#endif /* ENABLE_FEATURE_MODPROBE_DEP_CACHE */
+
 /*
  * This function reads aliases and default module options from a configuration file
  * (/etc/modprobe.conf syntax). It supports includes (only files, no directories).
@@ -355,7 +384,7 @@ static void include_conf ( struct dep_t **first, struct dep_t **current, char *b
 				while ( isspace ( *filename ))
 					filename++;
 
-				if (( fdi = open ( filename, O_RDONLY )) >= 0 ) {
+				if (( fdi = dep_open ( filename )) >= 0 ) {
 					include_conf(first, current, buffer, buflen, fdi);
 					close(fdi);
 				}
@@ -369,10 +398,9 @@ static void include_conf ( struct dep_t **first, struct dep_t **current, char *b
  * It then fills every modules and aliases with their default options, found by parsing
  * modprobe.conf (or modules.conf, or conf.modules).
  */
-static struct dep_t *build_dep ( void )
+static struct dep_t *build_dep ( const char *release )
 {
 	int fd;
-	struct utsname un;
 	struct dep_t *first = 0;
 	struct dep_t *current = 0;
 	char buffer[2048];
@@ -381,23 +409,26 @@ static struct dep_t *build_dep ( void )
 	int k_version;
 
 	k_version = 0;
-	if ( uname ( &un ))
-		bb_error_msg_and_die("can't determine kernel version");
-
-	if (un.release[0] == '2') {
-		k_version = un.release[2] - '0';
+	if (release[0] == '2') {
+		k_version = release[2] - '0';
 	}
 
-	filename = bb_xasprintf("/lib/modules/%s/modules.dep", un.release );
-	fd = open ( filename, O_RDONLY );
-	if (ENABLE_FEATURE_CLEAN_UP)
-		free(filename);
+	filename = bb_xasprintf("/lib/modules/%s/modules.dep", release );
+	fd = dep_open ( filename );
 	if (fd < 0) {
 		/* Ok, that didn't work.  Fall back to looking in /lib/modules */
-		if (( fd = open ( "/lib/modules/modules.dep", O_RDONLY )) < 0 ) {
+		free(filename);
+		filename = bb_xstrdup("/lib/modules/modules.dep");
+		if (( fd = dep_open ( filename )) < 0 ) {
+			free(filename);
 			return 0;
 		}
 	}
+#if ENABLE_FEATURE_MODPROBE_DEP_CACHE
+	dep_cache_path = bb_xasprintf("%s.stablebox", filename);
+#endif
+	if (ENABLE_FEATURE_CLEAN_UP)
+		free(filename);
 
 	while ( reads ( fd, buffer, sizeof( buffer ))) {
 		int l = strlen ( buffer );
@@ -550,9 +581,9 @@ static struct dep_t *build_dep ( void )
 	 * as they take precedence over the kernel ones.
 	 */
 	if (!ENABLE_FEATURE_2_6_MODULES
-			|| ( fd = open ( "/etc/modprobe.conf", O_RDONLY )) < 0 )
-		if (( fd = open ( "/etc/modules.conf", O_RDONLY )) < 0 )
-			fd = open ( "/etc/conf.modules", O_RDONLY );
+			|| ( fd = dep_open ( "/etc/modprobe.conf" )) < 0 )
+		if (( fd = dep_open ( "/etc/modules.conf" )) < 0 )
+			fd = dep_open ( "/etc/conf.modules" );
 
 	if (fd >= 0) {
 		include_conf (&first, &current, buffer, sizeof(buffer), fd);
@@ -562,10 +593,10 @@ static struct dep_t *build_dep ( void )
 	/* Only 2.6 has a modules.alias file */
 	if (ENABLE_FEATURE_2_6_MODULES) {
 		/* Parse kernel-declared aliases */
-		filename = bb_xasprintf("/lib/modules/%s/modules.alias", un.release);
-		if ((fd = open ( filename, O_RDONLY )) < 0) {
+		filename = bb_xasprintf("/lib/modules/%s/modules.alias", release);
+		if ((fd = dep_open ( filename )) < 0) {
 			/* Ok, that didn't work.  Fall back to looking in /lib/modules */
-			fd = open ( "/lib/modules/modules.alias", O_RDONLY );
+			fd = dep_open ( "/lib/modules/modules.alias" );
 		}
 		if (ENABLE_FEATURE_CLEAN_UP)
 			free(filename);
@@ -579,6 +610,421 @@ static struct dep_t *build_dep ( void )
 	return first;
 }
 
+#if ENABLE_FEATURE_MODPROBE_DEP_CACHE
+/*
+ * The rules build_dep() comes up with are saved next to modules.dep in a
+ * binary file that later runs map instead of parsing everything again.
+ * It lists the files the rules came from, and is used only while none of
+ * them has changed, appeared or gone.  Module names are hashed, and
+ * names that are shell patterns (as in modules.alias) are also hashed by
+ * the plain text they start with: only those whose start mod begins with
+ * need to be tried.  All references are offsets from the start of the
+ * file.
+ */
+#define DEP_CACHE_MAGIC "SBDEP01"
+
+struct dep_cache_hdr {
+	char     magic[8];
+	uint32_t size;			/* of the whole file */
+	uint32_t release;		/* uname -r it was made for */
+	uint32_t nfiles, files;		/* struct dep_cache_file [nfiles] */
+	uint32_t nrules, rules;		/* struct dep_cache_rule [nrules] */
+	uint32_t nbuckets, buckets;	/* rule number + 1 [nbuckets] */
+	uint32_t npatterns, patterns;	/* struct dep_cache_pattern [npatterns] */
+	uint32_t npbuckets, pbuckets;	/* pattern number + 1 [npbuckets] */
+};
+
+struct dep_cache_file {
+	uint64_t ino;
+	int64_t  size;
+	int64_t  mtime;
+	int64_t  ctime;
+	uint32_t path;
+	uint32_t exists;
+};
+
+struct dep_cache_rule {
+	uint32_t name;
+	uint32_t path;			/* 0 for an alias */
+	uint32_t options;		/* a count, then that many strings */
+	uint32_t deps;			/* the same */
+	uint32_t next;			/* rule number + 1, same bucket */
+	uint32_t isalias;
+};
+
+struct dep_cache_pattern {
+	uint32_t rule;
+	uint32_t plain;			/* how many chars before the first special */
+	uint32_t next;			/* pattern number + 1, same bucket */
+};
+
+static char *dep_cache;			/* mapped, if in use */
+
+#define DEP_HASH_INIT		2166136261u
+#define DEP_HASH(h, c)		((( h ) ^ (unsigned char) ( c )) * 16777619u)
+
+static uint32_t dep_hash ( const char *name, size_t len )
+{
+	uint32_t h = DEP_HASH_INIT;
+
+	while ( len-- )
+		h = DEP_HASH ( h, *name++ );
+	return h;
+}
+
+/* How long the plain text a pattern starts with is */
+static size_t dep_plain ( const char *name )
+{
+	return strcspn ( name, "*?[\\" );
+}
+
+static uint32_t dep_buckets ( uint32_t n )
+{
+	uint32_t size = 16;
+
+	while ( size < n )
+		size <<= 1;
+	return size;
+}
+
+static void dep_source_info ( struct dep_cache_file *f, struct stat *st, int exists )
+{
+	memset ( f, 0, sizeof ( *f ));
+	if (( f-> exists = exists )) {
+		f-> ino   = st-> st_ino;
+		f-> size  = st-> st_size;
+		f-> mtime = st-> st_mtime;
+		f-> ctime = st-> st_ctime;
+	}
+}
+
+/* The file is put together in a growing buffer */
+static char *cbuf;
+static uint32_t clen, calloc_size;
+
+static uint32_t cache_put_align ( const void *data, size_t len, int align )
+{
+	uint32_t off = ( clen + align - 1 ) & ~( align - 1 );
+
+	if ( off + len > calloc_size ) {
+		calloc_size = ( off + len ) * 2 + 4096;
+		cbuf = xrealloc ( cbuf, calloc_size );
+	}
+	memset ( cbuf + clen, 0, off - clen );
+	if ( data )
+		memcpy ( cbuf + off, data, len );
+	else
+		memset ( cbuf + off, 0, len );
+	clen = off + len;
+	return off;
+}
+
+#define cache_put(data, len)	cache_put_align ( data, len, 8 )
+
+static uint32_t cache_str ( const char *str )
+{
+	return str ? cache_put_align ( str, strlen ( str ) + 1, 1 ) : 0;
+}
+
+static uint32_t cache_strs ( int count, char **strs, struct mod_opt_t *opts )
+{
+	uint32_t *list = xmalloc (( count + 1 ) * sizeof ( uint32_t ));
+	uint32_t off;
+	int i;
+
+	list [0] = count;
+	for ( i = 1; i <= count; i++ ) {
+		list [i] = cache_str ( strs ? strs [i - 1] : opts-> m_opt_val );
+		if ( opts )
+			opts = opts-> m_next;
+	}
+	off = cache_put ( list, ( count + 1 ) * sizeof ( uint32_t ));
+	free ( list );
+	return off;
+}
+
+#define CACHE_AT(type, off)	((type *) ( cbuf + (off) ))
+
+/* Save the rules as they are now, if the directory is writable */
+static void dep_cache_save ( struct dep_t *first, const char *release )
+{
+	struct dep_cache_hdr hdr;
+	struct dep_cache_rule *rule;
+	struct dep_cache_pattern *pat;
+	struct mod_opt_t *opt;
+	struct dep_t *dt;
+	uint32_t i, n, *bucket;
+	char *tmp;
+	int fd;
+
+	memset ( &hdr, 0, sizeof ( hdr ));
+	memcpy ( hdr.magic, DEP_CACHE_MAGIC, sizeof ( hdr.magic ));
+	clen = 0;
+	cache_put ( NULL, sizeof ( hdr ));
+	hdr.release = cache_str ( release );
+
+	hdr.nfiles = dep_nsources;
+	hdr.files = cache_put ( NULL, dep_nsources * sizeof ( struct dep_cache_file ));
+	for ( i = 0; i < hdr.nfiles; i++ ) {
+		uint32_t path = cache_str ( dep_sources [i]. path );
+		struct dep_cache_file *f = CACHE_AT ( struct dep_cache_file,
+				hdr.files + i * sizeof ( *f ));
+
+		dep_source_info ( f, &dep_sources [i]. st, dep_sources [i]. exists );
+		f-> path = path;
+	}
+
+	for ( n = 0, dt = first; dt; dt = dt-> m_next )
+		n++;
+	hdr.nrules = n;
+	hdr.rules = cache_put ( NULL, n * sizeof ( *rule ));
+	for ( i = 0, dt = first; dt; dt = dt-> m_next, i++ ) {
+		struct dep_cache_rule r;
+		int nopts = 0;
+
+		for ( opt = dt-> m_options; opt; opt = opt-> m_next )
+			nopts++;
+		r. name = cache_str ( dt-> m_name );
+		r. path = cache_str ( dt-> m_path );
+		r. options = cache_strs ( nopts, NULL, dt-> m_options );
+		r. deps = cache_strs ( dt-> m_depcnt, dt-> m_deparr, NULL );
+		r. next = 0;
+		r. isalias = dt-> m_isalias != 0;
+		*CACHE_AT ( struct dep_cache_rule, hdr.rules + i * sizeof ( r )) = r;
+	}
+
+	hdr.nbuckets = dep_buckets ( n );
+	hdr.buckets = cache_put ( NULL, hdr.nbuckets * sizeof ( uint32_t ));
+	/* Going backwards leaves every bucket in rule order */
+	rule = CACHE_AT ( struct dep_cache_rule, hdr.rules );
+	bucket = CACHE_AT ( uint32_t, hdr.buckets );
+	for ( i = n; i-- > 0; ) {
+		char *name = cbuf + rule [i]. name;
+		uint32_t h = dep_hash ( name, strlen ( name )) & ( hdr.nbuckets - 1 );
+
+		rule [i]. next = bucket [h];
+		bucket [h] = i + 1;
+	}
+
+	for ( i = 0; i < n; i++ ) {
+		char *name = cbuf + rule [i]. name;
+
+		hdr.npatterns += name [dep_plain ( name )] != 0;
+	}
+	hdr.patterns = cache_put ( NULL, hdr.npatterns * sizeof ( *pat ));
+	hdr.npbuckets = dep_buckets ( hdr.npatterns );
+	hdr.pbuckets = cache_put ( NULL, hdr.npbuckets * sizeof ( uint32_t ));
+	rule = CACHE_AT ( struct dep_cache_rule, hdr.rules );
+	pat = CACHE_AT ( struct dep_cache_pattern, hdr.patterns );
+	bucket = CACHE_AT ( uint32_t, hdr.pbuckets );
+	for ( n = hdr.npatterns, i = hdr.nrules; i-- > 0; ) {
+		char *name = cbuf + rule [i]. name;
+		size_t plain = dep_plain ( name );
+		uint32_t h;
+
+		if ( !name [plain] )
+			continue;
+		h = dep_hash ( name, plain ) & ( hdr.npbuckets - 1 );
+		n--;
+		pat [n]. rule = i;
+		pat [n]. plain = plain;
+		pat [n]. next = bucket [h];
+		bucket [h] = n + 1;
+	}
+
+	hdr.size = clen;
+	memcpy ( cbuf, &hdr, sizeof ( hdr ));
+
+	/* Others may be reading the old one, so write a new one and rename */
+	tmp = bb_xasprintf ( "%s.XXXXXX", dep_cache_path );
+	if (( fd = mkstemp ( tmp )) >= 0 ) {
+		if ( bb_full_write ( fd, cbuf, clen ) != clen || fchmod ( fd, 0644 )
+				|| close ( fd ) || rename ( tmp, dep_cache_path ))
+			unlink ( tmp );
+	}
+	free ( tmp );
+	free ( cbuf );
+	cbuf = NULL;
+	calloc_size = 0;
+}
+
+static int dep_cache_try ( const char *path, const char *release )
+{
+	struct dep_cache_hdr *hdr;
+	struct dep_cache_file *f, now;
+	struct stat st;
+	size_t size = 0;
+	char *map;
+	uint32_t i;
+	int fd;
+
+	if (( fd = open ( path, O_RDONLY )) < 0 )
+		return 0;
+	map = MAP_FAILED;
+	if ( fstat ( fd, &st ) == 0 && st.st_size > sizeof ( *hdr )
+			&& st.st_size < 0x7fffffff ) {
+		size = st.st_size;
+		map = mmap ( NULL, size, PROT_READ, MAP_SHARED, fd, 0 );
+	}
+	close ( fd );
+	if ( map == MAP_FAILED )
+		return 0;
+
+	hdr = (struct dep_cache_hdr *) map;
+	if ( memcmp ( hdr-> magic, DEP_CACHE_MAGIC, sizeof ( hdr-> magic ))
+			|| hdr-> size != size || map [size - 1] != 0
+			|| hdr-> files + hdr-> nfiles * sizeof ( *f ) > hdr-> size
+			|| hdr-> rules + hdr-> nrules * sizeof ( struct dep_cache_rule ) > hdr-> size
+			|| hdr-> buckets + hdr-> nbuckets * sizeof ( uint32_t ) > hdr-> size
+			|| hdr-> patterns + hdr-> npatterns * sizeof ( struct dep_cache_pattern ) > hdr-> size
+			|| hdr-> pbuckets + hdr-> npbuckets * sizeof ( uint32_t ) > hdr-> size
+			|| strcmp ( map + hdr-> release, release ))
+		goto stale;
+
+	/* Is every file the same as when the rules were made? */
+	f = (struct dep_cache_file *) ( map + hdr-> files );
+	for ( i = 0; i < hdr-> nfiles; i++, f++ ) {
+		int exists = stat ( map + f-> path, &st ) == 0;
+
+		dep_source_info ( &now, &st, exists );
+		now. path = f-> path;
+		if ( memcmp ( &now, f, sizeof ( now )))
+			goto stale;
+	}
+
+	dep_cache = map;
+	return 1;
+ stale:
+	munmap ( map, size );
+	return 0;
+}
+
+static int dep_cache_load ( const char *release )
+{
+	char *path = bb_xasprintf ( "/lib/modules/%s/modules.dep.stablebox", release );
+	int ok = dep_cache_try ( path, release )
+		|| dep_cache_try ( "/lib/modules/modules.dep.stablebox", release );
+
+	free ( path );
+	return ok;
+}
+
+/* A rule from the cache, made into a struct dep_t the first time it's
+ * asked for, so that options added to it stay */
+static struct dep_t *dep_cache_rule ( uint32_t n )
+{
+	struct dep_cache_hdr *hdr = (struct dep_cache_hdr *) dep_cache;
+	struct dep_cache_rule *r = (struct dep_cache_rule *) ( dep_cache + hdr-> rules ) + n;
+	struct dep_t *dt;
+	uint32_t *list;
+	uint32_t i;
+
+	for ( dt = depend; dt; dt = dt-> m_next )
+		if ( dt-> m_name == dep_cache + r-> name )
+			return dt;
+
+	dt = xcalloc ( 1, sizeof ( struct dep_t ));
+	dt-> m_name = dep_cache + r-> name;
+	dt-> m_path = r-> path ? dep_cache + r-> path : NULL;
+	dt-> m_isalias = r-> isalias;
+	list = (uint32_t *) ( dep_cache + r-> options );
+	for ( i = 1; i <= list [0]; i++ )
+		dt-> m_options = append_option ( dt-> m_options, dep_cache + list [i] );
+	list = (uint32_t *) ( dep_cache + r-> deps );
+	dt-> m_depcnt = list [0];
+	dt-> m_deparr = xmalloc ( list [0] * sizeof ( char * ) + 1 );
+	for ( i = 0; i < list [0]; i++ )
+		dt-> m_deparr [i] = dep_cache + list [i + 1];
+	dt-> m_next = depend;
+	depend = dt;
+	return dt;
+}
+
+/* The first rule named name, or nrules */
+static uint32_t dep_cache_find ( const char *name )
+{
+	struct dep_cache_hdr *hdr = (struct dep_cache_hdr *) dep_cache;
+	struct dep_cache_rule *rule = (struct dep_cache_rule *) ( dep_cache + hdr-> rules );
+	uint32_t n = ((uint32_t *) ( dep_cache + hdr-> buckets ))
+			[dep_hash ( name, strlen ( name )) & ( hdr-> nbuckets - 1 )];
+
+	for ( ; n; n = rule [n - 1]. next )
+		if ( strcmp ( dep_cache + rule [n - 1]. name, name ) == 0 )
+			return n - 1;
+	return hdr-> nrules;
+}
+#else
+#define dep_cache_load(release)	0
+#define dep_cache_save(first, release)
+#endif /* ENABLE_FEATURE_MODPROBE_DEP_CACHE */
+
+/* The first rule that matches mod, which rules may do as a shell pattern */
+static struct dep_t *find_dep ( const char *mod )
+{
+	struct dep_t *dt;
+
+#if ENABLE_FEATURE_MODPROBE_DEP_CACHE
+	if ( dep_cache ) {
+		struct dep_cache_hdr *hdr = (struct dep_cache_hdr *) dep_cache;
+		struct dep_cache_rule *rule = (struct dep_cache_rule *) ( dep_cache + hdr-> rules );
+		struct dep_cache_pattern *pat = (struct dep_cache_pattern *) ( dep_cache + hdr-> patterns );
+		uint32_t *bucket = (uint32_t *) ( dep_cache + hdr-> pbuckets );
+		uint32_t n = dep_cache_find ( mod );
+		uint32_t h = DEP_HASH_INIT;
+		size_t len;
+
+		/* A pattern that comes first wins over the name itself.  Try
+		 * those that start with each beginning of mod, the lowest one
+		 * in each bucket first. */
+		for ( len = 0; ; len++ ) {
+			uint32_t k;
+
+			for ( k = bucket [h & ( hdr-> npbuckets - 1 )]; k; k = pat [k - 1]. next ) {
+				struct dep_cache_pattern *p = &pat [k - 1];
+				char *name = dep_cache + rule [p-> rule]. name;
+
+				if ( p-> rule >= n )
+					break;
+				if ( p-> plain == len && strncmp ( name, mod, len ) == 0
+						&& fnmatch ( name, mod, 0 ) == 0 ) {
+					n = p-> rule;
+					break;
+				}
+			}
+			if ( !mod [len] )
+				break;
+			h = DEP_HASH ( h, mod [len] );
+		}
+		return n < hdr-> nrules ? dep_cache_rule ( n ) : NULL;
+	}
+#endif
+	for ( dt = depend; dt; dt = dt-> m_next ) {
+		if ( fnmatch ( dt-> m_name, mod, 0 ) == 0)
+			break;
+	}
+	return dt;
+}
+
+/* The first rule called name */
+static struct dep_t *find_dep_name ( const char *name )
+{
+	struct dep_t *dt;
+
+#if ENABLE_FEATURE_MODPROBE_DEP_CACHE
+	if ( dep_cache ) {
+		uint32_t n = dep_cache_find ( name );
+
+		return n < ((struct dep_cache_hdr *) dep_cache)-> nrules ?
+			dep_cache_rule ( n ) : NULL;
+	}
+#endif
+	for ( dt = depend; dt; dt = dt-> m_next ) {
+		if ( strcmp ( dt-> m_name, name ) == 0 )
+			break;
+	}
+	return dt;
+}
+
 /* return 1 = loaded, 0 = not loaded, -1 = can't tell */
 static int already_loaded (const char *name)
 {
@@ -729,11 +1175,7 @@ static void check_dep ( char *mod, struct mod_list_t **head, struct mod_list_t *
 	 * so try to match the given module name against such a pattern.
 	 * Of course if the name in the dependency rule is a plain string,
 	 * then we consider it a pattern, and matching will still work. */
-	for ( dt = depend; dt; dt = dt-> m_next ) {
-		if ( fnmatch ( dt-> m_name, mod, 0 ) == 0) {
-			break;
-		}
-	}
+	dt = find_dep ( mod );
 
 	if( !dt ) {
 		bb_error_msg ("module %s not found.", mod);
@@ -743,12 +1185,8 @@ static void check_dep ( char *mod, struct mod_list_t **head, struct mod_list_t *
 	// resolve alias names
 	while ( dt-> m_isalias ) {
 		if ( dt-> m_depcnt == 1 ) {
-			struct dep_t *adt;
+			struct dep_t *adt = find_dep_name ( dt-> m_deparr [0] );
 
-			for ( adt = depend; adt; adt = adt-> m_next ) {
-				if ( strcmp ( adt-> m_name, dt-> m_deparr [0] ) == 0 )
-					break;
-			}
 			if ( adt ) {
 				/* This is the module we are aliased to */
 				struct mod_opt_t *opts = dt-> m_options;
@@ -879,6 +1317,8 @@ int modprobe_main(int argc, char** argv)
 {
 	int rc = EXIT_SUCCESS;
 	char *unused;
+	struct utsname un;
+	char *release = un.release;
 
 	bb_opt_complementally = "?V-:q-v:v-q";
 	main_opts = bb_getopt_ulflags(argc, argv, "acdklnqrst:vVC:",
@@ -888,10 +1328,16 @@ int modprobe_main(int argc, char** argv)
 	if((main_opts & (RESTRICT_DIR | CONFIG_FILE)))
 				bb_error_msg_and_die("-t and -C not supported");
 
-	depend = build_dep ( );
+	if ( uname ( &un ))
+		bb_error_msg_and_die("can't determine kernel version");
 
-	if ( !depend )
-		bb_error_msg_and_die ( "could not parse modules.dep" );
+	if ( !dep_cache_load ( release )) {
+		depend = build_dep ( release );
+
+		if ( !depend )
+			bb_error_msg_and_die ( "could not parse modules.dep" );
+		dep_cache_save ( depend, release );
+	}
 
 	if (remove_opt) {
 		do {
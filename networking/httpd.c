@@ -99,10 +99,17 @@
 #include <sys/types.h>
 #include <sys/socket.h>    /* for connect and socket*/
 #include <netinet/in.h>    /* for sockaddr_in       */
+#include <netinet/tcp.h>   /* for TCP_CORK          */
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>         /* for open modes        */
 #include "busybox.h"
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#endif
 
 
 static const char httpdVersion[] = "busybox httpd/1.35 6-Oct-2004";
@@ -146,9 +153,34 @@ typedef struct HT_ACCESS_IP {
 	struct HT_ACCESS_IP *next;
 } Htaccess_IP;
 
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+typedef struct HTTPD_CONN {
+	int fd;
+	unsigned events;            /* what epoll is watching for */
+	unsigned int rmt_ip;
+	unsigned port;
+	char *in;                   /* request bytes not handled yet */
+	int in_len;
+	char *out;                  /* response bytes not sent yet */
+	int out_len;
+	int out_pos;
+	int file;                   /* followed by the rest of this, or -1 */
+	off_t file_left;
+	int closing;                /* 1 close after the response, 2 closing,
+				       -1 handed over to a CGI process */
+	int eof;                    /* client has stopped sending */
+	time_t last;                /* last activity */
+	struct HTTPD_CONN *prev;    /* least recently active first */
+	struct HTTPD_CONN *next;
+} HttpdConn;
+#endif
+
 typedef struct
 {
   char buf[MAX_MEMORY_BUFF];
+  char rbuf[MAX_MEMORY_BUFF];   /* request bytes read but not parsed yet */
+  int rbuf_start;
+  int rbuf_len;
 
   USE_FEATURE_HTTPD_BASIC_AUTH(const char *realm;)
   USE_FEATURE_HTTPD_BASIC_AUTH(char *remoteuser;)
@@ -191,6 +223,11 @@ typedef struct
 # define a_c_w 1
 #endif
   volatile int alarm_signaled;
+  int keepalive;                /* connection stays open after this response */
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+  struct HTTPD_CONN *conn;      /* request came in on the event loop */
+  int subdir_conf;              /* a subdir config was parsed */
+#endif
 
 #ifdef CONFIG_FEATURE_HTTPD_CONFIG_WITH_SCRIPT_INTERPR
   Htaccess *script_i;           /* config script interpreters */
@@ -880,28 +917,55 @@ static int openServer(void)
   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&on, sizeof(on)) ;
 #endif
   bb_xbind(fd, (struct sockaddr *)&lsocket, sizeof(lsocket));
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+  /* one process accepts everything, so let bursts queue up */
+  listen(fd, SOMAXCONN);
+#else
   listen(fd, 9); /* bb_xlisten? */
+#endif
   signal(SIGCHLD, SIG_IGN);   /* prevent zombie (defunct) processes */
   return fd;
 }
 #endif  /* CONFIG_FEATURE_HTTPD_WITHOUT_INETD */
 
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+/* Queue response bytes for the event loop to send */
+static int connQueue(HttpdConn *c, const char *buf, int len)
+{
+  char *p = realloc(c->out, c->out_len + len);
+
+  if (p == NULL)
+	return -1;
+  memcpy(p + c->out_len, buf, len);
+  c->out = p;
+  c->out_len += len;
+  return len;
+}
+#endif
+
+/* Write part of the response */
+static int sendBuf(const char *buf, int len)
+{
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+  if (config->conn)
+	return connQueue(config->conn, buf, len);
+#endif
+  return bb_full_write(a_c_w, buf, len);
+}
+
 /****************************************************************************
  *
- > $Function: sendHeaders()
+ > $Function: makeHeaders()
  *
- * $Description: Create and send HTTP response headers.
- *   The arguments are combined and sent as one write operation.  Note that
- *   IE will puke big-time if the headers are not sent in one packet and the
- *   second packet is delayed for any reason.
+ * $Description: Create HTTP response headers in config->buf.
  *
  * $Parameter:
  *      (HttpResponseNum) responseNum . . . The result code to send.
  *
- * $Return: (int)  . . . . writing errors
+ * $Return: (int)  . . . . length of the headers
  *
  ****************************************************************************/
-static int sendHeaders(HttpResponseNum responseNum)
+static int makeHeaders(HttpResponseNum responseNum)
 {
   char *buf = config->buf;
   const char *responseString = "";
@@ -924,12 +988,19 @@ static int sendHeaders(HttpResponseNum responseNum)
   mime_type = responseNum == HTTP_OK ?
 		config->httpd_found.found_mime_type : "text/html";
 
+  /* Only a file of known length can be followed by another response */
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+  if (!config->conn || responseNum != HTTP_OK || config->ContentLength == -1)
+#endif
+	config->keepalive = 0;
+
   /* emit the current date */
   strftime(timeStr, sizeof(timeStr), RFC1123FMT, gmtime(&timer));
   len = sprintf(buf,
-	"HTTP/1.0 %d %s\r\nContent-type: %s\r\n"
-	"Date: %s\r\nConnection: close\r\n",
-	  responseNum, responseString, mime_type, timeStr);
+	"HTTP/1.%d %d %s\r\nContent-type: %s\r\n"
+	"Date: %s\r\nConnection: %s\r\n",
+	  config->keepalive, responseNum, responseString, mime_type, timeStr,
+	  config->keepalive ? "keep-alive" : "close");
 
 #ifdef CONFIG_FEATURE_HTTPD_BASIC_AUTH
   if (responseNum == HTTP_UNAUTHORIZED) {
@@ -961,7 +1032,27 @@ static int sendHeaders(HttpResponseNum responseNum)
 #if DEBUG
   fprintf(stderr, "Headers: '%s'", buf);
 #endif
-  return bb_full_write(a_c_w, buf, len);
+  return len;
+}
+
+/****************************************************************************
+ *
+ > $Function: sendHeaders()
+ *
+ * $Description: Create and send HTTP response headers.
+ *   The arguments are combined and sent as one write operation.  Note that
+ *   IE will puke big-time if the headers are not sent in one packet and the
+ *   second packet is delayed for any reason.
+ *
+ * $Parameter:
+ *      (HttpResponseNum) responseNum . . . The result code to send.
+ *
+ * $Return: (int)  . . . . writing errors
+ *
+ ****************************************************************************/
+static int sendHeaders(HttpResponseNum responseNum)
+{
+  return sendBuf(config->buf, makeHeaders(responseNum));
 }
 
 /****************************************************************************
@@ -970,7 +1061,9 @@ static int sendHeaders(HttpResponseNum responseNum)
  *
  * $Description: Read from the socket until an end of line char found.
  *
- *   Characters are read one at a time until an eol sequence is found.
+ *   The socket is read a buffer at a time into config->rbuf and lines are
+ *   taken from there into config->buf; whatever follows the line stays in
+ *   rbuf for the next call (or is the start of a POST body).
  *
  * $Return: (int) . . . . number of characters read.  -1 if error.
  *
@@ -980,15 +1073,35 @@ static int getLine(void)
   int  count = 0;
   char *buf = config->buf;
 
-  while (read(a_c_r, buf + count, 1) == 1) {
-    if (buf[count] == '\r') continue;
-    if (buf[count] == '\n') {
-      buf[count] = 0;
-      return count;
+  while (1) {
+    char *p = config->rbuf + config->rbuf_start;
+    char *eol;
+    int n = config->rbuf_len - config->rbuf_start;
+
+    if (n == 0) {
+      /* not safe_read(): a timeout must be able to interrupt us */
+      n = read(a_c_r, config->rbuf, sizeof(config->rbuf));
+      if (n <= 0)
+	break;
+      config->rbuf_start = 0;
+      config->rbuf_len = n;
+      p = config->rbuf;
+    }
+    eol = memchr(p, '\n', n);
+    if (eol)
+      n = eol - p + 1;
+    config->rbuf_start += n;
+    for (; n; n--, p++) {
+      if (*p == '\r') continue;
+      if (*p == '\n') {
+	buf[count] = 0;
+	return count;
+      }
+      if(count < (MAX_MEMORY_BUFF-1))      /* check owerflow */
+	buf[count++] = *p;
     }
-    if(count < (MAX_MEMORY_BUFF-1))      /* check owerflow */
-	count++;
   }
+  buf[count] = 0;
   if (count) return count;
   else return -1;
 }
@@ -1189,6 +1302,19 @@ static int sendCgi(const char *url,
       int nfound;
       int count;
 
+      /* the start of the body may have come in with the headers */
+      count = config->rbuf_len - config->rbuf_start;
+      if(bodyLen > 0 && post_readed_size == 0 && count > 0) {
+	if(count > bodyLen)
+		count = bodyLen;
+	if(count > (int)sizeof(wbuf))
+		count = sizeof(wbuf);
+	memcpy(wbuf, config->rbuf + config->rbuf_start, count);
+	config->rbuf_start += count;
+	post_readed_size = count;
+	bodyLen -= count;
+      }
+
       FD_ZERO(&readSet);
       FD_ZERO(&writeSet);
       FD_SET(inFd, &readSet);
@@ -1333,13 +1459,39 @@ static int sendFile(const char *url)
 
   f = open(url, O_RDONLY);
   if (f >= 0) {
-	int count;
-	char *buf = config->buf;
+	int len = makeHeaders(HTTP_OK);
+
+	if (config->ContentLength >= 0
+			&& config->ContentLength <= MAX_MEMORY_BUFF - len) {
+		/* small file: send it in the same write as the headers */
+		int count = bb_full_read(f, config->buf + len, config->ContentLength);
+
+		if (count > 0)
+			len += count;
+		sendBuf(config->buf, len);
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+	} else if (config->conn) {
+		/* the event loop sends it as the socket drains */
+		if (sendBuf(config->buf, len) == len) {
+			config->conn->file = f;
+			config->conn->file_left = config->ContentLength;
+			return 0;
+		}
+#endif
+	} else {
+		/* cork, so the headers share a packet with the start of the
+		 * file, which the kernel sends straight from the page cache */
+#ifdef TCP_CORK
+		int on = 1;
 
-	sendHeaders(HTTP_OK);
-	while ((count = bb_full_read(f, buf, MAX_MEMORY_BUFF)) > 0) {
-		if (bb_full_write(a_c_w, buf, count) != count)
-			break;
+		setsockopt(a_c_w, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#endif
+		if (bb_full_write(a_c_w, config->buf, len) == len)
+			bb_copyfd_eof(f, a_c_w);
+#ifdef TCP_CORK
+		on = 0;
+		setsockopt(a_c_w, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#endif
 	}
 	close(f);
   } else {
@@ -1468,6 +1620,7 @@ set_remoteuser_var:
 
 #endif  /* CONFIG_FEATURE_HTTPD_BASIC_AUTH */
 
+#ifndef CONFIG_FEATURE_HTTPD_EVENT_LOOP
 /****************************************************************************
  *
  > $Function: handle_sigalrm()
@@ -1482,20 +1635,86 @@ handle_sigalrm( int sig )
     sendHeaders(HTTP_REQUEST_TIMEOUT);
     config->alarm_signaled = sig;
 }
+#endif
+
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+/* Hand the connection over to a process of its own, for a CGI script.
+ * Returns nonzero in the event loop, 0 in the new process. */
+static int connFork(void)
+{
+  HttpdConn *c = config->conn;
+  sigset_t hup;
+  pid_t pid = fork();
+
+  if (pid) {
+	if (pid < 0)
+		sendHeaders(HTTP_INTERNAL_SERVER_ERROR);
+	else
+		c->closing = -1;
+	return 1;
+  }
+  config->conn = NULL;
+  fcntl(c->fd, F_SETFL, 0);
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+  signal(SIGALRM, SIG_DFL);
+#ifdef CONFIG_FEATURE_HTTPD_RELOAD_CONFIG_SIGHUP
+  signal(SIGHUP, SIG_IGN);
+#endif
+  sigemptyset(&hup);
+  sigaddset(&hup, SIGHUP);
+  sigprocmask(SIG_UNBLOCK, &hup, NULL);
+  return 0;
+}
+#endif
 
 /****************************************************************************
  *
- > $Function: handleIncoming()
+ > $Function: closeIncoming()
  *
- * $Description: Handle an incoming http request.
+ * $Description: Close the connection once the response is out.
  *
  ****************************************************************************/
-static void handleIncoming(void)
+static void closeIncoming(void)
+{
+  char *buf = config->buf;
+  fd_set s_fd;
+  struct timeval tv;
+  int retval;
+
+  shutdown(a_c_w, SHUT_WR);
+
+  /* Properly wait for remote to closed */
+  FD_ZERO (&s_fd) ;
+  FD_SET (a_c_r, &s_fd) ;
+
+  do {
+    tv.tv_sec = 2 ;
+    tv.tv_usec = 0 ;
+    retval = select (a_c_r + 1, &s_fd, NULL, NULL, &tv);
+  } while (retval > 0 && (read (a_c_r, buf, sizeof (config->buf)) > 0));
+
+  shutdown(a_c_r, SHUT_RD);
+#ifdef CONFIG_FEATURE_HTTPD_WITHOUT_INETD
+  close(config->accepted_socket);
+#endif  /* CONFIG_FEATURE_HTTPD_WITHOUT_INETD */
+}
+
+/****************************************************************************
+ *
+ > $Function: handleRequest()
+ *
+ * $Description: Handle one http request, whose first bytes may already be
+ *   in config->rbuf.
+ *
+ ****************************************************************************/
+static void handleRequest(void)
 {
   char *buf = config->buf;
   char *url;
   char *purl;
   int  blank = -1;
+  int  minor = 0;
   char *test;
   struct stat sb;
   int ip_allowed;
@@ -1505,20 +1724,11 @@ static void handleIncoming(void)
   char *cookie = 0;
   char *content_type = 0;
 #endif
-  fd_set s_fd;
-  struct timeval tv;
-  int retval;
-  struct sigaction sa;
 
 #ifdef CONFIG_FEATURE_HTTPD_BASIC_AUTH
   int credentials = -1;  /* if not requred this is Ok */
 #endif
 
-  sa.sa_handler = handle_sigalrm;
-  sigemptyset(&sa.sa_mask);
-  sa.sa_flags = 0; /* no SA_RESTART */
-  sigaction(SIGALRM, &sa, NULL);
-
   do {
     int  count;
 
@@ -1548,7 +1758,7 @@ BAD_REQUEST:
     }
 #endif
     *purl = ' ';
-    count = sscanf(purl, " %[^ ] HTTP/%d.%*d", buf, &blank);
+    count = sscanf(purl, " %[^ ] HTTP/%d.%d", buf, &blank, &minor);
 
     if (count < 1 || buf[0] != '/') {
       /* Garbled request/URL */
@@ -1620,10 +1830,15 @@ BAD_REQUEST:
 	if( is_directory(url + 1, 1, &sb) ) {
 		/* may be having subdir config */
 		parse_conf(url + 1, SUBDIR_PARSE);
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+		config->subdir_conf = 1;
+#endif
 		ip_allowed = checkPermIP();
 	}
 	*test = '/';
     }
+    /* HTTP/1.1 connections are persistent unless asked otherwise */
+    config->keepalive = blank > 1 || (blank == 1 && minor > 0);
     if(blank >= 0) {
       // read until blank line for HTTP version specified, else parse immediate
       while(1) {
@@ -1635,6 +1850,14 @@ BAD_REQUEST:
 #if DEBUG
 	fprintf(stderr, "Header: '%s'\n", buf);
 #endif
+	if ((strncasecmp(buf, "Connection:", 11) == 0)) {
+		for(test = buf + 11; isspace(*test); test++)
+			;
+		if (strncasecmp(test, "close", 5) == 0)
+			config->keepalive = 0;
+		else if (strncasecmp(test, "keep-alive", 10) == 0)
+			config->keepalive = 1;
+	}
 
 #ifdef CONFIG_FEATURE_HTTPD_CGI
 	/* try and do our best to parse more lines */
@@ -1714,6 +1937,16 @@ FORBIDDEN:      /* protect listing /cgi-bin */
     if (strncmp(test, "cgi-bin", 7) == 0) {
 		if(test[7] == '/' && test[8] == 0)
 			goto FORBIDDEN;     // protect listing cgi-bin/
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+		/* a script gets a process of its own, as without the event loop */
+		if (config->conn) {
+			if (connFork())
+				break;
+			sendCgi(url, prequest, length, cookie, content_type);
+			closeIncoming();
+			_exit(0);
+		}
+#endif
 		sendCgi(url, prequest, length, cookie, content_type);
     } else {
 	if (prequest != request_GET)
@@ -1749,29 +1982,369 @@ FORBIDDEN:      /* protect listing /cgi-bin */
   free(cookie);
   free(content_type);
   free(config->referer);
+  config->referer = NULL;
+# endif
 #ifdef CONFIG_FEATURE_HTTPD_BASIC_AUTH
   free(config->remoteuser);
+  config->remoteuser = NULL;
 #endif
-# endif
 #endif  /* CONFIG_FEATURE_HTTPD_WITHOUT_INETD */
-  shutdown(a_c_w, SHUT_WR);
+}
 
-  /* Properly wait for remote to closed */
-  FD_ZERO (&s_fd) ;
-  FD_SET (a_c_r, &s_fd) ;
+#ifndef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+/****************************************************************************
+ *
+ > $Function: handleIncoming()
+ *
+ * $Description: Handle an incoming http request.
+ *
+ ****************************************************************************/
+static void handleIncoming(void)
+{
+  struct sigaction sa;
 
-  do {
-    tv.tv_sec = 2 ;
-    tv.tv_usec = 0 ;
-    retval = select (a_c_r + 1, &s_fd, NULL, NULL, &tv);
-  } while (retval > 0 && (read (a_c_r, buf, sizeof (config->buf)) > 0));
+  sa.sa_handler = handle_sigalrm;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = 0; /* no SA_RESTART */
+  sigaction(SIGALRM, &sa, NULL);
+  config->rbuf_start = config->rbuf_len = 0;
 
-  shutdown(a_c_r, SHUT_RD);
-#ifdef CONFIG_FEATURE_HTTPD_WITHOUT_INETD
-  close(config->accepted_socket);
-#endif  /* CONFIG_FEATURE_HTTPD_WITHOUT_INETD */
+  handleRequest();
+  closeIncoming();
+}
+#endif
+
+#ifdef CONFIG_FEATURE_HTTPD_EVENT_LOOP
+#define MAX_EVENTS 64
+
+#ifndef MSG_MORE
+# define MSG_MORE 0
+#endif
+
+static HttpdConn *conn_head, *conn_tail;   /* least recently active first */
+
+static void connAppend(HttpdConn *c)
+{
+  c->last = time(0);
+  c->prev = conn_tail;
+  c->next = NULL;
+  if (conn_tail)
+	conn_tail->next = c;
+  else
+	conn_head = c;
+  conn_tail = c;
+}
+
+static void connUnlink(HttpdConn *c)
+{
+  if (c->prev)
+	c->prev->next = c->next;
+  else
+	conn_head = c->next;
+  if (c->next)
+	c->next->prev = c->prev;
+  else
+	conn_tail = c->prev;
+}
+
+static void connClose(HttpdConn *c, int efd)
+{
+  connUnlink(c);
+  /* a CGI process may still have the socket open */
+  epoll_ctl(efd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  if (c->file >= 0)
+	close(c->file);
+  free(c->in);
+  free(c->out);
+  free(c);
 }
 
+static void connWatch(HttpdConn *c, int efd, unsigned events)
+{
+  struct epoll_event ev;
+
+  if (c->events == events)
+	return;
+  c->events = ev.events = events;
+  ev.data.ptr = c;
+  epoll_ctl(efd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void connAccept(int server, int efd)
+{
+  while (1) {
+	struct sockaddr_in fromAddr;
+	socklen_t fromAddrLen = sizeof(fromAddr);
+	struct epoll_event ev;
+	HttpdConn *c;
+	int on = 1;
+	int s = accept(server, (struct sockaddr *)&fromAddr, &fromAddrLen);
+
+	if (s < 0) {
+		/* out of descriptors: make room by dropping the longest idle */
+		if ((errno == EMFILE || errno == ENFILE) && conn_head) {
+			connClose(conn_head, efd);
+			continue;
+		}
+		return;
+	}
+	c = calloc(1, sizeof(*c));
+	if (c == NULL) {
+		close(s);
+		continue;
+	}
+	fcntl(s, F_SETFL, O_NONBLOCK);
+	setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, (void *)&on, sizeof (on));
+	/* responses are whole writes; don't let them wait for acks */
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (void *)&on, sizeof (on));
+	c->fd = s;
+	c->file = -1;
+	c->rmt_ip = ntohl(fromAddr.sin_addr.s_addr);
+	c->port = ntohs(fromAddr.sin_port);
+	c->events = ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, s, &ev) < 0) {
+		close(s);
+		free(c);
+		continue;
+	}
+	connAppend(c);
+  }
+}
+
+/* Read whatever has arrived.  Returns 0 if the connection broke. */
+static int connRead(HttpdConn *c)
+{
+  while (!c->eof) {
+	int n;
+
+	if (c->closing) {
+		/* just waiting for the client to close */
+		n = read(c->fd, config->buf, sizeof(config->buf));
+	} else {
+		if (c->in_len == MAX_MEMORY_BUFF)
+			break;
+		if (c->in == NULL && (c->in = malloc(MAX_MEMORY_BUFF)) == NULL)
+			return 0;
+		n = read(c->fd, c->in + c->in_len, MAX_MEMORY_BUFF - c->in_len);
+	}
+	if (n > 0) {
+		if (!c->closing)
+			c->in_len += n;
+		continue;
+	}
+	if (n == 0)
+		c->eof = 1;
+	else if (errno == EINTR)
+		continue;
+	else if (errno != EAGAIN)
+		return 0;
+	break;
+  }
+  return 1;
+}
+
+/* Send what's pending.  Returns 1 when it's all gone, 0 if the socket
+ * is full, -1 on error. */
+static int connFlush(HttpdConn *c)
+{
+  while (c->out_pos < c->out_len) {
+	int n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos,
+			c->file >= 0 ? MSG_MORE : 0);
+
+	if (n < 0) {
+		if (errno == EINTR)
+			continue;
+		return errno == EAGAIN ? 0 : -1;
+	}
+	c->out_pos += n;
+  }
+  free(c->out);
+  c->out = NULL;
+  c->out_len = c->out_pos = 0;
+
+  while (c->file >= 0 && c->file_left > 0) {
+	ssize_t n = sendfile(c->fd, c->file, NULL,
+			c->file_left > 0x7ffff000 ? 0x7ffff000 : c->file_left);
+
+	if (n < 0) {
+		if (errno == EINTR)
+			continue;
+		return errno == EAGAIN ? 0 : -1;
+	}
+	if (n == 0)
+		return -1;      /* file shrank, we promised more */
+	c->file_left -= n;
+  }
+  if (c->file >= 0) {
+	close(c->file);
+	c->file = -1;
+  }
+  return 1;
+}
+
+/* Does the buffer hold a whole request?  It ends with an empty line,
+ * or with the first line if that has no HTTP version (HTTP/0.9). */
+static int requestComplete(const char *p, int n)
+{
+  const char *eol = memchr(p, '\n', n);
+
+  if (eol == NULL)
+	return 0;
+  if (memmem(p, eol - p, " HTTP/", 6) == NULL)
+	return 1;
+  return memmem(p, n, "\n\n", 2) || memmem(p, n, "\n\r\n", 3);
+}
+
+/* Answer the request at the start of c->in */
+static void connRequest(HttpdConn *c)
+{
+  int left;
+
+  memcpy(config->rbuf, c->in, c->in_len);
+  config->rbuf_start = 0;
+  config->rbuf_len = c->in_len;
+  config->accepted_socket = c->fd;
+  config->rmt_ip = c->rmt_ip;
+#if defined(CONFIG_FEATURE_HTTPD_CGI) || DEBUG
+  sprintf(config->rmt_ip_str, "%u.%u.%u.%u",
+		(unsigned char)(config->rmt_ip >> 24),
+		(unsigned char)(config->rmt_ip >> 16),
+		(unsigned char)(config->rmt_ip >> 8),
+				config->rmt_ip & 0xff);
+#endif
+  config->port = c->port;
+  config->query = NULL;
+  config->httpd_found.found_moved_temporarily = NULL;
+  config->ContentLength = -1;
+  config->keepalive = 0;
+  config->conn = c;
+
+  handleRequest();
+
+  alarm(0);
+  config->conn = NULL;
+  left = config->rbuf_len - config->rbuf_start;
+  memcpy(c->in, config->rbuf + config->rbuf_start, left);
+  c->in_len = left;
+  if (!c->closing)
+	c->closing = !config->keepalive;
+  if (config->subdir_conf) {
+	/* a subdir config only holds for the request that read it */
+	parse_conf(default_path_httpd_conf, SIGNALED_PARSE);
+	config->subdir_conf = 0;
+  }
+}
+
+/* Send what's pending and answer complete requests, one at a time and in
+ * order.  Returns 0 when the connection is finished with. */
+static int connRun(HttpdConn *c, int efd)
+{
+  while (1) {
+	int r = connFlush(c);
+
+	if (r < 0)
+		return 0;
+	if (r == 0) {
+		connWatch(c, efd, EPOLLOUT);
+		return 1;
+	}
+	if (c->closing || c->in_len == 0 || !requestComplete(c->in, c->in_len))
+		break;
+	connRequest(c);
+  }
+  if (c->closing < 0 || c->eof)
+	return 0;
+  if (c->closing) {
+	/* let the client read everything before it sees us go */
+	if (c->closing == 1)
+		shutdown(c->fd, SHUT_WR);
+	c->closing = 2;
+  } else if (c->in_len == MAX_MEMORY_BUFF) {
+	return 0;       /* request too big */
+  }
+  if (c->in_len == 0) {
+	/* idle connections shouldn't cost a buffer */
+	free(c->in);
+	c->in = NULL;
+  }
+  connWatch(c, efd, EPOLLIN);
+  return 1;
+}
+
+/****************************************************************************
+ *
+ > $Function: miniHttpd()
+ *
+ * $Description: The main http server function, event loop version.
+ *
+ *   All connections are served from this one process: epoll tells us
+ *   which sockets can be read or written, requests are answered in the
+ *   order they came in (so pipelining works), static files go out with
+ *   sendfile() as the socket drains, and HTTP/1.1 connections are kept
+ *   open for the next request.  Only CGI requests fork.
+ *
+ * $Parameters:
+ *      (int) server. . . The server socket fildes.
+ *
+ * $Return: (int) . . . . Always 0.
+ *
+ ****************************************************************************/
+static int miniHttpd(int server)
+{
+  struct epoll_event ev, events[MAX_EVENTS];
+  struct rlimit rl;
+  sigset_t hup, waitmask;
+  int efd;
+
+  /* every idle connection holds a descriptor */
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  efd = epoll_create(MAX_EVENTS);
+  if (efd < 0)
+	bb_perror_msg_and_die("epoll_create");
+  fcntl(server, F_SETFL, O_NONBLOCK);
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(efd, EPOLL_CTL_ADD, server, &ev);
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGCHLD, SIG_IGN);     /* CGI processes */
+  signal(SIGALRM, SIG_IGN);     /* idle connections are timed out below */
+  /* the config is only reloaded between events */
+  sigemptyset(&hup);
+  sigaddset(&hup, SIGHUP);
+  sigprocmask(SIG_BLOCK, &hup, &waitmask);
+
+  while (1) {
+	int i, n = epoll_pwait(efd, events, MAX_EVENTS, 1000, &waitmask);
+	time_t now;
+
+	for (i = 0; i < n; i++) {
+		HttpdConn *c = events[i].data.ptr;
+
+		if (c == NULL) {
+			connAccept(server, efd);
+			continue;
+		}
+		if (!connRead(c) || !connRun(c, efd)) {
+			connClose(c, efd);
+			continue;
+		}
+		connUnlink(c);
+		connAppend(c);
+	}
+	now = time(0);
+	while (conn_head && now - conn_head->last >= TIMEOUT)
+		connClose(conn_head, efd);
+  }
+  return 0;
+}
+
+#elif defined(CONFIG_FEATURE_HTTPD_WITHOUT_INETD)
 /****************************************************************************
  *
  > $Function: miniHttpd()
@@ -1787,7 +2360,6 @@ FORBIDDEN:      /* protect listing /cgi-bin */
  * $Return: (int) . . . . Always 0.
  *
  ****************************************************************************/
-#ifdef CONFIG_FEATURE_HTTPD_WITHOUT_INETD
 static int miniHttpd(int server)
 {
   fd_set readfd, portfd;
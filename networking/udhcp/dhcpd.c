@@ -71,7 +71,7 @@ int udhcpd_main(int argc, char *argv[])
 		server_config.max_leases = num_ips;
 	}
 
-	leases = xzalloc(server_config.max_leases * sizeof(struct dhcpOfferedAddr));
+	init_leases();
 	read_leases(server_config.lease_file);
 
 	if (read_interface(server_config.interface, &server_config.ifindex,
@@ -210,7 +210,7 @@ int udhcpd_main(int argc, char *argv[])
 				if ((lease = find_lease_by_yiaddr(requested_align))) {
 					if (lease_expired(lease)) {
 						/* probably best if we drop this lease */
-						memset(lease->chaddr, 0, 16);
+						clear_lease_chaddr(lease);
 					/* make some contention for this address */
 					} else sendNAK(&packet);
 				} else if (requested_align < server_config.start ||
@@ -225,13 +225,13 @@ int udhcpd_main(int argc, char *argv[])
 		case DHCPDECLINE:
 			DEBUG(LOG_INFO,"received DECLINE");
 			if (lease) {
-				memset(lease->chaddr, 0, 16);
-				lease->expires = time(0) + server_config.decline_time;
+				clear_lease_chaddr(lease);
+				set_lease_expires(lease, time(0) + server_config.decline_time);
 			}
 			break;
 		case DHCPRELEASE:
 			DEBUG(LOG_INFO,"received RELEASE");
-			if (lease) lease->expires = time(0);
+			if (lease) set_lease_expires(lease, time(0));
 			break;
 		case DHCPINFORM:
 			DEBUG(LOG_INFO,"received INFORM");
@@ -21,18 +21,220 @@
 
 uint8_t blank_chaddr[] = {[0 ... 15] = 0};
 
-/* clear every lease out that chaddr OR yiaddr matches and is nonzero */
-void clear_lease(uint8_t *chaddr, uint32_t yiaddr)
+/* The lease table is indexed so that nothing has to walk all of it:
+ * - hash chains by chaddr and by yiaddr (blank chaddrs aren't hashed),
+ * - a stack of the empty slots, which are used first as before,
+ * - a min-heap of the others by expiry, oldest on top,
+ * - bitmaps over the pool, one of addresses some lease holds, one of
+ *   addresses never to hand out (static leases, .0 and .255). */
+static int *chaddr_hash, *chaddr_next;
+static int *yiaddr_hash, *yiaddr_next;
+static unsigned hash_mask;
+static int *free_slots, nfree;
+static int *heap, *heap_pos, *heap_walk, heap_len;
+static unsigned long *pool_used, *pool_reserved;
+static uint32_t pool_start, pool_size;	/* host order */
+static long free_hint;		/* no pool bit below this one is free */
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+
+static unsigned chaddr_bucket(uint8_t *chaddr)
+{
+	unsigned h = 0;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		h = h * 31 + chaddr[i];
+	return h & hash_mask;
+}
+
+#define yiaddr_bucket(yiaddr) (ntohl(yiaddr) & hash_mask)
+
+static int is_blank(uint8_t *chaddr)
+{
+	return !memcmp(chaddr, blank_chaddr, 16);
+}
+
+/* Bit number of an address in the pool bitmaps, -1 if it's outside */
+static long pool_bit(uint32_t yiaddr)
+{
+	uint32_t off = ntohl(yiaddr) - pool_start;
+
+	return off < pool_size ? (long) off : -1;
+}
+
+static void set_bit(unsigned long *map, long bit, int on)
 {
-	unsigned int i, j;
+	if (on)
+		map[bit / BITS_PER_LONG] |= 1UL << (bit % BITS_PER_LONG);
+	else
+		map[bit / BITS_PER_LONG] &= ~(1UL << (bit % BITS_PER_LONG));
+}
 
-	for (j = 0; j < 16 && !chaddr[j]; j++);
+static void unlink_slot(int *head, int *next, int i)
+{
+	while (*head != i)
+		head = &next[*head];
+	*head = next[i];
+}
 
-	for (i = 0; i < server_config.max_leases; i++)
-		if ((j != 16 && !memcmp(leases[i].chaddr, chaddr, 16)) ||
-		    (yiaddr && leases[i].yiaddr == yiaddr)) {
-			memset(&(leases[i]), 0, sizeof(struct dhcpOfferedAddr));
+/* Take slot i out of the hashes and the pool bitmap */
+static void unindex_lease(int i)
+{
+	long bit;
+
+	if (!is_blank(leases[i].chaddr))
+		unlink_slot(&chaddr_hash[chaddr_bucket(leases[i].chaddr)], chaddr_next, i);
+	if (leases[i].yiaddr) {
+		unlink_slot(&yiaddr_hash[yiaddr_bucket(leases[i].yiaddr)], yiaddr_next, i);
+		if ((bit = pool_bit(leases[i].yiaddr)) >= 0) {
+			set_bit(pool_used, bit, 0);
+			if (bit < free_hint)
+				free_hint = bit;
 		}
+	}
+}
+
+static void index_lease(int i)
+{
+	unsigned h;
+	long bit;
+
+	if (!is_blank(leases[i].chaddr)) {
+		h = chaddr_bucket(leases[i].chaddr);
+		chaddr_next[i] = chaddr_hash[h];
+		chaddr_hash[h] = i;
+	}
+	if (leases[i].yiaddr) {
+		h = yiaddr_bucket(leases[i].yiaddr);
+		yiaddr_next[i] = yiaddr_hash[h];
+		yiaddr_hash[h] = i;
+		if ((bit = pool_bit(leases[i].yiaddr)) >= 0)
+			set_bit(pool_used, bit, 1);
+	}
+}
+
+static int heap_before(int a, int b)
+{
+	return leases[a].expires < leases[b].expires
+		|| (leases[a].expires == leases[b].expires && a < b);
+}
+
+static void heap_put(int pos, int i)
+{
+	heap[pos] = i;
+	heap_pos[i] = pos;
+}
+
+/* Move slot i to its place in the heap after its expiry changed */
+static void heap_fix(int i)
+{
+	int n = heap_len;
+	int pos = heap_pos[i];
+
+	while (pos > 0 && heap_before(i, heap[(pos - 1) / 2])) {
+		heap_put(pos, heap[(pos - 1) / 2]);
+		pos = (pos - 1) / 2;
+	}
+	for (;;) {
+		int child = 2 * pos + 1;
+
+		if (child >= n)
+			break;
+		if (child + 1 < n && heap_before(heap[child + 1], heap[child]))
+			child++;
+		if (!heap_before(heap[child], i))
+			break;
+		heap_put(pos, heap[child]);
+		pos = child;
+	}
+	heap_put(pos, i);
+}
+
+static void heap_remove(int i)
+{
+	int last = heap[--heap_len];
+
+	if (last != i) {
+		heap_put(heap_pos[i], last);
+		heap_fix(last);
+	}
+	heap_pos[i] = -1;
+	free_slots[nfree++] = i;
+}
+
+/* Only slots of the table are indexed; dhcpd also passes in a static
+ * lease it made up on the stack. */
+static int lease_slot(struct dhcpOfferedAddr *lease)
+{
+	if (lease < leases || lease >= leases + server_config.max_leases)
+		return -1;
+	return lease - leases;
+}
+
+
+/* allocate the lease table and its indexes for the configured pool */
+void init_leases(void)
+{
+	struct static_lease *s;
+	unsigned int i, n = server_config.max_leases;
+	uint32_t addr;
+	size_t words;
+
+	leases = xzalloc(n * sizeof(struct dhcpOfferedAddr));
+	for (hash_mask = 1; hash_mask < n; hash_mask <<= 1)
+		continue;
+	chaddr_hash = xmalloc(hash_mask * sizeof(int));
+	yiaddr_hash = xmalloc(hash_mask * sizeof(int));
+	memset(chaddr_hash, -1, hash_mask * sizeof(int));
+	memset(yiaddr_hash, -1, hash_mask * sizeof(int));
+	hash_mask--;
+	chaddr_next = xmalloc(n * sizeof(int));
+	yiaddr_next = xmalloc(n * sizeof(int));
+
+	/* all slots are empty, lowest first */
+	free_slots = xmalloc(n * sizeof(int));
+	for (i = 0; i < n; i++)
+		free_slots[i] = n - 1 - i;
+	nfree = n;
+	heap = xmalloc(n * sizeof(int));
+	heap_pos = xmalloc(n * sizeof(int));
+	heap_walk = xmalloc(n * sizeof(int));
+	memset(heap_pos, -1, n * sizeof(int));
+
+	pool_start = ntohl(server_config.start);
+	pool_size = ntohl(server_config.end) - pool_start + 1;
+	words = pool_size / BITS_PER_LONG + 1;
+	pool_used = xzalloc(words * sizeof(long));
+	pool_reserved = xzalloc(words * sizeof(long));
+	for (i = 0; i < pool_size; i++) {
+		addr = pool_start + i;
+		/* ie, 192.168.55.0 and 192.168.55.255 */
+		if (!(addr & 0xFF) || (addr & 0xFF) == 0xFF)
+			set_bit(pool_reserved, i, 1);
+	}
+	for (s = server_config.static_leases; s; s = s->next) {
+		long bit = pool_bit(*s->ip);
+
+		if (bit >= 0)
+			set_bit(pool_reserved, bit, 1);
+	}
+}
+
+
+/* clear every lease out that chaddr OR yiaddr matches and is nonzero */
+void clear_lease(uint8_t *chaddr, uint32_t yiaddr)
+{
+	struct dhcpOfferedAddr *lease;
+	int i;
+
+	while ((!is_blank(chaddr) && (lease = find_lease_by_chaddr(chaddr)))
+			|| (yiaddr && (lease = find_lease_by_yiaddr(yiaddr)))) {
+		i = lease - leases;
+		unindex_lease(i);
+		memset(lease, 0, sizeof(struct dhcpOfferedAddr));
+		heap_remove(i);
+	}
 }
 
 
@@ -40,6 +242,7 @@ void clear_lease(uint8_t *chaddr, uint32_t yiaddr)
 struct dhcpOfferedAddr *add_lease(uint8_t *chaddr, uint32_t yiaddr, unsigned long lease)
 {
 	struct dhcpOfferedAddr *oldest;
+	int i;
 
 	/* clean out any old ones */
 	clear_lease(chaddr, yiaddr);
@@ -47,15 +250,46 @@ struct dhcpOfferedAddr *add_lease(uint8_t *chaddr, uint32_t yiaddr, unsigned lon
 	oldest = oldest_expired_lease();
 
 	if (oldest) {
+		i = oldest - leases;
+		unindex_lease(i);
 		memcpy(oldest->chaddr, chaddr, 16);
 		oldest->yiaddr = yiaddr;
 		oldest->expires = time(0) + lease;
+		index_lease(i);
+		if (heap_pos[i] < 0) {
+			nfree--;
+			heap_put(heap_len++, i);
+		}
+		heap_fix(i);
 	}
 
 	return oldest;
 }
 
 
+/* forget whose a lease is, but keep its address taken */
+void clear_lease_chaddr(struct dhcpOfferedAddr *lease)
+{
+	int i = lease_slot(lease);
+
+	if (i >= 0)
+		unindex_lease(i);
+	memset(lease->chaddr, 0, 16);
+	if (i >= 0)
+		index_lease(i);
+}
+
+
+void set_lease_expires(struct dhcpOfferedAddr *lease, unsigned long expires)
+{
+	int i = lease_slot(lease);
+
+	lease->expires = expires;
+	if (i >= 0 && heap_pos[i] >= 0)
+		heap_fix(i);
+}
+
+
 /* true if a lease has expired */
 int lease_expired(struct dhcpOfferedAddr *lease)
 {
@@ -66,27 +300,22 @@ int lease_expired(struct dhcpOfferedAddr *lease)
 /* Find the oldest expired lease, NULL if there are no expired leases */
 struct dhcpOfferedAddr *oldest_expired_lease(void)
 {
-	struct dhcpOfferedAddr *oldest = NULL;
-	unsigned long oldest_lease = time(0);
-	unsigned int i;
-
-
-	for (i = 0; i < server_config.max_leases; i++)
-		if (oldest_lease > leases[i].expires) {
-			oldest_lease = leases[i].expires;
-			oldest = &(leases[i]);
-		}
-	return oldest;
-
+	if (nfree)
+		return &leases[free_slots[nfree - 1]];
+	if (heap_len && lease_expired(&leases[heap[0]]))
+		return &leases[heap[0]];
+	return NULL;
 }
 
 
 /* Find the first lease that matches chaddr, NULL if no match */
 struct dhcpOfferedAddr *find_lease_by_chaddr(uint8_t *chaddr)
 {
-	unsigned int i;
+	int i;
 
-	for (i = 0; i < server_config.max_leases; i++)
+	if (is_blank(chaddr))
+		return NULL;
+	for (i = chaddr_hash[chaddr_bucket(chaddr)]; i >= 0; i = chaddr_next[i])
 		if (!memcmp(leases[i].chaddr, chaddr, 16)) return &(leases[i]);
 
 	return NULL;
@@ -96,9 +325,9 @@ struct dhcpOfferedAddr *find_lease_by_chaddr(uint8_t *chaddr)
 /* Find the first lease that matches yiaddr, NULL is no match */
 struct dhcpOfferedAddr *find_lease_by_yiaddr(uint32_t yiaddr)
 {
-	unsigned int i;
+	int i;
 
-	for (i = 0; i < server_config.max_leases; i++)
+	for (i = yiaddr_hash[yiaddr_bucket(yiaddr)]; i >= 0; i = yiaddr_next[i])
 		if (leases[i].yiaddr == yiaddr) return &(leases[i]);
 
 	return NULL;
@@ -120,39 +349,115 @@ static int check_ip(uint32_t addr)
 }
 
 
-/* find an assignable address, it check_expired is true, we check all the expired leases as well.
- * Maybe this should try expired leases by age... */
-uint32_t find_address(int check_expired)
+/* First pool bit from 'from' on that's neither leased nor reserved,
+ * -1 if there's none */
+static long next_free(long from)
 {
-	uint32_t addr, ret;
-	struct dhcpOfferedAddr *lease = NULL;
-
-	addr = ntohl(server_config.start); /* addr is in host order here */
-	for (;addr <= ntohl(server_config.end); addr++) {
+	long bit = from > free_hint ? from : free_hint;
+	long w = bit / BITS_PER_LONG;
+	long words = (pool_size + BITS_PER_LONG - 1) / BITS_PER_LONG;
+	unsigned long taken;
+
+	if (bit < (long) pool_size) {
+		taken = pool_used[w] | pool_reserved[w]
+			| ((1UL << (bit % BITS_PER_LONG)) - 1);
+		while (taken == ~0UL && ++w < words)
+			taken = pool_used[w] | pool_reserved[w];
+		bit = w < words ? w * BITS_PER_LONG + __builtin_ctzl(~taken) : pool_size;
+		if (bit > (long) pool_size)
+			bit = pool_size;
+	}
+	if (from <= free_hint)
+		free_hint = bit;
+	return bit < (long) pool_size ? bit : -1;
+}
 
-		/* ie, 192.168.55.0 */
-		if (!(addr & 0xFF)) continue;
 
-		/* ie, 192.168.55.255 */
-		if ((addr & 0xFF) == 0xFF) continue;
+/* heap_walk is a second little heap of positions in the first one,
+ * ordered the same way, to visit the leases oldest first */
+static void walk_push(int len, int pos)
+{
+	while (len > 0 && heap_before(heap[pos], heap[heap_walk[(len - 1) / 2]])) {
+		heap_walk[len] = heap_walk[(len - 1) / 2];
+		len = (len - 1) / 2;
+	}
+	heap_walk[len] = pos;
+}
 
-		/* Only do if it isn't an assigned as a static lease */
-		if(!reservedIp(server_config.static_leases, htonl(addr)))
-		{
+static int walk_pop(int len)
+{
+	int top = heap_walk[0], last = heap_walk[--len], i = 0;
 
-		/* lease is not taken */
-		ret = htonl(addr);
-		if ((!(lease = find_lease_by_yiaddr(ret)) ||
+	for (;;) {
+		int child = 2 * i + 1;
 
-		     /* or it expired and we are checking for expired leases */
-		     (check_expired  && lease_expired(lease))) &&
+		if (child >= len)
+			break;
+		if (child + 1 < len
+		 && heap_before(heap[heap_walk[child + 1]], heap[heap_walk[child]]))
+			child++;
+		if (!heap_before(heap[heap_walk[child]], heap[last]))
+			break;
+		heap_walk[i] = heap_walk[child];
+		i = child;
+	}
+	heap_walk[i] = last;
+	return top;
+}
 
-		     /* and it isn't on the network */
-		     !check_ip(ret)) {
-			return ret;
+/* Pool bit of the oldest expired lease we may hand out again, -1 if
+ * there's none.  Usually that's the top of the heap. */
+static long oldest_expired(void)
+{
+	int n = heap_len;
+	int len = 0, pos;
+	long bit;
+	struct dhcpOfferedAddr *lease;
+
+	if (n)
+		walk_push(len++, 0);
+	while (len) {
+		pos = walk_pop(len--);
+		lease = &leases[heap[pos]];
+		if (!lease_expired(lease))
 			break;
-		}
+		bit = lease->yiaddr ? pool_bit(lease->yiaddr) : -1;
+		if (bit >= 0
+		 && !(pool_reserved[bit / BITS_PER_LONG] & (1UL << (bit % BITS_PER_LONG))))
+			return bit;
+		if (2 * pos + 1 < n)
+			walk_push(len++, 2 * pos + 1);
+		if (2 * pos + 2 < n)
+			walk_push(len++, 2 * pos + 2);
 	}
+	return -1;
+}
+
+
+/* find an assignable address, it check_expired is true, we check all the expired leases as well,
+ * oldest first. */
+uint32_t find_address(int check_expired)
+{
+	long from = 0, bit;
+	uint32_t ret;
+
+	for (;;) {
+		/* lease is not taken */
+		bit = next_free(from);
+		if (bit >= 0)
+			from = bit + 1;
+
+		/* or it expired and we are checking for expired leases
+		 * (if it's on the network, check_ip() renews it for the
+		 * conflict, so the next oldest comes up next time round) */
+		else if (check_expired)
+			bit = oldest_expired();
+		if (bit < 0)
+			return 0;
+
+		/* and it isn't on the network */
+		ret = htonl(pool_start + bit);
+		if (!check_ip(ret))
+			return ret;
 	}
-	return 0;
 }
@@ -11,8 +11,11 @@ struct dhcpOfferedAddr {
 
 extern uint8_t blank_chaddr[];
 
+void init_leases(void);
 void clear_lease(uint8_t *chaddr, uint32_t yiaddr);
 struct dhcpOfferedAddr *add_lease(uint8_t *chaddr, uint32_t yiaddr, unsigned long lease);
+void clear_lease_chaddr(struct dhcpOfferedAddr *lease);
+void set_lease_expires(struct dhcpOfferedAddr *lease, unsigned long expires);
 int lease_expired(struct dhcpOfferedAddr *lease);
 struct dhcpOfferedAddr *oldest_expired_lease(void);
 struct dhcpOfferedAddr *find_lease_by_chaddr(uint8_t *chaddr);
@@ -48,7 +48,7 @@
 typedef int (*cmp_t)(procps_status_t *P, procps_status_t *Q);
 
 static procps_status_t *top;   /* Hehe */
-static int ntop;
+static int ntop, top_alloc;
 
 #ifdef CONFIG_FEATURE_USE_TERMIOS
 static int pid_sort(procps_status_t *P, procps_status_t *Q)
@@ -93,6 +93,7 @@ static int mult_lvl_cmp(void* a, void* b) {
 struct save_hist {
 	int ticks;
 	int pid;
+	int next;	/* next entry in the same hash chain, or -1 */
 };
 
 /*
@@ -101,7 +102,10 @@ struct save_hist {
 
 static struct save_hist *prev_hist;
 static int prev_hist_count;
-/* static int hist_iterations; */
+/* Previous frame's entries hashed by pid, so each lookup is O(1) even
+ * with tens of thousands of processes */
+static int *prev_hash;
+static unsigned prev_hash_mask;
 
 
 static unsigned total_pcpu;
@@ -133,18 +137,23 @@ static void get_jiffy_counts(void)
 static void do_stats(void)
 {
 	procps_status_t *cur;
-	int pid, total_time, i, last_i, n;
+	int pid, total_time, i, n;
 	struct save_hist *new_hist;
+	int *new_hash;
+	unsigned new_mask;
 
 	get_jiffy_counts();
 	total_pcpu = 0;
 	/* total_rss = 0; */
 	new_hist = xmalloc(sizeof(struct save_hist)*ntop);
+	/* at least twice as many chains as processes */
+	for (new_mask = 63; new_mask < 2*ntop; new_mask = new_mask*2 + 1)
+		continue;
+	new_hash = xmalloc(sizeof(int)*(new_mask + 1));
+	memset(new_hash, -1, sizeof(int)*(new_mask + 1));
 	/*
 	 * Make a pass through the data to get stats.
 	 */
-	/* hist_iterations = 0; */
-	i = 0;
 	for (n = 0; n < ntop; n++) {
 		cur = top + n;
 
@@ -156,20 +165,20 @@ static void do_stats(void)
 		total_time = cur->stime + cur->utime;
 		new_hist[n].ticks = total_time;
 		new_hist[n].pid = pid;
+		new_hist[n].next = new_hash[pid & new_mask];
+		new_hash[pid & new_mask] = n;
 
 		/* find matching entry from previous pass */
 		cur->pcpu = 0;
-		/* do not start at index 0, continue at last used one
-		 * (brought hist_iterations from ~14000 down to 172) */
-		last_i = i;
-		if (prev_hist_count) do {
-			if (prev_hist[i].pid == pid) {
-				cur->pcpu = total_time - prev_hist[i].ticks;
-				break;
+		if (prev_hist_count) {
+			for (i = prev_hash[pid & prev_hash_mask]; i >= 0;
+					i = prev_hist[i].next) {
+				if (prev_hist[i].pid == pid) {
+					cur->pcpu = total_time - prev_hist[i].ticks;
+					break;
+				}
 			}
-			i = (i+1) % prev_hist_count;
-			/* hist_iterations++; */
-		} while (i != last_i);
+		}
 		total_pcpu += cur->pcpu;
 		/* total_rss += cur->rss; */
 	}
@@ -178,8 +187,11 @@ static void do_stats(void)
 	 * Save cur frame's information.
 	 */
 	free(prev_hist);
+	free(prev_hash);
 	prev_hist = new_hist;
 	prev_hist_count = ntop;
+	prev_hash = new_hash;
+	prev_hash_mask = new_mask;
 }
 #else
 static cmp_t sort_function;
@@ -355,7 +367,6 @@ static void display_status(int count, int scr_width)
 			jif.busy - prev_jif.busy, jif.total - prev_jif.total); */
 		s++;
 	}
-	/* printf(" %d", hist_iterations); */
 	putchar('\r');
 	fflush(stdout);
 }
@@ -364,7 +375,7 @@ static void clearmems(void)
 {
 	free(top);
 	top = 0;
-	ntop = 0;
+	ntop = top_alloc = 0;
 }
 
 #ifdef CONFIG_FEATURE_USE_TERMIOS
@@ -381,6 +392,7 @@ static void reset_term(void)
 	clearmems();
 #ifdef CONFIG_FEATURE_TOP_CPU_USAGE_PERCENTAGE
 	free(prev_hist);
+	free(prev_hash);
 #endif
 #endif /* CONFIG_FEATURE_CLEAN_UP */
 }
@@ -397,6 +409,7 @@ int top_main(int argc, char **argv)
 {
 	int opt, interval, lines, col;
 	char *sinterval;
+	procps_scan_t *scan;
 #ifdef CONFIG_FEATURE_USE_TERMIOS
 	struct termios new_settings;
 	struct timeval tv;
@@ -415,6 +428,7 @@ int top_main(int argc, char **argv)
 
 	/* change to /proc */
 	bb_xchdir("/proc");
+	scan = procps_scan_open(0);
 #ifdef CONFIG_FEATURE_USE_TERMIOS
 	tcgetattr(0, (void *) &initial_settings);
 	memcpy(&new_settings, &initial_settings, sizeof(struct termios));
@@ -452,11 +466,12 @@ int top_main(int argc, char **argv)
 #endif /* CONFIG_FEATURE_USE_TERMIOS */
 
 		/* read process IDs & status for all the processes */
-		while ((p = procps_scan(0)) != 0) {
-			int n = ntop;
-
-			top = xrealloc(top, (++ntop)*sizeof(procps_status_t));
-			memcpy(top + n, p, sizeof(procps_status_t));
+		while ((p = procps_scan_next(scan)) != 0) {
+			if (ntop == top_alloc) {
+				top_alloc = top_alloc ? top_alloc*2 : 256;
+				top = xrealloc(top, top_alloc*sizeof(procps_status_t));
+			}
+			memcpy(top + ntop++, p, sizeof(procps_status_t));
 		}
 		if (ntop == 0) {
 			bb_error_msg_and_die("Can't find process info in /proc");
@@ -465,7 +480,7 @@ int top_main(int argc, char **argv)
 		if (!prev_hist_count) {
 			do_stats();
 			sleep(1);
-			clearmems();
+			ntop = 0;
 			continue;
 		}
 		do_stats();
@@ -523,10 +538,13 @@ int top_main(int argc, char **argv)
 #else
 		sleep(interval);
 #endif /* CONFIG_FEATURE_USE_TERMIOS */
-		clearmems();
+		/* keep the array for the next frame */
+		ntop = 0;
 	}
-	if (ENABLE_FEATURE_CLEAN_UP)
+	if (ENABLE_FEATURE_CLEAN_UP) {
 		clearmems();
+		procps_scan_close(scan);
+	}
 	putchar('\n');
 	return EXIT_SUCCESS;
 }
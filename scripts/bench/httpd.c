@@ -0,0 +1,246 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * httpd load generator.
+ *
+ * Keeps -c connections busy fetching PATH until -n requests have been
+ * answered and reports requests per second.  With -k each connection is
+ * kept open for HTTP/1.1 requests (and -p of them pipelined at a time),
+ * otherwise every request is an HTTP/1.0 one on a fresh connection, like
+ * simple clients do.  -i opens that many more connections which just sit
+ * idle for the whole run.
+ * It's standalone:
+ *
+ *   gcc -O2 -o httpd_bench scripts/bench/httpd.c
+ *   httpd -p 8080 -h /www
+ *   ./httpd_bench -c 50 -n 100000 -k 127.0.0.1 8080 /index.html
+ *
+ * Licensed under GPLv2, see file LICENSE in this tarball for details.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+struct client {
+	int fd;
+	int queued;			/* requests sent and not answered yet */
+	int answered;
+	char buf[65536];
+	int len;
+};
+
+static struct sockaddr_in addr;
+static char request[1024];
+static int request_len;
+static int keepalive, pipeline = 1;
+static long sent, done, failed, total = 10000;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int open_conn(void)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+
+	if (fd < 0) {
+		perror("socket");
+		exit(1);
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+}
+
+static void send_requests(struct client *c)
+{
+	while (c->queued < pipeline && sent < total) {
+		if (write(c->fd, request, request_len) != request_len) {
+			perror("write");
+			exit(1);
+		}
+		c->queued++;
+		sent++;
+	}
+}
+
+static void start(struct client *c, int efd)
+{
+	struct epoll_event ev;
+
+	c->fd = open_conn();
+	c->queued = c->answered = c->len = 0;
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	epoll_ctl(efd, EPOLL_CTL_ADD, c->fd, &ev);
+	send_requests(c);
+}
+
+/* Length of the first complete response in the buffer, or 0 */
+static int response_length(struct client *c, int eof)
+{
+	char *end, *cl;
+
+	c->buf[c->len] = '\0';
+	end = strstr(c->buf, "\r\n\r\n");
+	if (!end)
+		return 0;
+	end += 4;
+	cl = strcasestr(c->buf, "\r\nContent-length:");
+	if (cl && cl < end) {
+		int n = end - c->buf + atoi(cl + 17);
+
+		return n <= c->len ? n : 0;
+	}
+	return eof ? c->len : 0;
+}
+
+static void finish(struct client *c, int efd)
+{
+	epoll_ctl(efd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	if (sent < total)
+		start(c, efd);
+	else
+		c->fd = -1;
+}
+
+static void readable(struct client *c, int efd)
+{
+	for (;;) {
+		int n, eof = 0;
+
+		/* bodies are only counted, not kept */
+		if (c->len == sizeof(c->buf) - 1) {
+			char *end;
+
+			c->buf[c->len] = '\0';
+			end = strstr(c->buf, "\r\n\r\n");
+			if (!end || !keepalive) {
+				c->len = end ? end + 4 - c->buf : 0;
+			} else {
+				fprintf(stderr, "keep-alive responses must fit the buffer\n");
+				exit(1);
+			}
+		}
+		n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+		if (n < 0) {
+			if (errno == EAGAIN)
+				return;
+			if (errno == EINTR)
+				continue;
+			n = 0;
+			failed++;
+		}
+		if (n == 0)
+			eof = 1;
+		c->len += n;
+		while (c->queued && (n = response_length(c, eof)) > 0) {
+			if (strncmp(c->buf + 9, "200", 3) != 0)
+				failed++;
+			done++;
+			c->queued--;
+			c->answered++;
+			c->len -= n;
+			memmove(c->buf, c->buf + n, c->len);
+			if (keepalive)
+				send_requests(c);
+		}
+		if (eof || (!keepalive && !c->queued)) {
+			/* Requests left over when the server closes after answering
+			 * are retried on a new connection, as browsers do */
+			if (c->answered) {
+				sent -= c->queued;
+			} else {
+				failed += c->queued;
+				done += c->queued;
+			}
+			finish(c, efd);
+			return;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct epoll_event ev[64];
+	struct client *clients;
+	struct rlimit rl;
+	int nconn = 10, idle = 0, efd, i, opt;
+	double t;
+
+	while ((opt = getopt(argc, argv, "c:n:kp:i:")) != -1) {
+		switch (opt) {
+		case 'c': nconn = atoi(optarg); break;
+		case 'n': total = atol(optarg); break;
+		case 'k': keepalive = 1; break;
+		case 'p': pipeline = atoi(optarg); break;
+		case 'i': idle = atoi(optarg); break;
+		default: goto usage;
+		}
+	}
+	if (argc - optind != 3 || nconn < 1 || pipeline < 1) {
+ usage:
+		fprintf(stderr, "usage: %s [-c CONNS] [-n REQUESTS] [-k [-p DEPTH]] "
+				"[-i IDLE] HOST PORT PATH\n", argv[0]);
+		return 1;
+	}
+	if (!keepalive)
+		pipeline = 1;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(argv[optind + 1]));
+	if (inet_aton(argv[optind], &addr.sin_addr) == 0)
+		goto usage;
+	request_len = snprintf(request, sizeof(request), keepalive
+			? "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n"
+			: "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n",
+			argv[optind + 2], argv[optind]);
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	for (i = 0; i < idle; i++)
+		open_conn();
+
+	efd = epoll_create(64);
+	clients = calloc(nconn, sizeof(*clients));
+	t = now();
+	for (i = 0; i < nconn && sent < total; i++)
+		start(&clients[i], efd);
+	while (done < total) {
+		int n = epoll_wait(efd, ev, 64, 10000);
+
+		if (n <= 0) {
+			fprintf(stderr, "stalled after %ld requests\n", done);
+			return 1;
+		}
+		for (i = 0; i < n; i++)
+			readable(ev[i].data.ptr, efd);
+	}
+	t = now() - t;
+	printf("%ld requests (%ld failed) on %d %s connections, %d idle: "
+			"%.3f s, %.0f requests/s\n", done, failed, nconn,
+			keepalive ? "keep-alive" : "one-shot", idle, t, done / t);
+	return failed != 0;
+}
@@ -0,0 +1,132 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Line reader throughput benchmark.
+ *
+ * Compares the old bb_get_chunk_from_file() (getc() per byte, 80 byte
+ * buffer steps), the current one and bb_line_reader_next() over the same
+ * file.
+ * Build it against an already built tree:
+ *
+ *   gcc -O2 -D_GNU_SOURCE -Iinclude -o line_reader_bench \
+ *       scripts/bench/line_reader.c libbb/libbb.a
+ *   ./line_reader_bench bigfile.log
+ *
+ * Licensed under GPLv2, see file LICENSE in this tarball for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "libbb.h"
+
+const char *bb_applet_name = "line_reader_bench";
+
+/* The reader as it was before the line reader went in. */
+static char *old_get_chunk_from_file(FILE * file, int *end)
+{
+	int ch;
+	int idx = 0;
+	char *linebuf = NULL;
+	int linebufsz = 0;
+
+	while ((ch = getc(file)) != EOF) {
+		if (idx > linebufsz - 2) {
+			linebuf = xrealloc(linebuf, linebufsz += 80);
+		}
+		linebuf[idx++] = (char) ch;
+		if (!ch || (end && ch == '\n'))
+			break;
+	}
+	if (end)
+		*end = idx;
+	if (linebuf) {
+		if (ferror(file)) {
+			free(linebuf);
+			return NULL;
+		}
+		linebuf[idx] = 0;
+	}
+	return linebuf;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *name, double t, unsigned long lines,
+		unsigned long long bytes)
+{
+	printf("%-28s %9lu lines %12llu bytes %8.3f s %9.1f MB/s\n",
+			name, lines, bytes, t, bytes / t / (1024 * 1024));
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long lines;
+	unsigned long long bytes;
+	double t;
+	FILE *f;
+	int len;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s FILE\n", argv[0]);
+		return 1;
+	}
+
+	{
+		char *line;
+
+		f = bb_xfopen(argv[1], "r");
+		lines = bytes = 0;
+		t = now();
+		while ((line = old_get_chunk_from_file(f, &len)) != NULL) {
+			lines++;
+			bytes += len;
+			free(line);
+		}
+		report("getc (old)", now() - t, lines, bytes);
+		fclose(f);
+	}
+
+	{
+		char *line;
+
+		f = bb_xfopen(argv[1], "r");
+		lines = bytes = 0;
+		t = now();
+		while ((line = bb_get_chunk_from_file(f, &len)) != NULL) {
+			lines++;
+			bytes += len;
+			free(line);
+		}
+		report("bb_get_chunk_from_file", now() - t, lines, bytes);
+		fclose(f);
+	}
+
+	{
+		line_reader_t *lr;
+		size_t n;
+		int fd = bb_xopen(argv[1], O_RDONLY);
+
+		lr = bb_line_reader_open(fd);
+		lines = bytes = 0;
+		t = now();
+		while (bb_line_reader_next(lr, '\n', &n) != NULL) {
+			lines++;
+			bytes += n;
+		}
+		report("bb_line_reader_next", now() - t, lines, bytes);
+		bb_line_reader_free(lr);
+		close(fd);
+	}
+
+	return 0;
+}
@@ -0,0 +1,271 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * modprobe hotplug benchmark.
+ *
+ * Makes up a module tree of -m modules (3000 by default), with a
+ * modules.dep in which drivers need a few of the first 100 modules, the
+ * core ones, which need a few of those before them in turn, and a
+ * modules.alias with four device patterns per module, and then times
+ * every given modprobe binary on a hotplug burst: -n runs (1000 by
+ * default) of "modprobe -n -v <name>", most of them for device aliases
+ * the way the hotplug agent asks, the rest for plain module names, -j
+ * of them at a time.  Nothing is loaded (-n).  The outputs of all the
+ * binaries must be the same.
+ *
+ * modprobe only looks in /lib/modules, so this must run as root: it goes
+ * into a mount namespace of its own and mounts the made up tree over
+ * /lib/modules there.  It's standalone:
+ *
+ *   gcc -O2 -o modprobe_bench scripts/bench/modprobe.c
+ *   ./modprobe_bench -n 1000 old/stablebox new/stablebox
+ *
+ * A binary named stablebox or busybox is run as "<binary> modprobe".
+ * The first run of each binary, which may have to make up a cache, is
+ * timed on its own.
+ *
+ * Licensed under GPLv2, see file LICENSE in this tarball for details.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+static unsigned long seed = 1;
+
+static unsigned long rnd(void)
+{
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return seed >> 33;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static FILE *create(const char *dir, const char *name)
+{
+	char path[4096];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fp = fopen(path, "w");
+	if (!fp)
+		die(path);
+	return fp;
+}
+
+#define CORE 100
+
+/* Module i's device ids */
+static void device(int i, int n, unsigned *vendor, unsigned *dev)
+{
+	*vendor = 0x1000 + i % 512;
+	*dev = i * 8 + n;
+}
+
+static void make_tree(const char *top, const char *release, int mods)
+{
+	char dir[4096];
+	FILE *dep, *alias;
+	int i, j;
+
+	snprintf(dir, sizeof(dir), "%s/%s", top, release);
+	if (mkdir(dir, 0755) < 0)
+		die(dir);
+	dep = create(dir, "modules.dep");
+	alias = create(dir, "modules.alias");
+	for (i = 0; i < mods; i++) {
+		int below = i < CORE ? i : CORE;
+		int ndeps = below ? rnd() % (i < CORE ? 3 : 4) : 0;
+
+		fprintf(dep, "/lib/modules/%s/kernel/drivers/d%d/mod%d.o:",
+				release, i % 50, i);
+		for (j = 0; j < ndeps; j++) {
+			int d = rnd() % below;
+
+			fprintf(dep, " /lib/modules/%s/kernel/drivers/d%d/mod%d.o",
+					release, d % 50, d);
+		}
+		fputs("\n\n", dep);
+		for (j = 0; j < 4; j++) {
+			unsigned vendor, dev;
+
+			device(i, j, &vendor, &dev);
+			fprintf(alias, "alias pci:v%08Xd%08Xsv*sd*bc*sc*i* mod%d\n",
+					vendor, dev, i);
+		}
+	}
+	if (fclose(dep) || fclose(alias))
+		die("modules tree");
+}
+
+/* What the hotplug agent would ask for, number k of the burst */
+static void request(int k, int mods, char *name, size_t size)
+{
+	int i = rnd() % mods;
+
+	if (k % 4 == 3) {
+		snprintf(name, size, "mod%d", i);
+	} else {
+		unsigned vendor, dev;
+
+		device(i, rnd() % 4, &vendor, &dev);
+		snprintf(name, size, "pci:v%08Xd%08Xsv%08Xsd%08Xbc02sc00i00",
+				vendor, dev, (unsigned) rnd() % 100, (unsigned) rnd() % 100);
+	}
+}
+
+static pid_t start(const char *binary, const char *name, int out)
+{
+	const char *argv[8];
+	const char *base = strrchr(binary, '/');
+	int argc = 0;
+	pid_t pid;
+
+	base = base ? base + 1 : binary;
+	argv[argc++] = binary;
+	if (strcmp(base, "stablebox") == 0 || strcmp(base, "busybox") == 0)
+		argv[argc++] = "modprobe";
+	argv[argc++] = "-n";
+	argv[argc++] = "-v";
+	argv[argc++] = name;
+	argv[argc] = NULL;
+
+	pid = fork();
+	if (pid == 0) {
+		if (dup2(out, 1) < 0 || dup2(out, 2) < 0)
+			_exit(127);
+		execv(binary, (char **)argv);
+		_exit(127);
+	}
+	if (pid < 0)
+		die("fork");
+	return pid;
+}
+
+static double burst(const char *binary, int runs, int jobs, int mods,
+		const char *out)
+{
+	char name[128];
+	int fd, k, running = 0, status;
+	double t = now();
+
+	fd = open(out, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+	if (fd < 0)
+		die(out);
+	seed = 12345;
+	for (k = 0; k < runs; k++) {
+		if (running == jobs) {
+			wait(&status);
+			running--;
+		}
+		request(k, mods, name, sizeof(name));
+		start(binary, name, fd);
+		running++;
+	}
+	while (running--)
+		wait(&status);
+	close(fd);
+	return now() - t;
+}
+
+static int same(const char *a, const char *b)
+{
+	char cmd[512];
+
+	/* with -j the lines come in any order */
+	snprintf(cmd, sizeof(cmd), "sort %s > %s.sorted && sort %s > %s.sorted"
+			" && cmp -s %s.sorted %s.sorted", a, a, b, b, a, b);
+	return system(cmd) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	char top[] = "/tmp/modprobe_bench.XXXXXX";
+	char cache[4096], out[2][sizeof(top) + 8];
+	struct utsname un;
+	int runs = 1000, jobs = 1, mods = 3000;
+	int i, opt, status;
+
+	while ((opt = getopt(argc, argv, "n:j:m:")) != -1) {
+		switch (opt) {
+		case 'n': runs = atoi(optarg); break;
+		case 'j': jobs = atoi(optarg); break;
+		case 'm': mods = atoi(optarg); break;
+		default: goto usage;
+		}
+	}
+	if (optind == argc || runs < 1 || jobs < 1 || mods < 1) {
+ usage:
+		fprintf(stderr, "usage: %s [-n RUNS] [-j JOBS] [-m MODULES] MODPROBE...\n",
+				argv[0]);
+		return 1;
+	}
+	for (i = optind; i < argc; i++) {
+		if (argv[i][0] != '/') {
+			char *abs = realpath(argv[i], NULL);
+
+			if (!abs)
+				die(argv[i]);
+			argv[i] = abs;
+		}
+	}
+
+	if (!mkdtemp(top))
+		die(top);
+	uname(&un);
+	make_tree(top, un.release, mods);
+	snprintf(cache, sizeof(cache), "/lib/modules/%s/modules.dep.stablebox",
+			un.release);
+	sprintf(out[0], "%s.out", top);
+	sprintf(out[1], "%s.cmp", top);
+
+	if (unshare(CLONE_NEWNS) < 0
+	 || mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) < 0)
+		die("mount namespace");
+	mkdir("/lib/modules", 0755);
+	if (mount(top, "/lib/modules", NULL, MS_BIND, NULL) < 0)
+		die("/lib/modules");
+
+	printf("%d modules, %d runs, %d at a time\n", mods, runs, jobs);
+	for (i = optind; i < argc; i++) {
+		double first, t;
+		int null = open("/dev/null", O_WRONLY);
+
+		unlink(cache);
+		first = now();
+		waitpid(start(argv[i], "mod0", null), &status, 0);
+		first = now() - first;
+		close(null);
+		t = burst(argv[i], runs, jobs, mods, out[i != optind]);
+		printf("%-32s first %7.3f s  burst %8.2f s  %7.2f ms/run",
+				argv[i], first, t, t * 1000 / runs);
+		if (i != optind && !same(out[0], out[1]))
+			printf("  output differs!");
+		putchar('\n');
+	}
+
+	umount("/lib/modules");
+	snprintf(cache, sizeof(cache), "rm -rf %s %s.out %s.cmp %s.out.sorted %s.cmp.sorted",
+			top, top, top, top, top);
+	return system(cache) != 0;
+}
@@ -0,0 +1,189 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * sort benchmark.
+ *
+ * Writes -n lines (10 million by default) of numeric records to a
+ * temporary file:
+ *
+ *   <id> <0-999> <signed int> <float> <month> <word>
+ *
+ * and times every given sort binary on a few multi-key numeric sorts of
+ * it.  The outputs of all the binaries must be the same for each sort.
+ * It's standalone:
+ *
+ *   gcc -O2 -o sort_bench scripts/bench/sort.c
+ *   ./sort_bench -n 10000000 old/stablebox new/stablebox
+ *
+ * A binary named stablebox or busybox is run as "<binary> sort".  Extra
+ * sort options, -S for one, can be passed to every run with -o.
+ *
+ * Licensed under GPLv2, see file LICENSE in this tarball for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+static const char *const sorts[][5] = {
+	{ "-n", NULL },
+	{ "-k2,2n", "-k3,3n", NULL },
+	{ "-k3,3nr", "-k1,1n", NULL },
+	{ "-t", " ", "-k2,2n", "-k4,4g", NULL },
+	{ "-k5,5M", "-k2,2n", "-k6,6", NULL },
+};
+
+static const char *const months[] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static const char *const words[] = {
+	"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel"
+};
+
+static unsigned long seed = 1;
+
+static unsigned long rnd(void)
+{
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return seed >> 33;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void make_input(const char *name, long lines)
+{
+	FILE *fp = fopen(name, "w");
+	long i;
+
+	if (!fp) {
+		perror(name);
+		exit(1);
+	}
+	for (i = 0; i < lines; i++)
+		fprintf(fp, "%lu %lu %ld %lu.%03lu %s %s\n", rnd() % 100000000,
+				rnd() % 1000, (long)(rnd() % 2000001) - 1000000,
+				rnd() % 10000, rnd() % 1000, months[rnd() % 12],
+				words[rnd() % 8]);
+	if (fclose(fp)) {
+		perror(name);
+		exit(1);
+	}
+}
+
+/* Run binary on the input with the given options, output to out */
+static double run(const char *binary, const char *const *opts, char *extra,
+		const char *in, const char *out)
+{
+	const char *argv[32];
+	const char *base = strrchr(binary, '/');
+	int argc = 0, status;
+	double t = now();
+	pid_t pid;
+
+	base = base ? base + 1 : binary;
+	argv[argc++] = binary;
+	if (strcmp(base, "stablebox") == 0 || strcmp(base, "busybox") == 0)
+		argv[argc++] = "sort";
+	while (*opts)
+		argv[argc++] = *opts++;
+	if (extra) {
+		char *p;
+
+		for (p = strtok(extra, " "); p && argc < 29; p = strtok(NULL, " "))
+			argv[argc++] = p;
+	}
+	argv[argc++] = in;
+	argv[argc] = NULL;
+
+	pid = fork();
+	if (pid == 0) {
+		int fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+		if (fd < 0 || dup2(fd, 1) < 0)
+			_exit(127);
+		setenv("LC_ALL", "C", 1);
+		execv(binary, (char **)argv);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || status != 0) {
+		fprintf(stderr, "%s failed\n", binary);
+		exit(1);
+	}
+	return now() - t;
+}
+
+static int same(const char *a, const char *b)
+{
+	char cmd[256];
+
+	snprintf(cmd, sizeof(cmd), "cmp -s %s %s", a, b);
+	return system(cmd) == 0;
+}
+
+int main(int argc, char **argv)
+{
+	char in[] = "/tmp/sort_bench.XXXXXX";
+	char out[2][sizeof(in) + 4];
+	long lines = 10000000;
+	char *extra = NULL;
+	unsigned s;
+	int i, opt, fd;
+
+	while ((opt = getopt(argc, argv, "n:o:")) != -1) {
+		switch (opt) {
+		case 'n': lines = atol(optarg); break;
+		case 'o': extra = optarg; break;
+		default: goto usage;
+		}
+	}
+	if (optind == argc) {
+ usage:
+		fprintf(stderr, "usage: %s [-n LINES] [-o SORT_OPTIONS] SORT...\n",
+				argv[0]);
+		return 1;
+	}
+	fd = mkstemp(in);
+	if (fd < 0) {
+		perror(in);
+		return 1;
+	}
+	close(fd);
+	sprintf(out[0], "%s.out", in);
+	sprintf(out[1], "%s.cmp", in);
+	make_input(in, lines);
+
+	for (s = 0; s < sizeof(sorts) / sizeof(sorts[0]); s++) {
+		char name[64] = "";
+		const char *const *o;
+
+		for (o = sorts[s]; *o; o++) {
+			strcat(name, strcmp(*o, " ") ? *o : "' '");
+			strcat(name, " ");
+		}
+		for (i = optind; i < argc; i++) {
+			char *e = extra ? strdup(extra) : NULL;
+			double t = run(argv[i], sorts[s], e, in, out[i != optind]);
+
+			free(e);
+			printf("%-28s %-24s %8.2f s", name, argv[i], t);
+			if (i != optind && !same(out[0], out[1]))
+				printf("  output differs!");
+			putchar('\n');
+		}
+	}
+	unlink(in);
+	unlink(out[0]);
+	unlink(out[1]);
+	return 0;
+}
@@ -0,0 +1,199 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * udhcpd lease table load test.
+ *
+ * Replays DISCOVER/REQUEST traffic straight against leases.c, the way
+ * sendOffer() and sendACK() use it, with a fake clock and a fake network
+ * on which every 997th address answers ARP.  Checks that no address is
+ * ever handed to two clients and reports the time each phase took:
+ *
+ *   1. the clients get an offer and a lease each,
+ *   2. all of them renew, later only the second half does,
+ *   3. the clock moves past the leases of the first half and half as
+ *      many new clients come along, who must be given the expired
+ *      addresses.
+ *
+ * It's standalone; build it against an already built tree:
+ *
+ *   gcc -O2 -D_GNU_SOURCE -DIN_BUSYBOX -Iinclude -Inetworking/udhcp \
+ *       -o udhcpd_leases_bench scripts/bench/udhcpd_leases.c \
+ *       networking/udhcp/leases.c networking/udhcp/static_leases.c \
+ *       libbb/libbb.a
+ *   ./udhcpd_leases_bench 16 60000
+ *
+ * The first argument is the pool size in bits (16 is a /16), the second
+ * the number of clients.
+ *
+ * Licensed under GPLv2, see file LICENSE in this tarball for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "dhcpd.h"
+#include "leases.h"
+#include "static_leases.h"
+
+const char *bb_applet_name = "udhcpd_leases_bench";
+
+struct dhcpOfferedAddr *leases;
+struct server_config_t server_config;
+
+static time_t fake_now = 1000000000;
+static unsigned long conflicts;
+
+/* leases.c reads the clock through this */
+time_t time(time_t *t)
+{
+	if (t)
+		*t = fake_now;
+	return fake_now;
+}
+
+int arpping(uint32_t yiaddr, uint32_t ip, uint8_t *arp, char *interface)
+{
+	if (ntohl(yiaddr) % 997 == 0) {
+		conflicts++;
+		return 0;
+	}
+	return 1;
+}
+
+void udhcp_logging(int level, const char *fmt, ...)
+{
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void make_chaddr(uint8_t *chaddr, unsigned n)
+{
+	memset(chaddr, 0, 16);
+	chaddr[0] = 0x02;
+	chaddr[2] = n >> 24;
+	chaddr[3] = n >> 16;
+	chaddr[4] = n >> 8;
+	chaddr[5] = n;
+}
+
+/* What sendOffer() does to pick an address */
+static uint32_t discover(uint8_t *chaddr)
+{
+	struct dhcpOfferedAddr *lease;
+	uint32_t yiaddr;
+
+	lease = find_lease_by_chaddr(chaddr);
+	if (lease) {
+		yiaddr = lease->yiaddr;
+	} else {
+		yiaddr = find_address(0);
+		if (!yiaddr)
+			yiaddr = find_address(1);
+	}
+	if (!yiaddr || !add_lease(chaddr, yiaddr, server_config.offer_time))
+		return 0;
+	return yiaddr;
+}
+
+/* What the REQUEST handling and sendACK() do */
+static int request(uint8_t *chaddr, uint32_t yiaddr)
+{
+	struct dhcpOfferedAddr *lease = find_lease_by_chaddr(chaddr);
+
+	if (!lease || lease->yiaddr != yiaddr)
+		return -1;
+	return add_lease(chaddr, yiaddr, server_config.lease) ? 0 : -1;
+}
+
+static uint32_t *owner;	/* client owning each pool address, +1 */
+static uint32_t static_ip;
+
+static void check(unsigned client, uint32_t yiaddr)
+{
+	uint32_t off = ntohl(yiaddr) - ntohl(server_config.start);
+
+	if (off > ntohl(server_config.end) - ntohl(server_config.start)
+	 || (ntohl(yiaddr) & 0xff) == 0 || (ntohl(yiaddr) & 0xff) == 0xff
+	 || yiaddr == static_ip) {
+		fprintf(stderr, "client %u got a bad address\n", client);
+		exit(1);
+	}
+	if (owner[off] && owner[off] != client + 1) {
+		struct dhcpOfferedAddr *lease;
+		uint8_t chaddr[16];
+
+		/* fine if the old owner's lease is gone */
+		make_chaddr(chaddr, owner[off] - 1);
+		lease = find_lease_by_chaddr(chaddr);
+		if (lease && lease->yiaddr == yiaddr) {
+			fprintf(stderr, "clients %u and %u share an address\n",
+					owner[off] - 1, client);
+			exit(1);
+		}
+	}
+	owner[off] = client + 1;
+}
+
+static void run(const char *what, unsigned first, unsigned count)
+{
+	uint8_t chaddr[16];
+	uint32_t yiaddr;
+	unsigned i, failed = 0;
+	double t = now();
+
+	for (i = first; i < first + count; i++) {
+		make_chaddr(chaddr, i);
+		yiaddr = discover(chaddr);
+		if (!yiaddr || request(chaddr, yiaddr) < 0) {
+			failed++;
+			continue;
+		}
+		check(i, yiaddr);
+	}
+	printf("%-28s %7u clients %7u failed %8.3f s\n", what, count, failed, now() - t);
+}
+
+int main(int argc, char **argv)
+{
+	int bits = argc > 1 ? atoi(argv[1]) : 16;
+	unsigned clients = argc > 2 ? atoi(argv[2]) : 60000;
+	unsigned pool;
+	static uint8_t static_mac[6] = { 0x02, 0xff, 0, 0, 0, 1 };
+
+	if (bits < 8 || bits > 24) {
+		fprintf(stderr, "usage: %s [POOL_BITS [CLIENTS]]\n", argv[0]);
+		return 1;
+	}
+	pool = 1U << bits;
+	server_config.start = htonl(0x0a000000 + 1);
+	server_config.end = htonl(0x0a000000 + pool - 2);
+	server_config.max_leases = pool - 2;
+	server_config.lease = 3600;
+	server_config.offer_time = 60;
+	server_config.conflict_time = 3600;
+	static_ip = htonl(0x0a000000 + 10);
+	addStaticLease(&server_config.static_leases, static_mac, &static_ip);
+	owner = calloc(pool, sizeof(*owner));
+
+	init_leases();
+
+	run("new clients", 0, clients);
+	fake_now += 1800;
+	run("renewals", 0, clients);
+	/* the first half of them never renew again */
+	fake_now += 1800;
+	run("renewals of second half", clients / 2, clients - clients / 2);
+	fake_now += 1801;
+	run("new clients, expired pool", clients, clients / 2);
+	printf("%lu addresses were in use on the network\n", conflicts);
+	return 0;
+}
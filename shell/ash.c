@@ -58,6 +58,7 @@
 #include <sys/ioctl.h>
 #include <sys/param.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
@@ -1196,6 +1197,9 @@ static int evalstring(char *, int mask);
 union node;     /* BLETCH for ansi C */
 static void evaltree(union node *, int);
 static void evalbackcmd(union node *, struct backcmd *);
+#ifdef CONFIG_ASH_BACKQ_INLINE
+static int evalbackinline(union node *, struct backcmd *);
+#endif
 
 static int evalskip;                   /* set if we are skipping commands */
 static int skipcount;           /* number of levels to skip */
@@ -1407,6 +1411,7 @@ static const char *pathopt;     /* set by padvance */
 
 static void shellexec(char **, const char *, int)
     ATTRIBUTE_NORETURN;
+static char *cmdpath(const char *, const char *, int);
 static char *padvance(const char **, const char *);
 static void find_command(char *, struct cmdentry *, int, const char *);
 static struct builtincmd *find_builtin(const char *);
@@ -1414,6 +1419,11 @@ static void hashcd(void);
 static void changepath(const char *);
 static void defun(char *, union node *);
 static void unsetfunc(const char *);
+#ifdef CONFIG_ASH_NOFORK
+static struct BB_applet *find_nofork(const char *, const char *, int, int *);
+static void noexec_applet(struct BB_applet *, int, char **)
+    ATTRIBUTE_NORETURN;
+#endif
 
 #ifdef CONFIG_ASH_MATH_SUPPORT_64
 typedef int64_t arith_t;
@@ -1589,6 +1599,7 @@ static int setvarsafe(const char *, const char *, int);
 #endif
 static int varcmp(const char *, const char *);
 static struct var **hashvar(const char *);
+static struct var **findvar(struct var **, const char *);
 
 
 static inline int varequal(const char *a, const char *b) {
@@ -1797,6 +1808,10 @@ static int jobctl;              /* true if doing job control */
 
 static struct job *makejob(union node *, int);
 static int forkshell(struct job *, union node *, int);
+#ifdef CONFIG_ASH_VFORK
+static int vforkexec(struct job *, union node *, char **, const char *, int,
+    struct strlist *);
+#endif
 static int waitforjob(struct job *);
 static int stoppedjobs(void);
 
@@ -2002,6 +2017,9 @@ union node;
 static void redirect(union node *, int);
 static void popredir(int);
 static void clearredir(int);
+#ifdef CONFIG_ASH_VFORK
+static void closesavedfds(void);
+#endif
 static int copyfd(int, int);
 static int redirectsafe(union node *, int);
 
@@ -2030,6 +2048,9 @@ static char gotsig[NSIG - 1];
 
 static void clear_traps(void);
 static void setsignal(int);
+#if defined(CONFIG_ASH_NOFORK) || defined(CONFIG_ASH_VFORK)
+static void execsignals(void);
+#endif
 static void ignoresig(int);
 static void onsig(int);
 static int dotrap(void);
@@ -3143,6 +3164,12 @@ evalbackcmd(union node *n, struct backcmd *result)
 	saveherefd = herefd;
 	herefd = -1;
 
+#ifdef CONFIG_ASH_BACKQ_INLINE
+	if (evalbackinline(n, result)) {
+		herefd = saveherefd;
+		goto out;
+	}
+#endif
 	{
 		int pip[2];
 		struct job *jp;
@@ -3244,6 +3271,10 @@ evalcommand(union node *cmd, int flags)
 	char **nargv;
 	struct builtincmd *bcmd;
 	int pseudovarflag = 0;
+#ifdef CONFIG_ASH_NOFORK
+	struct BB_applet *applet;
+	int nofork;
+#endif
 
 	/* First expand the arguments. */
 	TRACE(("evalcommand(0x%lx, %d) called\n", (long)cmd, flags));
@@ -3384,10 +3415,35 @@ bail:
 	/* Execute the command. */
 	switch (cmdentry.cmdtype) {
 	default:
+#ifdef CONFIG_ASH_NOFORK
+		applet = find_nofork(argv[0], path, cmdentry.u.index, &nofork);
+		/* the shell's environment is the applet's, so no assignments */
+		if (applet && nofork && !varlist.list) {
+			INTOFF;
+			exitstatus = run_nofork_applet(applet, argc, argv);
+			flushall();
+			exitstatus |= ferror(stdout);
+			clearerr(stdout);
+			INTON;
+			break;
+		}
+#endif
 		/* Fork off a child process if necessary. */
 		if (!(flags & EV_EXIT) || trap[0]) {
 			INTOFF;
 			jp = makejob(cmd, 1);
+#ifdef CONFIG_ASH_VFORK
+			if (
+#ifdef CONFIG_ASH_NOFORK
+			    !applet &&
+#endif
+			    vforkexec(jp, cmd, argv, path, cmdentry.u.index,
+					varlist.list)) {
+				exitstatus = waitforjob(jp);
+				INTON;
+				break;
+			}
+#endif
 			if (forkshell(jp, cmd, FORK_FG) != 0) {
 				exitstatus = waitforjob(jp);
 				INTON;
@@ -3396,6 +3452,10 @@ bail:
 			FORCEINTON;
 		}
 		listsetvar(varlist.list, VEXPORT|VSTACK);
+#ifdef CONFIG_ASH_NOFORK
+		if (applet)
+			noexec_applet(applet, argc, argv);
+#endif
 		shellexec(argv, path, cmdentry.u.index);
 		/* NOTREACHED */
 
@@ -3762,6 +3822,27 @@ repeat:
 }
 
 
+/*
+ * The file find_command() found name at, index idx of path, or NULL.
+ * Allocated on the stack, like padvance() does.
+ */
+
+static char *
+cmdpath(const char *name, const char *path, int idx)
+{
+	char *cmdname;
+
+	if (strchr(name, '/') != NULL)
+		return (char *)name;
+	while ((cmdname = padvance(&path, name)) != NULL) {
+		if (--idx < 0 && pathopt == NULL)
+			return cmdname;
+		stunalloc(cmdname);
+	}
+	return NULL;
+}
+
+
 
 /*
  * Do a path search.  The variable path (passed by reference) should be
@@ -4059,6 +4140,88 @@ find_builtin(const char *name)
 	return bp;
 }
 
+#ifdef CONFIG_ASH_NOFORK
+/*
+ * Applets that can do without the exec.  NOFORK ones run in the shell
+ * itself: they read no input, keep nothing from one run to the next and
+ * give back what they take (but for the few bytes expr has in hand when
+ * it dies on bad input).  NOEXEC ones only skip the exec in the forked
+ * child.  Keep sorted, it is searched by bsearch().
+ */
+#define APPLET_NOEXEC   "0"
+#define APPLET_NOFORK   "1"
+
+static const char *const nofork_applets[] = {
+	APPLET_NOFORK "[",
+	APPLET_NOFORK "basename",
+	APPLET_NOEXEC "cat",
+	APPLET_NOEXEC "cut",
+	APPLET_NOFORK "dirname",
+	APPLET_NOFORK "expr",
+	APPLET_NOFORK "false",
+	APPLET_NOEXEC "head",
+	APPLET_NOFORK "printf",
+	APPLET_NOEXEC "sed",
+	APPLET_NOEXEC "seq",
+	APPLET_NOEXEC "sort",
+	APPLET_NOEXEC "tail",
+	APPLET_NOFORK "test",
+	APPLET_NOEXEC "tr",
+	APPLET_NOFORK "true",
+	APPLET_NOEXEC "uniq",
+	APPLET_NOEXEC "wc",
+};
+
+/*
+ * The applet to run for a command that find_command() found at index
+ * idx of path, if the file there is this very binary and the applet is
+ * in the table above; *nofork is set for the NOFORK ones.
+ */
+
+static struct BB_applet *
+find_nofork(const char *name, const char *path, int idx, int *nofork)
+{
+	static struct stat self;
+	const char *const *entry;
+	struct BB_applet *applet;
+	const char *base;
+	char *cmdname;
+	struct stat st;
+
+	base = strrchr(name, '/');
+	base = base ? base + 1 : name;
+	entry = bsearch(base, nofork_applets,
+		sizeof(nofork_applets) / sizeof(nofork_applets[0]),
+		sizeof(nofork_applets[0]), pstrcmp);
+	if (!entry || !(applet = find_applet_by_name(base)))
+		return NULL;
+
+	cmdname = cmdpath(name, path, idx);
+	if (!cmdname || stat(cmdname, &st) < 0)
+		return NULL;
+	if (!self.st_ino && stat("/proc/self/exe", &self) < 0)
+		return NULL;
+	if (st.st_ino != self.st_ino || st.st_dev != self.st_dev)
+		return NULL;
+
+	*nofork = **entry == *APPLET_NOFORK;
+	return applet;
+}
+
+/*
+ * Run a NOEXEC applet in place of shellexec().  Never returns.
+ */
+
+static void
+noexec_applet(struct BB_applet *applet, int argc, char **argv)
+{
+	clearredir(1);
+	environ = environment();
+	execsignals();
+	exit(run_nofork_applet(applet, argc, argv));
+}
+#endif
+
 
 
 /*
@@ -4902,6 +5065,158 @@ expari(int quotes)
 }
 #endif
 
+#ifdef CONFIG_ASH_BACKQ_INLINE
+/*
+ * Whether the expansion of an argument can change the shell:
+ * ${var=text}, ${var?text} and arithmetic can.
+ */
+
+static int
+argchanges(const char *p)
+{
+	for (; *p; p++) {
+		switch (*p) {
+		case CTLESC:
+			p++;
+			break;
+		case CTLVAR:
+			switch (*++p & VSTYPE) {
+			case VSASSIGN:
+			case VSQUESTION:
+				return 1;
+			}
+			break;
+		case CTLARI:
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Run a command substitution in the shell itself, when it is a simple
+ * command that can't change the shell, so needs no subshell: echo, pwd,
+ * test, true, false or a NOFORK applet, with arguments that assign
+ * nothing.  The output is collected in a malloc()ed buffer.  Returns 0
+ * if the command has to be forked.
+ *
+ * Called with interrupts off.
+ */
+
+static int
+evalbackinline(union node *n, struct backcmd *result)
+{
+	struct jmploc jmploc;
+	struct jmploc *volatile savehandler;
+	int savesuppressint = suppressint;
+	int saveexitstatus = exitstatus;
+	char **saveargptr = argptr;
+	char *saveoptptr = optptr;
+	struct nodelist *saveargbackq = argbackq;
+	struct ifsregion saveifsfirst = ifsfirst;
+	struct ifsregion *saveifslastp = ifslastp;
+	struct arglist saveexparg = exparg;
+	FILE *saveout = stdout;
+	struct BB_applet *applet = NULL;
+	struct cmdentry entry;
+	struct arglist arglist;
+	union node *argp;
+	struct strlist *sp;
+	char **argv;
+	char *name, *p;
+	size_t size;
+	int argc, status;
+
+	if (n->type != NCMD || n->ncmd.assign || n->ncmd.redirect ||
+	    !n->ncmd.args || xflag || uflag)
+		return 0;
+	for (argp = n->ncmd.args ; argp ; argp = argp->narg.next)
+		if (argchanges(argp->narg.text))
+			return 0;
+	name = n->ncmd.args->narg.text;
+	for (p = name ; *p ; p++)
+		if (*p >= CTL_FIRST && *p <= CTL_LAST)
+			return 0;
+
+	find_command(name, &entry, 0, pathval());
+	switch (entry.cmdtype) {
+	case CMDBUILTIN:
+		if (
+#ifdef CONFIG_ASH_BUILTIN_ECHO
+		    entry.u.cmd->builtin != echocmd &&
+#endif
+#ifdef CONFIG_ASH_BUILTIN_TEST
+		    entry.u.cmd->builtin != testcmd &&
+#endif
+		    entry.u.cmd->builtin != pwdcmd &&
+		    entry.u.cmd->builtin != truecmd &&
+		    entry.u.cmd->builtin != falsecmd)
+			return 0;
+		break;
+#ifdef CONFIG_ASH_NOFORK
+	case CMDNORMAL: {
+		int nofork;
+
+		applet = find_nofork(name, pathval(), entry.u.index, &nofork);
+		if (!applet || !nofork)
+			return 0;
+		break;
+	}
+#endif
+	default:
+		return 0;
+	}
+
+	if ((stdout = open_memstream(&result->buf, &size)) == NULL) {
+		stdout = saveout;
+		return 0;
+	}
+	savehandler = handler;
+	if (!setjmp(jmploc.loc)) {
+		handler = &jmploc;
+		arglist.lastp = &arglist.list;
+		for (argp = n->ncmd.args ; argp ; argp = argp->narg.next)
+			expandarg(argp, &arglist, EXP_FULL | EXP_TILDE);
+		*arglist.lastp = NULL;
+		argc = 0;
+		for (sp = arglist.list ; sp ; sp = sp->next)
+			argc++;
+		argv = stalloc(sizeof (char *) * (argc + 1));
+		for (argc = 0, sp = arglist.list ; sp ; sp = sp->next)
+			argv[argc++] = sp->text;
+		argv[argc] = NULL;
+
+		if (applet) {
+			status = run_nofork_applet(applet, argc, argv);
+			fflush(stdout);
+			status |= ferror(stdout);
+		} else if (evalbltin(entry.u.cmd, argc, argv))
+			status = 2;
+		else
+			status = exitstatus;
+	} else {
+		/* the error a subshell would have exited on */
+		status = 2;
+	}
+	handler = savehandler;
+	suppressint = savesuppressint;
+
+	fclose(stdout);
+	stdout = saveout;
+	result->nleft = size;
+	back_exitstatus = status;
+
+	exitstatus = saveexitstatus;
+	argptr = saveargptr;
+	optptr = saveoptptr;
+	argbackq = saveargbackq;
+	ifsfirst = saveifsfirst;
+	ifslastp = saveifslastp;
+	exparg = saveexparg;
+	return 1;
+}
+#endif
+
 /*
  * Expand stuff in backwards quotes.
  */
@@ -4925,6 +5240,8 @@ expbackq(union node *cmd, int quoted, int quotes)
 	grabstackstr(dest);
 	evalbackcmd(cmd, (struct backcmd *) &in);
 	popstackmark(&smark);
+	/* an inline command may have moved the stack block */
+	expdest = (char *)stackblock() + startloc;
 
 	p = in.buf;
 	i = in.nleft;
@@ -7217,6 +7534,108 @@ forkshell(struct job *jp, union node *n, int mode)
 	return pid;
 }
 
+#ifdef CONFIG_ASH_VFORK
+/*
+ * The environment a forked child would exec the command with after
+ * listsetvar(vars, VEXPORT|VSTACK), or NULL if one of the assignments
+ * is to a readonly variable: the child reports that.
+ */
+
+static char **
+spawnenv(struct strlist *vars)
+{
+	struct strlist *sp;
+	struct var *vp;
+	char **env, **end, **ep;
+	int n = 0;
+
+	for (sp = vars ; sp ; sp = sp->next) {
+		vp = *findvar(hashvar(sp->text), sp->text);
+		if (vp && (vp->flags & (VREADONLY|VDYNAMIC)) == VREADONLY)
+			return NULL;
+		n++;
+	}
+	env = listvars(VEXPORT, VUNSET, &end);
+	if (!n)
+		return env;
+	ep = stalloc((end - env + n + 1) * sizeof(char *));
+	memcpy(ep, env, (end - env) * sizeof(char *));
+	end = ep + (end - env);
+	env = ep;
+	for (sp = vars ; sp ; sp = sp->next) {
+		for (ep = env ; ep < end && !varequal(*ep, sp->text) ; ep++);
+		*ep = sp->text;
+		if (ep == end)
+			end++;
+	}
+	*end = NULL;
+	return env;
+}
+
+/*
+ * Start the simple foreground command argv with vfork() and exec it
+ * straight away, without copying the shell.  The child does to itself
+ * what forkchild() and the exec would, and leaves the memory it shares
+ * with the shell alone.  Returns the pid, or 0 if the command has to be
+ * forked after all, for a failed exec to be reported the usual way.
+ *
+ * Called with interrupts off.
+ */
+
+static int
+vforkexec(struct job *jp, union node *n, char **argv, const char *path,
+	int idx, struct strlist *vars)
+{
+	static volatile int exec_errno;
+	sigset_t all, old;
+	char *cmd, **envp;
+	int pid;
+
+	if ((cmd = cmdpath(argv[0], path, idx)) == NULL)
+		return 0;
+	if ((envp = spawnenv(vars)) == NULL)
+		return 0;
+
+	TRACE(("vforkexec(%%%d, %p) called\n", jobno(jp), n));
+	/* no handler of the shell's may run in the child */
+	sigfillset(&all);
+	sigprocmask(SIG_SETMASK, &all, &old);
+	exec_errno = 0;
+	pid = vfork();
+	if (pid == 0) {
+#if JOBS
+		if (jp->jobctl && !shlvl) {
+			pid_t pgrp;
+
+			if (jp->nprocs == 0)
+				pgrp = getpid();
+			else
+				pgrp = jp->ps[0].pid;
+			setpgid(0, pgrp);
+			tcsetpgrp(ttyfd, pgrp);
+		}
+#endif
+		closesavedfds();
+		execsignals();
+		sigprocmask(SIG_SETMASK, &old, NULL);
+		execve(cmd, argv, envp);
+		exec_errno = errno;
+		_exit(127);
+	}
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	if (pid < 0) {
+		TRACE(("Vfork failed, errno=%d", errno));
+		return 0;
+	}
+	if (exec_errno) {
+		waitpid(pid, NULL, 0);
+		return 0;
+	}
+	forkparent(jp, n, FORK_FG, pid);
+	return pid;
+}
+#endif
+
 /*
  * Wait for job to finish.
  *
@@ -11184,6 +11603,25 @@ clearredir(int drop)
 	}
 }
 
+#ifdef CONFIG_ASH_VFORK
+/*
+ * Close the saved file descriptors like clearredir(1), but leave the
+ * list alone: for a vfork()ed child, which shares it with the shell.
+ */
+
+static void
+closesavedfds(void)
+{
+	struct redirtab *rp;
+	int i;
+
+	for (rp = redirlist ; rp ; rp = rp->next)
+		for (i = 0 ; i < 10 ; i++)
+			if (rp->renamed[i] != EMPTY)
+				close(rp->renamed[i]);
+}
+#endif
+
 
 /*
  * Copy a file descriptor to be >= to.  Returns -1
@@ -11764,6 +12202,31 @@ ignoresig(int signo)
 	sigmode[signo - 1] = S_HARD_IGN;
 }
 
+#if defined(CONFIG_ASH_NOFORK) || defined(CONFIG_ASH_VFORK)
+/*
+ * Set the signals up the way a command exec'd from a forked child finds
+ * them: those the shell catches, or ignores for its own sake rather than
+ * for a trap, back to default.  Only system calls, for vforkexec().
+ */
+
+static void
+execsignals(void)
+{
+	int signo;
+
+	for (signo = 1; signo < NSIG; signo++) {
+		switch (sigmode[signo - 1]) {
+		case S_IGN:
+			if (trap[signo] && !*trap[signo])
+				break;
+			/* FALLTHROUGH */
+		case S_CATCH:
+			signal(signo, SIG_DFL);
+		}
+	}
+}
+#endif
+
 
 /*
  * Signal handler.
@@ -11923,7 +12386,6 @@ static int decode_signal(const char *string, int minsig)
 static struct var *vartab[VTABSIZE];
 
 static int vpcmp(const void *, const void *);
-static struct var **findvar(struct var **, const char *);
 
 /*
  * Initialize the variable symbol tables and import the environment
@@ -12544,11 +13006,87 @@ typedef enum __rlimit_resource rlim_t;
 #endif
 
 
+/*
+ * Input for the read builtin.  It must not take more from fd 0 than it
+ * uses, as whatever runs next reads on from there.  A file is read in
+ * blocks and the offset put back afterwards, a socket is peeked at, and
+ * anything else (pipes, terminals) is read a byte at a time.
+ */
+
+#define RB_BYTE 0
+#define RB_SEEK 1
+#define RB_PEEK 2
+
+struct readbuf {
+	int mode;
+	int size;		/* how much to ask for next */
+	int len;
+	int pos;
+	char buf[4096];
+};
+
+static void
+rb_init(struct readbuf *rb)
+{
+	struct stat st;
+
+	rb->mode = RB_BYTE;
+	if (fstat(0, &st) == 0) {
+		if (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))
+			rb->mode = RB_SEEK;
+		else if (S_ISSOCK(st.st_mode))
+			rb->mode = RB_PEEK;
+	}
+	/* Lines are mostly short; ask for more if they turn out not to be */
+	rb->size = 128;
+	rb->len = rb->pos = 0;
+}
+
+static int
+rb_getc(struct readbuf *rb, char *c)
+{
+	int n;
+
+	if (rb->pos == rb->len) {
+		switch (rb->mode) {
+		case RB_SEEK:
+			n = read(0, rb->buf, rb->size);
+			break;
+		case RB_PEEK:
+			/* everything peeked at so far was used */
+			if (rb->len && recv(0, rb->buf, rb->len, 0) != rb->len)
+				return 0;
+			n = recv(0, rb->buf, rb->size, MSG_PEEK);
+			break;
+		default:
+			n = read(0, rb->buf, 1);
+		}
+		if (n <= 0) {
+			rb->len = rb->pos = 0;
+			return 0;
+		}
+		rb->len = n;
+		rb->pos = 0;
+		if (rb->size < (int)sizeof(rb->buf))
+			rb->size *= 2;
+	}
+	*c = rb->buf[rb->pos++];
+	return 1;
+}
+
+/* Give back what was read but not used */
+static void
+rb_done(struct readbuf *rb)
+{
+	if (rb->mode == RB_SEEK && rb->pos < rb->len)
+		lseek(0, rb->pos - rb->len, SEEK_CUR);
+	else if (rb->mode == RB_PEEK && rb->len)
+		recv(0, rb->buf, rb->pos, 0);
+}
+
 /*
  * The read builtin.  The -e option causes backslashes to escape the
  * following character.
- *
- * This uses unbuffered input, which may be avoidable in some cases.
  */
 
 static int
@@ -12564,6 +13102,7 @@ readcmd(int argc, char **argv)
 	int startword;
 	int status;
 	int i;
+	struct readbuf rb;
 #if defined(CONFIG_ASH_READ_NCHARS)
 	int nch_flag = 0;
 	int nchars = 0;
@@ -12676,6 +13215,7 @@ readcmd(int argc, char **argv)
 	status = 0;
 	startword = 1;
 	backslash = 0;
+	rb_init(&rb);
 	STARTSTACKSTR(p);
 #if defined(CONFIG_ASH_READ_NCHARS)
 	while (!nch_flag || nchars--)
@@ -12683,7 +13223,7 @@ readcmd(int argc, char **argv)
 	for (;;)
 #endif
 	{
-		if (read(0, &c, 1) != 1) {
+		if (!rb_getc(&rb, &c)) {
 			status = 1;
 			break;
 		}
@@ -12716,6 +13256,7 @@ put:
 			STPUTC(c, p);
 		}
 	}
+	rb_done(&rb);
 #if defined(CONFIG_ASH_READ_NCHARS)
 	if (nch_flag || silent)
 		tcsetattr(0, TCSANOW, &old_tty);